@@ -3,6 +3,8 @@
 
 #include "../instructions.hh"
 
+struct DecodedProgram;
+
 //using Value = std::variant<int32_t, double, bool, std::string>;
 //using Value = std::variant<int, double, bool, std::string, unsigned int>;
 
@@ -12,6 +14,8 @@ public:
     virtual void execute(const Instruction &instruction) = 0;
     virtual void dumpRegisters() = 0;
     virtual void run(const std::vector<Instruction> &program)  = 0;
+    // Runs a program that was decoded ahead of time, e.g. loaded from a .lmc file
+    virtual void run(const DecodedProgram &program) = 0;
 };
 
 #endif // BACKEND_HH
@@ -0,0 +1,230 @@
+#include "bytecode.hh"
+#include <stdexcept>
+#include <type_traits>
+#include <unordered_map>
+
+std::string decodedOpcodeName(uint16_t opcode)
+{
+    static const char *const decodedNames[] = {
+        "LOAD_LOCAL",      "STORE_LOCAL",     "TAIL_CALL",            "QUICK_ADD_INT",
+        "QUICK_SUB_INT",   "QUICK_MUL_INT",   "QUICK_EQ_INT",         "QUICK_NE_INT",
+        "QUICK_LT_INT",    "QUICK_LE_INT",    "QUICK_GT_INT",         "QUICK_GE_INT",
+        "QUICK_ADD_FLOAT", "QUICK_SUB_FLOAT", "QUICK_MUL_FLOAT",      "QUICK_EQ_FLOAT",
+        "QUICK_NE_FLOAT",  "QUICK_LT_FLOAT",  "QUICK_LE_FLOAT",       "QUICK_GT_FLOAT",
+        "QUICK_GE_FLOAT",  "INC_VAR_CONST",   "INC_LOCAL_CONST",      "JUMP_IF_VAR_LT_CONST",
+        "JUMP_IF_LOCAL_LT_CONST",
+    };
+    static_assert(sizeof(decodedNames) / sizeof(decodedNames[0])
+                      == DECODED_OPCODE_COUNT - OPCODE_COUNT,
+                  "decodedNames must name every DecodedOpcode");
+
+    if (opcode < OPCODE_COUNT) {
+        return Instruction(static_cast<Opcode>(opcode), 0).opcodeToString(static_cast<Opcode>(opcode));
+    }
+    if (opcode < DECODED_OPCODE_COUNT) {
+        return decodedNames[opcode - OPCODE_COUNT];
+    }
+    return "UNKNOWN";
+}
+
+int64_t DecodedProgram::integerOperand(const ValuePtr &value)
+{
+    if (!value) {
+        throw std::runtime_error("Missing instruction operand");
+    }
+    return std::visit(
+        [](const auto &v) -> int64_t {
+            using T = std::decay_t<decltype(v)>;
+            if constexpr (std::is_integral_v<T>) {
+                return static_cast<int64_t>(v);
+            } else if constexpr (std::is_floating_point_v<T>) {
+                return static_cast<int64_t>(v);
+            } else {
+                throw std::runtime_error("Instruction operand is not an integer");
+            }
+        },
+        value->data);
+}
+
+// Gives every variable declared in the function's own body (nested function bodies are
+// skipped) a frame-relative slot and rewrites the accesses to those variables.
+static void assignLocals(DecodedProgram &decoded, FunctionInfo &function)
+{
+    std::unordered_map<int32_t, int32_t> locals; // global slot -> frame slot
+
+    auto forEachOwnInstruction = [&](auto &&visit) {
+        for (int32_t pc = function.entry; pc < function.end; ++pc) {
+            if (decoded.code[pc].opcode == DEFINE_FUNCTION) {
+                pc = decoded.code[pc + 1].a - 1; // skip the nested body
+                continue;
+            }
+            visit(decoded.code[pc]);
+        }
+    };
+
+    forEachOwnInstruction([&](DecodedInstruction &record) {
+        if (record.opcode == DECLARE_VARIABLE) {
+            locals.emplace(record.a, static_cast<int32_t>(locals.size()));
+        }
+    });
+    function.localCount = static_cast<int32_t>(locals.size());
+
+    forEachOwnInstruction([&](DecodedInstruction &record) {
+        if (record.opcode != DECLARE_VARIABLE && record.opcode != LOAD_VARIABLE
+            && record.opcode != STORE_VARIABLE) {
+            return;
+        }
+        auto it = locals.find(record.a);
+        if (it == locals.end()) {
+            return; // a global
+        }
+        switch (record.opcode) {
+        case DECLARE_VARIABLE:
+            record.opcode = NOP; // frames start out with nil locals
+            break;
+        case LOAD_VARIABLE:
+            record.opcode = LOAD_LOCAL;
+            break;
+        default:
+            record.opcode = STORE_LOCAL;
+            break;
+        }
+        record.a = it->second;
+    });
+}
+
+// `return f(...)` compiles to INVOKE_FUNCTION followed by RETURN_VALUE, with at most NOPs
+// in between (the parser's dropped conversions); those calls of known functions become
+// TAIL_CALL.
+static void markTailCalls(DecodedProgram &decoded, const FunctionInfo &function)
+{
+    for (int32_t pc = function.entry; pc + 1 < function.end; ++pc) {
+        DecodedInstruction &record = decoded.code[pc];
+        if (record.opcode != INVOKE_FUNCTION || record.a < 0) {
+            continue;
+        }
+        int32_t next = pc + 1;
+        while (next + 1 < function.end && decoded.code[next].opcode == NOP) {
+            ++next;
+        }
+        if (decoded.code[next].opcode == RETURN_VALUE) {
+            record.opcode = TAIL_CALL;
+        }
+    }
+}
+
+DecodedProgram DecodedProgram::decode(const std::vector<Instruction> &program,
+                                      const std::vector<ValuePtr> &pool)
+{
+    DecodedProgram decoded;
+    decoded.constants = pool;
+    decoded.code.reserve(program.size());
+    decoded.lines.reserve(program.size());
+
+    std::unordered_map<const Value *, int32_t> constantIndex;
+    std::unordered_map<std::string, int32_t> nameIndex;
+
+    auto internConstant = [&](const ValuePtr &value) {
+        auto it = constantIndex.find(value.get());
+        if (it != constantIndex.end()) {
+            return it->second;
+        }
+        int32_t index = static_cast<int32_t>(decoded.constants.size());
+        decoded.constants.push_back(value);
+        constantIndex.emplace(value.get(), index);
+        return index;
+    };
+
+    auto internName = [&](const ValuePtr &value) {
+        const std::string &name = std::get<std::string>(value->data);
+        auto it = nameIndex.find(name);
+        if (it != nameIndex.end()) {
+            return it->second;
+        }
+        int32_t index = static_cast<int32_t>(decoded.names.size());
+        decoded.names.push_back(name);
+        nameIndex.emplace(name, index);
+        return index;
+    };
+
+    for (size_t pc = 0; pc < program.size(); ++pc) {
+        const Instruction &instruction = program[pc];
+        DecodedInstruction record{static_cast<uint16_t>(instruction.opcode), 0, 0, 0, 0};
+
+        switch (instruction.opcode) {
+        case LOAD_CONST:
+        case LOAD_STR:
+        case BOOLEAN: {
+            int64_t slot = integerOperand(instruction.value);
+            if (slot < 0 || static_cast<size_t>(slot) >= pool.size()) {
+                throw std::runtime_error("Constant pool index out of range");
+            }
+            record.a = static_cast<int32_t>(slot);
+            break;
+        }
+        case PUSH_ARGS:
+            record.a = internConstant(instruction.value);
+            break;
+        case DECLARE_VARIABLE:
+        case LOAD_VARIABLE:
+        case STORE_VARIABLE:
+        case PARALLEL:
+        case CONCURRENT:
+            record.a = static_cast<int32_t>(integerOperand(instruction.value));
+            break;
+        case JUMP:
+            // JUMP carries an offset relative to the instruction after it
+            record.a = static_cast<int32_t>(pc + 1 + integerOperand(instruction.value));
+            break;
+        case JUMP_IF_FALSE:
+            // JUMP_IF_FALSE carries an absolute target
+            record.a = static_cast<int32_t>(integerOperand(instruction.value));
+            break;
+        case DEFINE_FUNCTION:
+        case INVOKE_FUNCTION:
+            record.a = internName(instruction.value);
+            break;
+        default:
+            break;
+        }
+
+        decoded.code.push_back(record);
+        decoded.lines.push_back(instruction.lineNumber);
+    }
+
+    // Function table. The parser emits DEFINE_FUNCTION followed by a JUMP over the body.
+    std::unordered_map<int32_t, int32_t> functionIds; // name index -> function id
+    for (size_t pc = 0; pc < decoded.code.size(); ++pc) {
+        DecodedInstruction &record = decoded.code[pc];
+        if (record.opcode != DEFINE_FUNCTION) {
+            continue;
+        }
+        const std::string &name = decoded.names[record.a];
+        if (pc + 1 >= decoded.code.size() || decoded.code[pc + 1].opcode != JUMP) {
+            throw std::runtime_error("Function " + name + " has no body");
+        }
+        if (functionIds.count(record.a)) {
+            throw std::runtime_error("Function " + name + " already declared");
+        }
+        int32_t id = static_cast<int32_t>(decoded.functions.size());
+        decoded.functions.push_back(
+            FunctionInfo{record.a, static_cast<int32_t>(pc + 2), decoded.code[pc + 1].a, 0});
+        functionIds.emplace(record.a, id);
+        record.a = id;
+    }
+
+    for (auto &record : decoded.code) {
+        if (record.opcode == INVOKE_FUNCTION) {
+            auto it = functionIds.find(record.a);
+            record.b = record.a;
+            record.a = it != functionIds.end() ? it->second : -1;
+        }
+    }
+
+    for (auto &function : decoded.functions) {
+        assignLocals(decoded, function);
+        markTailCalls(decoded, function);
+    }
+
+    return decoded;
+}
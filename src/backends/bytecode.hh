@@ -0,0 +1,103 @@
+#ifndef BYTECODE_HH
+#define BYTECODE_HH
+
+#include "../instructions.hh"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Opcodes that only exist in decoded code. The decoder rewrites instructions into these
+// when it can resolve something at load time that the parser could not.
+enum DecodedOpcode : uint16_t {
+    LOAD_LOCAL = OPCODE_COUNT, // a = frame-relative slot
+    STORE_LOCAL,               // a = frame-relative slot
+    TAIL_CALL,                 // INVOKE_FUNCTION whose result the caller returns at once
+
+    // Quickened forms of generic operations, installed in place by the StackBackend once a
+    // site has seen the same operand types a few times. aux keeps the generic opcode and b
+    // the site's feedback slot; a guard miss restores the generic opcode.
+    QUICK_ADD_INT,
+    QUICK_SUB_INT,
+    QUICK_MUL_INT,
+    QUICK_EQ_INT,
+    QUICK_NE_INT,
+    QUICK_LT_INT,
+    QUICK_LE_INT,
+    QUICK_GT_INT,
+    QUICK_GE_INT,
+    QUICK_ADD_FLOAT,
+    QUICK_SUB_FLOAT,
+    QUICK_MUL_FLOAT,
+    QUICK_EQ_FLOAT,
+    QUICK_NE_FLOAT,
+    QUICK_LT_FLOAT,
+    QUICK_LE_FLOAT,
+    QUICK_GT_FLOAT,
+    QUICK_GE_FLOAT,
+
+    // Superinstructions installed by fuseSuperinstructions(). The fused record replaces the
+    // first record of the sequence it covers and aux holds the sequence length; the covered
+    // records stay in place so the backend can fall back to them when a guard fails.
+    INC_VAR_CONST,          // var[a] = var[a] + const[b]
+    INC_LOCAL_CONST,        // local[a] = local[a] + const[b]
+    JUMP_IF_VAR_LT_CONST,   // if !(var[a] < const[b]) jump to c
+    JUMP_IF_LOCAL_LT_CONST, // if !(local[a] < const[b]) jump to c
+
+    DECODED_OPCODE_COUNT
+};
+
+// Name of a source or decoded opcode, for listings and reports.
+std::string decodedOpcodeName(uint16_t opcode);
+
+// Fixed-width record the backends execute from. Operands are plain integers resolved at
+// load time:
+//   a - variable slot, constant index, absolute jump target, function id or task count
+//   b, c - extra operands for instructions that need them
+struct DecodedInstruction
+{
+    uint16_t opcode;
+    uint16_t aux;
+    int32_t a;
+    int32_t b;
+    int32_t c;
+};
+
+static_assert(sizeof(DecodedInstruction) == 16, "DecodedInstruction must stay 16 bytes wide");
+
+// One entry of the function table, indexed by function id.
+struct FunctionInfo
+{
+    int32_t nameIndex;  // into DecodedProgram::names
+    int32_t entry;      // first instruction of the body (the parameter prologue)
+    int32_t end;        // one past the last instruction of the body
+    int32_t localCount; // frame-relative slots used by parameters and locals
+};
+
+// A program lowered from std::vector<Instruction>. Instruction i of the source program is
+// record i of `code`, so jump targets keep their meaning.
+//
+// DEFINE_FUNCTION and INVOKE_FUNCTION carry a function id; INVOKE_FUNCTION of an unknown
+// name gets -1 and keeps the name index in b. Variables declared inside a function body
+// become LOAD_LOCAL/STORE_LOCAL on a frame-relative slot, and their DECLARE_VARIABLE a NOP.
+// A call of a known function inside a function body that is directly followed by
+// RETURN_VALUE becomes TAIL_CALL, with the same operands; the RETURN_VALUE stays, so a
+// backend may run TAIL_CALL as an ordinary call, or replace the caller's frame by the callee's.
+struct DecodedProgram
+{
+    std::vector<DecodedInstruction> code;
+    std::vector<uint32_t> lines;     // source line of each record
+    std::vector<ValuePtr> constants; // the parser's constant pool, then PUSH_ARGS operands
+    std::vector<std::string> names;  // function names referenced by DEFINE/INVOKE_FUNCTION
+    std::vector<FunctionInfo> functions;
+
+    // `pool` is the parser's ConstantPool; LOAD_CONST/LOAD_STR/BOOLEAN operands index into it.
+    static DecodedProgram decode(const std::vector<Instruction> &program,
+                                 const std::vector<ValuePtr> &pool);
+
+    // Integer payload of an instruction operand, whatever integral type the parser used.
+    static int64_t integerOperand(const ValuePtr &value);
+
+    uint32_t lineAt(size_t pc) const { return pc < lines.size() ? lines[pc] : 0; }
+};
+
+#endif // BYTECODE_HH
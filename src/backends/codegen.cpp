@@ -1,167 +1,713 @@
-//#include "codegen.hh"
-
-//CodegenBackend::CodegenBackend(const std::string &outputFile) {
-//    outFile.open(outputFile);
-//    if (!outFile) {
-//        throw std::runtime_error("Failed to open output file");
-//    }
-//    writeHeader();
-//}
-
-//CodegenBackend::~CodegenBackend() {
-//    writeFooter();
-//    if (outFile.is_open()) {
-//        outFile.close();
-//    }
-//}
-
-//void CodegenBackend::execute(const Instruction &instruction) {
-//    switch (instruction.opcode) {
-//        case LOAD_CONST:
-//            handleLoadConst(instruction.value);
-//            break;
-//        case DECLARE_VARIABLE:
-//            handleDeclareVariable(std::get<int32_t>(instruction.value));
-//            break;
-//        case LOAD_VARIABLE:
-//            handleLoadVariable(std::get<int32_t>(instruction.value));
-//            break;
-//        case STORE_VARIABLE:
-//            handleStoreVariable(std::get<int32_t>(instruction.value));
-//            break;
-//        case PRINT:
-//            handlePrint();
-//            break;
-//        case HALT:
-//            handleHalt();
-//            break;
-//        case ADD:
-//        case SUBTRACT:
-//        case MULTIPLY:
-//        case DIVIDE:
-//        case MODULUS:
-//            handleBinaryOperation(instruction);
-//            break;
-//        case NEGATE:
-//            handleUnaryOperation(instruction);
-//            break;
-//        case JUMP:
-//            handleJump(std::get<int32_t>(instruction.value));
-//            break;
-//        case JUMP_IF_FALSE:
-//            handleJumpZero(std::get<int32_t>(instruction.value));
-//            break;
-//        default:
-//            outFile << "// Unknown opcode\n";
-//    }
-//}
-
-//void CodegenBackend::dumpRegisters() {
-//    // Not applicable for code generation, but could log state
-//}
-
-//void CodegenBackend::run(const std::vector<Instruction> &program) {
-//    for (const auto &instruction : program) {
-//        execute(instruction);
-//    }
-//}
-
-//void CodegenBackend::handleLoadConst(const Value &constantValue) {
-//    std::visit([this](auto &&val) {
-//        outFile << "push(" << val << ");\n";
-//    }, constantValue);
-//}
-
-//void CodegenBackend::handleDeclareVariable(unsigned int variableIndex) {
-//    if (variableIndex >= variables.size()) {
-//        variables.resize(variableIndex + 1);
-//    }
-//    outFile << "int var" << variableIndex << ";\n";
-//}
-
-//void CodegenBackend::handleLoadVariable(unsigned int variableIndex) {
-//    if (variableIndex >= variables.size()) {
-//        outFile << "// Error: Invalid variable index\n";
-//        return;
-//    }
-//    outFile << "push(var" << variableIndex << ");\n";
-//}
-
-//void CodegenBackend::handleStoreVariable(unsigned int variableIndex) {
-//    if (variableIndex >= variables.size()) {
-//        variables.resize(variableIndex + 1);
-//    }
-//    outFile << "var" << variableIndex << " = pop();\n";
-//}
-
-//void CodegenBackend::handlePrint() {
-//    outFile << "printf(\"%d\\n\", pop());\n";
-//}
-
-//void CodegenBackend::handleHalt() {
-//    outFile << "exit(0);\n";
-//}
-
-//void CodegenBackend::handleBinaryOperation(const Instruction &instruction) {
-//    outFile << "int b = pop();\n";
-//    outFile << "int a = pop();\n";
-
-//    switch (instruction.opcode) {
-//        case ADD:
-//            outFile << "push(a + b);\n";
-//            break;
-//        case SUBTRACT:
-//            outFile << "push(a - b);\n";
-//            break;
-//        case MULTIPLY:
-//            outFile << "push(a * b);\n";
-//            break;
-//        case DIVIDE:
-//            outFile << "push(a / b);\n";
-//            break;
-//        case MODULUS:
-//            outFile << "push(a % b);\n";
-//            break;
-//        default:
-//            outFile << "// Error: Invalid binary operation\n";
-//    }
-//}
-
-//void CodegenBackend::handleUnaryOperation(const Instruction &instruction) {
-//    outFile << "int a = pop();\n";
-
-//    switch (instruction.opcode) {
-//        case NEGATE:
-//            outFile << "push(-a);\n";
-//            break;
-//        default:
-//            outFile << "// Error: Invalid unary operation\n";
-//    }
-//}
-
-//void CodegenBackend::handleJump(int targetAddress) {
-//    outFile << "goto label" << targetAddress << ";\n";
-//}
-
-//void CodegenBackend::handleJumpZero(int targetAddress) {
-//    outFile << "if (pop() == 0) goto label" << targetAddress << ";\n";
-//}
-
-//void CodegenBackend::writeHeader() {
-//    outFile << "#include <stdio.h>\n";
-//    outFile << "#include <stdlib.h>\n\n";
-//    outFile << "int stack[1024];\n";
-//    outFile << "int sp = -1;\n\n";
-//    outFile << "void push(int value) {\n";
-//    outFile << "    stack[++sp] = value;\n";
-//    outFile << "}\n\n";
-//    outFile << "int pop() {\n";
-//    outFile << "    return stack[sp--];\n";
-//    outFile << "}\n\n";
-//    outFile << "int main() {\n";
-//}
-
-//void CodegenBackend::writeFooter() {
-//    outFile << "    return 0;\n";
-//    outFile << "}\n";
-//}
+#include "codegen.hh"
+#include "regtypes.hh"
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <type_traits>
+#include <variant>
+
+#ifndef LUMINAR_RUNTIME_DIR
+#define LUMINAR_RUNTIME_DIR "src/runtime"
+#endif
+
+namespace {
+
+const char *cTypeName(StaticType type)
+{
+    switch (type) {
+    case StaticType::Bool:
+        return "bool";
+    case StaticType::Int:
+        return "int64_t";
+    case StaticType::Float:
+        return "double";
+    default:
+        return "lm_value";
+    }
+}
+
+// A C expression and the type it evaluates to
+struct Expr
+{
+    std::string code;
+    StaticType type;
+};
+
+std::string cString(const std::string &text)
+{
+    std::ostringstream out;
+    out << '"';
+    for (unsigned char c : text) {
+        if (c == '"' || c == '\\' || c == '?') {
+            out << '\\' << c;
+        } else if (c >= 0x20 && c < 0x7f) {
+            out << c;
+        } else {
+            out << '\\' << std::oct << std::setw(3) << std::setfill('0') << int(c) << std::dec;
+        }
+    }
+    out << '"';
+    return out.str();
+}
+
+std::string intLiteral(int64_t value)
+{
+    if (value == INT64_MIN) {
+        return "(-INT64_C(9223372036854775807) - 1)";
+    }
+    return "INT64_C(" + std::to_string(value) + ")";
+}
+
+std::string floatLiteral(double value)
+{
+    if (std::isnan(value)) {
+        return "NAN";
+    }
+    if (std::isinf(value)) {
+        return value > 0 ? "HUGE_VAL" : "(-HUGE_VAL)";
+    }
+    std::ostringstream out;
+    out << std::setprecision(17) << value;
+    std::string text = out.str();
+    if (text.find_first_of(".e") == std::string::npos) {
+        text += ".0";
+    }
+    return text;
+}
+
+class CGenerator
+{
+public:
+    explicit CGenerator(const RegisterProgram &code)
+        : code(code)
+        , types(RegisterTypes::infer(code))
+    {}
+
+    std::string generate(CodegenReport *report);
+
+private:
+    static constexpr int32_t MAIN = RegisterTypes::MAIN;
+
+    const RegisterProgram &code;
+    RegisterTypes types;
+    std::vector<std::string> constants; // C expression for each constant
+    std::vector<std::pair<size_t, std::string>> strings; // constant index, contents
+
+    const RegisterFunction &functionAt(int32_t id) const
+    {
+        return id == MAIN ? code.main : code.functions[id];
+    }
+
+    std::string functionName(int32_t id) const
+    {
+        return functionAt(id).nameIndex < 0 ? "<main>" : code.names[functionAt(id).nameIndex];
+    }
+
+    void lowerConstants();
+
+    std::string registerName(int32_t id, int32_t reg) const
+    {
+        return (id == MAIN && types.globals[reg] ? "g" : "r") + std::to_string(reg);
+    }
+    Expr operand(int32_t id, int32_t operand) const
+    {
+        if (isConstantOperand(operand)) {
+            return Expr{constants[~operand], types.constants[~operand]};
+        }
+        return Expr{registerName(id, operand), types.of(id).registers[operand]};
+    }
+    Expr result(int32_t id, const RegisterInstruction &instruction) const;
+    Expr lower(uint16_t opcode, const Expr &a, const Expr &b, bool nonZeroDivisor) const;
+
+    std::string signature(int32_t id) const;
+    void emitFunction(std::ostream &out, int32_t id) const;
+    void emitInstruction(std::ostream &out, int32_t id, const RegisterInstruction &instruction) const;
+};
+
+// Views of an Expr as another C type
+std::string valueOf(const Expr &e)
+{
+    switch (e.type) {
+    case StaticType::Bool:
+        return "lm_bool(" + e.code + ")";
+    case StaticType::Int:
+        return "lm_int(" + e.code + ")";
+    case StaticType::Float:
+        return "lm_float(" + e.code + ")";
+    default:
+        return e.code;
+    }
+}
+
+// What the register VM reads from the payload, for typed opcodes
+std::string intOf(const Expr &e)
+{
+    return e.type == StaticType::Int ? e.code : "(" + valueOf(e) + ").as.i";
+}
+
+std::string floatOf(const Expr &e)
+{
+    return e.type == StaticType::Float ? e.code : "(" + valueOf(e) + ").as.f";
+}
+
+// Numeric conversion, for generic arithmetic on two numbers
+std::string doubleOf(const Expr &e)
+{
+    return e.type == StaticType::Int ? "((double) " + e.code + ")" : e.code;
+}
+
+std::string convert(const Expr &e, StaticType to)
+{
+    if (e.type == to) {
+        return e.code;
+    }
+    if (to == StaticType::Any) {
+        return valueOf(e);
+    }
+    throw std::runtime_error("C code cannot store a " + std::string(cTypeName(e.type))
+                             + " in a " + cTypeName(to) + " register");
+}
+
+const char *comparisonSelector(uint16_t opcode)
+{
+    switch (opcode) {
+    case EQUAL:
+    case EQ_I64:
+    case EQ_F64:
+    case EQ_STR:
+        return "LM_EQ";
+    case NOT_EQUAL:
+    case NE_I64:
+    case NE_F64:
+    case NE_STR:
+        return "LM_NE";
+    case LESS_THAN:
+    case LT_I64:
+    case LT_F64:
+        return "LM_LT";
+    case LESS_THAN_OR_EQUAL:
+    case LE_I64:
+    case LE_F64:
+        return "LM_LE";
+    case GREATER_THAN:
+    case GT_I64:
+    case GT_F64:
+        return "LM_GT";
+    case GREATER_THAN_OR_EQUAL:
+    case GE_I64:
+    case GE_F64:
+        return "LM_GE";
+    default:
+        return nullptr;
+    }
+}
+
+const char *comparisonOperator(uint16_t opcode)
+{
+    static const std::pair<const char *, const char *> operators[] = {
+        {"LM_EQ", " == "}, {"LM_NE", " != "}, {"LM_LT", " < "},
+        {"LM_LE", " <= "}, {"LM_GT", " > "},  {"LM_GE", " >= "},
+    };
+    const char *selector = comparisonSelector(opcode);
+    for (const auto &[name, op] : operators) {
+        if (selector == std::string(name)) {
+            return op;
+        }
+    }
+    return nullptr;
+}
+
+void CGenerator::lowerConstants()
+{
+    for (size_t i = 0; i < code.constants.size(); ++i) {
+        std::string expr = "lm_nil()";
+        std::visit(
+            [&](const auto &v) {
+                using T = std::decay_t<decltype(v)>;
+                if constexpr (std::is_same_v<T, bool>) {
+                    expr = v ? "true" : "false";
+                } else if constexpr (std::is_integral_v<T>) {
+                    expr = intLiteral(static_cast<int64_t>(v));
+                } else if constexpr (std::is_floating_point_v<T>) {
+                    expr = floatLiteral(static_cast<double>(v));
+                } else if constexpr (std::is_same_v<T, std::string>) {
+                    expr = "K[" + std::to_string(i) + "]";
+                    strings.emplace_back(i, v);
+                }
+            },
+            code.constants[i]->data);
+        constants.push_back(expr);
+    }
+}
+
+Expr CGenerator::result(int32_t id, const RegisterInstruction &instruction) const
+{
+    switch (instruction.opcode) {
+    case GET_GLOBAL:
+        return operand(MAIN, instruction.a);
+    case INVOKE_FUNCTION: {
+        if (instruction.a < 0) {
+            return Expr{"lm_nil()", StaticType::Any};
+        }
+        const RegisterTypes::Function &callee = types.functions[instruction.a];
+        std::string call = "lm_fn" + std::to_string(instruction.a) + "(";
+        const RegisterFunction &function = functionAt(id);
+        for (uint16_t i = 0; i < instruction.aux; ++i) {
+            call += (i ? ", " : "")
+                    + convert(operand(id, function.arguments[instruction.b + i]),
+                              callee.registers[i]);
+        }
+        return Expr{call + ")", callee.result};
+    }
+    default: {
+        bool unary = isUnaryOperation(instruction.opcode);
+        return lower(instruction.opcode, operand(id, instruction.a),
+                     unary ? Expr{"", StaticType::Any} : operand(id, instruction.b),
+                     !unary && types.nonZero(instruction.b));
+    }
+    }
+}
+
+// The C for one operation, following ValueOperations (and the register VM's typed fast
+// paths) case by case. resultType() decides which case applies, so the expression always
+// has the type the inference gave its destination.
+Expr CGenerator::lower(uint16_t opcode, const Expr &a, const Expr &b, bool nonZeroDivisor) const
+{
+    StaticType type = resultType(opcode, a.type, b.type, nonZeroDivisor);
+    auto call = [&](const std::string &name) {
+        return Expr{name + "(" + valueOf(a) + ")", type};
+    };
+    auto call2 = [&](const std::string &name) {
+        return Expr{name + "(" + valueOf(a) + ", " + valueOf(b) + ")", type};
+    };
+    auto infix = [&](const std::string &lhs, const char *op, const std::string &rhs) {
+        return Expr{"(" + lhs + op + rhs + ")", type};
+    };
+    auto compare = [&] {
+        return Expr{std::string("lm_compare(") + comparisonSelector(opcode) + ", " + valueOf(a)
+                        + ", " + valueOf(b) + ")",
+                    type};
+    };
+
+    switch (opcode) {
+    case MOVE:
+        return a;
+    case NEGATE:
+    case NEG_I64:
+    case NEG_F64:
+        if (type == StaticType::Int) {
+            return Expr{"lm_sub_i64(0, " + a.code + ")", type};
+        }
+        return type == StaticType::Float ? Expr{"(-" + a.code + ")", type} : call("lm_negate");
+    case NOT:
+        return type == StaticType::Bool ? Expr{"(!" + a.code + ")", type} : call("lm_not");
+    case TO_INT64:
+        if (type != StaticType::Int) {
+            return call("lm_to_int");
+        }
+        return a.type == StaticType::Int ? a : Expr{"((int64_t) " + a.code + ")", type};
+    case TO_FLOAT64:
+        if (type != StaticType::Float) {
+            return call("lm_to_float");
+        }
+        return a.type == StaticType::Float ? a : Expr{"((double) " + a.code + ")", type};
+
+    case ADD_I64:
+        return Expr{"lm_add_i64(" + intOf(a) + ", " + intOf(b) + ")", type};
+    case SUB_I64:
+        return Expr{"lm_sub_i64(" + intOf(a) + ", " + intOf(b) + ")", type};
+    case MUL_I64:
+        return Expr{"lm_mul_i64(" + intOf(a) + ", " + intOf(b) + ")", type};
+    case DIV_I64:
+    case MOD_I64:
+        if (type == StaticType::Int) {
+            return Expr{std::string(opcode == DIV_I64 ? "lm_quot_i64(" : "lm_rem_i64(") + intOf(a)
+                            + ", " + intOf(b) + ")",
+                        type};
+        }
+        return Expr{std::string(opcode == DIV_I64 ? "lm_div_i64(" : "lm_mod_i64(") + intOf(a)
+                        + ", " + intOf(b) + ")",
+                    type};
+    case ADD_F64:
+        return infix(floatOf(a), " + ", floatOf(b));
+    case SUB_F64:
+        return infix(floatOf(a), " - ", floatOf(b));
+    case MUL_F64:
+        return infix(floatOf(a), " * ", floatOf(b));
+    case DIV_F64:
+        if (type == StaticType::Float) {
+            return infix(floatOf(a), " / ", floatOf(b));
+        }
+        return Expr{"lm_div_f64(" + floatOf(a) + ", " + floatOf(b) + ")", type};
+    case MOD_F64:
+        return Expr{"fmod(" + floatOf(a) + ", " + floatOf(b) + ")", type};
+
+    case EQ_I64:
+    case NE_I64:
+    case LT_I64:
+    case LE_I64:
+    case GT_I64:
+    case GE_I64:
+        return infix(intOf(a), comparisonOperator(opcode), intOf(b));
+    case EQ_F64:
+    case NE_F64:
+    case LT_F64:
+    case LE_F64:
+    case GT_F64:
+    case GE_F64:
+        return infix(floatOf(a), comparisonOperator(opcode), floatOf(b));
+    case EQ_STR:
+    case NE_STR:
+        return compare();
+    case EQUAL:
+    case NOT_EQUAL:
+    case LESS_THAN:
+    case LESS_THAN_OR_EQUAL:
+    case GREATER_THAN:
+    case GREATER_THAN_OR_EQUAL:
+        if (a.type == StaticType::Int && b.type == StaticType::Int) {
+            return infix(a.code, comparisonOperator(opcode), b.code);
+        }
+        if ((a.type == StaticType::Int || a.type == StaticType::Float)
+            && (b.type == StaticType::Int || b.type == StaticType::Float)) {
+            return infix(doubleOf(a), comparisonOperator(opcode), doubleOf(b));
+        }
+        if (a.type == StaticType::Bool && b.type == StaticType::Bool
+            && (opcode == EQUAL || opcode == NOT_EQUAL)) {
+            return infix(a.code, comparisonOperator(opcode), b.code);
+        }
+        return compare();
+
+    case ADD:
+    case SUBTRACT:
+    case MULTIPLY: {
+        static const char *const intOps[] = {"lm_add_i64(", "lm_sub_i64(", "lm_mul_i64("};
+        static const char *const floatOps[] = {" + ", " - ", " * "};
+        static const char *const selectors[] = {"LM_ADD", "LM_SUB", "LM_MUL"};
+        int k = opcode == ADD ? 0 : opcode == SUBTRACT ? 1 : 2;
+        if (type == StaticType::Int) {
+            return Expr{intOps[k] + a.code + ", " + b.code + ")", type};
+        }
+        if (type == StaticType::Float) {
+            return infix(doubleOf(a), floatOps[k], doubleOf(b));
+        }
+        return Expr{std::string("lm_arith(") + selectors[k] + ", " + valueOf(a) + ", "
+                        + valueOf(b) + ")",
+                    type};
+    }
+    case DIVIDE:
+        if (type != StaticType::Any) {
+            return type == StaticType::Int
+                       ? Expr{"lm_quot_i64(" + a.code + ", " + b.code + ")", type}
+                       : infix(doubleOf(a), " / ", doubleOf(b));
+        }
+        return Expr{"lm_arith(LM_DIV, " + valueOf(a) + ", " + valueOf(b) + ")", type};
+    case MODULUS:
+        if (type != StaticType::Any) {
+            return type == StaticType::Int
+                       ? Expr{"lm_rem_i64(" + a.code + ", " + b.code + ")", type}
+                       : Expr{"fmod(" + doubleOf(a) + ", " + doubleOf(b) + ")", type};
+        }
+        return Expr{"lm_arith(LM_MOD, " + valueOf(a) + ", " + valueOf(b) + ")", type};
+
+    case AND:
+    case OR:
+        if (type == StaticType::Bool) {
+            return infix(a.code, opcode == AND ? " && " : " || ", b.code);
+        }
+        return call2(opcode == AND ? "lm_and" : "lm_or");
+    case CONCATENATE_STR:
+        return call2("lm_concat");
+    case INTERPOLATE_STRING:
+        return call2("lm_interpolate");
+    default:
+        throw std::runtime_error("C code has no lowering for " + registerOpcodeName(opcode));
+    }
+}
+
+std::string CGenerator::signature(int32_t id) const
+{
+    const RegisterFunction &function = functionAt(id);
+    const RegisterTypes::Function &typesOf = types.of(id);
+    std::string text = std::string("static ") + cTypeName(typesOf.result) + " lm_fn"
+                       + std::to_string(id) + "(";
+    for (int32_t i = 0; i < function.paramCount; ++i) {
+        text += std::string(i ? ", " : "") + cTypeName(typesOf.registers[i]) + " r"
+                + std::to_string(i);
+    }
+    return text + (function.paramCount ? ")" : "void)");
+}
+
+void CGenerator::emitInstruction(std::ostream &out, int32_t id,
+                                 const RegisterInstruction &instruction) const
+{
+    const RegisterTypes::Function &typesOf = types.of(id);
+    auto store = [&](const std::string &target, StaticType type, const Expr &value) {
+        out << "    " << target << " = " << convert(value, type) << ";\n";
+    };
+
+    switch (instruction.opcode) {
+    case NOP:
+        break;
+    case SET_GLOBAL:
+        store(registerName(MAIN, instruction.dst), types.main.registers[instruction.dst],
+              operand(id, instruction.a));
+        break;
+    case PRINT: {
+        Expr value = operand(id, instruction.a);
+        switch (value.type) {
+        case StaticType::Bool:
+            out << "    lm_print_bool(" << value.code << ");\n";
+            break;
+        case StaticType::Int:
+            out << "    lm_print_int(" << value.code << ");\n";
+            break;
+        case StaticType::Float:
+            out << "    lm_print_float(" << value.code << ");\n";
+            break;
+        default:
+            out << "    lm_print(" << value.code << ");\n";
+            break;
+        }
+        break;
+    }
+    case JUMP:
+        out << "    goto L" << instruction.dst << ";\n";
+        break;
+    case JUMP_IF_FALSE: {
+        Expr condition = operand(id, instruction.a);
+        if (condition.type == StaticType::Bool) {
+            out << "    if (!" << condition.code << ")\n";
+        } else {
+            out << "    if (lm_jump_unless(" << valueOf(condition) << "))\n";
+        }
+        out << "        goto L" << instruction.dst << ";\n";
+        break;
+    }
+    case BRANCH_UNLESS:
+        out << "    if (!"
+            << lower(instruction.aux, operand(id, instruction.a), operand(id, instruction.b),
+                     false)
+                   .code
+            << ")\n        goto L" << instruction.dst << ";\n";
+        break;
+    case RETURN:
+    case RETURN_VALUE:
+        if (id == MAIN) {
+            out << "    lm_return_outside_function();\n";
+        } else {
+            Expr value = instruction.opcode == RETURN ? Expr{"lm_nil()", StaticType::Any}
+                                                      : operand(id, instruction.a);
+            out << "    LM_LEAVE();\n    return " << convert(value, typesOf.result) << ";\n";
+        }
+        break;
+    case HALT:
+        out << "    lm_halt();\n";
+        break;
+    case INVOKE_FUNCTION:
+        if (instruction.a < 0) {
+            out << "    lm_unknown_function(" << cString(code.names[instruction.b]) << ");\n";
+        } else if (id != MAIN
+                   && isTailCall(functionAt(id), &instruction - functionAt(id).code.data())) {
+            // A call in return position, which the C compiler turns into a jump (-O2 optimizes
+            // sibling calls), so tail recursion grows neither the stack nor lm_depth
+            out << "    LM_LEAVE();\n    return "
+                << convert(result(id, instruction), typesOf.result) << ";\n";
+            break;
+        }
+        store(registerName(id, instruction.dst), typesOf.registers[instruction.dst],
+              result(id, instruction));
+        break;
+    default:
+        store(registerName(id, instruction.dst), typesOf.registers[instruction.dst],
+              result(id, instruction));
+        break;
+    }
+}
+
+void CGenerator::emitFunction(std::ostream &out, int32_t id) const
+{
+    const RegisterFunction &function = functionAt(id);
+    const RegisterTypes::Function &typesOf = types.of(id);
+
+    std::vector<bool> labels(function.code.size() + 1, false);
+    for (const auto &instruction : function.code) {
+        if (instruction.opcode == JUMP || instruction.opcode == JUMP_IF_FALSE
+            || instruction.opcode == BRANCH_UNLESS) {
+            labels[instruction.dst] = true;
+        }
+    }
+
+    out << "/* " << functionName(id) << " */\n"
+        << (id == MAIN ? "static void lm_main(void)" : signature(id)) << "\n{\n";
+    for (int32_t reg = id == MAIN ? 0 : function.paramCount; reg < function.frameSize; ++reg) {
+        if (id == MAIN && types.globals[reg]) {
+            continue;
+        }
+        StaticType type = typesOf.registers[reg];
+        out << "    " << cTypeName(type) << " r" << reg << " = "
+            << (type == StaticType::Any    ? "lm_nil()"
+                : type == StaticType::Bool ? "false"
+                                           : "0")
+            << ";\n";
+    }
+    if (id == MAIN) {
+        for (const auto &[index, text] : strings) {
+            out << "    K[" << index << "] = lm_string_literal(" << cString(text) << ", "
+                << text.size() << ");\n";
+        }
+    } else {
+        out << "    LM_ENTER(" << cString(functionName(id)) << ");\n";
+    }
+    for (size_t pc = 0; pc < function.code.size(); ++pc) {
+        if (labels[pc]) {
+            out << "L" << pc << ":;\n";
+        }
+        emitInstruction(out, id, function.code[pc]);
+    }
+    out << "}\n\n";
+}
+
+std::string CGenerator::generate(CodegenReport *report)
+{
+    lowerConstants();
+    if (report) {
+        auto count = [report](const RegisterTypes::Function &function) {
+            for (StaticType type : function.registers) {
+                ++report->registers;
+                report->typedRegisters += type != StaticType::Any;
+            }
+        };
+        count(types.main);
+        for (const auto &function : types.functions) {
+            count(function);
+        }
+    }
+
+    std::ostringstream out;
+    out << "/* Generated by luminar build. */\n"
+        << "#include \"luminar_runtime.h\"\n\n";
+    if (!code.constants.empty()) {
+        out << "static lm_value K[" << code.constants.size() << "];\n";
+    }
+    for (int32_t reg = 0; reg < code.main.frameSize; ++reg) {
+        if (types.globals[reg]) {
+            out << "static " << cTypeName(types.main.registers[reg]) << " g" << reg << ";\n";
+        }
+    }
+    out << "\n";
+    for (size_t id = 0; id < code.functions.size(); ++id) {
+        out << signature(static_cast<int32_t>(id)) << ";\n";
+    }
+    out << "\n";
+    for (size_t id = 0; id < code.functions.size(); ++id) {
+        emitFunction(out, static_cast<int32_t>(id));
+    }
+    emitFunction(out, MAIN);
+    out << "int main(void)\n{\n    return lm_start(lm_main);\n}\n";
+    return out.str();
+}
+
+std::string shellQuote(const std::string &text)
+{
+    std::string quoted = "'";
+    for (char c : text) {
+        quoted += c == '\'' ? std::string("'\\''") : std::string(1, c);
+    }
+    return quoted + "'";
+}
+
+} // namespace
+
+CodegenBackend::CodegenBackend(std::vector<Instruction> &program,
+                               const ConstantPool &constantPool, std::string outputFile)
+    : constantPool(constantPool)
+    , program(program)
+    , outputFile(std::move(outputFile))
+{}
+
+void CodegenBackend::execute(const Instruction &instruction)
+{
+    run({instruction, Instruction(HALT, instruction.lineNumber)});
+}
+
+void CodegenBackend::run(const std::vector<Instruction> &program)
+{
+    built = false;
+    this->program = program;
+    DecodedProgram decoded;
+    try {
+        decoded = DecodedProgram::decode(this->program, constantPool.values());
+    } catch (const std::exception &ex) {
+        std::cerr << "Error: Cannot compile to C: " << ex.what() << std::endl;
+        return;
+    }
+    run(decoded);
+}
+
+void CodegenBackend::run(const DecodedProgram &program)
+{
+    auto start_time = std::chrono::high_resolution_clock::now();
+    built = false;
+    std::string source;
+    try {
+        code = RegisterProgram::translate(program);
+        report = CodegenReport();
+        source = generate(code, &report);
+    } catch (const std::exception &ex) {
+        std::cerr << "Error: Cannot compile to C: " << ex.what() << std::endl;
+        return;
+    }
+
+    std::string cFile = outputFile + ".c";
+    std::ofstream file(cFile);
+    if (!file.is_open()) {
+        std::cerr << "Error: Unable to write " << cFile << std::endl;
+        return;
+    }
+    file << source;
+    file.close();
+
+    built = compile(cFile, outputFile);
+    auto end_time = std::chrono::high_resolution_clock::now();
+    auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(end_time - start_time);
+    if (built) {
+        std::cout << "Built " << outputFile << " from " << cFile << " in " << duration.count()
+                  << " ms." << std::endl;
+    }
+}
+
+void CodegenBackend::dumpRegisters()
+{
+    std::cout << "C code: " << code.functions.size() << " functions, " << report.typedRegisters
+              << " of " << report.registers << " registers native int64_t/double/bool\n";
+}
+
+std::string CodegenBackend::generate(const RegisterProgram &code, CodegenReport *report)
+{
+    return CGenerator(code).generate(report);
+}
+
+bool CodegenBackend::compile(const std::string &cFile, const std::string &outputFile)
+{
+    const char *compiler = std::getenv("CC");
+    const char *runtimeDir = std::getenv("LUMINAR_RUNTIME_DIR");
+    std::string runtime = runtimeDir && *runtimeDir ? runtimeDir : LUMINAR_RUNTIME_DIR;
+
+    std::string command = std::string(compiler && *compiler ? compiler : "cc")
+                          + " -std=c99 -O2 -I" + shellQuote(runtime) + " -o "
+                          + shellQuote(outputFile) + " " + shellQuote(cFile) + " "
+                          + shellQuote(runtime + "/luminar_runtime.c") + " -lm -pthread";
+    std::cout << command << std::endl;
+    int status = std::system(command.c_str());
+    if (status != 0) {
+        std::cerr << "Error: C compiler failed (exit status " << status << ")" << std::endl;
+        return false;
+    }
+    return true;
+}
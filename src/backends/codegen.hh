@@ -1,37 +1,56 @@
-//#ifndef CODEGEN_HH
-//#define CODEGEN_HH
-
-//#include "backend.hh"
-//#include <vector>
-//#include <string>
-//#include <fstream>
-
-//class CodegenBackend : public Backend {
-//public:
-//    explicit CodegenBackend(const std::string &outputFile);
-//    ~CodegenBackend() override;
-
-//    void execute(const Instruction &instruction) override;
-//    void dumpRegisters() override;
-//    void run(const std::vector<Instruction> &program) override;
-
-//private:
-//    std::ofstream outFile;
-//    std::vector<Value> constants;   // Constants for storing data
-//    std::vector<Value> variables;   // Variables for storing data
-
-//    void handleLoadConst(const Value &constantValue);
-//    void handleDeclareVariable(unsigned int variableIndex);
-//    void handleLoadVariable(unsigned int variableIndex);
-//    void handleStoreVariable(unsigned int variableIndex);
-//    void handlePrint();
-//    void handleHalt();
-//    void handleBinaryOperation(const Instruction &instruction);
-//    void handleUnaryOperation(const Instruction &instruction);
-//    void handleJump(int targetAddress);
-//    void handleJumpZero(int targetAddress);
-//    void writeHeader();
-//    void writeFooter();
-//};
-
-//#endif // CODEGEN_HH
+#ifndef CODEGEN_HH
+#define CODEGEN_HH
+
+#include "../constants.hh"
+#include "backend.hh"
+#include "bytecode.hh"
+#include "regcode.hh"
+#include <string>
+#include <vector>
+
+// How much of a program generate() managed to keep in native C types
+struct CodegenReport
+{
+    size_t registers = 0;      // over all functions, main included
+    size_t typedRegisters = 0; // declared int64_t, double or bool instead of lm_value
+};
+
+// Ahead-of-time backend for `luminar build`: lowers the RegisterProgram of a whole script
+// to portable C and hands that to the system C compiler together with the runtime library
+// in src/runtime. Each register becomes a C local; registers whose every write produces
+// the same scalar type (the typed opcodes the parser emits for annotated code guarantee
+// that, and plain literals usually do) become int64_t, double or bool locals and the
+// arithmetic on them plain C operators. The rest stay lm_value, the runtime's TaggedValue,
+// and go through the runtime's generic operations.
+class CodegenBackend : public Backend
+{
+public:
+    CodegenBackend(std::vector<Instruction> &program, const ConstantPool &constantPool,
+                   std::string outputFile);
+
+    // Only whole programs can be compiled; execute() builds the one instruction as one.
+    void execute(const Instruction &instruction) override;
+    void dumpRegisters() override;
+    // Writes outputFile + ".c" and compiles it into the executable outputFile
+    void run(const std::vector<Instruction> &program) override;
+    void run(const DecodedProgram &program) override;
+
+    bool succeeded() const { return built; }
+
+    // Throws std::runtime_error for code it cannot lower (heap constants other than strings).
+    static std::string generate(const RegisterProgram &code, CodegenReport *report = nullptr);
+    // Compiles cFile (C source or an object file) and the runtime library with $CC (default
+    // `cc`) into the executable outputFile. The runtime is looked up in $LUMINAR_RUNTIME_DIR,
+    // falling back to the source tree luminar was built from.
+    static bool compile(const std::string &cFile, const std::string &outputFile);
+
+private:
+    ConstantPool constantPool;
+    std::vector<Instruction> program;
+    std::string outputFile;
+    RegisterProgram code;
+    CodegenReport report;
+    bool built = false;
+};
+
+#endif // CODEGEN_HH
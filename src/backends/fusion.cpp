@@ -0,0 +1,198 @@
+#include "fusion.hh"
+#include <algorithm>
+#include <type_traits>
+
+// Instructions after which control does not simply fall through to the next record
+static bool transfersControl(uint16_t opcode)
+{
+    switch (opcode) {
+    case JUMP:
+    case JUMP_IF_FALSE:
+    case DEFINE_FUNCTION:
+    case INVOKE_FUNCTION:
+    case TAIL_CALL:
+    case RETURN:
+    case RETURN_VALUE:
+    case HALT:
+        return true;
+    default:
+        return false;
+    }
+}
+
+std::vector<bool> jumpTargets(const DecodedProgram &program)
+{
+    std::vector<bool> targets(program.code.size() + 1, false);
+    for (const auto &record : program.code) {
+        if ((record.opcode == JUMP || record.opcode == JUMP_IF_FALSE) && record.a >= 0
+            && static_cast<size_t>(record.a) < targets.size()) {
+            targets[record.a] = true;
+        }
+    }
+    for (const auto &function : program.functions) {
+        targets[function.entry] = true;
+    }
+    return targets;
+}
+
+void OpcodeCensus::add(const DecodedProgram &program)
+{
+    const auto &code = program.code;
+    std::vector<bool> targets = jumpTargets(program);
+
+    std::vector<bool> inLoop(code.size(), false);
+    for (size_t pc = 0; pc < code.size(); ++pc) {
+        if (code[pc].opcode == JUMP && code[pc].a >= 0 && static_cast<size_t>(code[pc].a) <= pc) {
+            std::fill(inLoop.begin() + code[pc].a, inLoop.begin() + pc + 1, true);
+        }
+    }
+
+    for (size_t start = 0; start < code.size(); ++start) {
+        std::vector<uint16_t> sequence{code[start].opcode};
+        for (size_t pc = start + 1; pc < code.size() && sequence.size() < MAX_LENGTH; ++pc) {
+            if (targets[pc] || transfersControl(code[pc - 1].opcode)) {
+                break;
+            }
+            sequence.push_back(code[pc].opcode);
+            if (sequence.size() >= MIN_LENGTH) {
+                Count &count = sequences_[sequence];
+                count.total++;
+                if (inLoop[start]) {
+                    count.inLoops++;
+                }
+            }
+        }
+    }
+
+    programs_++;
+    instructions_ += code.size();
+}
+
+void OpcodeCensus::report(std::ostream &out, size_t top) const
+{
+    out << "Opcode census of " << programs_ << " program(s), " << instructions_
+        << " instructions\n";
+
+    for (size_t length = MIN_LENGTH; length <= MAX_LENGTH; ++length) {
+        std::vector<std::pair<std::vector<uint16_t>, Count>> ranked;
+        for (const auto &entry : sequences_) {
+            if (entry.first.size() == length) {
+                ranked.push_back(entry);
+            }
+        }
+        std::sort(ranked.begin(), ranked.end(), [](const auto &lhs, const auto &rhs) {
+            if (lhs.second.inLoops != rhs.second.inLoops) {
+                return lhs.second.inLoops > rhs.second.inLoops;
+            }
+            return lhs.second.total > rhs.second.total;
+        });
+        if (ranked.size() > top) {
+            ranked.resize(top);
+        }
+
+        out << "Sequences of " << length << ": (in loops / total)\n";
+        for (const auto &[sequence, count] : ranked) {
+            out << "  " << count.inLoops << " / " << count.total << "  ";
+            for (size_t i = 0; i < sequence.size(); ++i) {
+                out << (i ? ", " : "") << decodedOpcodeName(sequence[i]);
+            }
+            out << "\n";
+        }
+    }
+}
+
+// The fusion table. Each rule lists the opcodes accepted at every position of the
+// sequence; fuse() below checks the operands. The rules are hand-written from an
+// OpcodeCensus of the sample scripts (`luminar census sample/arithmetic.lm
+// sample/fibonacci.lm sample/loops.lm`), whose top sequences of length 4, in loops / total:
+//   4 / 4  LOAD_CONST, ADD_I64, STORE_VARIABLE, JUMP
+//   4 / 4  LOAD_VARIABLE, LOAD_CONST, ADD_I64, STORE_VARIABLE   -> INC_VAR_CONST
+//   3 / 3  LOAD_VARIABLE, LOAD_CONST, LT_I64, JUMP_IF_FALSE     -> JUMP_IF_VAR_LT_CONST
+//   1 / 1  everything else
+// The first is the tail of the same counter update and ends in the loop's back edge, which
+// a fused record cannot cover without owning the jump, so it is left alone. Untyped code
+// (function parameters) reaches the same shapes with the generic opcodes and frame-relative
+// slots, and float accumulators with ADD_F64/LT_F64. Re-run the census when adding a rule.
+struct FusionRule
+{
+    uint16_t fused;
+    std::vector<std::vector<uint16_t>> pattern;
+};
+
+static const std::vector<FusionRule> fusionRules = {
+    {INC_VAR_CONST, {{LOAD_VARIABLE}, {LOAD_CONST}, {ADD_I64, ADD_F64, ADD}, {STORE_VARIABLE}}},
+    {INC_LOCAL_CONST, {{LOAD_LOCAL}, {LOAD_CONST}, {ADD_I64, ADD_F64, ADD}, {STORE_LOCAL}}},
+    {JUMP_IF_VAR_LT_CONST,
+     {{LOAD_VARIABLE}, {LOAD_CONST}, {LT_I64, LT_F64, LESS_THAN}, {JUMP_IF_FALSE}}},
+    {JUMP_IF_LOCAL_LT_CONST,
+     {{LOAD_LOCAL}, {LOAD_CONST}, {LT_I64, LT_F64, LESS_THAN}, {JUMP_IF_FALSE}}},
+};
+
+static bool isNumericConstant(const DecodedProgram &program, int32_t index)
+{
+    return std::visit(
+        [](const auto &v) {
+            using T = std::decay_t<decltype(v)>;
+            return std::is_arithmetic_v<T> && !std::is_same_v<T, bool>;
+        },
+        program.constants[index]->data);
+}
+
+static bool matches(const DecodedProgram &program, const std::vector<bool> &targets,
+                    size_t start, const FusionRule &rule)
+{
+    const auto &code = program.code;
+    if (start + rule.pattern.size() > code.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < rule.pattern.size(); ++i) {
+        if (i > 0 && targets[start + i]) {
+            return false;
+        }
+        const auto &accepted = rule.pattern[i];
+        if (std::find(accepted.begin(), accepted.end(), code[start + i].opcode) == accepted.end()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Operands of the fused record, or false if this instance of the pattern does not qualify
+static bool fuse(const DecodedProgram &program, size_t start, const FusionRule &rule,
+                 DecodedInstruction &fused)
+{
+    const DecodedInstruction *sequence = &program.code[start];
+    if (!isNumericConstant(program, sequence[1].a)) {
+        return false;
+    }
+
+    fused = DecodedInstruction{rule.fused, static_cast<uint16_t>(rule.pattern.size()),
+                               sequence[0].a, sequence[1].a, 0};
+    switch (rule.fused) {
+    case INC_VAR_CONST:
+    case INC_LOCAL_CONST:
+        return sequence[3].a == sequence[0].a; // stores back into the variable it loaded
+    default:
+        fused.c = sequence[3].a;
+        return true;
+    }
+}
+
+size_t fuseSuperinstructions(DecodedProgram &program)
+{
+    std::vector<bool> targets = jumpTargets(program);
+    size_t fusedCount = 0;
+
+    for (size_t pc = 0; pc < program.code.size(); ++pc) {
+        for (const auto &rule : fusionRules) {
+            DecodedInstruction fused;
+            if (matches(program, targets, pc, rule) && fuse(program, pc, rule, fused)) {
+                program.code[pc] = fused;
+                pc += rule.pattern.size() - 1;
+                fusedCount++;
+                break;
+            }
+        }
+    }
+    return fusedCount;
+}
@@ -0,0 +1,46 @@
+#ifndef FUSION_HH
+#define FUSION_HH
+
+#include "bytecode.hh"
+#include <cstdint>
+#include <map>
+#include <ostream>
+#include <vector>
+
+// Frequency census of short opcode sequences in decoded programs. Sequences never run
+// across a jump target, so every one of them could be fused. Sequences that sit inside a
+// loop body (between a backward JUMP and its target) are counted separately, since those
+// are the ones whose dispatch overhead matters.
+class OpcodeCensus
+{
+public:
+    static constexpr size_t MIN_LENGTH = 2;
+    static constexpr size_t MAX_LENGTH = 4;
+
+    struct Count
+    {
+        uint64_t total = 0;
+        uint64_t inLoops = 0;
+    };
+
+    void add(const DecodedProgram &program);
+    // The `top` most frequent sequences of each length, loop counts first.
+    void report(std::ostream &out, size_t top = 10) const;
+
+    const std::map<std::vector<uint16_t>, Count> &sequences() const { return sequences_; }
+
+private:
+    std::map<std::vector<uint16_t>, Count> sequences_;
+    size_t programs_ = 0;
+    size_t instructions_ = 0;
+};
+
+// Positions control can reach other than by falling through: jump targets and function
+// entries. A fused sequence may start at one but must not contain one.
+std::vector<bool> jumpTargets(const DecodedProgram &program);
+
+// Rewrites the sequences in the fusion table (see fusion.cpp) into superinstructions.
+// Returns the number of sequences fused.
+size_t fuseSuperinstructions(DecodedProgram &program);
+
+#endif // FUSION_HH
@@ -1,6 +1,8 @@
 #include "backend.hh"
-//#include "codegen.hh"
+#include "codegen.hh"
 #include "jit.hh"
+#include "lmc.hh"
+#include "optimizer.hh"
 #include "register.hh"
 #include "stack.hh"
 #include "yasm.hh"
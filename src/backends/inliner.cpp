@@ -0,0 +1,317 @@
+#include "bytecode.hh"
+#include "optimizer.hh"
+#include <map>
+#include <optional>
+#include <set>
+#include <variant>
+
+namespace {
+
+ValuePtr integerOperand(int64_t value)
+{
+    return std::make_shared<Value>(
+        Value{std::make_shared<Type>(TypeTag::Int), static_cast<int32_t>(value)});
+}
+
+struct Function
+{
+    std::string name;
+    size_t entry; // the parameter prologue
+    size_t end;   // one past the body
+    std::set<int64_t> locals;
+    bool inlinable = false;
+    bool bareReturn = false; // has a RETURN without a value
+};
+
+// Where a jump lands once everything is spliced: an instruction of the old program, or a
+// position in the new one
+struct Target
+{
+    bool old;
+    size_t pc;
+};
+
+class Inliner
+{
+public:
+    Inliner(std::vector<Instruction> &program, OptimizerReport &report, size_t budget)
+        : program(program)
+        , report(report)
+        , budget(budget)
+    {}
+
+    void run();
+
+private:
+    std::vector<Instruction> &program;
+    OptimizerReport &report;
+    size_t budget;
+
+    std::map<std::string, Function> functions; // only names defined once
+    std::vector<bool> leaders;
+    std::vector<const Function *> owner; // innermost function body each pc is in
+    int64_t nextSlot = 0;
+
+    int64_t operand(size_t pc) const { return DecodedProgram::integerOperand(program[pc].value); }
+    size_t jumpTarget(size_t pc) const
+    {
+        return program[pc].opcode == JUMP ? pc + 1 + operand(pc) : operand(pc);
+    }
+    bool isJump(size_t pc) const
+    {
+        return program[pc].opcode == JUMP || program[pc].opcode == JUMP_IF_FALSE;
+    }
+    const Function *callee(size_t pc) const;
+
+    void analyze();
+    bool canInline(const Function &function) const;
+    bool localsStoredFirst(const Function &function) const;
+    void splice(const std::map<size_t, const Function *> &sites);
+    void inlineBody(const Function &function, bool dropResult, std::vector<Instruction> &out,
+                    std::vector<std::optional<Target>> &targets);
+};
+
+// The function an INVOKE_FUNCTION at `pc` calls, if that can be inlined there
+const Function *Inliner::callee(size_t pc) const
+{
+    if (program[pc].opcode != INVOKE_FUNCTION || !program[pc].value
+        || !std::holds_alternative<std::string>(program[pc].value->data)) {
+        return nullptr;
+    }
+    auto it = functions.find(std::get<std::string>(program[pc].value->data));
+    if (it == functions.end() || !it->second.inlinable) {
+        return nullptr;
+    }
+    // Without a result to return, the call must be a statement, whose POP drops it
+    if (it->second.bareReturn
+        && (pc + 1 >= program.size() || program[pc + 1].opcode != POP || leaders[pc + 1])) {
+        return nullptr;
+    }
+    return &it->second;
+}
+
+void Inliner::analyze()
+{
+    size_t n = program.size();
+    functions.clear();
+    leaders.assign(n + 1, false);
+    owner.assign(n, nullptr);
+    nextSlot = 0;
+    std::set<std::string> redefined;
+    for (size_t pc = 0; pc < n; ++pc) {
+        Opcode opcode = program[pc].opcode;
+        if (isJump(pc)) {
+            leaders[std::min(jumpTarget(pc), n)] = true;
+            leaders[pc + 1] = true;
+        }
+        if (opcode == DECLARE_VARIABLE || opcode == LOAD_VARIABLE || opcode == STORE_VARIABLE) {
+            nextSlot = std::max(nextSlot, operand(pc) + 1);
+        }
+        if (opcode != DEFINE_FUNCTION || pc + 1 >= n || program[pc + 1].opcode != JUMP
+            || !std::holds_alternative<std::string>(program[pc].value->data)) {
+            continue;
+        }
+        const std::string &name = std::get<std::string>(program[pc].value->data);
+        Function function{name, pc + 2, std::min(jumpTarget(pc + 1), n), {}};
+        if (!functions.emplace(name, function).second) {
+            redefined.insert(name);
+        }
+    }
+    for (const auto &name : redefined) {
+        functions.erase(name);
+    }
+    for (auto &[name, function] : functions) {
+        for (size_t pc = function.entry; pc < function.end; ++pc) {
+            if (program[pc].opcode == DECLARE_VARIABLE) {
+                function.locals.insert(operand(pc));
+            }
+            function.bareReturn = function.bareReturn || program[pc].opcode == RETURN;
+        }
+        function.inlinable = canInline(function);
+    }
+    // Bodies come in program order, so a nested body overwrites its enclosing one
+    std::map<size_t, const Function *> byEntry;
+    for (const auto &[name, function] : functions) {
+        byEntry[function.entry] = &function;
+    }
+    for (const auto &[entry, function] : byEntry) {
+        for (size_t pc = entry; pc < function->end; ++pc) {
+            owner[pc] = function;
+        }
+    }
+}
+
+// Small leaf functions: no calls (so no recursion), no nested definitions, jumps that stay
+// in the body, and a body that ends in a return
+bool Inliner::canInline(const Function &function) const
+{
+    if (function.end <= function.entry || function.end - function.entry > budget) {
+        return false;
+    }
+    for (size_t pc = function.entry; pc < function.end; ++pc) {
+        switch (program[pc].opcode) {
+        case INVOKE_FUNCTION:
+        case DEFINE_FUNCTION:
+        case PARALLEL:
+        case CONCURRENT:
+            return false;
+        case JUMP:
+        case JUMP_IF_FALSE:
+            if (jumpTarget(pc) < function.entry || jumpTarget(pc) >= function.end) {
+                return false;
+            }
+            break;
+        default:
+            break;
+        }
+    }
+    Opcode last = program[function.end - 1].opcode;
+    return (last == RETURN || last == RETURN_VALUE) && localsStoredFirst(function);
+}
+
+// A call starts with nil locals, inlined code with whatever the previous run left. That
+// only matters when a local can be read before it is stored, so each DECLARE_VARIABLE has
+// to be followed by a store of the variable within the same straight-line run.
+bool Inliner::localsStoredFirst(const Function &function) const
+{
+    for (size_t pc = function.entry; pc < function.end; ++pc) {
+        if (program[pc].opcode != DECLARE_VARIABLE) {
+            continue;
+        }
+        int64_t slot = operand(pc);
+        bool stored = false;
+        for (size_t next = pc + 1; !stored && next < function.end; ++next) {
+            Opcode opcode = program[next].opcode;
+            if (leaders[next] || isJump(next) || opcode == RETURN || opcode == RETURN_VALUE
+                || (opcode == LOAD_VARIABLE && operand(next) == slot)) {
+                break;
+            }
+            stored = opcode == STORE_VARIABLE && operand(next) == slot;
+        }
+        if (!stored) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// A copy of the body with fresh variables for its locals, where returns jump past the copy
+void Inliner::inlineBody(const Function &function, bool dropResult, std::vector<Instruction> &out,
+                         std::vector<std::optional<Target>> &targets)
+{
+    std::map<int64_t, int64_t> slots;
+    for (int64_t local : function.locals) {
+        slots[local] = nextSlot++;
+    }
+    std::vector<size_t> offset(function.end - function.entry + 1);
+    size_t size = 0;
+    for (size_t pc = function.entry; pc < function.end; ++pc) {
+        offset[pc - function.entry] = size;
+        size += dropResult && program[pc].opcode == RETURN_VALUE ? 2 : 1;
+    }
+    size_t start = out.size();
+    size_t exit = start + size;
+
+    for (size_t pc = function.entry; pc < function.end; ++pc) {
+        Instruction instruction = program[pc];
+        std::optional<Target> target;
+        switch (instruction.opcode) {
+        case DECLARE_VARIABLE:
+        case LOAD_VARIABLE:
+        case STORE_VARIABLE: {
+            auto slot = slots.find(operand(pc));
+            if (slot != slots.end()) {
+                instruction.value = integerOperand(slot->second);
+            }
+            break;
+        }
+        case JUMP:
+        case JUMP_IF_FALSE:
+            target = Target{false, start + offset[jumpTarget(pc) - function.entry]};
+            break;
+        case RETURN_VALUE:
+            if (dropResult) {
+                out.push_back(Instruction(POP, instruction.lineNumber));
+                targets.push_back(std::nullopt);
+            }
+            [[fallthrough]];
+        case RETURN:
+            instruction = Instruction(JUMP, instruction.lineNumber);
+            target = Target{false, exit};
+            break;
+        default:
+            break;
+        }
+        out.push_back(instruction);
+        targets.push_back(target);
+    }
+}
+
+// Replaces every call in `sites` by a copy of its callee (and the POP after it when the
+// copy drops the result itself), then retargets all jumps
+void Inliner::splice(const std::map<size_t, const Function *> &sites)
+{
+    size_t n = program.size();
+    std::vector<size_t> newIndex(n + 1);
+    std::vector<Instruction> out;
+    std::vector<std::optional<Target>> targets;
+    out.reserve(n);
+    for (size_t pc = 0; pc < n; ++pc) {
+        newIndex[pc] = out.size();
+        auto site = sites.find(pc);
+        if (site == sites.end()) {
+            out.push_back(program[pc]);
+            targets.push_back(isJump(pc) ? std::optional<Target>(Target{true, jumpTarget(pc)})
+                                         : std::nullopt);
+            continue;
+        }
+        const Function &function = *site->second;
+        const Function *caller = owner[pc];
+        report.inlined.push_back(function.name + " into " + (caller ? caller->name : "main")
+                                 + " at line " + std::to_string(program[pc].lineNumber));
+        inlineBody(function, function.bareReturn, out, targets);
+        if (function.bareReturn) {
+            newIndex[++pc] = out.size(); // the POP
+        }
+    }
+    newIndex[n] = out.size();
+
+    for (size_t index = 0; index < out.size(); ++index) {
+        if (!targets[index]) {
+            continue;
+        }
+        size_t to = targets[index]->old ? newIndex[targets[index]->pc] : targets[index]->pc;
+        out[index].value = integerOperand(out[index].opcode == JUMP
+                                              ? int64_t(to) - int64_t(index) - 1
+                                              : int64_t(to));
+    }
+    program = std::move(out);
+}
+
+void Inliner::run()
+{
+    if (budget == 0) {
+        return;
+    }
+    // Each round inlines the current leaves, which may turn their callers into leaves
+    for (int round = 0; round < 8; ++round) {
+        analyze();
+        std::map<size_t, const Function *> sites;
+        for (size_t pc = 0; pc < program.size(); ++pc) {
+            if (const Function *function = callee(pc)) {
+                sites[pc] = function;
+            }
+        }
+        if (sites.empty()) {
+            break;
+        }
+        splice(sites);
+    }
+}
+
+} // namespace
+
+void inlineFunctions(std::vector<Instruction> &program, OptimizerReport &report, size_t budget)
+{
+    Inliner(program, report, budget).run();
+}
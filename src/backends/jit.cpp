@@ -0,0 +1,972 @@
+#include "jit.hh"
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <stdexcept>
+
+#if LUMINAR_X64_JIT
+#include <sys/mman.h>
+#endif
+
+// Runtime entry points for the generated code. They only take pointers and integers so the
+// code generator can call them with the plain SysV convention, and none of them may let an
+// exception escape into generated code: failures leave through jitExit() instead.
+namespace {
+
+[[noreturn]] void jitExit(JitRuntime *runtime, int32_t status)
+{
+    runtime->status = status;
+    std::longjmp(runtime->exit, 1);
+}
+
+// Runs `body`, recording the message of anything it throws. Kept separate from the callers
+// so no destructor is pending when they longjmp out.
+template<typename Body>
+bool guarded(JitRuntime *runtime, Body body)
+{
+    try {
+        body();
+        return true;
+    } catch (const std::exception &ex) {
+        *runtime->error = ex.what();
+    }
+    return false;
+}
+
+void jitCopy(TaggedValue *dst, const TaggedValue *src)
+{
+    *dst = *src;
+}
+
+void jitRelease(TaggedValue *value)
+{
+    *value = TaggedValue();
+}
+
+void jitPrint(const TaggedValue *value)
+{
+    std::cout << "The result: " << std::boolalpha << *value << std::endl;
+}
+
+void jitUnary(JitRuntime *runtime, uint32_t opcode, TaggedValue *dst, const TaggedValue *value)
+{
+    if (!guarded(runtime, [&] { *dst = runtime->operations->unary(opcode, *value); })) {
+        jitExit(runtime, JitBackend::Failed);
+    }
+}
+
+void jitBinary(JitRuntime *runtime, uint32_t opcode, TaggedValue *dst, const TaggedValue *lhs,
+               const TaggedValue *rhs)
+{
+    if (!guarded(runtime, [&] { *dst = runtime->operations->binary(opcode, *lhs, *rhs); })) {
+        jitExit(runtime, JitBackend::Failed);
+    }
+}
+
+bool jitCompare(JitRuntime *runtime, uint32_t opcode, const TaggedValue *lhs,
+                const TaggedValue *rhs)
+{
+    bool result = false;
+    if (!guarded(runtime, [&] { result = runtime->operations->compare(opcode, *lhs, *rhs); })) {
+        jitExit(runtime, JitBackend::Failed);
+    }
+    return result;
+}
+
+void jitConditionError()
+{
+    std::cerr << "Error: JUMP_IF_FALSE requires a boolean condition" << std::endl;
+}
+
+void jitUnknownFunction(JitRuntime *runtime, uint32_t nameIndex)
+{
+    std::cerr << "Error: Function " << runtime->code->names[nameIndex] << " not declared"
+              << std::endl;
+}
+
+[[noreturn]] void jitCallOverflow(JitRuntime *runtime, uint32_t nameIndex)
+{
+    *runtime->error = "Call stack overflow in " + runtime->code->names[nameIndex];
+    jitExit(runtime, JitBackend::CallDepthExceeded);
+}
+
+void jitReturnOutsideFunction()
+{
+    std::cerr << "Error: RETURN outside of a function" << std::endl;
+}
+
+void jitHalt()
+{
+    std::cout << "Program halted normally." << std::endl;
+}
+
+// Calls the generated entry point; returns the JitBackend::Exit it left with. setjmp lives
+// in this frame so nothing with a destructor is skipped when generated code bails out.
+int32_t enter(void (*entry)(TaggedValue *, JitRuntime *), TaggedValue *registers,
+              JitRuntime *runtime)
+{
+    if (setjmp(runtime->exit) != 0) {
+        return runtime->status;
+    }
+    entry(registers, runtime);
+    return JitBackend::Finished;
+}
+
+#if LUMINAR_X64_JIT
+using namespace x64;
+
+constexpr int32_t VALUE_SIZE = sizeof(TaggedValue);
+constexpr int32_t PAYLOAD = offsetof(TaggedValue, as);
+constexpr uint8_t TAG_NIL = static_cast<uint8_t>(TaggedValue::Tag::Nil);
+constexpr uint8_t TAG_BOOL = static_cast<uint8_t>(TaggedValue::Tag::Bool);
+constexpr uint8_t TAG_INT = static_cast<uint8_t>(TaggedValue::Tag::Int);
+constexpr uint8_t TAG_FLOAT = static_cast<uint8_t>(TaggedValue::Tag::Float);
+constexpr uint8_t TAG_OBJECT = static_cast<uint8_t>(TaggedValue::Tag::Object);
+
+constexpr int32_t RT_CONSTANTS = offsetof(JitRuntime, constants);
+constexpr int32_t RT_GLOBALS = offsetof(JitRuntime, globals);
+constexpr int32_t RT_REGISTERS_END = offsetof(JitRuntime, registersEnd);
+constexpr int32_t RT_DEPTH = offsetof(JitRuntime, depth);
+constexpr int32_t RT_RESULT = offsetof(JitRuntime, result);
+
+// Generated code keeps these in callee-saved registers for its whole run
+constexpr Reg FRAME = RBX;     // registers of the current call
+constexpr Reg CONSTANTS = R12; // JitRuntime::constants
+constexpr Reg RUNTIME = R13;   // the JitRuntime
+constexpr Reg GLOBALS = R14;   // JitRuntime::globals
+
+Mem payload(Mem value)
+{
+    return Mem{value.base, value.disp + PAYLOAD};
+}
+
+template<typename Function>
+const void *address(Function *function)
+{
+    return reinterpret_cast<const void *>(function);
+}
+
+Cond intCondition(uint16_t opcode)
+{
+    switch (opcode) {
+    case EQ_I64:
+    case EQUAL:
+        return E;
+    case NE_I64:
+    case NOT_EQUAL:
+        return NE;
+    case LT_I64:
+    case LESS_THAN:
+        return L;
+    case LE_I64:
+    case LESS_THAN_OR_EQUAL:
+        return LE;
+    case GT_I64:
+    case GREATER_THAN:
+        return G;
+    default:
+        return GE;
+    }
+}
+
+bool isIntComparison(uint16_t opcode)
+{
+    switch (opcode) {
+    case EQ_I64:
+    case NE_I64:
+    case LT_I64:
+    case LE_I64:
+    case GT_I64:
+    case GE_I64:
+        return true;
+    default:
+        return false;
+    }
+}
+
+bool isGenericComparison(uint16_t opcode)
+{
+    switch (opcode) {
+    case EQUAL:
+    case NOT_EQUAL:
+    case LESS_THAN:
+    case LESS_THAN_OR_EQUAL:
+    case GREATER_THAN:
+    case GREATER_THAN_OR_EQUAL:
+        return true;
+    default:
+        return false;
+    }
+}
+
+class Compiler
+{
+public:
+    Compiler(Emitter &as, const RegisterProgram &program, const std::vector<TaggedValue> &constants)
+        : as(as)
+        , program(program)
+        , constants(constants)
+        , registersExhausted(as.newLabel())
+    {
+        for (size_t i = 0; i < program.functions.size(); ++i) {
+            entries.push_back(as.newLabel());
+            overflows.push_back(as.newLabel());
+        }
+    }
+
+    // Emits the whole program and returns the offset of the C-callable entry point
+    int32_t compile()
+    {
+        Label mainEntry = as.newLabel();
+        compileFunction(program.main, mainEntry, true);
+        for (size_t i = 0; i < program.functions.size(); ++i) {
+            compileFunction(program.functions[i], entries[i], false);
+        }
+
+        for (size_t i = 0; i < program.functions.size(); ++i) {
+            as.bind(overflows[i]);
+            as.mov(RDI, RUNTIME);
+            as.movImm(RSI, static_cast<uint64_t>(program.functions[i].nameIndex));
+            as.callAbsolute(address(jitCallOverflow));
+        }
+        as.bind(registersExhausted);
+        exitWith(JitBackend::RegistersExhausted);
+
+        // void entry(TaggedValue *registers, JitRuntime *runtime)
+        Label entry = as.newLabel();
+        as.bind(entry);
+        as.push(RBX);
+        as.push(R12);
+        as.push(R13);
+        as.push(R14);
+        as.subImm(RSP, 8);
+        as.mov(RUNTIME, RSI);
+        as.mov(CONSTANTS, Mem{RUNTIME, RT_CONSTANTS});
+        as.mov(GLOBALS, Mem{RUNTIME, RT_GLOBALS});
+        as.call(mainEntry);
+        as.addImm(RSP, 8);
+        as.pop(R14);
+        as.pop(R13);
+        as.pop(R12);
+        as.pop(RBX);
+        as.ret();
+
+        as.finish();
+        return as.offsetOf(entry);
+    }
+
+private:
+    Emitter &as;
+    const RegisterProgram &program;
+    const std::vector<TaggedValue> &constants;
+    std::vector<Label> entries;   // by function id
+    std::vector<Label> overflows; // by function id, raise the call depth error
+    Label registersExhausted;
+
+    const RegisterFunction *function = nullptr;
+    std::vector<Label> labels; // by instruction of the current function
+    bool isMain = false;
+
+    Mem operand(int32_t x) const
+    {
+        return x >= 0 ? Mem{FRAME, x * VALUE_SIZE} : Mem{CONSTANTS, ~x * VALUE_SIZE};
+    }
+
+    Mem frameRegister(int32_t index) const { return Mem{FRAME, index * VALUE_SIZE}; }
+
+    const TaggedValue *constant(int32_t x) const
+    {
+        return isConstantOperand(x) ? &constants[~x] : nullptr;
+    }
+
+    void exitWith(JitBackend::Exit status)
+    {
+        as.mov(RDI, RUNTIME);
+        as.movImm(RSI, static_cast<uint64_t>(status));
+        as.callAbsolute(address(jitExit));
+    }
+
+    // Frees what `value` holds when it is a heap object; must run before it is overwritten
+    void releaseIfObject(Mem value)
+    {
+        Label skip = as.newLabel();
+        as.cmpByte(value, TAG_OBJECT);
+        as.jcc(NE, skip);
+        as.lea(RDI, value);
+        as.callAbsolute(address(jitRelease));
+        as.bind(skip);
+    }
+
+    void storeScalar(Mem dst, uint8_t tag, Reg value)
+    {
+        as.mov(payload(dst), value);
+        as.movByte(dst, tag);
+    }
+
+    void copyRaw(Mem dst, Mem src)
+    {
+        as.mov(RAX, src);
+        as.mov(dst, RAX);
+        as.mov(RAX, payload(src));
+        as.mov(payload(dst), RAX);
+    }
+
+    // dst = src with reference counting done out of line only when an object is involved
+    void copy(Mem dst, int32_t src, bool dstMayHoldObject)
+    {
+        if (const TaggedValue *value = constant(src)) {
+            if (!value->isObject()) {
+                if (dstMayHoldObject) {
+                    releaseIfObject(dst);
+                }
+                as.movImm(RAX, static_cast<uint64_t>(value->as.i));
+                storeScalar(dst, static_cast<uint8_t>(value->tag), RAX);
+                return;
+            }
+        }
+        copy(dst, operand(src), dstMayHoldObject);
+    }
+
+    void copy(Mem dst, Mem src, bool dstMayHoldObject)
+    {
+        if (dst.base == src.base && dst.disp == src.disp) {
+            return;
+        }
+        Label slow = as.newLabel();
+        Label done = as.newLabel();
+        as.cmpByte(src, TAG_OBJECT);
+        as.jcc(E, slow);
+        if (dstMayHoldObject) {
+            as.cmpByte(dst, TAG_OBJECT);
+            as.jcc(E, slow);
+        }
+        copyRaw(dst, src);
+        as.jmp(done);
+        as.bind(slow);
+        as.lea(RDI, dst);
+        as.lea(RSI, src);
+        as.callAbsolute(address(jitCopy));
+        as.bind(done);
+    }
+
+    // Jumps to `notInt` unless both operands are integers; constants are checked here
+    bool guardInts(int32_t lhs, int32_t rhs, Label notInt)
+    {
+        for (int32_t x : {lhs, rhs}) {
+            if (const TaggedValue *value = constant(x)) {
+                if (!value->isInt()) {
+                    return false;
+                }
+            } else {
+                as.cmpByte(operand(x), TAG_INT);
+                as.jcc(NE, notInt);
+            }
+        }
+        return true;
+    }
+
+    void intArithmetic(const RegisterInstruction &instruction, uint16_t opcode)
+    {
+        Mem dst = operand(instruction.dst);
+        as.mov(RAX, payload(operand(instruction.a)));
+        Mem rhs = payload(operand(instruction.b));
+        if (opcode == ADD_I64 || opcode == ADD) {
+            as.add(RAX, rhs);
+        } else if (opcode == SUB_I64 || opcode == SUBTRACT) {
+            as.sub(RAX, rhs);
+        } else {
+            as.imul(RAX, rhs);
+        }
+        releaseIfObjectPreserving(dst);
+        storeScalar(dst, TAG_INT, RAX);
+    }
+
+    // DIV_I64 and MOD_I64. The only idiv the JIT emits: a divisor of 0 or -1 (where idiv
+    // traps on INT64_MIN) goes to the C++ path, which reports the one and wraps the other.
+    void intDivision(const RegisterInstruction &instruction)
+    {
+        Mem dst = operand(instruction.dst);
+        Label slow = as.newLabel();
+        Label done = as.newLabel();
+        as.mov(RCX, payload(operand(instruction.b)));
+        as.lea(RAX, Mem{RCX, 1});
+        as.cmpImm(RAX, 1);
+        as.jcc(BE, slow); // divisor + 1 is 0 or 1
+        as.mov(RAX, payload(operand(instruction.a)));
+        as.cqo();
+        as.idiv(RCX);
+        if (instruction.opcode == MOD_I64) {
+            as.mov(RAX, RDX);
+        }
+        releaseIfObjectPreserving(dst);
+        storeScalar(dst, TAG_INT, RAX);
+        as.jmp(done);
+        as.bind(slow);
+        callBinary(instruction.opcode, instruction);
+        as.bind(done);
+    }
+
+    void intComparison(const RegisterInstruction &instruction, uint16_t opcode)
+    {
+        Mem dst = operand(instruction.dst);
+        releaseIfObject(dst);
+        as.mov(RAX, payload(operand(instruction.a)));
+        as.cmp(RAX, payload(operand(instruction.b)));
+        as.setcc(intCondition(opcode), RAX);
+        as.movzxByte(RAX, RAX);
+        storeScalar(dst, TAG_BOOL, RAX);
+    }
+
+    // releaseIfObject() for when RAX holds a result: the release call clobbers it
+    void releaseIfObjectPreserving(Mem value)
+    {
+        Label skip = as.newLabel();
+        as.cmpByte(value, TAG_OBJECT);
+        as.jcc(NE, skip);
+        as.push(RAX);
+        as.subImm(RSP, 8);
+        as.lea(RDI, value);
+        as.callAbsolute(address(jitRelease));
+        as.addImm(RSP, 8);
+        as.pop(RAX);
+        as.bind(skip);
+    }
+
+    void floatArithmetic(const RegisterInstruction &instruction)
+    {
+        Mem dst = operand(instruction.dst);
+        releaseIfObject(dst);
+        as.movsd(XMM0, payload(operand(instruction.a)));
+        Mem rhs = payload(operand(instruction.b));
+        switch (instruction.opcode) {
+        case ADD_F64:
+            as.addsd(XMM0, rhs);
+            break;
+        case SUB_F64:
+            as.subsd(XMM0, rhs);
+            break;
+        case MUL_F64:
+            as.mulsd(XMM0, rhs);
+            break;
+        default:
+            as.divsd(XMM0, rhs);
+            break;
+        }
+        as.movsd(payload(dst), XMM0);
+        as.movByte(dst, TAG_FLOAT);
+    }
+
+    void floatDivision(const RegisterInstruction &instruction)
+    {
+        Label slow = as.newLabel();
+        Label done = as.newLabel();
+        // Doubling the bits leaves zero only for +0.0 and -0.0, which jitBinary reports
+        as.mov(RAX, payload(operand(instruction.b)));
+        as.add(RAX, RAX);
+        as.jcc(E, slow);
+        floatArithmetic(instruction);
+        as.jmp(done);
+        as.bind(slow);
+        callBinary(instruction.opcode, instruction);
+        as.bind(done);
+    }
+
+    // Sets the flags so that `true` of the returned condition means `lhs <op> rhs`. NaN
+    // compares unordered, which leaves every returned condition false.
+    Cond floatCompare(uint16_t opcode, int32_t lhs, int32_t rhs)
+    {
+        bool swap = opcode == LT_F64 || opcode == LE_F64;
+        as.movsd(XMM0, payload(operand(swap ? rhs : lhs)));
+        as.ucomisd(XMM0, payload(operand(swap ? lhs : rhs)));
+        return opcode == LT_F64 || opcode == GT_F64 ? A : AE;
+    }
+
+    void floatComparison(const RegisterInstruction &instruction)
+    {
+        Mem dst = operand(instruction.dst);
+        releaseIfObject(dst);
+        if (instruction.opcode == EQ_F64 || instruction.opcode == NE_F64) {
+            bool equal = instruction.opcode == EQ_F64;
+            as.movsd(XMM0, payload(operand(instruction.a)));
+            as.ucomisd(XMM0, payload(operand(instruction.b)));
+            as.setcc(equal ? E : NE, RAX);
+            as.setcc(equal ? NP : P, RCX);
+            if (equal) {
+                as.andByte(RAX, RCX);
+            } else {
+                as.orByte(RAX, RCX);
+            }
+        } else {
+            as.setcc(floatCompare(instruction.opcode, instruction.a, instruction.b), RAX);
+        }
+        as.movzxByte(RAX, RAX);
+        storeScalar(dst, TAG_BOOL, RAX);
+    }
+
+    void callBinary(uint16_t opcode, const RegisterInstruction &instruction)
+    {
+        as.lea(RDX, operand(instruction.dst));
+        as.lea(RCX, operand(instruction.a));
+        as.lea(R8, operand(instruction.b));
+        as.mov(RDI, RUNTIME);
+        as.movImm(RSI, opcode);
+        as.callAbsolute(address(jitBinary));
+    }
+
+    // Generic operations get an inline path for two integers and the C++ one for the rest
+    void genericBinary(const RegisterInstruction &instruction)
+    {
+        Label slow = as.newLabel();
+        Label done = as.newLabel();
+        if (guardInts(instruction.a, instruction.b, slow)) {
+            if (isGenericComparison(instruction.opcode)) {
+                intComparison(instruction, instruction.opcode);
+            } else {
+                intArithmetic(instruction, instruction.opcode);
+            }
+            as.jmp(done);
+        }
+        as.bind(slow);
+        callBinary(instruction.opcode, instruction);
+        as.bind(done);
+    }
+
+    void branchUnless(const RegisterInstruction &instruction)
+    {
+        Label target = labels[instruction.dst];
+        uint16_t comparison = instruction.aux;
+        if (isIntComparison(comparison)) {
+            as.mov(RAX, payload(operand(instruction.a)));
+            as.cmp(RAX, payload(operand(instruction.b)));
+            as.jcc(invert(intCondition(comparison)), target);
+            return;
+        }
+        if (comparison == LT_F64 || comparison == LE_F64 || comparison == GT_F64
+            || comparison == GE_F64) {
+            as.jcc(invert(floatCompare(comparison, instruction.a, instruction.b)), target);
+            return;
+        }
+
+        Label slow = as.newLabel();
+        Label done = as.newLabel();
+        if (isGenericComparison(comparison) && guardInts(instruction.a, instruction.b, slow)) {
+            as.mov(RAX, payload(operand(instruction.a)));
+            as.cmp(RAX, payload(operand(instruction.b)));
+            as.jcc(invert(intCondition(comparison)), target);
+            as.jmp(done);
+        }
+        as.bind(slow);
+        as.lea(RDX, operand(instruction.a));
+        as.lea(RCX, operand(instruction.b));
+        as.mov(RDI, RUNTIME);
+        as.movImm(RSI, comparison);
+        as.callAbsolute(address(jitCompare));
+        as.testByte(RAX, RAX);
+        as.jcc(E, target);
+        as.bind(done);
+    }
+
+    void jumpIfFalse(const RegisterInstruction &instruction)
+    {
+        Label target = labels[instruction.dst];
+        if (const TaggedValue *condition = constant(instruction.a)) {
+            if (!condition->isBool()) {
+                as.callAbsolute(address(jitConditionError));
+            } else if (!condition->as.b) {
+                as.jmp(target);
+            }
+            return;
+        }
+        Mem condition = operand(instruction.a);
+        Label check = as.newLabel();
+        Label next = as.newLabel();
+        as.cmpByte(condition, TAG_BOOL);
+        as.jcc(E, check);
+        as.callAbsolute(address(jitConditionError));
+        as.jmp(next);
+        as.bind(check);
+        as.cmpByte(payload(condition), 0);
+        as.jcc(E, target);
+        as.bind(next);
+    }
+
+    void invoke(const RegisterInstruction &instruction)
+    {
+        Mem dst = operand(instruction.dst);
+        if (instruction.a < 0) {
+            as.mov(RDI, RUNTIME);
+            as.movImm(RSI, static_cast<uint64_t>(instruction.b));
+            as.callAbsolute(address(jitUnknownFunction));
+            releaseIfObject(dst);
+            as.movByte(dst, TAG_NIL);
+            return;
+        }
+
+        const RegisterFunction &callee = program.functions[instruction.a];
+        int32_t calleeBase = function->frameSize;
+        bool tail = !isMain && isTailCall(*function, &instruction - function->code.data());
+        if (!tail) {
+            as.incDword(Mem{RUNTIME, RT_DEPTH});
+            as.cmpDword(Mem{RUNTIME, RT_DEPTH}, JitBackend::MAX_CALL_DEPTH);
+            as.jcc(G, overflows[instruction.a]);
+        }
+        as.lea(RAX, frameRegister(calleeBase + callee.frameSize));
+        as.cmp(RAX, Mem{RUNTIME, RT_REGISTERS_END});
+        as.jcc(A, registersExhausted);
+
+        // The callee's registers are all nil until it writes them
+        int32_t passed = std::min<int32_t>(instruction.aux, callee.paramCount);
+        for (int32_t i = 0; i < passed; ++i) {
+            copy(frameRegister(calleeBase + i), function->arguments[instruction.b + i], false);
+        }
+        if (tail) {
+            // The arguments are in place above the frame; the callee takes the frame over
+            // and returns straight to our caller
+            for (int32_t i = 0; i < function->frameSize; ++i) {
+                releaseIfObject(frameRegister(i));
+                as.movByte(frameRegister(i), TAG_NIL);
+            }
+            for (int32_t i = 0; i < passed; ++i) {
+                copyRaw(frameRegister(i), frameRegister(calleeBase + i));
+                as.movByte(frameRegister(calleeBase + i), TAG_NIL);
+            }
+            as.mov(RDI, FRAME);
+            as.pop(FRAME);
+            as.jmp(entries[instruction.a]);
+            return;
+        }
+        as.lea(RDI, frameRegister(calleeBase));
+        as.call(entries[instruction.a]);
+        as.decDword(Mem{RUNTIME, RT_DEPTH});
+
+        // Move the result out of the runtime
+        Mem result{RUNTIME, RT_RESULT};
+        releaseIfObject(dst);
+        copyRaw(dst, result);
+        as.movByte(result, TAG_NIL);
+    }
+
+    void returnFromFunction(const RegisterInstruction &instruction)
+    {
+        if (isMain) {
+            as.callAbsolute(address(jitReturnOutsideFunction));
+            return;
+        }
+        Mem result{RUNTIME, RT_RESULT};
+        if (instruction.opcode == RETURN_VALUE) {
+            if (isConstantOperand(instruction.a)) {
+                copy(result, instruction.a, false);
+            } else {
+                // The frame is about to be cleared, so the value can move instead of copy
+                Mem value = operand(instruction.a);
+                copyRaw(result, value);
+                as.movByte(value, TAG_NIL);
+            }
+        }
+        for (int32_t i = 0; i < function->frameSize; ++i) {
+            releaseIfObject(frameRegister(i));
+            as.movByte(frameRegister(i), TAG_NIL);
+        }
+        epilogue();
+    }
+
+    void epilogue()
+    {
+        as.pop(FRAME);
+        as.ret();
+    }
+
+    void compileFunction(const RegisterFunction &current, Label entry, bool main)
+    {
+        function = &current;
+        isMain = main;
+        labels.clear();
+        for (size_t i = 0; i < current.code.size(); ++i) {
+            labels.push_back(as.newLabel());
+        }
+
+        // Entered with the frame in RDI; the stack is 16-byte aligned after the push
+        as.bind(entry);
+        as.push(FRAME);
+        as.mov(FRAME, RDI);
+
+        for (size_t pc = 0; pc < current.code.size(); ++pc) {
+            const RegisterInstruction &instruction = current.code[pc];
+            as.bind(labels[pc]);
+            compileInstruction(instruction);
+        }
+    }
+
+    void compileInstruction(const RegisterInstruction &instruction)
+    {
+        switch (instruction.opcode) {
+        case NOP:
+            break;
+        case MOVE:
+            copy(operand(instruction.dst), instruction.a, true);
+            break;
+        case GET_GLOBAL:
+            copy(operand(instruction.dst), Mem{GLOBALS, instruction.a * VALUE_SIZE}, true);
+            break;
+        case SET_GLOBAL:
+            copy(Mem{GLOBALS, instruction.dst * VALUE_SIZE}, instruction.a, true);
+            break;
+        case ADD_I64:
+        case SUB_I64:
+        case MUL_I64:
+            intArithmetic(instruction, instruction.opcode);
+            break;
+        case DIV_I64:
+        case MOD_I64:
+            intDivision(instruction);
+            break;
+        case EQ_I64:
+        case NE_I64:
+        case LT_I64:
+        case LE_I64:
+        case GT_I64:
+        case GE_I64:
+            intComparison(instruction, instruction.opcode);
+            break;
+        case ADD_F64:
+        case SUB_F64:
+        case MUL_F64:
+            floatArithmetic(instruction);
+            break;
+        case DIV_F64:
+            floatDivision(instruction);
+            break;
+        case EQ_F64:
+        case NE_F64:
+        case LT_F64:
+        case LE_F64:
+        case GT_F64:
+        case GE_F64:
+            floatComparison(instruction);
+            break;
+        case ADD:
+        case SUBTRACT:
+        case MULTIPLY:
+        case EQUAL:
+        case NOT_EQUAL:
+        case LESS_THAN:
+        case LESS_THAN_OR_EQUAL:
+        case GREATER_THAN:
+        case GREATER_THAN_OR_EQUAL:
+            genericBinary(instruction);
+            break;
+        case NEG_I64: {
+            Mem dst = operand(instruction.dst);
+            as.mov(RAX, payload(operand(instruction.a)));
+            as.neg(RAX);
+            releaseIfObjectPreserving(dst);
+            storeScalar(dst, TAG_INT, RAX);
+            break;
+        }
+        case NEGATE:
+        case NOT:
+        case NEG_F64:
+        case TO_INT64:
+        case TO_FLOAT64:
+            as.lea(RDX, operand(instruction.dst));
+            as.lea(RCX, operand(instruction.a));
+            as.mov(RDI, RUNTIME);
+            as.movImm(RSI, instruction.opcode);
+            as.callAbsolute(address(jitUnary));
+            break;
+        case PRINT:
+            as.lea(RDI, operand(instruction.a));
+            as.callAbsolute(address(jitPrint));
+            break;
+        case JUMP:
+            as.jmp(labels[instruction.dst]);
+            break;
+        case JUMP_IF_FALSE:
+            jumpIfFalse(instruction);
+            break;
+        case BRANCH_UNLESS:
+            branchUnless(instruction);
+            break;
+        case INVOKE_FUNCTION:
+            invoke(instruction);
+            break;
+        case RETURN:
+        case RETURN_VALUE:
+            returnFromFunction(instruction);
+            break;
+        case HALT:
+            as.callAbsolute(address(jitHalt));
+            if (isMain) {
+                epilogue();
+            } else {
+                exitWith(JitBackend::Halted);
+            }
+            break;
+        default:
+            callBinary(instruction.opcode, instruction);
+            break;
+        }
+    }
+};
+#endif
+
+} // namespace
+
+JitBackend::JitBackend(std::vector<Instruction> &program, const ConstantPool &constantPool)
+    : memoryManager(Logger::memory().isEnabled(LogLevel::Debug))
+    , globalRegion(memoryManager)
+    , operations(globalRegion)
+    , constantPool(constantPool)
+    , program(program)
+{}
+
+JitBackend::~JitBackend()
+{
+#if LUMINAR_X64_JIT
+    if (registers) {
+        clearRegisters(REGISTER_FILE_SIZE);
+        munmap(registers, REGISTER_FILE_SIZE * sizeof(TaggedValue));
+    }
+#endif
+}
+
+void JitBackend::run(const std::vector<Instruction> &program)
+{
+    this->program = program;
+    DecodedProgram decoded;
+    try {
+        decoded = DecodedProgram::decode(this->program, constantPool.values());
+    } catch (const std::exception &ex) {
+        std::cerr << "Exception occurred during VM execution: " << ex.what() << std::endl;
+        return;
+    }
+    run(decoded);
+}
+
+void JitBackend::run(const DecodedProgram &program)
+{
+#if !LUMINAR_X64_JIT
+    (void) program;
+    std::cerr << "Error: The jit backend needs an x86-64 Unix host" << std::endl;
+#else
+    auto start_time = std::chrono::high_resolution_clock::now();
+    try {
+        load(program);
+        auto start_time = std::chrono::high_resolution_clock::now();
+        int32_t status = enter(entry, registers, &runtime);
+        auto end_time = std::chrono::high_resolution_clock::now();
+        if (status != Finished) {
+            // Calls that were cut short left their frames behind
+            runtime.depth = 0;
+            runtime.result = TaggedValue();
+            clearRegisters(REGISTER_FILE_SIZE);
+        }
+        switch (status) {
+        case RegistersExhausted:
+            throw std::runtime_error("Register file exhausted");
+        case CallDepthExceeded:
+        case Failed:
+            throw std::runtime_error(error);
+        default:
+            break;
+        }
+        auto duration = std::chrono::duration_cast<std::chrono::microseconds>(end_time - start_time);
+        std::cout << "VM Execution completed in " << duration.count() << " microseconds."
+                  << std::endl;
+    } catch (const std::exception &ex) {
+        std::cerr << "Exception occurred during VM execution: " << ex.what() << std::endl;
+    }
+    auto end_time = std::chrono::high_resolution_clock::now();
+    auto duration = std::chrono::duration_cast<std::chrono::microseconds>(end_time - start_time);
+    std::cout << "VM ran for a total of  " << duration.count() << " microseconds." << std::endl;
+#endif
+}
+
+void JitBackend::load(const DecodedProgram &decoded)
+{
+    stackInstructions = decoded.code.size();
+    code = RegisterProgram::translate(decoded);
+
+    constants.clear();
+    constants.reserve(code.constants.size());
+    for (const auto &constant : code.constants) {
+        constants.push_back(TaggedValue::fromValue(*constant, globalRegion));
+    }
+
+#if LUMINAR_X64_JIT
+    if (!registers) {
+        // Untouched pages read as zero, which is a nil TaggedValue
+        void *memory = mmap(nullptr, REGISTER_FILE_SIZE * sizeof(TaggedValue),
+                            PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+                            -1, 0);
+        if (memory == MAP_FAILED) {
+            throw std::runtime_error("Cannot map the register file");
+        }
+        registers = static_cast<TaggedValue *>(memory);
+    } else {
+        clearRegisters(std::max<size_t>(code.main.frameSize, 256));
+    }
+    if (static_cast<size_t>(code.main.frameSize) > REGISTER_FILE_SIZE) {
+        throw std::runtime_error("Register file exhausted");
+    }
+    compile();
+#endif
+
+    runtime.constants = constants.data();
+    runtime.globals = registers;
+    runtime.registersEnd = registers + REGISTER_FILE_SIZE;
+    runtime.depth = 0;
+    runtime.operations = &operations;
+    runtime.code = &code;
+    runtime.error = &error;
+}
+
+void JitBackend::compile()
+{
+#if LUMINAR_X64_JIT
+    x64::Emitter emitter;
+    Compiler compiler(emitter, code, constants);
+    int32_t offset = compiler.compile();
+    machineCode.load(emitter.code());
+    codeSize = emitter.size();
+    entry = reinterpret_cast<void (*)(TaggedValue *, JitRuntime *)>(
+        const_cast<uint8_t *>(machineCode.data() + offset));
+#endif
+}
+
+void JitBackend::clearRegisters(size_t count)
+{
+    for (size_t i = 0; i < count; ++i) {
+        if (registers[i].tag != TaggedValue::Tag::Nil) {
+            registers[i] = TaggedValue();
+        }
+    }
+}
+
+void JitBackend::execute(const Instruction &instruction)
+{
+    // Machine code only exists for whole programs
+    run({instruction, Instruction(HALT, instruction.lineNumber)});
+}
+
+void JitBackend::dumpRegisters()
+{
+    std::cout << "Registers:\n";
+    for (int32_t i = 0; registers && i < code.main.frameSize; ++i) {
+        std::cout << "R-" << i << ": " << registers[i] << "\n";
+    }
+
+    std::cout << "Constants:\n";
+    for (size_t i = 0; i < constants.size(); ++i) {
+        std::cout << "C-" << i << ": " << constants[i] << "\n";
+    }
+
+    size_t registerInstructions = code.main.code.size();
+    for (const auto &function : code.functions) {
+        registerInstructions += function.code.size();
+    }
+    std::cout << "Machine code: " << codeSize << " bytes for " << registerInstructions
+              << " register instructions from " << stackInstructions << " stack instructions\n";
+    code.print(std::cout);
+    std::cout << "End of Dump Registers\n";
+}
@@ -1,6 +1,80 @@
-#include <functional>
-#include <mutex>
+#ifndef JIT_HH
+#define JIT_HH
+
+#include "../constants.hh"
+#include "../memory.hh"
+#include "backend.hh"
+#include "bytecode.hh"
+#include "operations.hh"
+#include "regcode.hh"
+#include "tagged.hh"
+#include "x64.hh"
+#include <csetjmp>
+#include <cstdint>
 #include <string>
-#include <thread>
-#include <variant>
 #include <vector>
+
+// State the generated code reaches through r13. Only pointers, scalars and a TaggedValue so
+// the code generator can address every field with offsetof.
+struct JitRuntime
+{
+    const TaggedValue *constants;
+    TaggedValue *globals;            // the main frame, for GET_GLOBAL/SET_GLOBAL
+    const TaggedValue *registersEnd; // one past the register file
+    int32_t depth;                   // active calls
+    int32_t status;                  // why the code longjmp'd out, see JitBackend::Exit
+    TaggedValue result;              // return value in flight between RETURN and the caller
+    ValueOperations *operations;
+    const RegisterProgram *code;
+    std::string *error;
+    std::jmp_buf exit;
+};
+
+// Baseline compiler from RegisterProgram to x86-64. Every register function becomes one
+// native function that keeps its frame in the same TaggedValue register file the register
+// VM uses, so the two agree on layout and on every slow path: integer and float arithmetic,
+// comparisons, branches, moves and calls are emitted inline, and anything that touches a
+// heap object (strings, printing, generic operations on mixed types) calls back into C++.
+class JitBackend : public Backend
+{
+public:
+    JitBackend(std::vector<Instruction> &program, const ConstantPool &constantPool);
+    ~JitBackend() override;
+
+    void execute(const Instruction &instruction) override;
+    void dumpRegisters() override;
+    void run(const std::vector<Instruction> &program) override;
+    void run(const DecodedProgram &program) override;
+
+    enum Exit : int32_t { Finished, Halted, CallDepthExceeded, RegistersExhausted, Failed };
+    static constexpr int32_t MAX_CALL_DEPTH = 100000;
+
+private:
+    // Declared first so they outlive every TaggedValue below.
+    ValueMemory memoryManager;
+    ValueMemory::Region globalRegion;
+    ValueOperations operations;
+
+    static constexpr size_t REGISTER_FILE_SIZE = size_t(1) << 21;
+
+    TaggedValue *registers = nullptr; // REGISTER_FILE_SIZE values, mapped zeroed (all nil)
+    std::vector<TaggedValue> constants;
+    ConstantPool constantPool;
+    std::vector<Instruction> program;
+    size_t stackInstructions = 0;
+    RegisterProgram code;
+    JitRuntime runtime{};
+    std::string error;
+
+#if LUMINAR_X64_JIT
+    x64::ExecutableMemory machineCode;
+#endif
+    size_t codeSize = 0;
+    void (*entry)(TaggedValue *registers, JitRuntime *runtime) = nullptr;
+
+    void load(const DecodedProgram &decoded);
+    void compile();
+    void clearRegisters(size_t count);
+};
+
+#endif // JIT_HH
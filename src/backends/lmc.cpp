@@ -0,0 +1,433 @@
+#include "lmc.hh"
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <type_traits>
+#include <variant>
+
+namespace {
+
+const char MAGIC[4] = {'L', 'M', 'C', '\0'};
+constexpr uint8_t NO_TYPE = 0xff;
+
+struct Header
+{
+    char magic[4];
+    uint32_t version;
+    uint32_t opcodeCount; // DECODED_OPCODE_COUNT of the build that wrote it
+    uint32_t recordSize;  // sizeof(DecodedInstruction)
+    uint64_t sourceHash;
+    uint32_t codeCount;
+    uint32_t functionCount;
+    uint32_t constantCount;
+    uint32_t nameCount;
+    uint64_t linesOffset;
+    uint64_t functionsOffset;
+    uint64_t constantsOffset;
+    uint64_t namesOffset;
+    uint64_t size; // of the whole file
+};
+
+static_assert(sizeof(Header) % 8 == 0, "Sections after the header must stay aligned");
+
+using Data = decltype(Value::data);
+
+size_t aligned(size_t offset)
+{
+    return (offset + 7) & ~size_t(7);
+}
+
+class Writer
+{
+public:
+    template<typename T>
+    void put(const T &value)
+    {
+        bytes(&value, sizeof value);
+    }
+    void bytes(const void *data, size_t size)
+    {
+        buffer.append(static_cast<const char *>(data), size);
+    }
+    void string(const std::string &text)
+    {
+        put(static_cast<uint32_t>(text.size()));
+        bytes(text.data(), text.size());
+    }
+    void align() { buffer.resize(aligned(buffer.size()), '\0'); }
+    size_t offset() const { return buffer.size(); }
+
+    std::string buffer;
+};
+
+// Bounds-checked reads from the file's bytes; any overrun marks the whole file bad
+class Reader
+{
+public:
+    Reader(const char *data, size_t size)
+        : data(data)
+        , size(size)
+    {}
+
+    bool seek(uint64_t offset)
+    {
+        ok = ok && offset <= size;
+        position = ok ? offset : size;
+        return ok;
+    }
+    // Whether count entries of at least smallest bytes each can still follow
+    bool holds(uint64_t count, size_t smallest)
+    {
+        ok = ok && count <= (size - position) / smallest;
+        return ok;
+    }
+    const char *take(size_t count)
+    {
+        if (!ok || count > size - position) {
+            ok = false;
+            return nullptr;
+        }
+        const char *at = data + position;
+        position += count;
+        return at;
+    }
+    template<typename T>
+    T get()
+    {
+        T value{};
+        if (const char *at = take(sizeof value)) {
+            std::memcpy(&value, at, sizeof value);
+        }
+        return value;
+    }
+    std::string string()
+    {
+        uint32_t length = get<uint32_t>();
+        const char *at = take(length);
+        return at ? std::string(at, length) : std::string();
+    }
+
+    bool ok = true;
+
+private:
+    const char *data;
+    size_t size;
+    size_t position = 0;
+};
+
+// Sets `data` to alternative `index` read from 8 payload bytes, for the scalar alternatives
+template<size_t I = 0>
+bool readScalar(size_t index, const char *payload, Data &data)
+{
+    if constexpr (I < std::variant_size_v<Data>) {
+        using T = std::variant_alternative_t<I, Data>;
+        if (index == I) {
+            if constexpr (std::is_arithmetic_v<T>) {
+                T value;
+                std::memcpy(&value, payload, sizeof value);
+                data.template emplace<I>(value);
+                return true;
+            } else if constexpr (std::is_same_v<T, std::monostate>) {
+                data.template emplace<I>();
+                return true;
+            } else {
+                return false;
+            }
+        }
+        return readScalar<I + 1>(index, payload, data);
+    }
+    return false;
+}
+
+bool writeConstant(Writer &out, const ValuePtr &value)
+{
+    if (!value) {
+        return false;
+    }
+    out.put(value->type ? static_cast<uint8_t>(value->type->tag) : NO_TYPE);
+    out.put(static_cast<uint8_t>(value->data.index()));
+    return std::visit(
+        [&](const auto &v) {
+            using T = std::decay_t<decltype(v)>;
+            if constexpr (std::is_arithmetic_v<T>) {
+                char payload[8] = {};
+                std::memcpy(payload, &v, sizeof v);
+                out.bytes(payload, sizeof payload);
+                return true;
+            } else if constexpr (std::is_same_v<T, std::string>) {
+                out.string(v);
+                return true;
+            } else {
+                return std::is_same_v<T, std::monostate>;
+            }
+        },
+        value->data);
+}
+
+ValuePtr readConstant(Reader &in)
+{
+    uint8_t tag = in.get<uint8_t>();
+    uint8_t index = in.get<uint8_t>();
+    auto value = std::make_shared<Value>();
+    if (tag != NO_TYPE && tag > static_cast<uint8_t>(TypeTag::UserDefined)) {
+        in.ok = false;
+        return value;
+    }
+    if (tag != NO_TYPE) {
+        value->type = std::make_shared<Type>(static_cast<TypeTag>(tag));
+    }
+    constexpr size_t STRING = std::variant_size_v<Data> - 5; // std::string, then the heap types
+    static_assert(std::is_same_v<std::variant_alternative_t<STRING, Data>, std::string>,
+                  "Value::data alternatives changed");
+    if (index == STRING) {
+        value->data = in.string();
+    } else if (index == 0) {
+        value->data = std::monostate();
+    } else {
+        const char *payload = in.take(8);
+        if (!payload || !readScalar(index, payload, value->data)) {
+            in.ok = false;
+        }
+    }
+    return value;
+}
+
+// The whole file, read in one go
+std::string readFile(const std::string &path)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        return std::string();
+    }
+    return std::string(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+}
+
+template<typename T>
+bool copySection(const std::string &file, uint64_t offset, size_t count, std::vector<T> &into)
+{
+    if (offset > file.size() || count > (file.size() - offset) / sizeof(T)) {
+        return false;
+    }
+    into.resize(count);
+    if (count > 0) {
+        std::memcpy(into.data(), file.data() + offset, count * sizeof(T));
+    }
+    return true;
+}
+
+bool inRange(int32_t index, size_t count)
+{
+    return index >= 0 && static_cast<size_t>(index) < count;
+}
+
+// Whether every record of a loaded program is one DecodedProgram::decode() could have
+// produced, with operands the backends can index with: the backends trust decoded code,
+// so a damaged or foreign file must not reach them. The function table is checked already.
+bool wellFormed(const DecodedProgram &program)
+{
+    const size_t codeCount = program.code.size();
+
+    // Frame size of the innermost function around each record, -1 at the top level
+    std::vector<int32_t> frameSize(codeCount, -1);
+    std::vector<int32_t> owner(codeCount, -1);
+    for (size_t id = 0; id < program.functions.size(); ++id) {
+        const FunctionInfo &function = program.functions[id];
+        if (function.localCount < 0) {
+            return false;
+        }
+        for (int32_t pc = function.entry; pc < function.end; ++pc) {
+            if (owner[pc] < 0 || program.functions[owner[pc]].entry < function.entry) {
+                owner[pc] = static_cast<int32_t>(id);
+                frameSize[pc] = function.localCount;
+            }
+        }
+    }
+
+    for (size_t pc = 0; pc < codeCount; ++pc) {
+        const DecodedInstruction &record = program.code[pc];
+        switch (record.opcode) {
+        case LOAD_CONST:
+        case LOAD_STR:
+        case BOOLEAN:
+        case PUSH_ARGS:
+            if (!inRange(record.a, program.constants.size())) {
+                return false;
+            }
+            break;
+        case DECLARE_VARIABLE:
+        case LOAD_VARIABLE:
+        case STORE_VARIABLE:
+            // Slots come from the parser's process-wide counter, so they need not start
+            // at 0; the backends grow their variable tables to the largest one.
+            if (record.a < 0) {
+                return false;
+            }
+            break;
+        case LOAD_LOCAL:
+        case STORE_LOCAL:
+            if (!inRange(record.a, frameSize[pc] < 0 ? 0 : frameSize[pc])) {
+                return false;
+            }
+            break;
+        case JUMP:
+        case JUMP_IF_FALSE:
+            if (!inRange(record.a, codeCount + 1)) {
+                return false;
+            }
+            break;
+        case DEFINE_FUNCTION:
+        case TAIL_CALL:
+            if (!inRange(record.a, program.functions.size())) {
+                return false;
+            }
+            break;
+        case INVOKE_FUNCTION:
+            if ((record.a != -1 && !inRange(record.a, program.functions.size()))
+                || !inRange(record.b, program.names.size())) {
+                return false;
+            }
+            break;
+        case PARALLEL:
+        case CONCURRENT:
+            return false; // never written
+        default:
+            // Quickened and fused opcodes are installed at run time and never written
+            if (record.opcode >= OPCODE_COUNT) {
+                return false;
+            }
+            break;
+        }
+    }
+    return true;
+}
+
+} // namespace
+
+uint64_t BytecodeFile::hashSource(const std::string &source)
+{
+    uint64_t hash = 14695981039346656037ull;
+    for (unsigned char c : source) {
+        hash ^= c;
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+std::string BytecodeFile::pathFor(const std::string &sourcePath)
+{
+    return std::filesystem::path(sourcePath).replace_extension(".lmc").string();
+}
+
+bool BytecodeFile::write(const std::string &path, const DecodedProgram &program,
+                         uint64_t sourceHash)
+{
+    for (const auto &record : program.code) {
+        if (record.opcode == PARALLEL || record.opcode == CONCURRENT) {
+            return false;
+        }
+    }
+
+    Header header{};
+    std::memcpy(header.magic, MAGIC, sizeof MAGIC);
+    header.version = VERSION;
+    header.opcodeCount = DECODED_OPCODE_COUNT;
+    header.recordSize = sizeof(DecodedInstruction);
+    header.sourceHash = sourceHash;
+    header.codeCount = static_cast<uint32_t>(program.code.size());
+    header.functionCount = static_cast<uint32_t>(program.functions.size());
+    header.constantCount = static_cast<uint32_t>(program.constants.size());
+    header.nameCount = static_cast<uint32_t>(program.names.size());
+
+    Writer out;
+    out.put(header);
+    out.bytes(program.code.data(), program.code.size() * sizeof(DecodedInstruction));
+    header.linesOffset = out.offset();
+    for (size_t pc = 0; pc < program.code.size(); ++pc) {
+        out.put(program.lineAt(pc));
+    }
+    out.align();
+    header.functionsOffset = out.offset();
+    out.bytes(program.functions.data(), program.functions.size() * sizeof(FunctionInfo));
+    header.constantsOffset = out.offset();
+    for (const auto &constant : program.constants) {
+        if (!writeConstant(out, constant)) {
+            return false;
+        }
+    }
+    out.align();
+    header.namesOffset = out.offset();
+    for (const auto &name : program.names) {
+        out.string(name);
+    }
+    header.size = out.offset();
+    std::memcpy(out.buffer.data(), &header, sizeof header);
+
+    std::string temporary = path + ".tmp";
+    {
+        std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+        if (!file || !file.write(out.buffer.data(), out.buffer.size())) {
+            file.close();
+            std::error_code ignored;
+            std::filesystem::remove(temporary, ignored);
+            return false;
+        }
+    }
+    std::error_code error;
+    std::filesystem::rename(temporary, path, error);
+    if (error) {
+        std::filesystem::remove(temporary, error);
+        return false;
+    }
+    return true;
+}
+
+std::optional<DecodedProgram> BytecodeFile::load(const std::string &path, uint64_t sourceHash)
+{
+    std::string file = readFile(path);
+    if (file.size() < sizeof(Header)) {
+        return std::nullopt;
+    }
+    Header header;
+    std::memcpy(&header, file.data(), sizeof header);
+    if (std::memcmp(header.magic, MAGIC, sizeof MAGIC) != 0 || header.version != VERSION
+        || header.opcodeCount != DECODED_OPCODE_COUNT
+        || header.recordSize != sizeof(DecodedInstruction) || header.sourceHash != sourceHash
+        || header.size != file.size()) {
+        return std::nullopt;
+    }
+
+    DecodedProgram program;
+    if (!copySection(file, sizeof(Header), header.codeCount, program.code)
+        || !copySection(file, header.linesOffset, header.codeCount, program.lines)
+        || !copySection(file, header.functionsOffset, header.functionCount, program.functions)) {
+        return std::nullopt;
+    }
+    for (const auto &function : program.functions) {
+        if (function.nameIndex < 0 || static_cast<uint32_t>(function.nameIndex) >= header.nameCount
+            || function.entry < 0 || function.end < function.entry
+            || static_cast<uint32_t>(function.end) > header.codeCount) {
+            return std::nullopt;
+        }
+    }
+
+    Reader in(file.data(), file.size());
+    // Counts are checked against what is left of the file before anything is reserved for them:
+    // a constant is at least its two tag bytes, a name at least its length
+    if (in.seek(header.constantsOffset) && in.holds(header.constantCount, 2)) {
+        program.constants.reserve(header.constantCount);
+    }
+    for (uint32_t i = 0; i < header.constantCount && in.ok; ++i) {
+        program.constants.push_back(readConstant(in));
+    }
+    if (in.seek(header.namesOffset) && in.holds(header.nameCount, sizeof(uint32_t))) {
+        program.names.reserve(header.nameCount);
+    }
+    for (uint32_t i = 0; i < header.nameCount && in.ok; ++i) {
+        program.names.push_back(in.string());
+    }
+    if (!in.ok || !wellFormed(program)) {
+        return std::nullopt;
+    }
+    return program;
+}
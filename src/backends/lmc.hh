@@ -0,0 +1,47 @@
+#ifndef LMC_HH
+#define LMC_HH
+
+#include "bytecode.hh"
+#include <cstdint>
+#include <optional>
+#include <string>
+
+// Compiled scripts (.lmc): a DecodedProgram on disk, so a run whose source did not change
+// starts without scanning or parsing it. The file is a fixed header followed by sections,
+// each 8-byte aligned, in native byte order:
+//
+//   code       codeCount DecodedInstruction records, as the backends execute them
+//   lines      codeCount uint32_t source lines (the line table)
+//   functions  functionCount FunctionInfo entries (the function table)
+//   constants  constantCount entries: uint8_t type tag (0xff: none), uint8_t variant index,
+//              then 8 payload bytes for scalars or a uint32_t length and the bytes of strings
+//   names      nameCount entries: uint32_t length and the bytes
+//
+// The file is read in one go and the fixed-width sections copied out of it. A file only
+// loads when its version, opcode count and record size match this build, it was compiled
+// from source with the same hash and every record is one the decoder could have produced;
+// anything else reads as a cache miss.
+struct BytecodeFile
+{
+    // Bump whenever what the decoder emits for a source changes meaning (operand layout,
+    // opcode numbering, a new rewrite), so files written by older builds miss.
+    // 2: wrapping integer arithmetic and INT64_MIN / -1
+    // 3: no files for scripts with syntax errors; drops those older builds wrote
+    static constexpr uint32_t VERSION = 3;
+
+    // FNV-1a over the source text
+    static uint64_t hashSource(const std::string &source);
+    // Where the compiled form of `sourcePath` lives: next to it, with the extension .lmc
+    static std::string pathFor(const std::string &sourcePath);
+
+    // Writes through a temporary file and a rename, so readers never see half a file.
+    // Returns false, leaving no file behind, for programs it cannot represent: constants
+    // other than scalars and strings, or PARALLEL/CONCURRENT, which re-run source
+    // instructions.
+    static bool write(const std::string &path, const DecodedProgram &program,
+                      uint64_t sourceHash);
+    // The program in `path` if it exists, is well formed and matches sourceHash
+    static std::optional<DecodedProgram> load(const std::string &path, uint64_t sourceHash);
+};
+
+#endif // LMC_HH
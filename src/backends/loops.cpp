@@ -0,0 +1,541 @@
+#include "bytecode.hh"
+#include "optimizer.hh"
+#include <algorithm>
+#include <map>
+#include <optional>
+#include <set>
+#include <tuple>
+#include <variant>
+
+namespace {
+
+// Operations that neither fail nor have an effect besides their result, whatever the
+// operands hold; the parser only emits them for operands of the matching type. Not the
+// conversions, which report an `any` holding a non-number, nor the divisions by zero.
+bool isPureUnary(Opcode opcode)
+{
+    switch (opcode) {
+    case NEG_I64:
+    case NEG_F64:
+        return true;
+    default:
+        return false;
+    }
+}
+
+bool isPureBinary(Opcode opcode)
+{
+    switch (opcode) {
+    case ADD_I64:
+    case SUB_I64:
+    case MUL_I64:
+    case ADD_F64:
+    case SUB_F64:
+    case MUL_F64:
+    case EQ_I64:
+    case NE_I64:
+    case LT_I64:
+    case LE_I64:
+    case GT_I64:
+    case GE_I64:
+    case EQ_F64:
+    case NE_F64:
+    case LT_F64:
+    case LE_F64:
+    case GT_F64:
+    case GE_F64:
+        return true;
+    default:
+        return false;
+    }
+}
+
+ValuePtr integerOperand(int64_t value)
+{
+    return std::make_shared<Value>(
+        Value{std::make_shared<Type>(TypeTag::Int), static_cast<int32_t>(value)});
+}
+
+// [header, end]: `end` is the jump back to `header`
+struct Loop
+{
+    size_t header;
+    size_t end;
+
+    bool contains(size_t pc) const { return pc >= header && pc <= end; }
+    size_t size() const { return end - header + 1; }
+};
+
+class LoopOptimizer
+{
+public:
+    LoopOptimizer(std::vector<Instruction> &program, ConstantPool &constants,
+                  OptimizerReport &report)
+        : program(program)
+        , constants(constants)
+        , report(report)
+    {}
+
+    void run();
+
+private:
+    std::vector<Instruction> &program;
+    ConstantPool &constants;
+    OptimizerReport &report;
+
+    std::vector<bool> leaders;      // jump targets and fall-throughs of jumps
+    std::vector<int64_t> owner;     // DEFINE_FUNCTION of the innermost enclosing body, or -1
+    std::set<int64_t> functionStores; // slots stored anywhere in a function body
+    int64_t nextSlot = 0;           // first variable slot the program does not use
+
+    int64_t operand(size_t pc) const { return DecodedProgram::integerOperand(program[pc].value); }
+    size_t jumpTarget(size_t pc) const
+    {
+        return program[pc].opcode == JUMP ? pc + 1 + operand(pc) : operand(pc);
+    }
+    bool isJump(size_t pc) const
+    {
+        return program[pc].opcode == JUMP || program[pc].opcode == JUMP_IF_FALSE;
+    }
+    std::optional<int64_t> integerValue(int64_t slot) const;
+    std::optional<int64_t> integerConstant(size_t pc) const
+    {
+        return program[pc].opcode == LOAD_CONST ? integerValue(operand(pc)) : std::nullopt;
+    }
+    Instruction variableInstruction(Opcode opcode, int64_t slot, uint32_t line) const
+    {
+        ValuePtr value = integerOperand(slot);
+        return Instruction(opcode, line, value);
+    }
+
+    void analyze();
+    std::vector<Loop> findLoops() const;
+    bool calls(const Loop &loop) const;
+    std::set<int64_t> storedIn(const Loop &loop) const;
+    bool hoist(const Loop &loop);
+    bool reduce(const Loop &loop, const std::vector<Loop> &loops);
+    void rewrite(const Loop &loop, const std::vector<Instruction> &preheader,
+                 const std::map<size_t, std::vector<Instruction>> &edits);
+};
+
+// The constant in pool slot `slot`, if it is an integer
+std::optional<int64_t> LoopOptimizer::integerValue(int64_t slot) const
+{
+    return std::visit(
+        [](const auto &v) -> std::optional<int64_t> {
+            using T = std::decay_t<decltype(v)>;
+            if constexpr (std::is_integral_v<T> && !std::is_same_v<T, bool>) {
+                return static_cast<int64_t>(v);
+            } else {
+                return std::nullopt;
+            }
+        },
+        constants.at(slot)->data);
+}
+
+void LoopOptimizer::analyze()
+{
+    size_t n = program.size();
+    leaders.assign(n + 1, false);
+    owner.assign(n, -1);
+    functionStores.clear();
+    nextSlot = 0;
+    for (size_t pc = 0; pc < n; ++pc) {
+        Opcode opcode = program[pc].opcode;
+        if (isJump(pc)) {
+            leaders[std::min(jumpTarget(pc), n)] = true;
+            leaders[pc + 1] = true;
+        }
+        if (opcode == DECLARE_VARIABLE || opcode == LOAD_VARIABLE || opcode == STORE_VARIABLE) {
+            nextSlot = std::max(nextSlot, operand(pc) + 1);
+        }
+        // Bodies come in program order, so a nested body overwrites its enclosing one
+        if (opcode == DEFINE_FUNCTION && pc + 1 < n && program[pc + 1].opcode == JUMP) {
+            size_t end = std::min(jumpTarget(pc + 1), n);
+            for (size_t body = pc + 2; body < end; ++body) {
+                owner[body] = static_cast<int64_t>(pc);
+            }
+        }
+    }
+    for (size_t pc = 0; pc < n; ++pc) {
+        if (owner[pc] >= 0 && program[pc].opcode == STORE_VARIABLE) {
+            functionStores.insert(operand(pc));
+        }
+    }
+}
+
+// Loops entered only through their header, within one function body, innermost first
+std::vector<Loop> LoopOptimizer::findLoops() const
+{
+    std::map<size_t, size_t> ends; // header -> last jump back to it
+    for (size_t pc = 0; pc < program.size(); ++pc) {
+        if (program[pc].opcode == JUMP && jumpTarget(pc) <= pc) {
+            size_t &end = ends[jumpTarget(pc)];
+            end = std::max(end, pc);
+        }
+    }
+
+    std::vector<Loop> loops;
+    for (const auto &[header, end] : ends) {
+        Loop loop{header, end};
+        bool valid = true;
+        for (size_t pc = 0; valid && pc < program.size(); ++pc) {
+            if (loop.contains(pc)) {
+                valid = owner[pc] == owner[header] && program[pc].opcode != DEFINE_FUNCTION;
+            } else if (isJump(pc)) {
+                size_t target = jumpTarget(pc);
+                valid = !loop.contains(target) || target == header;
+            }
+        }
+        if (valid) {
+            loops.push_back(loop);
+        }
+    }
+    // Loops that overlap without nesting are not loops the parsers produce; leave them alone
+    std::vector<Loop> nested;
+    for (const Loop &loop : loops) {
+        bool overlaps = false;
+        for (const Loop &other : loops) {
+            bool disjoint = other.end < loop.header || loop.end < other.header;
+            bool inside = (loop.contains(other.header) && loop.contains(other.end))
+                          || (other.contains(loop.header) && other.contains(loop.end));
+            overlaps = overlaps || (!disjoint && !inside);
+        }
+        if (!overlaps) {
+            nested.push_back(loop);
+        }
+    }
+    std::stable_sort(nested.begin(), nested.end(),
+                     [](const Loop &a, const Loop &b) { return a.size() < b.size(); });
+    return nested;
+}
+
+bool LoopOptimizer::calls(const Loop &loop) const
+{
+    for (size_t pc = loop.header; pc <= loop.end; ++pc) {
+        if (program[pc].opcode == INVOKE_FUNCTION) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Slots the loop may change: what it declares or stores, and what any function stores if
+// it calls one
+std::set<int64_t> LoopOptimizer::storedIn(const Loop &loop) const
+{
+    std::set<int64_t> stored;
+    for (size_t pc = loop.header; pc <= loop.end; ++pc) {
+        Opcode opcode = program[pc].opcode;
+        if (opcode == STORE_VARIABLE || opcode == DECLARE_VARIABLE) {
+            stored.insert(operand(pc));
+        }
+    }
+    if (calls(loop)) {
+        stored.insert(functionStores.begin(), functionStores.end());
+    }
+    return stored;
+}
+
+// Finds the largest invariant subexpressions with a stack of what each operand on the
+// operand stack was computed from, within each straight-line run of the loop
+bool LoopOptimizer::hoist(const Loop &loop)
+{
+    struct Operand
+    {
+        size_t start; // its code is [start, end]
+        size_t end;
+        bool invariant;
+        bool computed; // an operation, not just a load
+    };
+    std::set<int64_t> stored = storedIn(loop);
+    std::vector<Operand> operands;
+    std::vector<std::pair<size_t, size_t>> ranges;
+
+    auto candidate = [&](const Operand &operand) {
+        if (operand.invariant && operand.computed) {
+            ranges.emplace_back(operand.start, operand.end);
+        }
+    };
+    auto flush = [&]() {
+        for (const Operand &operand : operands) {
+            candidate(operand);
+        }
+        operands.clear();
+    };
+
+    for (size_t pc = loop.header; pc <= loop.end; ++pc) {
+        if (leaders[pc]) {
+            flush();
+        }
+        Opcode opcode = program[pc].opcode;
+        if (opcode == LOAD_CONST || opcode == LOAD_STR || opcode == BOOLEAN) {
+            operands.push_back({pc, pc, true, false});
+        } else if (opcode == LOAD_VARIABLE) {
+            operands.push_back({pc, pc, stored.count(operand(pc)) == 0, false});
+        } else if (isPureUnary(opcode) && !operands.empty()) {
+            operands.back().end = pc;
+            operands.back().computed = true;
+        } else if (isPureBinary(opcode) && operands.size() >= 2) {
+            Operand rhs = operands.back();
+            operands.pop_back();
+            Operand &lhs = operands.back();
+            if (!lhs.invariant || !rhs.invariant) {
+                candidate(lhs);
+                candidate(rhs);
+            }
+            lhs = {lhs.start, pc, lhs.invariant && rhs.invariant, true};
+        } else {
+            flush();
+        }
+    }
+    flush();
+    if (ranges.empty()) {
+        return false;
+    }
+
+    std::vector<Instruction> preheader;
+    std::map<size_t, std::vector<Instruction>> edits;
+    for (const auto &[start, end] : ranges) {
+        int64_t slot = nextSlot++;
+        uint32_t line = program[start].lineNumber;
+        preheader.insert(preheader.end(), program.begin() + start, program.begin() + end + 1);
+        preheader.push_back(variableInstruction(DECLARE_VARIABLE, slot, line));
+        preheader.push_back(variableInstruction(STORE_VARIABLE, slot, line));
+        edits[start] = {variableInstruction(LOAD_VARIABLE, slot, line)};
+        for (size_t pc = start + 1; pc <= end; ++pc) {
+            edits[pc] = {};
+        }
+    }
+    report.hoisted += ranges.size();
+    rewrite(loop, preheader, edits);
+    return true;
+}
+
+// Strength reduction of `i * k` for basic induction variables i: stored once in the loop,
+// outside any loop nested in it, by `i = i + c` or `i = i - c`
+bool LoopOptimizer::reduce(const Loop &loop, const std::vector<Loop> &loops)
+{
+    std::set<int64_t> stored = storedIn(loop);
+    std::map<int64_t, size_t> stores; // slot -> its only store in the loop
+    std::set<int64_t> declared;
+    std::set<int64_t> storedTwice;
+    for (size_t pc = loop.header; pc <= loop.end; ++pc) {
+        if (program[pc].opcode == DECLARE_VARIABLE) {
+            declared.insert(operand(pc));
+        } else if (program[pc].opcode == STORE_VARIABLE
+                   && !stores.emplace(operand(pc), pc).second) {
+            storedTwice.insert(operand(pc));
+        }
+    }
+    auto nestedDeeper = [&](size_t pc) {
+        for (const Loop &inner : loops) {
+            if (inner.size() < loop.size() && loop.contains(inner.header) && inner.contains(pc)) {
+                return true;
+            }
+        }
+        return false;
+    };
+    auto straight = [&](size_t from, size_t to) { // no leader in (from, to]
+        for (size_t pc = from + 1; pc <= to; ++pc) {
+            if (leaders[pc]) {
+                return false;
+            }
+        }
+        return true;
+    };
+
+    struct Induction
+    {
+        size_t store;
+        Opcode step;       // ADD_I64 or SUB_I64
+        int64_t increment; // c
+    };
+    std::map<int64_t, Induction> inductions;
+    bool callsOut = calls(loop);
+    for (const auto &[slot, store] : stores) {
+        if (storedTwice.count(slot) || declared.count(slot)
+            || (callsOut && functionStores.count(slot))
+            || store < loop.header + 3 || nestedDeeper(store) || !straight(store - 3, store)) {
+            continue;
+        }
+        Opcode step = program[store - 1].opcode;
+        std::optional<int64_t> increment = integerConstant(store - 2);
+        if (program[store - 3].opcode == LOAD_VARIABLE && operand(store - 3) == slot
+            && increment && (step == ADD_I64 || step == SUB_I64)) {
+            inductions[slot] = {store, step, *increment};
+        }
+    }
+    if (inductions.empty()) {
+        return false;
+    }
+
+    // Uses: LOAD i, <k>, MUL_I64 or <k>, LOAD i, MUL_I64, where <k> loads a constant integer
+    // or an invariant variable
+    struct Factor
+    {
+        Opcode opcode; // LOAD_CONST or LOAD_VARIABLE
+        int64_t operand;
+        bool operator<(const Factor &other) const
+        {
+            return std::tie(opcode, operand) < std::tie(other.opcode, other.operand);
+        }
+    };
+    auto factorAt = [&](size_t pc) -> std::optional<Factor> {
+        if (integerConstant(pc)) {
+            return Factor{LOAD_CONST, operand(pc)};
+        }
+        if (program[pc].opcode == LOAD_VARIABLE && !stored.count(operand(pc))) {
+            return Factor{LOAD_VARIABLE, operand(pc)};
+        }
+        return std::nullopt;
+    };
+    std::map<std::pair<int64_t, Factor>, std::vector<size_t>> uses; // (i, k) -> first pcs
+    for (size_t pc = loop.header; pc + 2 <= loop.end; ++pc) {
+        if (program[pc + 2].opcode != MUL_I64 || !straight(pc, pc + 2)) {
+            continue;
+        }
+        bool first = program[pc].opcode == LOAD_VARIABLE && inductions.count(operand(pc));
+        size_t variable = first ? pc : pc + 1;
+        if (program[variable].opcode != LOAD_VARIABLE || !inductions.count(operand(variable))) {
+            continue;
+        }
+        if (std::optional<Factor> factor = factorAt(first ? pc + 1 : pc)) {
+            uses[{operand(variable), *factor}].push_back(pc);
+            pc += 2;
+        }
+    }
+    if (uses.empty()) {
+        return false;
+    }
+
+    std::vector<Instruction> preheader;
+    std::map<size_t, std::vector<Instruction>> edits;
+    for (const auto &[key, pcs] : uses) {
+        const auto &[slot, factor] = key;
+        const Induction &induction = inductions.at(slot);
+        uint32_t line = program[pcs.front()].lineNumber;
+        ValuePtr factorOperand = integerOperand(factor.operand);
+        Instruction loadFactor(factor.opcode, line, factorOperand);
+
+        // product = i * k before the loop
+        int64_t product = nextSlot++;
+        preheader.push_back(variableInstruction(LOAD_VARIABLE, slot, line));
+        preheader.push_back(loadFactor);
+        preheader.push_back(Instruction(MUL_I64, line));
+        preheader.push_back(variableInstruction(DECLARE_VARIABLE, product, line));
+        preheader.push_back(variableInstruction(STORE_VARIABLE, product, line));
+
+        // and c * k, a constant when k is one
+        Instruction loadStep = loadFactor;
+        if (factor.opcode == LOAD_CONST) {
+            // Wraps like the run-time multiplication would
+            uint64_t step = static_cast<uint64_t>(induction.increment)
+                            * static_cast<uint64_t>(*integerValue(factor.operand));
+            ValuePtr stepOperand = integerOperand(constants.add(
+                Value{std::make_shared<Type>(TypeTag::Int), static_cast<int64_t>(step)}));
+            loadStep = Instruction(LOAD_CONST, line, stepOperand);
+        } else {
+            int64_t stepSlot = nextSlot++;
+            ValuePtr increment = integerOperand(constants.add(
+                Value{std::make_shared<Type>(TypeTag::Int), induction.increment}));
+            preheader.push_back(Instruction(LOAD_CONST, line, increment));
+            preheader.push_back(loadFactor);
+            preheader.push_back(Instruction(MUL_I64, line));
+            preheader.push_back(variableInstruction(DECLARE_VARIABLE, stepSlot, line));
+            preheader.push_back(variableInstruction(STORE_VARIABLE, stepSlot, line));
+            loadStep = variableInstruction(LOAD_VARIABLE, stepSlot, line);
+        }
+
+        // product += c * k wherever i += c
+        auto &update = edits[induction.store];
+        if (update.empty()) {
+            update.push_back(program[induction.store]);
+        }
+        uint32_t storeLine = program[induction.store].lineNumber;
+        update.push_back(variableInstruction(LOAD_VARIABLE, product, storeLine));
+        update.push_back(loadStep);
+        update.push_back(Instruction(induction.step, storeLine));
+        update.push_back(variableInstruction(STORE_VARIABLE, product, storeLine));
+
+        for (size_t pc : pcs) {
+            edits[pc] = {variableInstruction(LOAD_VARIABLE, product, program[pc].lineNumber)};
+            edits[pc + 1] = {};
+            edits[pc + 2] = {};
+        }
+        report.reduced += pcs.size();
+    }
+    rewrite(loop, preheader, edits);
+    return true;
+}
+
+// Puts `preheader` in front of the loop and replaces each instruction in `edits` by its
+// list. Jumps from outside the loop to its header now run the preheader first, the jumps
+// back from inside skip it; edited instructions are never jumps.
+void LoopOptimizer::rewrite(const Loop &loop, const std::vector<Instruction> &preheader,
+                            const std::map<size_t, std::vector<Instruction>> &edits)
+{
+    size_t n = program.size();
+    std::vector<size_t> newIndex(n + 1);
+    std::vector<Instruction> rewritten;
+    std::vector<size_t> origin; // pc in `program` of each unchanged instruction, n otherwise
+    rewritten.reserve(n + preheader.size());
+    for (size_t pc = 0; pc < n; ++pc) {
+        newIndex[pc] = rewritten.size();
+        if (pc == loop.header) {
+            rewritten.insert(rewritten.end(), preheader.begin(), preheader.end());
+            origin.resize(rewritten.size(), n);
+        }
+        auto edit = edits.find(pc);
+        if (edit == edits.end()) {
+            rewritten.push_back(program[pc]);
+            origin.push_back(pc);
+        } else {
+            rewritten.insert(rewritten.end(), edit->second.begin(), edit->second.end());
+            origin.resize(rewritten.size(), n);
+        }
+    }
+    newIndex[n] = rewritten.size();
+
+    size_t header = newIndex[loop.header] + preheader.size();
+    for (size_t index = 0; index < rewritten.size(); ++index) {
+        size_t pc = origin[index];
+        if (pc == n || !isJump(pc)) {
+            continue;
+        }
+        size_t target = jumpTarget(pc);
+        size_t to = target == loop.header && loop.contains(pc) ? header : newIndex[target];
+        rewritten[index].value = integerOperand(program[pc].opcode == JUMP
+                                                    ? int64_t(to) - int64_t(index) - 1
+                                                    : int64_t(to));
+    }
+    program = std::move(rewritten);
+}
+
+void LoopOptimizer::run()
+{
+    // Each change moves code out of a loop or turns a multiplication into an addition, so
+    // this ends; the bound keeps a pathological program from taking long
+    for (int round = 0; round < 64; ++round) {
+        analyze();
+        std::vector<Loop> loops = findLoops();
+        bool changed = false;
+        for (const Loop &loop : loops) {
+            if (hoist(loop) || reduce(loop, loops)) {
+                changed = true;
+                break;
+            }
+        }
+        if (!changed) {
+            break;
+        }
+    }
+}
+
+} // namespace
+
+void optimizeLoops(std::vector<Instruction> &program, ConstantPool &constants,
+                   OptimizerReport &report)
+{
+    LoopOptimizer(program, constants, report).run();
+}
@@ -0,0 +1,253 @@
+#include "operations.hh"
+#include <cmath>
+
+TaggedValue ValueOperations::unary(uint16_t opcode, const TaggedValue &value)
+{
+    switch (opcode) {
+    case NEGATE:
+    case NEG_I64:
+    case NEG_F64:
+        if (value.isInt()) {
+            return TaggedValue::integer(IntArithmetic::negate(value.as.i));
+        }
+        if (value.isFloat()) {
+            return TaggedValue::number(-value.as.f);
+        }
+        std::cerr << "Error: Unsupported type for NEGATE operation" << std::endl;
+        return TaggedValue();
+    case NOT:
+        if (value.isBool()) {
+            return TaggedValue::boolean(!value.as.b);
+        }
+        std::cerr << "Error: Unsupported type for NOT operation" << std::endl;
+        return TaggedValue();
+    case TO_INT64:
+        if (value.isFloat()) {
+            return TaggedValue::integer(static_cast<int64_t>(value.as.f));
+        }
+        if (value.isInt() || value.isNil()) {
+            return value;
+        }
+        std::cerr << "Error: Cannot convert a non-number to int" << std::endl;
+        return TaggedValue();
+    case TO_FLOAT64:
+        if (value.isInt()) {
+            return TaggedValue::number(static_cast<double>(value.as.i));
+        }
+        if (value.isFloat() || value.isNil()) {
+            return value;
+        }
+        std::cerr << "Error: Cannot convert a non-number to float" << std::endl;
+        return TaggedValue();
+    default:
+        std::cerr << "Error: Invalid unary operation opcode" << std::endl;
+        return TaggedValue();
+    }
+}
+
+TaggedValue ValueOperations::binary(uint16_t opcode, const TaggedValue &lhs,
+                                    const TaggedValue &rhs)
+{
+    switch (opcode) {
+    case EQUAL:
+    case NOT_EQUAL:
+    case LESS_THAN:
+    case LESS_THAN_OR_EQUAL:
+    case GREATER_THAN:
+    case GREATER_THAN_OR_EQUAL:
+    case EQ_I64:
+    case NE_I64:
+    case LT_I64:
+    case LE_I64:
+    case GT_I64:
+    case GE_I64:
+    case EQ_F64:
+    case NE_F64:
+    case LT_F64:
+    case LE_F64:
+    case GT_F64:
+    case GE_F64:
+    case EQ_STR:
+    case NE_STR:
+        return TaggedValue::boolean(compare(opcode, lhs, rhs));
+    case AND:
+    case OR:
+        if (!lhs.isBool() || !rhs.isBool()) {
+            std::cerr << "Error: Unsupported types for logical operation" << std::endl;
+            return TaggedValue();
+        }
+        return TaggedValue::boolean(opcode == AND ? lhs.as.b && rhs.as.b : lhs.as.b || rhs.as.b);
+    case INTERPOLATE_STRING:
+        return interpolate(lhs, rhs);
+    case CONCATENATE_STR:
+        if (lhs.isString() && rhs.isString()) {
+            return TaggedValue::object(region,
+                                       Value{typeSystem.STRING_TYPE, lhs.string() + rhs.string()});
+        }
+        return binary(ADD, lhs, rhs); // a `str` can still hold anything via `any`
+    case DIV_I64:
+    case MOD_I64:
+        if (rhs.as.i == 0) {
+            std::cerr << "Error: " << (opcode == DIV_I64 ? "Division" : "Modulo") << " by zero"
+                      << std::endl;
+            return TaggedValue();
+        }
+        return TaggedValue::integer(opcode == DIV_I64
+                                        ? IntArithmetic::divide(lhs.as.i, rhs.as.i)
+                                        : IntArithmetic::remainder(lhs.as.i, rhs.as.i));
+    case DIV_F64:
+        if (rhs.as.f == 0.0) {
+            std::cerr << "Error: Division by zero" << std::endl;
+            return TaggedValue();
+        }
+        return TaggedValue::number(lhs.as.f / rhs.as.f);
+    case MOD_F64:
+        return TaggedValue::number(std::fmod(lhs.as.f, rhs.as.f));
+    default:
+        break;
+    }
+
+    // Generic arithmetic
+    if (lhs.isInt() && rhs.isInt()) {
+        int64_t v1 = lhs.as.i;
+        int64_t v2 = rhs.as.i;
+        switch (opcode) {
+        case ADD:
+            return TaggedValue::integer(IntArithmetic::add(v1, v2));
+        case SUBTRACT:
+            return TaggedValue::integer(IntArithmetic::subtract(v1, v2));
+        case MULTIPLY:
+            return TaggedValue::integer(IntArithmetic::multiply(v1, v2));
+        case DIVIDE:
+            if (v2 == 0) {
+                std::cerr << "Error: Division by zero" << std::endl;
+                return TaggedValue();
+            }
+            return TaggedValue::integer(IntArithmetic::divide(v1, v2));
+        case MODULUS:
+            if (v2 == 0) {
+                std::cerr << "Error: Modulo by zero" << std::endl;
+                return TaggedValue();
+            }
+            return TaggedValue::integer(IntArithmetic::remainder(v1, v2));
+        default:
+            break;
+        }
+    } else if (lhs.isNumber() && rhs.isNumber()) {
+        double v1 = lhs.asDouble();
+        double v2 = rhs.asDouble();
+        switch (opcode) {
+        case ADD:
+            return TaggedValue::number(v1 + v2);
+        case SUBTRACT:
+            return TaggedValue::number(v1 - v2);
+        case MULTIPLY:
+            return TaggedValue::number(v1 * v2);
+        case DIVIDE:
+            if (v2 == 0.0) {
+                std::cerr << "Error: Division by zero" << std::endl;
+                return TaggedValue();
+            }
+            return TaggedValue::number(v1 / v2);
+        case MODULUS:
+            return TaggedValue::number(std::fmod(v1, v2));
+        default:
+            break;
+        }
+    } else if (opcode == ADD && lhs.isString() && rhs.isString()) {
+        return TaggedValue::object(region,
+                                   Value{typeSystem.STRING_TYPE, lhs.string() + rhs.string()});
+    } else {
+        std::cerr << "Error: Unsupported types for binary operation" << std::endl;
+        return TaggedValue();
+    }
+    std::cerr << "Error: Invalid binary operation opcode" << std::endl;
+    return TaggedValue();
+}
+
+bool ValueOperations::compare(uint16_t opcode, const TaggedValue &lhs, const TaggedValue &rhs)
+{
+    // Typed comparisons map onto the generic ones; their operands are already the right kind
+    switch (opcode) {
+    case EQ_I64:
+    case EQ_F64:
+    case EQ_STR:
+        opcode = EQUAL;
+        break;
+    case NE_I64:
+    case NE_F64:
+    case NE_STR:
+        opcode = NOT_EQUAL;
+        break;
+    case LT_I64:
+    case LT_F64:
+        opcode = LESS_THAN;
+        break;
+    case LE_I64:
+    case LE_F64:
+        opcode = LESS_THAN_OR_EQUAL;
+        break;
+    case GT_I64:
+    case GT_F64:
+        opcode = GREATER_THAN;
+        break;
+    case GE_I64:
+    case GE_F64:
+        opcode = GREATER_THAN_OR_EQUAL;
+        break;
+    default:
+        break;
+    }
+
+    auto compareValues = [opcode](const auto &v1, const auto &v2) {
+        switch (opcode) {
+        case EQUAL:
+            return v1 == v2;
+        case NOT_EQUAL:
+            return v1 != v2;
+        case LESS_THAN:
+            return v1 < v2;
+        case LESS_THAN_OR_EQUAL:
+            return v1 <= v2;
+        case GREATER_THAN:
+            return v1 > v2;
+        case GREATER_THAN_OR_EQUAL:
+            return v1 >= v2;
+        default:
+            std::cerr << "Error: Invalid comparison operation opcode" << std::endl;
+            return false;
+        }
+    };
+
+    if (lhs.isInt() && rhs.isInt()) {
+        return compareValues(lhs.as.i, rhs.as.i);
+    }
+    if (lhs.isNumber() && rhs.isNumber()) {
+        return compareValues(lhs.asDouble(), rhs.asDouble());
+    }
+    if (lhs.isString() && rhs.isString()) {
+        return compareValues(lhs.string(), rhs.string());
+    }
+    if (lhs.isBool() && rhs.isBool() && (opcode == EQUAL || opcode == NOT_EQUAL)) {
+        return compareValues(lhs.as.b, rhs.as.b);
+    }
+    std::cerr << "Error: Unsupported type for comparison operation" << std::endl;
+    return false;
+}
+
+TaggedValue ValueOperations::interpolate(const TaggedValue &templateValue, const TaggedValue &value)
+{
+    if (!templateValue.isString()) {
+        std::cerr << "Error: Template is not a string" << std::endl;
+        return TaggedValue();
+    }
+    const std::string &templateString = templateValue.string();
+    size_t pos = templateString.find("{}");
+    if (pos == std::string::npos) {
+        std::cerr << "Error: No {} found in template string" << std::endl;
+        return TaggedValue();
+    }
+    std::string result = templateString.substr(0, pos) + value.toString()
+                         + templateString.substr(pos + 2);
+    return TaggedValue::object(region, Value{typeSystem.STRING_TYPE, std::move(result)});
+}
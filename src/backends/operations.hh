@@ -0,0 +1,35 @@
+#ifndef OPERATIONS_HH
+#define OPERATIONS_HH
+
+#include "../memory.hh"
+#include "../types.hh"
+#include "bytecode.hh"
+#include "tagged.hh"
+#include <cstdint>
+#include <iostream>
+
+// Semantics of the operations on TaggedValues for the backends that name their operands
+// instead of popping them (the register VM and the JIT). Errors are reported like the
+// StackBackend reports them and produce nil. Integer arithmetic is IntArithmetic's, so it
+// wraps and INT64_MIN / -1 does not trap. New strings are boxed in `region`.
+class ValueOperations
+{
+public:
+    explicit ValueOperations(ValueMemory::Region &region)
+        : region(region)
+    {}
+
+    // NEGATE, NOT, NEG_I64, NEG_F64, TO_INT64, TO_FLOAT64
+    TaggedValue unary(uint16_t opcode, const TaggedValue &value);
+    // Arithmetic, logical, comparison, string and INTERPOLATE_STRING opcodes
+    TaggedValue binary(uint16_t opcode, const TaggedValue &lhs, const TaggedValue &rhs);
+    // Generic or typed comparison opcodes
+    bool compare(uint16_t opcode, const TaggedValue &lhs, const TaggedValue &rhs);
+    TaggedValue interpolate(const TaggedValue &templateValue, const TaggedValue &value);
+
+private:
+    ValueMemory::Region &region;
+    TypeSystem typeSystem;
+};
+
+#endif // OPERATIONS_HH
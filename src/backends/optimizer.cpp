@@ -0,0 +1,533 @@
+#include "optimizer.hh"
+#include "bytecode.hh"
+#include "operations.hh"
+#include <map>
+#include <set>
+
+void OptimizerReport::print(std::ostream &out) const
+{
+    out << "Optimized " << before << " -> " << after << " instructions: " << inlined.size()
+        << " calls inlined, " << folded << " folded, " << propagated << " loads propagated, "
+        << branches << " branches resolved, " << hoisted << " hoisted out of loops, " << reduced
+        << " multiplications strength-reduced, " << commonSubexpressions
+        << " common subexpressions eliminated, " << copies << " copies propagated" << std::endl;
+    for (const auto &site : inlined) {
+        out << "  inlined " << site << std::endl;
+    }
+    if (!outOfSSA.empty()) {
+        out << "  kept out of SSA form: " << outOfSSA << std::endl;
+    }
+}
+
+namespace {
+
+bool isConstantLoad(Opcode opcode)
+{
+    return opcode == LOAD_CONST || opcode == LOAD_STR || opcode == BOOLEAN;
+}
+
+bool isUnary(Opcode opcode)
+{
+    switch (opcode) {
+    case NEGATE:
+    case NEG_I64:
+    case NEG_F64:
+    case NOT:
+    case TO_INT64:
+    case TO_FLOAT64:
+        return true;
+    default:
+        return false;
+    }
+}
+
+bool isBinary(Opcode opcode)
+{
+    switch (opcode) {
+    case ADD:
+    case SUBTRACT:
+    case MULTIPLY:
+    case DIVIDE:
+    case MODULUS:
+    case EQUAL:
+    case NOT_EQUAL:
+    case LESS_THAN:
+    case LESS_THAN_OR_EQUAL:
+    case GREATER_THAN:
+    case GREATER_THAN_OR_EQUAL:
+    case AND:
+    case OR:
+    case CONCATENATE_STR:
+    case ADD_I64:
+    case SUB_I64:
+    case MUL_I64:
+    case DIV_I64:
+    case MOD_I64:
+    case ADD_F64:
+    case SUB_F64:
+    case MUL_F64:
+    case DIV_F64:
+    case MOD_F64:
+    case EQ_I64:
+    case NE_I64:
+    case LT_I64:
+    case LE_I64:
+    case GT_I64:
+    case GE_I64:
+    case EQ_F64:
+    case NE_F64:
+    case LT_F64:
+    case LE_F64:
+    case GT_F64:
+    case GE_F64:
+    case EQ_STR:
+    case NE_STR:
+        return true;
+    default:
+        return false;
+    }
+}
+
+// Whether the operation succeeds on these operands in every backend. Typed opcodes only
+// fold on the operand kinds the parser emits them for; the backends do not check those.
+bool foldable(Opcode opcode, const TaggedValue &a, const TaggedValue &b)
+{
+    bool ints = a.isInt() && b.isInt();
+    bool floats = a.isFloat() && b.isFloat();
+    bool numbers = a.isNumber() && b.isNumber();
+    bool strings = a.isString() && b.isString();
+    switch (opcode) {
+    case NEGATE:
+    case TO_INT64:
+    case TO_FLOAT64:
+        return a.isNumber();
+    case NEG_I64:
+        return a.isInt();
+    case NEG_F64:
+        return a.isFloat();
+    case NOT:
+        return a.isBool();
+    case ADD:
+        return numbers || strings;
+    case SUBTRACT:
+    case MULTIPLY:
+        return numbers;
+    case DIVIDE:
+        return numbers && b.asDouble() != 0.0; // x / 0 is reported when it runs
+    case MODULUS:
+        return numbers && (!ints || b.as.i != 0);
+    case EQUAL:
+    case NOT_EQUAL:
+        return numbers || strings || (a.isBool() && b.isBool());
+    case LESS_THAN:
+    case LESS_THAN_OR_EQUAL:
+    case GREATER_THAN:
+    case GREATER_THAN_OR_EQUAL:
+        return numbers || strings;
+    case AND:
+    case OR:
+        return a.isBool() && b.isBool();
+    case CONCATENATE_STR:
+    case EQ_STR:
+    case NE_STR:
+        return strings;
+    case DIV_I64:
+    case MOD_I64:
+        // A -1 divisor folds to IntArithmetic's wrapped result, as every backend computes it
+        return ints && b.as.i != 0;
+    case ADD_I64:
+    case SUB_I64:
+    case MUL_I64:
+    case EQ_I64:
+    case NE_I64:
+    case LT_I64:
+    case LE_I64:
+    case GT_I64:
+    case GE_I64:
+        return ints;
+    case DIV_F64:
+        return floats && b.as.f != 0.0;
+    default:
+        return floats; // the F64 forms
+    }
+}
+
+// ValueOperations::binary() takes the typed arithmetic opcodes by their generic form
+Opcode genericArithmetic(Opcode opcode)
+{
+    switch (opcode) {
+    case ADD_I64:
+    case ADD_F64:
+        return ADD;
+    case SUB_I64:
+    case SUB_F64:
+        return SUBTRACT;
+    case MUL_I64:
+    case MUL_F64:
+        return MULTIPLY;
+    case DIV_F64:
+        return DIVIDE;
+    default:
+        return opcode;
+    }
+}
+
+ValuePtr integerOperand(int64_t value)
+{
+    return std::make_shared<Value>(
+        Value{std::make_shared<Type>(TypeTag::Int), static_cast<int32_t>(value)});
+}
+
+class Optimizer
+{
+public:
+    Optimizer(std::vector<Instruction> &program, ConstantPool &constants,
+              OptimizerReport &report)
+        : program(program)
+        , constants(constants)
+        , report(report)
+        , region(memoryManager, ValueMemory::RegionMode::Arena)
+        , operations(region)
+    {}
+
+    void run();
+
+private:
+    std::vector<Instruction> &program;
+    ConstantPool &constants;
+    OptimizerReport &report;
+    // Boxes the strings folding computes; they die with the optimizer, so all at once
+    ValueMemory memoryManager;
+    ValueMemory::Region region;
+    ValueOperations operations;
+
+    std::vector<bool> leaders;    // jump targets, function entries and fall-throughs of jumps
+    std::vector<bool> inFunction; // inside some function body
+
+    size_t jumpTarget(size_t pc) const
+    {
+        int64_t operand = DecodedProgram::integerOperand(program[pc].value);
+        return program[pc].opcode == JUMP ? pc + 1 + operand : operand;
+    }
+    bool isJump(size_t pc) const
+    {
+        return program[pc].opcode == JUMP || program[pc].opcode == JUMP_IF_FALSE;
+    }
+
+    TaggedValue constantAt(size_t pc)
+    {
+        int64_t slot = DecodedProgram::integerOperand(program[pc].value);
+        return TaggedValue::fromValue(*constants.at(slot), region);
+    }
+    void setConstant(size_t pc, const TaggedValue &value);
+    void setNop(size_t pc) { program[pc] = Instruction(NOP, program[pc].lineNumber); }
+
+    void findStructure();
+    bool fold();
+    bool propagate();
+    void eliminate();
+};
+
+void Optimizer::setConstant(size_t pc, const TaggedValue &value)
+{
+    Opcode opcode = LOAD_CONST;
+    Value constant;
+    if (value.isBool()) {
+        opcode = BOOLEAN;
+        constant = Value{std::make_shared<Type>(TypeTag::Bool), value.as.b};
+    } else if (value.isInt()) {
+        constant = Value{std::make_shared<Type>(TypeTag::Int), value.as.i};
+    } else if (value.isFloat()) {
+        constant = Value{std::make_shared<Type>(TypeTag::Float64), value.as.f};
+    } else if (value.isString()) {
+        opcode = LOAD_STR;
+        constant = Value{std::make_shared<Type>(TypeTag::String), value.string()};
+    } else {
+        throw std::runtime_error("Folding produced a value that is not a constant");
+    }
+    ValuePtr slot = integerOperand(constants.add(std::move(constant)));
+    program[pc] = Instruction(opcode, program[pc].lineNumber, slot);
+}
+
+void Optimizer::findStructure()
+{
+    size_t n = program.size();
+    leaders.assign(n + 1, false);
+    inFunction.assign(n + 1, false);
+    for (size_t pc = 0; pc < n; ++pc) {
+        if (isJump(pc)) {
+            size_t target = jumpTarget(pc);
+            if (target > n) {
+                throw std::runtime_error("Jump target out of range");
+            }
+            leaders[target] = true;
+            leaders[pc + 1] = true;
+        }
+        if (program[pc].opcode == DEFINE_FUNCTION && pc + 1 < n && program[pc + 1].opcode == JUMP) {
+            size_t end = jumpTarget(pc + 1);
+            for (size_t body = pc + 2; body < end; ++body) {
+                inFunction[body] = true;
+            }
+        }
+    }
+}
+
+// Evaluates operations on constant operands with a stack of the constant loads whose values
+// are on top of the operand stack. The stack only lives within a straight-line run.
+bool Optimizer::fold()
+{
+    bool changed = false;
+    std::vector<size_t> known; // pcs of the loads, topmost last
+    for (size_t pc = 0; pc < program.size(); ++pc) {
+        if (leaders[pc]) {
+            known.clear();
+        }
+        Opcode opcode = program[pc].opcode;
+        if (isConstantLoad(opcode)) {
+            known.push_back(pc);
+            continue;
+        }
+        if (opcode == NOP || opcode == DECLARE_VARIABLE) {
+            continue; // neither touches the operand stack
+        }
+        // Stores and pops take the top value and leave the loads below it on top, as when an
+        // inlined prologue stores its arguments one by one
+        if ((opcode == STORE_VARIABLE || opcode == POP) && !known.empty()) {
+            known.pop_back();
+            continue;
+        }
+
+        size_t arity = isUnary(opcode) ? 1 : isBinary(opcode) ? 2 : 0;
+        if (arity > 0 && known.size() >= arity) {
+            TaggedValue a = constantAt(known[known.size() - arity]);
+            TaggedValue b = arity == 2 ? constantAt(known.back()) : TaggedValue();
+            if (foldable(opcode, a, b)) {
+                TaggedValue result = arity == 1 ? operations.unary(opcode, a)
+                                                : operations.binary(genericArithmetic(opcode), a, b);
+                for (size_t i = 0; i < arity; ++i) {
+                    setNop(known.back());
+                    known.pop_back();
+                }
+                setConstant(pc, result);
+                known.push_back(pc);
+                ++report.folded;
+                changed = true;
+                continue;
+            }
+        }
+
+        if (opcode == JUMP_IF_FALSE && !known.empty()) {
+            TaggedValue condition = constantAt(known.back());
+            if (condition.isBool()) {
+                setNop(known.back());
+                if (condition.as.b) {
+                    setNop(pc);
+                } else {
+                    ValuePtr offset = integerOperand(int64_t(jumpTarget(pc)) - int64_t(pc) - 1);
+                    program[pc] = Instruction(JUMP, program[pc].lineNumber, offset);
+                }
+                ++report.branches;
+                changed = true;
+            }
+        }
+        known.clear();
+    }
+    return changed;
+}
+
+// Replaces loads of top-level variables that are only ever stored once, from a constant,
+// by that constant. A load in the main code is replaced when it comes after the store and
+// no jump can get there around it; one in a function body when no call happens before it.
+bool Optimizer::propagate()
+{
+    struct Stores
+    {
+        size_t count = 0;
+        size_t pc = 0;
+    };
+    std::map<int64_t, Stores> stores;
+    std::set<int64_t> functionLocals;
+    for (size_t pc = 0; pc < program.size(); ++pc) {
+        Opcode opcode = program[pc].opcode;
+        if (opcode == STORE_VARIABLE) {
+            Stores &slot = stores[DecodedProgram::integerOperand(program[pc].value)];
+            ++slot.count;
+            slot.pc = pc;
+        } else if (opcode == DECLARE_VARIABLE && inFunction[pc]) {
+            functionLocals.insert(DecodedProgram::integerOperand(program[pc].value));
+        }
+    }
+
+    bool changed = false;
+    for (const auto &[slot, store] : stores) {
+        if (store.count != 1 || inFunction[store.pc] || functionLocals.count(slot)) {
+            continue;
+        }
+        // The stored value: a constant load right before the store in the same run
+        size_t source = store.pc;
+        bool constant = false;
+        while (source > 0 && !leaders[source]) {
+            Opcode opcode = program[--source].opcode;
+            if (opcode != NOP && opcode != DECLARE_VARIABLE) {
+                constant = isConstantLoad(opcode);
+                break;
+            }
+        }
+        if (!constant) {
+            continue;
+        }
+
+        bool bypassed = false;
+        bool callsBefore = false;
+        for (size_t pc = 0; pc < program.size(); ++pc) {
+            if (inFunction[pc]) {
+                continue;
+            }
+            if (isJump(pc) && pc < store.pc && jumpTarget(pc) > store.pc) {
+                bypassed = true;
+            }
+            if (program[pc].opcode == INVOKE_FUNCTION && pc < store.pc) {
+                callsBefore = true;
+            }
+        }
+        if (bypassed) {
+            continue;
+        }
+
+        for (size_t pc = 0; pc < program.size(); ++pc) {
+            if (program[pc].opcode != LOAD_VARIABLE
+                || DecodedProgram::integerOperand(program[pc].value) != slot) {
+                continue;
+            }
+            if (inFunction[pc] ? !callsBefore : pc > store.pc) {
+                program[pc] = Instruction(program[source].opcode, program[pc].lineNumber,
+                                          program[source].value);
+                ++report.propagated;
+                changed = true;
+            }
+        }
+    }
+    return changed;
+}
+
+// Drops what cannot run or does nothing and renumbers the jumps over the rest. Function
+// definitions always stay: the function table is built from them whether or not they run.
+void Optimizer::eliminate()
+{
+    size_t n = program.size();
+    std::vector<bool> reachable(n, false);
+    std::vector<size_t> work{0};
+    for (size_t pc = 0; pc < n; ++pc) {
+        if (program[pc].opcode == DEFINE_FUNCTION) {
+            work.push_back(pc);
+            work.push_back(pc + 2);
+        }
+    }
+    while (!work.empty()) {
+        size_t pc = work.back();
+        work.pop_back();
+        if (pc >= n || reachable[pc]) {
+            continue;
+        }
+        reachable[pc] = true;
+        switch (program[pc].opcode) {
+        case JUMP:
+            work.push_back(jumpTarget(pc));
+            break;
+        case JUMP_IF_FALSE:
+            work.push_back(jumpTarget(pc));
+            work.push_back(pc + 1);
+            break;
+        case RETURN:
+        case RETURN_VALUE:
+        case HALT:
+            break;
+        default:
+            work.push_back(pc + 1);
+            break;
+        }
+    }
+
+    std::vector<bool> keep(n);
+    for (size_t pc = 0; pc < n; ++pc) {
+        keep[pc] = reachable[pc] && program[pc].opcode != NOP;
+    }
+    // Jumps over nothing but removed instructions, back to front so chains collapse
+    for (size_t pc = n; pc-- > 0;) {
+        if (!keep[pc] || program[pc].opcode != JUMP
+            || (pc > 0 && program[pc - 1].opcode == DEFINE_FUNCTION)) {
+            continue;
+        }
+        size_t target = jumpTarget(pc);
+        bool empty = target > pc;
+        for (size_t between = pc + 1; empty && between < target; ++between) {
+            empty = !keep[between];
+        }
+        if (empty) {
+            keep[pc] = false;
+        }
+    }
+
+    // A removed instruction maps to the next one kept, which is where control now lands
+    std::vector<size_t> newIndex(n + 1);
+    size_t kept = 0;
+    for (size_t pc = 0; pc < n; ++pc) {
+        newIndex[pc] = kept;
+        kept += keep[pc] ? 1 : 0;
+    }
+    newIndex[n] = kept;
+
+    std::vector<Instruction> optimized;
+    optimized.reserve(kept);
+    for (size_t pc = 0; pc < n; ++pc) {
+        if (!keep[pc]) {
+            continue;
+        }
+        Instruction instruction = program[pc];
+        if (instruction.opcode == JUMP) {
+            instruction.value = integerOperand(int64_t(newIndex[jumpTarget(pc)])
+                                               - int64_t(optimized.size()) - 1);
+        } else if (instruction.opcode == JUMP_IF_FALSE) {
+            instruction.value = integerOperand(newIndex[jumpTarget(pc)]);
+        }
+        optimized.push_back(instruction);
+    }
+    program = std::move(optimized);
+}
+
+void Optimizer::run()
+{
+    findStructure();
+    // Folding exposes constant stores and propagation exposes new folds
+    for (int round = 0; round < 8; ++round) {
+        bool folded = fold();
+        bool propagated = propagate();
+        if (!folded && !propagated) {
+            break;
+        }
+    }
+    eliminate();
+}
+
+} // namespace
+
+OptimizerReport optimizeBytecode(std::vector<Instruction> &program, ConstantPool &constants,
+                                 size_t inlineBudget)
+{
+    OptimizerReport report;
+    report.before = report.after = program.size();
+    for (const auto &instruction : program) {
+        if (instruction.opcode == PARALLEL || instruction.opcode == CONCURRENT) {
+            return report;
+        }
+    }
+    // Work on a copy so a program the optimizer gives up on is left as the parser made it
+    std::vector<Instruction> optimized = program;
+    inlineFunctions(optimized, report, inlineBudget);
+    Optimizer(optimized, constants, report).run();
+    optimizeLoops(optimized, constants, report);
+    optimizeSSA(optimized, constants, report);
+    report.after = optimized.size();
+    program = std::move(optimized);
+    return report;
+}
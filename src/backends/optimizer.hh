@@ -0,0 +1,80 @@
+#ifndef OPTIMIZER_HH
+#define OPTIMIZER_HH
+
+#include "../constants.hh"
+#include "../instructions.hh"
+#include <cstddef>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Largest function body, in instructions, inlineFunctions() copies into its callers
+constexpr size_t DEFAULT_INLINE_BUDGET = 24;
+
+// What optimizeBytecode() did to a program
+struct OptimizerReport
+{
+    size_t before = 0;     // instructions
+    size_t after = 0;
+    size_t folded = 0;     // operations computed at compile time
+    size_t propagated = 0; // variable loads replaced by the variable's constant value
+    size_t branches = 0;   // conditional jumps on a constant resolved
+    size_t hoisted = 0;    // loop-invariant expressions computed once before their loop
+    size_t reduced = 0;    // multiplications of an induction variable replaced by a running sum
+    size_t commonSubexpressions = 0; // typed operations replaced by an equal earlier result
+    size_t copies = 0;               // variable-to-variable assignments that needed no code
+    std::vector<std::string> inlined; // "callee into caller at line N" for each call inlined
+    std::string outOfSSA;             // why the SSA stage left the program alone, if it did
+
+    void print(std::ostream &out) const;
+};
+
+// Optimizes parser output before any backend sees it, working within the parser's own
+// instruction set:
+//   - first, calls to small functions are inlined, see inlineFunctions();
+//   - operations whose operands are all constant loads are computed (with the semantics of
+//     ValueOperations) and replaced by a load of the result, string concatenation included,
+//     unless they would fail at run time;
+//   - top-level variables stored once, from a constant, at a point every later load has to
+//     pass, are replaced by that constant wherever that is safe;
+//   - JUMP_IF_FALSE on a constant becomes a JUMP or disappears;
+//   - unreachable instructions, NOPs and jumps to the next instruction are removed, and the
+//     remaining jumps are retargeted;
+//   - then loops are optimized, see optimizeLoops();
+//   - last, the program is taken through SSA form, see optimizeSSA().
+// New constants are added to `constants`; `program` is only replaced when all passes succeed.
+// Programs with PARALLEL or CONCURRENT are left alone, since those re-run ranges of the
+// instruction stream itself.
+OptimizerReport optimizeBytecode(std::vector<Instruction> &program, ConstantPool &constants,
+                                 size_t inlineBudget = DEFAULT_INLINE_BUDGET);
+
+// The inlining stage of optimizeBytecode(). Replaces INVOKE_FUNCTION by a copy of the
+// callee's body, prologue included, whose locals and parameters get fresh variable slots
+// and whose returns jump past the copy, for callees that
+//   - are defined once and at most `budget` instructions long (0 turns inlining off),
+//   - call nothing, so recursion never inlines, and define no functions,
+//   - store each local right after declaring it, as a call starts with nil locals.
+// Helpers that call helpers are inlined from the leaves up. A function without a return
+// value is only inlined where its call is a statement.
+void inlineFunctions(std::vector<Instruction> &program, OptimizerReport &report, size_t budget);
+
+// The loop stage of optimizeBytecode(). A loop is the range from the target of a backward
+// JUMP to that jump, as while and for loops compile, entered only at its first instruction.
+// Innermost loops first:
+//   - expressions that read only constants and variables the loop never stores (nor any
+//     function it calls) are computed once, into a new variable, in front of the loop;
+//   - `i * k`, where i only changes by `i = i +/- c` once per iteration and k is a constant
+//     or invariant, becomes a variable kept equal to it by adding c * k after each step.
+// Only typed arithmetic and comparisons move, since those cannot fail or print anything:
+// a loop that runs zero times still has the same output.
+void optimizeLoops(std::vector<Instruction> &program, ConstantPool &constants,
+                   OptimizerReport &report);
+
+// The SSA stage of optimizeBytecode(): builds SSAProgram from the stack code, checks it,
+// eliminates common subexpressions and lowers it back, so values used once stay on the
+// operand stack and plain copies between variables disappear. Programs without an SSA form
+// keep their code, with the reason in report.outOfSSA.
+void optimizeSSA(std::vector<Instruction> &program, const ConstantPool &constants,
+                 OptimizerReport &report);
+
+#endif // OPTIMIZER_HH
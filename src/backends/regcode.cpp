@@ -0,0 +1,773 @@
+#include "regcode.hh"
+#include <algorithm>
+#include <set>
+#include <stdexcept>
+#include <unordered_map>
+#include <unordered_set>
+
+static bool isUnaryOpcode(uint16_t opcode)
+{
+    switch (opcode) {
+    case NEGATE:
+    case NOT:
+    case NEG_I64:
+    case NEG_F64:
+    case TO_INT64:
+    case TO_FLOAT64:
+        return true;
+    default:
+        return false;
+    }
+}
+
+static bool isComparisonOpcode(uint16_t opcode)
+{
+    switch (opcode) {
+    case EQUAL:
+    case NOT_EQUAL:
+    case LESS_THAN:
+    case LESS_THAN_OR_EQUAL:
+    case GREATER_THAN:
+    case GREATER_THAN_OR_EQUAL:
+    case EQ_I64:
+    case NE_I64:
+    case LT_I64:
+    case LE_I64:
+    case GT_I64:
+    case GE_I64:
+    case EQ_F64:
+    case NE_F64:
+    case LT_F64:
+    case LE_F64:
+    case GT_F64:
+    case GE_F64:
+    case EQ_STR:
+    case NE_STR:
+        return true;
+    default:
+        return false;
+    }
+}
+
+static bool isBinaryOpcode(uint16_t opcode)
+{
+    if (isComparisonOpcode(opcode)) {
+        return true;
+    }
+    switch (opcode) {
+    case ADD:
+    case SUBTRACT:
+    case MULTIPLY:
+    case DIVIDE:
+    case MODULUS:
+    case AND:
+    case OR:
+    case ADD_I64:
+    case SUB_I64:
+    case MUL_I64:
+    case DIV_I64:
+    case MOD_I64:
+    case ADD_F64:
+    case SUB_F64:
+    case MUL_F64:
+    case DIV_F64:
+    case MOD_F64:
+    case CONCATENATE_STR:
+    case INTERPOLATE_STRING:
+        return true;
+    default:
+        return false;
+    }
+}
+
+// Whether dst of the instruction is a register it writes
+static bool writesDestination(uint16_t opcode)
+{
+    return isUnaryOpcode(opcode) || opcode == MOVE || opcode == GET_GLOBAL
+           || opcode == INVOKE_FUNCTION || isBinaryOpcode(opcode);
+}
+
+// Calls read() for every operand the instruction reads and then write() for the register it
+// writes. Both get a reference so the operand can be rewritten.
+template<typename Read, typename Write>
+static void forEachOperand(RegisterInstruction &instruction, std::vector<int32_t> &arguments,
+                           Read read, Write write)
+{
+    uint16_t opcode = instruction.opcode;
+    if (isBinaryOpcode(opcode) || opcode == BRANCH_UNLESS) {
+        read(instruction.a);
+        read(instruction.b);
+    } else if (isUnaryOpcode(opcode) || opcode == MOVE || opcode == SET_GLOBAL || opcode == PRINT
+               || opcode == RETURN_VALUE || opcode == JUMP_IF_FALSE) {
+        read(instruction.a);
+    } else if (opcode == INVOKE_FUNCTION) {
+        for (uint16_t i = 0; i < instruction.aux; ++i) {
+            read(arguments[instruction.b + i]);
+        }
+    }
+    if (writesDestination(opcode)) {
+        write(instruction.dst);
+    }
+}
+
+static bool isJump(uint16_t opcode)
+{
+    return opcode == JUMP || opcode == JUMP_IF_FALSE || opcode == BRANCH_UNLESS;
+}
+
+// Values a straight-line instruction pops and pushes; false for anything that transfers
+// control or whose effect depends on other functions.
+static bool stackEffect(uint16_t opcode, int &pops, int &pushes)
+{
+    pops = 0;
+    pushes = 0;
+    if (isUnaryOpcode(opcode)) {
+        pops = pushes = 1;
+        return true;
+    }
+    if (isBinaryOpcode(opcode)) {
+        pops = 2;
+        pushes = 1;
+        return true;
+    }
+    switch (opcode) {
+    case NOP:
+    case DECLARE_VARIABLE:
+        return true;
+    case LOAD_CONST:
+    case LOAD_STR:
+    case BOOLEAN:
+    case PUSH_ARGS:
+    case LOAD_VARIABLE:
+    case LOAD_LOCAL:
+        pushes = 1;
+        return true;
+    case STORE_VARIABLE:
+    case STORE_LOCAL:
+    case PRINT:
+    case POP:
+        pops = 1;
+        return true;
+    default:
+        return false;
+    }
+}
+
+// The caller leaves the arguments on the stack and the prologue pops them into the
+// parameters, so the parameter count is how far the first block dips below its entry depth.
+static int32_t parameterCount(const DecodedProgram &program, const FunctionInfo &function)
+{
+    int depth = 0;
+    int lowest = 0;
+    for (int32_t pc = function.entry; pc < function.end; ++pc) {
+        int pops, pushes;
+        if (!stackEffect(program.code[pc].opcode, pops, pushes)) {
+            break;
+        }
+        depth -= pops;
+        lowest = std::min(lowest, depth);
+        depth += pushes;
+    }
+    return -lowest;
+}
+
+namespace {
+
+enum class VregKind : uint8_t {
+    Temp,     // produced and consumed within one block
+    Variable, // a local, or a top-level variable of the main program
+    Stack,    // the register a stack slot is kept in across block boundaries
+    Argument, // an incoming argument, fixed to its frame register
+    Global,   // a top-level variable functions use; lives for the whole program
+};
+
+struct Vreg
+{
+    VregKind kind;
+    int32_t fixed = -1; // frame register it must get, -1 for any
+    int32_t first = -1; // live interval in instruction positions
+    int32_t last = -1;
+};
+
+// Translates the stack code of one function by simulating its operand stack. Loads of
+// constants and variables push the operand itself, so `x + 1` becomes a single ADD reading
+// x's register and the constant; only computed values get a (temporary) register. At block
+// boundaries every stack slot is moved into a fixed register for its depth so all
+// predecessors of a block agree on where the values are.
+class FunctionTranslator
+{
+public:
+    FunctionTranslator(const DecodedProgram &program, const std::vector<int32_t> &paramCounts,
+                       RegisterFunction &out)
+        : program(program)
+        , paramCounts(paramCounts)
+        , out(out)
+    {}
+
+    void translateMain(const std::set<int32_t> &sharedGlobals)
+    {
+        isMain = true;
+        for (int32_t slot : sharedGlobals) {
+            globals.emplace(slot, newVreg(VregKind::Global));
+        }
+        translate(0, static_cast<int32_t>(program.code.size()), {});
+        allocate();
+    }
+
+    void translateFunction(const FunctionInfo &function, int32_t paramCount,
+                           const std::unordered_map<int32_t, int32_t> &mainGlobals)
+    {
+        isMain = false;
+        globalRegisters = &mainGlobals;
+        out.nameIndex = function.nameIndex;
+        out.paramCount = paramCount;
+
+        std::vector<int32_t> arguments;
+        for (int32_t i = 0; i < paramCount; ++i) {
+            arguments.push_back(newVreg(VregKind::Argument, i));
+        }
+        translate(function.entry, function.end, arguments);
+        allocate();
+    }
+
+    // Main-frame register of every top-level variable functions use
+    std::unordered_map<int32_t, int32_t> sharedGlobalRegisters() const
+    {
+        std::unordered_map<int32_t, int32_t> registers;
+        for (const auto &[slot, vreg] : globals) {
+            if (vregs[vreg].kind == VregKind::Global) {
+                registers.emplace(slot, assignment[vreg]);
+            }
+        }
+        return registers;
+    }
+
+private:
+    const DecodedProgram &program;
+    const std::vector<int32_t> &paramCounts;
+    RegisterFunction &out;
+    bool isMain = false;
+    const std::unordered_map<int32_t, int32_t> *globalRegisters = nullptr;
+
+    std::vector<Vreg> vregs;
+    std::vector<int32_t> assignment;                // vreg -> frame register
+    std::unordered_map<int32_t, int32_t> globals;   // top-level slot -> vreg (main only)
+    std::unordered_map<int32_t, int32_t> locals;    // frame slot -> vreg
+    std::vector<int32_t> stackRegisters;            // depth -> vreg
+    std::vector<int32_t> stack;                     // operands of the simulated stack
+    std::unordered_map<int32_t, size_t> labelDepth; // stack code pc -> depth on entry
+    std::unordered_map<int32_t, int32_t> labelIndex; // stack code pc -> register code index
+    std::vector<std::pair<size_t, int32_t>> fixups;  // jump instruction -> stack code target
+    int32_t currentPc = 0;
+
+    int32_t newVreg(VregKind kind, int32_t fixed = -1)
+    {
+        vregs.push_back(Vreg{kind, fixed});
+        return static_cast<int32_t>(vregs.size() - 1);
+    }
+
+    int32_t variable(std::unordered_map<int32_t, int32_t> &table, int32_t slot)
+    {
+        auto it = table.find(slot);
+        if (it != table.end()) {
+            return it->second;
+        }
+        int32_t vreg = newVreg(VregKind::Variable);
+        table.emplace(slot, vreg);
+        return vreg;
+    }
+
+    int32_t stackRegister(size_t depth)
+    {
+        while (stackRegisters.size() <= depth) {
+            stackRegisters.push_back(newVreg(VregKind::Stack));
+        }
+        return stackRegisters[depth];
+    }
+
+    bool isKind(int32_t operand, VregKind kind) const
+    {
+        return !isConstantOperand(operand) && vregs[operand].kind == kind;
+    }
+
+    void emit(uint16_t opcode, int32_t dst, int32_t a, int32_t b = 0, uint16_t aux = 0)
+    {
+        out.code.push_back(RegisterInstruction{opcode, aux, dst, a, b});
+        out.lines.push_back(program.lineAt(currentPc));
+    }
+
+    int32_t pop()
+    {
+        if (stack.empty()) {
+            throw std::runtime_error("Stack underflow translating instruction "
+                                     + std::to_string(currentPc) + " to register code");
+        }
+        int32_t operand = stack.back();
+        stack.pop_back();
+        return operand;
+    }
+
+    // Stack slots that are not in their depth's register get moved there
+    bool needsFlush() const
+    {
+        for (size_t depth = 0; depth < stack.size(); ++depth) {
+            if (depth >= stackRegisters.size() || stack[depth] != stackRegisters[depth]) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void flush()
+    {
+        for (size_t depth = 0; depth < stack.size(); ++depth) {
+            int32_t target = stackRegister(depth);
+            if (stack[depth] != target) {
+                emit(MOVE, target, stack[depth]);
+                stack[depth] = target;
+            }
+        }
+    }
+
+    // Copies stack slots that still refer to `vreg` (or to any variable of `kind`) into fresh
+    // temporaries before it is overwritten. Returns whether anything was copied.
+    template<typename Predicate>
+    bool materialize(Predicate refersToOverwritten)
+    {
+        bool copied = false;
+        for (auto &operand : stack) {
+            if (!isConstantOperand(operand) && refersToOverwritten(operand)) {
+                int32_t temp = newVreg(VregKind::Temp);
+                emit(MOVE, temp, operand);
+                operand = temp;
+                copied = true;
+            }
+        }
+        return copied;
+    }
+
+    void store(int32_t vreg)
+    {
+        int32_t value = pop();
+        bool copied = materialize([vreg](int32_t operand) { return operand == vreg; });
+
+        // Let the instruction that computed the value write the variable directly
+        if (!copied && isKind(value, VregKind::Temp) && !out.code.empty()
+            && writesDestination(out.code.back().opcode) && out.code.back().dst == value) {
+            out.code.back().dst = vreg;
+            return;
+        }
+        emit(MOVE, vreg, value);
+    }
+
+    void recordDepth(int32_t target, size_t depth)
+    {
+        auto [it, inserted] = labelDepth.emplace(target, depth);
+        if (!inserted && it->second != depth) {
+            throw std::runtime_error("Inconsistent stack depth at instruction "
+                                     + std::to_string(target));
+        }
+    }
+
+    void emitJump(uint16_t opcode, int32_t condition, int32_t target)
+    {
+        fixups.emplace_back(out.code.size(), target);
+        emit(opcode, 0, condition);
+    }
+
+    void translate(int32_t begin, int32_t end, std::vector<int32_t> entryStack)
+    {
+        std::unordered_set<int32_t> labels;
+        for (int32_t pc = begin; pc < end; ++pc) {
+            const DecodedInstruction &instruction = program.code[pc];
+            if (instruction.opcode == JUMP || instruction.opcode == JUMP_IF_FALSE) {
+                labels.insert(instruction.a);
+            }
+        }
+
+        stack = std::move(entryStack);
+        bool reachable = true;
+        for (int32_t pc = begin; pc < end; ++pc) {
+            const DecodedInstruction &instruction = program.code[pc];
+            currentPc = pc;
+
+            if (labels.count(pc)) {
+                if (reachable) {
+                    flush();
+                    recordDepth(pc, stack.size());
+                } else {
+                    auto it = labelDepth.find(pc);
+                    if (it == labelDepth.end()) {
+                        continue; // nothing jumps here (yet); dead code
+                    }
+                    reachable = true;
+                    stack.clear();
+                    for (size_t depth = 0; depth < it->second; ++depth) {
+                        stack.push_back(stackRegister(depth));
+                    }
+                }
+                labelIndex[pc] = static_cast<int32_t>(out.code.size());
+            }
+            if (!reachable) {
+                continue;
+            }
+
+            uint16_t opcode = instruction.opcode;
+            if (isUnaryOpcode(opcode)) {
+                int32_t operand = pop();
+                int32_t temp = newVreg(VregKind::Temp);
+                emit(opcode, temp, operand);
+                stack.push_back(temp);
+                continue;
+            }
+            if (isBinaryOpcode(opcode)) {
+                int32_t rhs = pop();
+                int32_t lhs = pop();
+                int32_t temp = newVreg(VregKind::Temp);
+                emit(opcode, temp, lhs, rhs);
+                stack.push_back(temp);
+                continue;
+            }
+
+            switch (opcode) {
+            case NOP:
+            case DECLARE_VARIABLE:
+                break;
+            case DEFINE_FUNCTION:
+                pc = program.code[pc + 1].a - 1; // the body is translated on its own
+                break;
+            case LOAD_CONST:
+            case LOAD_STR:
+            case BOOLEAN:
+            case PUSH_ARGS:
+                stack.push_back(constantOperand(instruction.a));
+                break;
+            case LOAD_LOCAL:
+                stack.push_back(variable(locals, instruction.a));
+                break;
+            case STORE_LOCAL:
+                store(variable(locals, instruction.a));
+                break;
+            case LOAD_VARIABLE:
+                if (isMain) {
+                    stack.push_back(variable(globals, instruction.a));
+                } else {
+                    int32_t temp = newVreg(VregKind::Temp);
+                    emit(GET_GLOBAL, temp, globalRegisters->at(instruction.a));
+                    stack.push_back(temp);
+                }
+                break;
+            case STORE_VARIABLE:
+                if (isMain) {
+                    store(variable(globals, instruction.a));
+                } else {
+                    emit(SET_GLOBAL, globalRegisters->at(instruction.a), pop());
+                }
+                break;
+            case PRINT:
+                emit(PRINT, 0, pop());
+                break;
+            case POP:
+                pop();
+                break;
+            case JUMP:
+                flush();
+                recordDepth(instruction.a, stack.size());
+                emitJump(JUMP, 0, instruction.a);
+                reachable = false;
+                break;
+            case JUMP_IF_FALSE: {
+                int32_t condition = pop();
+                RegisterInstruction *last = out.code.empty() ? nullptr : &out.code.back();
+                if (!needsFlush() && isKind(condition, VregKind::Temp) && last
+                    && isComparisonOpcode(last->opcode) && last->dst == condition) {
+                    // Compare and branch in one instruction
+                    last->aux = last->opcode;
+                    last->opcode = BRANCH_UNLESS;
+                    fixups.emplace_back(out.code.size() - 1, instruction.a);
+                } else {
+                    flush();
+                    emitJump(JUMP_IF_FALSE, condition, instruction.a);
+                }
+                recordDepth(instruction.a, stack.size());
+                break;
+            }
+            case TAIL_CALL: // stays a call followed by RETURN_VALUE, see RegisterBackend
+            case INVOKE_FUNCTION: {
+                int32_t count = instruction.a >= 0 ? paramCounts[instruction.a] : 0;
+                std::vector<int32_t> arguments(count);
+                for (int32_t i = count - 1; i >= 0; --i) {
+                    arguments[i] = pop();
+                }
+                // The callee may assign top-level variables still waiting on the stack
+                materialize([this](int32_t operand) { return vregs[operand].kind == VregKind::Global; });
+
+                int32_t first = static_cast<int32_t>(out.arguments.size());
+                out.arguments.insert(out.arguments.end(), arguments.begin(), arguments.end());
+                int32_t temp = newVreg(VregKind::Temp);
+                emit(INVOKE_FUNCTION, temp, instruction.a,
+                     instruction.a >= 0 ? first : instruction.b, static_cast<uint16_t>(count));
+                stack.push_back(temp);
+                break;
+            }
+            case RETURN:
+                emit(RETURN, 0, 0);
+                reachable = false;
+                break;
+            case RETURN_VALUE:
+                emit(RETURN_VALUE, 0, pop());
+                reachable = false;
+                break;
+            case HALT:
+                emit(HALT, 0, 0);
+                reachable = false;
+                break;
+            default:
+                throw std::runtime_error("Register code has no translation for "
+                                         + decodedOpcodeName(opcode));
+            }
+        }
+        if (reachable) {
+            emit(isMain ? HALT : RETURN, 0, 0);
+        }
+
+        for (const auto &[index, target] : fixups) {
+            auto it = labelIndex.find(target);
+            if (it == labelIndex.end()) {
+                throw std::runtime_error("Jump to instruction " + std::to_string(target)
+                                         + " leaves its function");
+            }
+            out.code[index].dst = it->second;
+        }
+    }
+
+    // Linear scan over the live intervals. There is no register limit, so nothing is ever
+    // spilled; the scan just reuses the register of every interval that has ended.
+    void allocate()
+    {
+        auto &code = out.code;
+        const int32_t length = static_cast<int32_t>(code.size());
+
+        for (int32_t pos = 0; pos < length; ++pos) {
+            auto touch = [&](bool isRead) {
+                return [&, isRead](int32_t &operand) {
+                    if (isConstantOperand(operand)) {
+                        return;
+                    }
+                    Vreg &vreg = vregs[operand];
+                    if (vreg.first < 0) {
+                        // A variable read before any write must keep the nil it starts with
+                        vreg.first = isRead && vreg.kind == VregKind::Variable ? 0 : pos;
+                    }
+                    vreg.last = std::max(vreg.last, pos);
+                };
+            };
+            forEachOperand(code[pos], out.arguments, touch(true), touch(false));
+        }
+        for (auto &vreg : vregs) {
+            if (vreg.kind == VregKind::Argument) {
+                vreg.first = 0;
+                vreg.last = std::max(vreg.last, 0);
+            } else if (vreg.kind == VregKind::Global) {
+                vreg.first = 0;
+                vreg.last = length;
+            }
+        }
+
+        // Values that cross block boundaries stay live around every loop they are used in
+        std::vector<std::pair<int32_t, int32_t>> loops; // header, back edge
+        for (int32_t pos = 0; pos < length; ++pos) {
+            if (isJump(code[pos].opcode) && code[pos].dst <= pos) {
+                loops.emplace_back(code[pos].dst, pos);
+            }
+        }
+        for (bool changed = true; changed;) {
+            changed = false;
+            for (auto &vreg : vregs) {
+                if (vreg.kind == VregKind::Temp || vreg.first < 0) {
+                    continue;
+                }
+                for (const auto &[header, backEdge] : loops) {
+                    if (vreg.first <= backEdge && vreg.last >= header
+                        && (vreg.first > header || vreg.last < backEdge)) {
+                        vreg.first = std::min(vreg.first, header);
+                        vreg.last = std::max(vreg.last, backEdge);
+                        changed = true;
+                    }
+                }
+            }
+        }
+
+        std::vector<int32_t> order;
+        for (int32_t id = 0; id < static_cast<int32_t>(vregs.size()); ++id) {
+            if (vregs[id].first >= 0) {
+                order.push_back(id);
+            }
+        }
+        std::sort(order.begin(), order.end(), [this](int32_t lhs, int32_t rhs) {
+            const Vreg &l = vregs[lhs];
+            const Vreg &r = vregs[rhs];
+            if (l.first != r.first) {
+                return l.first < r.first;
+            }
+            return (l.fixed >= 0) > (r.fixed >= 0);
+        });
+
+        assignment.assign(vregs.size(), -1);
+        std::set<int32_t> freeRegisters;
+        std::vector<int32_t> active;
+        int32_t nextRegister = out.paramCount;
+        for (int32_t id : order) {
+            const Vreg &vreg = vregs[id];
+            for (auto it = active.begin(); it != active.end();) {
+                if (vregs[*it].last < vreg.first) {
+                    freeRegisters.insert(assignment[*it]);
+                    it = active.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+            int32_t reg;
+            if (vreg.fixed >= 0) {
+                reg = vreg.fixed;
+            } else if (!freeRegisters.empty()) {
+                reg = *freeRegisters.begin();
+                freeRegisters.erase(freeRegisters.begin());
+            } else {
+                reg = nextRegister++;
+            }
+            assignment[id] = reg;
+            active.push_back(id);
+        }
+
+        auto rename = [this](int32_t &operand) {
+            if (!isConstantOperand(operand)) {
+                operand = assignment[operand];
+            }
+        };
+        for (auto &instruction : code) {
+            forEachOperand(instruction, out.arguments, rename, rename);
+        }
+        out.frameSize = std::max(nextRegister, out.paramCount);
+        out.virtualRegisters = static_cast<int32_t>(vregs.size());
+    }
+};
+
+} // namespace
+
+RegisterProgram RegisterProgram::translate(const DecodedProgram &program)
+{
+    RegisterProgram result;
+    result.constants = program.constants;
+    result.names = program.names;
+
+    std::vector<int32_t> paramCounts;
+    std::set<int32_t> sharedGlobals;
+    for (const auto &function : program.functions) {
+        paramCounts.push_back(parameterCount(program, function));
+        for (int32_t pc = function.entry; pc < function.end; ++pc) {
+            const DecodedInstruction &instruction = program.code[pc];
+            if (instruction.opcode == LOAD_VARIABLE || instruction.opcode == STORE_VARIABLE) {
+                sharedGlobals.insert(instruction.a);
+            }
+        }
+    }
+
+    FunctionTranslator mainTranslator(program, paramCounts, result.main);
+    mainTranslator.translateMain(sharedGlobals);
+    std::unordered_map<int32_t, int32_t> globalRegisters = mainTranslator.sharedGlobalRegisters();
+
+    result.functions.resize(program.functions.size());
+    for (size_t id = 0; id < program.functions.size(); ++id) {
+        FunctionTranslator translator(program, paramCounts, result.functions[id]);
+        translator.translateFunction(program.functions[id], paramCounts[id], globalRegisters);
+    }
+    return result;
+}
+
+std::string registerOpcodeName(uint16_t opcode)
+{
+    switch (opcode) {
+    case MOVE:
+        return "MOVE";
+    case GET_GLOBAL:
+        return "GET_GLOBAL";
+    case SET_GLOBAL:
+        return "SET_GLOBAL";
+    case BRANCH_UNLESS:
+        return "BRANCH_UNLESS";
+    default:
+        return decodedOpcodeName(opcode);
+    }
+}
+
+static std::string operandString(int32_t operand)
+{
+    return isConstantOperand(operand) ? "k" + std::to_string(~operand)
+                                      : "r" + std::to_string(operand);
+}
+
+void RegisterProgram::print(std::ostream &out) const
+{
+    auto printFunction = [&](const RegisterFunction &function) {
+        out << (function.nameIndex < 0 ? std::string("<main>") : names[function.nameIndex])
+            << ": " << function.paramCount << " params, " << function.frameSize
+            << " registers (" << function.virtualRegisters << " virtual), "
+            << function.code.size() << " instructions\n";
+        for (size_t pc = 0; pc < function.code.size(); ++pc) {
+            const RegisterInstruction &instruction = function.code[pc];
+            out << "  " << pc << ": " << registerOpcodeName(instruction.opcode);
+            switch (instruction.opcode) {
+            case JUMP:
+                out << " -> " << instruction.dst;
+                break;
+            case JUMP_IF_FALSE:
+                out << " " << operandString(instruction.a) << " -> " << instruction.dst;
+                break;
+            case BRANCH_UNLESS:
+                out << " " << registerOpcodeName(instruction.aux) << " "
+                    << operandString(instruction.a) << ", " << operandString(instruction.b)
+                    << " -> " << instruction.dst;
+                break;
+            case GET_GLOBAL:
+                out << " r" << instruction.dst << ", g" << instruction.a;
+                break;
+            case SET_GLOBAL:
+                out << " g" << instruction.dst << ", " << operandString(instruction.a);
+                break;
+            case INVOKE_FUNCTION:
+                out << " r" << instruction.dst << ", ";
+                if (instruction.a < 0) {
+                    out << names[instruction.b];
+                } else {
+                    out << names[functions[instruction.a].nameIndex] << "(";
+                    for (uint16_t i = 0; i < instruction.aux; ++i) {
+                        out << (i ? ", " : "")
+                            << operandString(function.arguments[instruction.b + i]);
+                    }
+                    out << ")";
+                }
+                break;
+            case PRINT:
+            case RETURN_VALUE:
+                out << " " << operandString(instruction.a);
+                break;
+            case RETURN:
+            case HALT:
+                break;
+            default:
+                out << " r" << instruction.dst << ", " << operandString(instruction.a);
+                if (isBinaryOpcode(instruction.opcode)) {
+                    out << ", " << operandString(instruction.b);
+                }
+                break;
+            }
+            out << "\n";
+        }
+    };
+
+    printFunction(main);
+    for (const auto &function : functions) {
+        printFunction(function);
+    }
+}
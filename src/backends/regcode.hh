@@ -0,0 +1,90 @@
+#ifndef REGCODE_HH
+#define REGCODE_HH
+
+#include "bytecode.hh"
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Opcodes that only exist in register code. Everything else reuses the source opcodes.
+enum RegisterOpcode : uint16_t {
+    GET_GLOBAL = DECODED_OPCODE_COUNT, // dst = main-frame register a
+    SET_GLOBAL,                        // main-frame register dst = a
+    BRANCH_UNLESS,                     // if !(a <aux> b) jump to dst; aux is a comparison opcode
+
+    REGISTER_OPCODE_COUNT
+};
+
+// Three-address instruction. dst is a register, a and b are operands: a register when
+// >= 0, constant ~operand otherwise (see constantOperand()). Layout per opcode:
+//   binary operations        dst = a <op> b
+//   unary operations, MOVE   dst = <op> a
+//   PRINT, RETURN_VALUE      a
+//   JUMP                     dst = target
+//   JUMP_IF_FALSE            a = condition, dst = target
+//   INVOKE_FUNCTION          dst = result, a = function id (-1 if unknown, b = name index),
+//                            b = first entry in RegisterFunction::arguments, aux = count
+struct RegisterInstruction
+{
+    uint16_t opcode;
+    uint16_t aux;
+    int32_t dst;
+    int32_t a;
+    int32_t b;
+};
+
+static_assert(sizeof(RegisterInstruction) == 16, "RegisterInstruction must stay 16 bytes wide");
+
+inline int32_t constantOperand(int32_t index)
+{
+    return ~index;
+}
+
+inline bool isConstantOperand(int32_t operand)
+{
+    return operand < 0;
+}
+
+// Register code for one function (or the top-level program). Registers are frame-relative;
+// the first paramCount registers receive the arguments.
+struct RegisterFunction
+{
+    int32_t nameIndex = -1; // into RegisterProgram::names, -1 for the top level
+    int32_t paramCount = 0;
+    int32_t frameSize = 0;
+    int32_t virtualRegisters = 0; // before allocation, for reports
+    std::vector<RegisterInstruction> code;
+    std::vector<uint32_t> lines;
+    std::vector<int32_t> arguments; // call argument operands, see INVOKE_FUNCTION
+};
+
+// Whether the INVOKE_FUNCTION at `pc` is a tail call (TAIL_CALL in the stack code): the
+// next instruction returns its result
+inline bool isTailCall(const RegisterFunction &function, size_t pc)
+{
+    const RegisterInstruction &call = function.code[pc];
+    return call.opcode == INVOKE_FUNCTION && call.a >= 0 && pc + 1 < function.code.size()
+           && function.code[pc + 1].opcode == RETURN_VALUE && function.code[pc + 1].a == call.dst;
+}
+
+// A DecodedProgram translated to register code. Every stack slot, parameter and variable
+// becomes a virtual register, and a linear scan over their live intervals packs those into
+// as few frame registers as it can. Top-level variables live in the registers of the main
+// frame; functions reach the ones they use through GET_GLOBAL/SET_GLOBAL.
+struct RegisterProgram
+{
+    RegisterFunction main;
+    std::vector<RegisterFunction> functions; // indexed by function id
+    std::vector<ValuePtr> constants;         // DecodedProgram::constants
+    std::vector<std::string> names;
+
+    // Throws std::runtime_error for code it cannot translate.
+    static RegisterProgram translate(const DecodedProgram &program);
+
+    void print(std::ostream &out) const;
+};
+
+std::string registerOpcodeName(uint16_t opcode);
+
+#endif // REGCODE_HH
@@ -1,439 +1,300 @@
-//#include "register.hh"
-
-//void RegisterBackend::dumpRegisters() {
-//    std::cout << "Registers:\n";
-//    for (size_t i = 0; i < registers.size(); ++i) {
-//        std::cout << "R-" << i << ": ";
-//        std::visit([](const auto &value) { std::cout << value; }, registers[i]);
-//        std::cout << "\n";
-//    }
-
-//    std::cout << "Constants:\n";
-//    for (size_t i = 0; i < constants.size(); ++i) {
-//        std::cout << "C-" << i << ": ";
-//        std::visit([](const auto &value) { std::cout << value; }, constants[i]);
-//        std::cout << "\n";
-//    }
-
-//    std::cout << "Variables:\n";
-//    for (size_t i = 0; i < variables.size(); ++i) {
-//        std::cout << "V-" << i << ": ";
-//        std::visit([](const auto &value) { std::cout << value; }, variables[i]);
-//        std::cout << "\n";
-//    }
-//}
-
-//void RegisterBackend::execute(const Instruction& instruction) {
-//    switch (instruction.opcode) {
-//        case NEGATE:
-//            performUnaryOperation(pc);
-//            break;
-//        case ADD:
-//        case SUBTRACT:
-//        case MULTIPLY:
-//        case DIVIDE:
-//        case MODULUS:
-//            performBinaryOperation(pc);
-//            break;
-//        case EQUAL:
-//        case NOT_EQUAL:
-//        case LESS_THAN:
-//        case LESS_THAN_OR_EQUAL:
-//        case GREATER_THAN:
-//        case GREATER_THAN_OR_EQUAL:
-//            performComparisonOperation(pc);
-//            break;
-//        case AND:
-//        case OR:
-//        case NOT:
-//            performLogicalOperation(pc);
-//            break;
-//        case LOAD_CONST:
-//            handleLoadConst(pc);
-//            break;
-//        case PRINT:
-//            handlePrint();
-//            break;
-//        case HALT:
-//            handleHalt();
-//            return;
-//        case DECLARE_VARIABLE:
-//            handleDeclareVariable(pc);
-//            break;
-//        case LOAD_VARIABLE:
-//            handleLoadVariable(pc);
-//            break;
-//        case STORE_VARIABLE:
-//            handleStoreVariable(pc);
-//            break;
-//        case WHILE_LOOP:
-//            handleWhileLoop();
-//            break;
-//        case PARALLEL:
-//            handleParallel(pc);
-//            break;
-//        case CONCURRENT:
-//            handleConcurrent(pc);
-//            break;
-//        default:
-//            std::cerr << "Unknown opcode." << std::endl;
-//    }
-//}
-
-//void RegisterBackend::performUnaryOperation(int op) {
-//    int opcode = program[op].opcode;
-//    if (registers.empty()) {
-//        std::cerr << "Error: Invalid operand register for unary operation" << std::endl;
-//        return;
-//    }
-
-//    auto value = registers.back();
-//    registers.pop_back();
-
-//    if (opcode == NEGATE) {
-//        if (std::holds_alternative<int32_t>(value)) {
-//            registers.push_back(-std::get<int32_t>(value));
-//        } else if (std::holds_alternative<double>(value)) {
-//            registers.push_back(-std::get<double>(value));
-//        } else {
-//            std::cerr << "Error: Unsupported type for NEGATE operation" << std::endl;
-//        }
-//    } else {
-//        std::cerr << "Error: Invalid unary operation opcode" << std::endl;
-//    }
-//}
-
-//void RegisterBackend::performBinaryOperation(int op) {
-//    int opcode = program[op].opcode;
-//    if (registers.size() < 2) {
-//        std::cerr << "Error: Invalid operand registers for binary operation" << std::endl;
-//        return;
-//    }
-
-//    auto value2 = registers.back();
-//    registers.pop_back();
-//    auto value1 = registers.back();
-//    registers.pop_back();
-
-//    if (std::holds_alternative<int32_t>(value1) && std::holds_alternative<int32_t>(value2)) {
-//        int32_t reg1 = std::get<int32_t>(value1);
-//        int32_t reg2 = std::get<int32_t>(value2);
-
-//        switch (opcode) {
-//            case ADD:
-//                registers.push_back(reg1 + reg2);
-//                break;
-//            case SUBTRACT:
-//                registers.push_back(reg1 - reg2);
-//                break;
-//            case MULTIPLY:
-//                registers.push_back(reg1 * reg2);
-//                break;
-//            case DIVIDE:
-//                if (reg2 == 0) {
-//                    std::cerr << "Error: Division by zero" << std::endl;
-//                    return;
-//                }
-//                registers.push_back(reg1 / reg2);
-//                break;
-//            case MODULUS:
-//                if (reg2 == 0) {
-//                    std::cerr << "Error: Modulo by zero" << std::endl;
-//                    return;
-//                }
-//                registers.push_back(reg1 % reg2);
-//                break;
-//            default:
-//                std::cerr << "Error: Invalid binary operation opcode" << std::endl;
-//        }
-//    } else if (std::holds_alternative<double>(value1) && std::holds_alternative<double>(value2)) {
-//        double reg1 = std::get<double>(value1);
-//        double reg2 = std::get<double>(value2);
-
-//        switch (opcode) {
-//            case ADD:
-//                registers.push_back(reg1 + reg2);
-//                break;
-//            case SUBTRACT:
-//                registers.push_back(reg1 - reg2);
-//                break;
-//            case MULTIPLY:
-//                registers.push_back(reg1 * reg2);
-//                break;
-//            case DIVIDE:
-//                if (reg2 == 0.0) {
-//                    std::cerr << "Error: Division by zero" << std::endl;
-//                    return;
-//                }
-//                registers.push_back(reg1 / reg2);
-//                break;
-//            default:
-//                std::cerr << "Error: Invalid binary operation opcode" << std::endl;
-//        }
-//    } else {
-//        std::cerr << "Error: Unsupported types for binary operation" << std::endl;
-//    }
-//}
-
-//void RegisterBackend::run(const std::vector<Instruction>& program)  {
-//    this->program = program; // Store the program in the instance
-//    try {
-//        pc = 0; // Reset program counter
-//        while (pc < program.size()) {
-//            const Instruction& instruction = program[pc];
-//            execute(instruction);
-//            pc++;
-//        }
-//    } catch (const std::exception& ex) {
-//        std::cerr << "Exception occurred during VM execution: " << ex.what() << std::endl;
-//    }
-//}
-
-//void RegisterBackend::performLogicalOperation(int op) {
-//    int opcode = program[op].opcode;
-//    if (registers.size() < 2) {
-//        std::cerr << "Error: Insufficient operand registers for logical operation" << std::endl;
-//        return;
-//    }
-
-//    auto value2 = registers.back();
-//    registers.pop_back();
-//    auto value1 = registers.back();
-//    registers.pop_back();
-
-//    if (std::holds_alternative<bool>(value1) && std::holds_alternative<bool>(value2)) {
-//        bool reg1 = std::get<bool>(value1);
-//        bool reg2 = std::get<bool>(value2);
-
-//        switch (opcode) {
-//            case AND:
-//                registers.push_back(reg1 && reg2);
-//                break;
-//            case OR:
-//                registers.push_back(reg1 || reg2);
-//                break;
-//            default:
-//                std::cerr << "Error: Invalid logical operation opcode" << std::endl;
-//        }
-//    } else {
-//        std::cerr << "Error: Unsupported types for logical operation" << std::endl;
-//    }
-//}
-
-//void RegisterBackend::performComparisonOperation(int op) {
-//    int opcode = program[op].opcode;
-//    if (registers.size() < 2) {
-//        std::cerr << "Error: Insufficient operand registers for comparison operation" << std::endl;
-//        return;
-//    }
-
-//    auto value2 = registers.back();
-//    registers.pop_back();
-//    auto value1 = registers.back();
-//    registers.pop_back();
-
-//    if (std::holds_alternative<int32_t>(value1) && std::holds_alternative<int32_t>(value2)) {
-//        int32_t reg1 = std::get<int32_t>(value1);
-//        int32_t reg2 = std::get<int32_t>(value2);
-
-//        switch (opcode) {
-//            case EQUAL:
-//                registers.push_back(reg1 == reg2);
-//                break;
-//            case NOT_EQUAL:
-//                registers.push_back(reg1 != reg2);
-//                break;
-//            case LESS_THAN:
-//                registers.push_back(reg1 < reg2);
-//                break;
-//            case LESS_THAN_OR_EQUAL:
-//                registers.push_back(reg1 <= reg2);
-//                break;
-//            case GREATER_THAN:
-//                registers.push_back(reg1 > reg2);
-//                break;
-//            case GREATER_THAN_OR_EQUAL:
-//                registers.push_back(reg1 >= reg2);
-//                break;
-//            default:
-//                std::cerr << "Error: Invalid comparison operation opcode" << std::endl;
-//        }
-//    } else if (std::holds_alternative<double>(value1) && std::holds_alternative<double>(value2)) {
-//        double reg1 = std::get<double>(value1);
-//        double reg2 = std::get<double>(value2);
-
-//        switch (opcode) {
-//            case EQUAL:
-//                registers.push_back(reg1 == reg2);
-//                break;
-//            case NOT_EQUAL:
-//                registers.push_back(reg1 != reg2);
-//                break;
-//            case LESS_THAN:
-//                registers.push_back(reg1 < reg2);
-//                break;
-//            case LESS_THAN_OR_EQUAL:
-//                registers.push_back(reg1 <= reg2);
-//                break;
-//            case GREATER_THAN:
-//                registers.push_back(reg1 > reg2);
-//                break;
-//            case GREATER_THAN_OR_EQUAL:
-//                registers.push_back(reg1 >= reg2);
-//                break;
-//            default:
-//                std::cerr << "Error: Invalid comparison operation opcode" << std::endl;
-//        }
-//    } else {
-//        std::cerr << "Error: Unsupported types for comparison operation" << std::endl;
-//    }
-//}
-
-//void RegisterBackend::handleLoadConst(unsigned int constantIndex) {
-//    if (constantIndex >= constants.size()) {
-//        std::cerr << "Error: Invalid constant index" << std::endl;
-//        return;
-//    }
-
-//    registers.push_back(constants[constantIndex]);
-//}
-
-//void RegisterBackend::handleStoreVariable(unsigned int variableIndex) {
-//    if (variableIndex >= variables.size()) {
-//        std::cerr << "Error: Invalid variable index during storing" << std::endl;
-//        return;
-//    }
-
-//    variables[variableIndex] = registers.back();
-//    registers.pop_back();
-//}
-
-//void RegisterBackend::handlePrint() {
-//    if (registers.empty()) {
-//        std::cerr << "Error: No value to print" << std::endl;
-//        return;
-//    }
-
-//    auto value = registers.back();
-//    registers.pop_back();
-
-//    std::visit([](auto &&arg) {
-//        using T = std::decay_t<decltype(arg)>;
-//        if constexpr (std::is_same_v<T, int32_t> || std::is_same_v<T, double> || std::is_same_v<T, std::string>) {
-//            std::cout << "PRINT: " << arg << std::endl;
-//        } else if constexpr (std::is_same_v<T, bool>) {
-//            std::cout << "PRINT: " << std::boolalpha << arg << std::endl;
-//        } else {
-//            std::cerr << "Unsupported type for PRINT operation" << std::endl;
-//        }
-//    }, value);
-//}
-
-//void RegisterBackend::handleDeclareVariable(unsigned int variableIndex) {
-//    if (variableIndex >= variables.size()) {
-//        variables.resize(variableIndex + 1);
-//    }
-
-//    variables[variableIndex] = {}; // Initialize with default value
-//}
-
-//void RegisterBackend::handleLoadVariable(unsigned int variableIndex) {
-//    if (variableIndex >= variables.size()) {
-//        std::cerr << "Error: Invalid variable index during loading" << std::endl;
-//        return;
-//    }
-
-//    registers.push_back(variables[variableIndex]);
-//}
-
-//void RegisterBackend::handleWhileLoop() {
-//    int loopStart = pc - 1;
-
-//    while (true) {
-//        auto conditionInstruction = program[pc];
-//        execute(conditionInstruction);
-
-//        auto condition = registers.back();
-//        registers.pop_back();
-
-//        if (std::holds_alternative<bool>(condition) && std::get<bool>(condition)) {
-//            pc++;
-//            auto bodyInstruction = program[pc];
-//            execute(bodyInstruction);
-//        } else {
-//            break;
-//        }
-
-//        pc = loopStart;
-//    }
-//}
-
-//void RegisterBackend::handleHalt() {
-//    std::cout << "Halt operation" << std::endl;
-//}
-
-//void RegisterBackend::handleInput() {
-//    // Implement input handling
-//}
-
-//void RegisterBackend::handleOutput() {
-//    // Implement output handling
-//}
-
-//void RegisterBackend::concurrent(std::vector<std::function<void()>> tasks) {
-//    for (auto& task : tasks) {
-//        threads.emplace_back(task);
-//    }
-
-//    for (auto& thread : threads) {
-//        if (thread.joinable()) {
-//            thread.join();
-//        }
-//    }
-
-//    threads.clear();
-//}
-
-//void RegisterBackend::handleParallel(unsigned int taskCount) {
-//    std::vector<std::function<void()>> tasks;
-//    unsigned int instructionsPerTask = program.size() / taskCount;
-
-//    for (unsigned int i = 0; i < taskCount; ++i) {
-//        tasks.push_back([this, i, instructionsPerTask]() {
-//            unsigned int start = i * instructionsPerTask;
-//            unsigned int end = (i + 1) * instructionsPerTask;
-//            for (unsigned int j = start; j < end; ++j) {
-//                execute(program[j]);
-//            }
-//        });
-//    }
-
-//    concurrent(tasks);
-//}
-
-//void RegisterBackend::handleConcurrent(unsigned int taskCount) {
-//    std::vector<std::function<void()>> tasks;
-//    // for (unsigned int i = 0; i < taskCount; ++i) {
-//    //     tasks.push_back([this, i]() {
-//    //         std::lock_guard<std::mutex> lock(this->mtx); // Lock for the duration of task
-//    //         this->pc = i;  // Assign each task its part of the program
-//    //         this->exe();  // Run each part of the program concurrently
-//    //     });
-//    // }
-//    // Calculate the number of instructions per task
-//    unsigned int instructionsPerTask = program.size() / taskCount;
-
-//    // Create tasks for each part of the program
-//    for (unsigned int i = 0; i < taskCount; ++i) {
-//        tasks.push_back([this, i, instructionsPerTask]() {
-//            std::lock_guard<std::mutex> lock(this->mtx); // Lock for the duration of task
-//            unsigned int start = i * instructionsPerTask;
-//            unsigned int end = (i + 1) * instructionsPerTask;
-//            for (unsigned int j = start; j < end; ++j) {
-//                this->execute(program[j]);
-//            }
-//        });
-//    }
-
-//    concurrent(tasks);
-//}
+#include "register.hh"
+#include <algorithm>
+#include <chrono>
+#include <stdexcept>
+
+RegisterBackend::RegisterBackend(std::vector<Instruction> &program, const ConstantPool &constantPool)
+    : memoryManager(Logger::memory().isEnabled(LogLevel::Debug))
+    , globalRegion(memoryManager)
+    , operations(globalRegion)
+    , constantPool(constantPool)
+    , program(program)
+{}
+
+void RegisterBackend::run(const std::vector<Instruction> &program)
+{
+    this->program = program;
+    DecodedProgram decoded;
+    try {
+        decoded = DecodedProgram::decode(this->program, constantPool.values());
+    } catch (const std::exception &ex) {
+        std::cerr << "Exception occurred during VM execution: " << ex.what() << std::endl;
+        return;
+    }
+    run(decoded);
+}
+
+void RegisterBackend::run(const DecodedProgram &program)
+{
+    auto start_time = std::chrono::high_resolution_clock::now();
+    try {
+        load(program);
+        auto start_time = std::chrono::high_resolution_clock::now();
+        interpret();
+        auto end_time = std::chrono::high_resolution_clock::now();
+        auto duration = std::chrono::duration_cast<std::chrono::microseconds>(end_time - start_time);
+        std::cout << "VM Execution completed in " << duration.count() << " microseconds."
+                  << std::endl;
+    } catch (const std::exception &ex) {
+        std::cerr << "Exception occurred during VM execution: " << ex.what() << std::endl;
+    }
+    auto end_time = std::chrono::high_resolution_clock::now();
+    auto duration = std::chrono::duration_cast<std::chrono::microseconds>(end_time - start_time);
+    std::cout << "VM ran for a total of  " << duration.count() << " microseconds." << std::endl;
+}
+
+void RegisterBackend::load(const DecodedProgram &decoded)
+{
+    stackInstructions = decoded.code.size();
+    code = RegisterProgram::translate(decoded);
+
+    constants.clear();
+    constants.reserve(code.constants.size());
+    for (const auto &constant : code.constants) {
+        constants.push_back(TaggedValue::fromValue(*constant, globalRegion));
+    }
+    frames.clear();
+    registers.clear();
+    registers.resize(std::max<size_t>(code.main.frameSize, 256));
+}
+
+void RegisterBackend::execute(const Instruction &instruction)
+{
+    // Register code only exists for whole programs
+    run({instruction, Instruction(HALT, instruction.lineNumber)});
+}
+
+void RegisterBackend::interpret()
+{
+    const RegisterFunction *function = &code.main;
+    const RegisterInstruction *instructions = function->code.data();
+    size_t base = 0;
+    TaggedValue *regs = registers.data();
+    size_t pc = 0;
+
+#define OPERAND(x) ((x) >= 0 ? regs[(x)] : constants[~(x)])
+#define INT_BINARY(make, expr) \
+    do { \
+        int64_t a = OPERAND(instruction.a).as.i; \
+        int64_t b = OPERAND(instruction.b).as.i; \
+        regs[instruction.dst] = TaggedValue::make(expr); \
+    } while (0)
+#define FLOAT_BINARY(make, expr) \
+    do { \
+        double a = OPERAND(instruction.a).as.f; \
+        double b = OPERAND(instruction.b).as.f; \
+        regs[instruction.dst] = TaggedValue::make(expr); \
+    } while (0)
+
+    for (;;) {
+        const RegisterInstruction &instruction = instructions[pc++];
+        switch (instruction.opcode) {
+        case NOP:
+            break;
+        case MOVE:
+            regs[instruction.dst] = OPERAND(instruction.a);
+            break;
+        case GET_GLOBAL:
+            regs[instruction.dst] = registers[instruction.a];
+            break;
+        case SET_GLOBAL:
+            registers[instruction.dst] = OPERAND(instruction.a);
+            break;
+        case ADD_I64:
+            INT_BINARY(integer, IntArithmetic::add(a, b));
+            break;
+        case SUB_I64:
+            INT_BINARY(integer, IntArithmetic::subtract(a, b));
+            break;
+        case MUL_I64:
+            INT_BINARY(integer, IntArithmetic::multiply(a, b));
+            break;
+        case EQ_I64:
+            INT_BINARY(boolean, a == b);
+            break;
+        case NE_I64:
+            INT_BINARY(boolean, a != b);
+            break;
+        case LT_I64:
+            INT_BINARY(boolean, a < b);
+            break;
+        case LE_I64:
+            INT_BINARY(boolean, a <= b);
+            break;
+        case GT_I64:
+            INT_BINARY(boolean, a > b);
+            break;
+        case GE_I64:
+            INT_BINARY(boolean, a >= b);
+            break;
+        case ADD_F64:
+            FLOAT_BINARY(number, a + b);
+            break;
+        case SUB_F64:
+            FLOAT_BINARY(number, a - b);
+            break;
+        case MUL_F64:
+            FLOAT_BINARY(number, a * b);
+            break;
+        case PRINT:
+            std::cout << "The result: " << std::boolalpha << OPERAND(instruction.a) << std::endl;
+            break;
+        case JUMP:
+            pc = instruction.dst;
+            break;
+        case JUMP_IF_FALSE: {
+            const TaggedValue &condition = OPERAND(instruction.a);
+            if (!condition.isBool()) {
+                std::cerr << "Error: JUMP_IF_FALSE requires a boolean condition" << std::endl;
+            } else if (!condition.as.b) {
+                pc = instruction.dst;
+            }
+            break;
+        }
+        case BRANCH_UNLESS: {
+            const TaggedValue &lhs = OPERAND(instruction.a);
+            const TaggedValue &rhs = OPERAND(instruction.b);
+            bool taken;
+            switch (instruction.aux) {
+            case LT_I64:
+                taken = lhs.as.i < rhs.as.i;
+                break;
+            case LE_I64:
+                taken = lhs.as.i <= rhs.as.i;
+                break;
+            case GT_I64:
+                taken = lhs.as.i > rhs.as.i;
+                break;
+            case GE_I64:
+                taken = lhs.as.i >= rhs.as.i;
+                break;
+            case EQ_I64:
+                taken = lhs.as.i == rhs.as.i;
+                break;
+            case NE_I64:
+                taken = lhs.as.i != rhs.as.i;
+                break;
+            default:
+                taken = operations.compare(instruction.aux, lhs, rhs);
+                break;
+            }
+            if (!taken) {
+                pc = instruction.dst;
+            }
+            break;
+        }
+        case INVOKE_FUNCTION: {
+            if (instruction.a < 0) {
+                std::cerr << "Error: Function " << code.names[instruction.b] << " not declared"
+                          << std::endl;
+                regs[instruction.dst] = TaggedValue();
+                break;
+            }
+            // A call whose result is returned at once (TAIL_CALL in the stack code) runs the
+            // callee in this frame, which then returns straight to our caller
+            bool tail = !frames.empty() && isTailCall(*function, pc - 1);
+            if (!tail && frames.size() >= MAX_CALL_DEPTH) {
+                throw std::runtime_error("Call stack overflow in "
+                                         + code.names[code.functions[instruction.a].nameIndex]);
+            }
+
+            const RegisterFunction *callee = &code.functions[instruction.a];
+            size_t calleeBase = tail ? base : base + function->frameSize;
+            size_t needed = calleeBase + callee->frameSize;
+            if (registers.size() < needed) {
+                registers.resize(std::max(needed, registers.size() * 2));
+                regs = registers.data() + base;
+            }
+
+            TaggedValue *calleeRegs = registers.data() + calleeBase;
+            int32_t passed = std::min<int32_t>(instruction.aux, callee->paramCount);
+            if (tail) {
+                // The arguments may read the registers they are about to replace
+                tailArguments.clear();
+                for (int32_t i = 0; i < passed; ++i) {
+                    tailArguments.push_back(OPERAND(function->arguments[instruction.b + i]));
+                }
+                std::move(tailArguments.begin(), tailArguments.end(), calleeRegs);
+            } else {
+                for (int32_t i = 0; i < passed; ++i) {
+                    calleeRegs[i] = OPERAND(function->arguments[instruction.b + i]);
+                }
+            }
+            for (int32_t i = passed; i < callee->frameSize; ++i) {
+                calleeRegs[i] = TaggedValue(); // frames start out with nil locals
+            }
+
+            if (!tail) {
+                frames.push_back(CallFrame{function, pc, base, instruction.dst});
+            }
+            function = callee;
+            instructions = function->code.data();
+            base = calleeBase;
+            regs = calleeRegs;
+            pc = 0;
+            break;
+        }
+        case RETURN:
+        case RETURN_VALUE: {
+            if (frames.empty()) {
+                std::cerr << "Error: RETURN outside of a function" << std::endl;
+                break;
+            }
+            TaggedValue result
+                = instruction.opcode == RETURN_VALUE ? OPERAND(instruction.a) : TaggedValue();
+            CallFrame frame = frames.back();
+            frames.pop_back();
+
+            function = frame.function;
+            instructions = function->code.data();
+            base = frame.base;
+            regs = registers.data() + base;
+            pc = frame.returnPc;
+            regs[frame.result] = std::move(result);
+            break;
+        }
+        case HALT:
+            std::cout << "Program halted normally." << std::endl;
+            return;
+        case NEGATE:
+        case NOT:
+        case NEG_I64:
+        case NEG_F64:
+        case TO_INT64:
+        case TO_FLOAT64:
+            regs[instruction.dst] = operations.unary(instruction.opcode, OPERAND(instruction.a));
+            break;
+        default:
+            regs[instruction.dst] = operations.binary(instruction.opcode, OPERAND(instruction.a),
+                                                      OPERAND(instruction.b));
+            break;
+        }
+    }
+
+#undef FLOAT_BINARY
+#undef INT_BINARY
+#undef OPERAND
+}
+
+void RegisterBackend::dumpRegisters()
+{
+    std::cout << "Registers:\n";
+    for (int32_t i = 0; i < code.main.frameSize && i < static_cast<int32_t>(registers.size());
+         ++i) {
+        std::cout << "R-" << i << ": " << registers[i] << "\n";
+    }
+
+    std::cout << "Constants:\n";
+    for (size_t i = 0; i < constants.size(); ++i) {
+        std::cout << "C-" << i << ": " << constants[i] << "\n";
+    }
+
+    size_t registerInstructions = code.main.code.size();
+    for (const auto &function : code.functions) {
+        registerInstructions += function.code.size();
+    }
+    std::cout << "Register code: " << registerInstructions << " instructions from "
+              << stackInstructions << " stack instructions\n";
+    code.print(std::cout);
+    std::cout << "End of Dump Registers\n";
+}
@@ -1,52 +1,56 @@
 #ifndef REGISTER_BACKEND_HH
 #define REGISTER_BACKEND_HH
 
+#include "../constants.hh"
+#include "../memory.hh"
 #include "backend.hh"
-#include <functional>
+#include "bytecode.hh"
+#include "operations.hh"
+#include "regcode.hh"
+#include "tagged.hh"
 #include <iostream>
-#include <mutex>
 #include <string>
-#include <thread>
-#include <variant>
 #include <vector>
 
-class RegisterBackend : public Backend {
+// Register machine over RegisterProgram. Each call gets a window of `registers` sized to
+// the callee's frame; instructions name their operands directly instead of pushing and
+// popping them, so a statement like `i = i + 1` is one instruction instead of four.
+class RegisterBackend : public Backend
+{
 public:
-    explicit RegisterBackend(std::vector<Instruction> &program)
-        : program(program) {}
+    RegisterBackend(std::vector<Instruction> &program, const ConstantPool &constantPool);
 
     void execute(const Instruction &instruction) override;
     void dumpRegisters() override;
     void run(const std::vector<Instruction> &program) override;
+    void run(const DecodedProgram &program) override;
 
 private:
-    unsigned int pc = 0;            // program counter
-    std::vector<ValuePtr> registers; // Registers for storing data
-    std::vector<ValuePtr> constants; // Constants for storing data
-    std::vector<ValuePtr> variables; // Variables for storing data location
-    std::vector<Instruction> &program;
-    std::vector<std::thread> threads;
-    std::mutex mtx; // Mutex for synchronization
-  //  size_t pc = 0;
-
-    void performUnaryOperation(int op);
-    void performBinaryOperation(int op);
-    void performLogicalOperation(int op);
-    void performComparisonOperation(int op);
-    void handleLoadConst(unsigned int constantIndex);
-    void handleDeclareVariable(unsigned int variableIndex);
-    void handleLoadVariable(unsigned int variableIndex);
-    void handleStoreVariable(unsigned int variableIndex);
-    void handleParallel(unsigned int taskCount);
-    void handleConcurrent(unsigned int taskCount);
-    void handlePrint();
-    void handleHalt();
-    void handleWhileLoop();
-    void handleInput();
-    void handleOutput();
-
-    //helpers functions
-    void concurrent(std::vector<std::function<void()>> tasks);
+    // Declared first so they outlive every TaggedValue below.
+    ValueMemory memoryManager;
+    ValueMemory::Region globalRegion;
+    ValueOperations operations;
+
+    struct CallFrame
+    {
+        const RegisterFunction *function; // the caller
+        size_t returnPc;                  // caller instruction to resume at
+        size_t base;                      // first register of the caller's frame
+        int32_t result;                   // caller register that receives the return value
+    };
+    static constexpr size_t MAX_CALL_DEPTH = 100000;
+
+    std::vector<TaggedValue> registers;
+    std::vector<TaggedValue> constants; // code.constants, converted once per run
+    ConstantPool constantPool;
+    std::vector<CallFrame> frames;
+    std::vector<TaggedValue> tailArguments; // reused by every tail call
+    std::vector<Instruction> program;
+    size_t stackInstructions = 0; // size of the stack code the register code came from
+    RegisterProgram code;
+
+    void load(const DecodedProgram &decoded);
+    void interpret();
 };
 
 #endif // REGISTER_BACKEND_HH
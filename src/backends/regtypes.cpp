@@ -0,0 +1,432 @@
+#include "regtypes.hh"
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <variant>
+
+StaticType joinTypes(StaticType a, StaticType b)
+{
+    if (a == StaticType::Unknown) {
+        return b;
+    }
+    if (b == StaticType::Unknown || a == b) {
+        return a;
+    }
+    return StaticType::Any;
+}
+
+static bool isNumber(StaticType type)
+{
+    return type == StaticType::Int || type == StaticType::Float;
+}
+
+bool isUnaryOperation(uint16_t opcode)
+{
+    switch (opcode) {
+    case MOVE:
+    case NEGATE:
+    case NOT:
+    case NEG_I64:
+    case NEG_F64:
+    case TO_INT64:
+    case TO_FLOAT64:
+        return true;
+    default:
+        return false;
+    }
+}
+
+StaticType resultType(uint16_t opcode, StaticType a, StaticType b, bool nonZeroDivisor)
+{
+    if (a == StaticType::Unknown || (!isUnaryOperation(opcode) && b == StaticType::Unknown)) {
+        return StaticType::Unknown;
+    }
+    bool ints = a == StaticType::Int && b == StaticType::Int;
+    bool numbers = isNumber(a) && isNumber(b);
+
+    switch (opcode) {
+    case MOVE:
+        return a;
+    case NEGATE:
+    case NEG_I64:
+    case NEG_F64:
+        return isNumber(a) ? a : StaticType::Any;
+    case NOT:
+        return a == StaticType::Bool ? a : StaticType::Any;
+    case TO_INT64:
+        return isNumber(a) ? StaticType::Int : StaticType::Any;
+    case TO_FLOAT64:
+        return isNumber(a) ? StaticType::Float : StaticType::Any;
+
+    case ADD_I64:
+    case SUB_I64:
+    case MUL_I64:
+        return StaticType::Int;
+    case DIV_I64:
+    case MOD_I64:
+        return nonZeroDivisor ? StaticType::Int : StaticType::Any;
+    case DIV_F64:
+        return nonZeroDivisor ? StaticType::Float : StaticType::Any;
+    case ADD_F64:
+    case SUB_F64:
+    case MUL_F64:
+    case MOD_F64:
+        return StaticType::Float;
+
+    case EQUAL:
+    case NOT_EQUAL:
+    case LESS_THAN:
+    case LESS_THAN_OR_EQUAL:
+    case GREATER_THAN:
+    case GREATER_THAN_OR_EQUAL:
+    case EQ_I64:
+    case NE_I64:
+    case LT_I64:
+    case LE_I64:
+    case GT_I64:
+    case GE_I64:
+    case EQ_F64:
+    case NE_F64:
+    case LT_F64:
+    case LE_F64:
+    case GT_F64:
+    case GE_F64:
+    case EQ_STR:
+    case NE_STR:
+        return StaticType::Bool;
+
+    case ADD:
+    case SUBTRACT:
+    case MULTIPLY:
+        return ints ? StaticType::Int : numbers ? StaticType::Float : StaticType::Any;
+    case DIVIDE:
+        if (numbers && nonZeroDivisor) {
+            return ints ? StaticType::Int : StaticType::Float;
+        }
+        return StaticType::Any;
+    case MODULUS:
+        if (ints) {
+            return nonZeroDivisor ? StaticType::Int : StaticType::Any;
+        }
+        return numbers ? StaticType::Float : StaticType::Any; // fmod, no zero check
+    case AND:
+    case OR:
+        return a == StaticType::Bool && b == StaticType::Bool ? a : StaticType::Any;
+    case CONCATENATE_STR:
+    case INTERPOLATE_STRING:
+        return StaticType::Any;
+    default:
+        throw std::runtime_error("No static type for " + registerOpcodeName(opcode));
+    }
+}
+
+bool writesRegister(uint16_t opcode)
+{
+    switch (opcode) {
+    case NOP:
+    case PRINT:
+    case JUMP:
+    case JUMP_IF_FALSE:
+    case BRANCH_UNLESS:
+    case SET_GLOBAL:
+    case RETURN:
+    case RETURN_VALUE:
+    case HALT:
+        return false;
+    default:
+        return true;
+    }
+}
+
+namespace {
+
+class TypeInference
+{
+public:
+    TypeInference(const RegisterProgram &code, RegisterTypes &types)
+        : code(code)
+        , types(types)
+    {}
+
+    void run();
+
+private:
+    const RegisterProgram &code;
+    RegisterTypes &types;
+
+    const RegisterFunction &functionAt(int32_t id) const
+    {
+        return id == RegisterTypes::MAIN ? code.main : code.functions[id];
+    }
+
+    void typeConstants();
+    void seedUnassignedReads(int32_t id);
+    bool inferFunction(int32_t id);
+    StaticType result(int32_t id, const RegisterInstruction &instruction) const;
+};
+
+void TypeInference::typeConstants()
+{
+    for (const auto &constant : code.constants) {
+        StaticType type = StaticType::Any;
+        bool divisor = false;
+        std::visit(
+            [&](const auto &v) {
+                using T = std::decay_t<decltype(v)>;
+                if constexpr (std::is_same_v<T, bool>) {
+                    type = StaticType::Bool;
+                } else if constexpr (std::is_integral_v<T>) {
+                    type = StaticType::Int;
+                    divisor = v != 0;
+                } else if constexpr (std::is_floating_point_v<T>) {
+                    type = StaticType::Float;
+                    divisor = v != 0;
+                } else if constexpr (!std::is_same_v<T, std::monostate>
+                                     && !std::is_same_v<T, std::string>) {
+                    throw std::runtime_error("Constant " + std::to_string(types.constants.size())
+                                             + " is neither a scalar nor a string");
+                }
+            },
+            constant->data);
+        types.constants.push_back(type);
+        types.nonZeroConstants.push_back(divisor);
+    }
+}
+
+// Registers read on some path before anything wrote them hold nil there, so they must be
+// able to hold nil: a forward must-analysis of which registers have been written. For main,
+// also the globals functions read before main wrote them.
+void TypeInference::seedUnassignedReads(int32_t id)
+{
+    const RegisterFunction &function = functionAt(id);
+    RegisterTypes::Function &typesOf = types.of(id);
+    size_t count = function.code.size();
+    std::vector<std::vector<bool>> in(count);
+    std::vector<bool> reached(count, false);
+    std::vector<bool> entry(function.frameSize, false);
+    for (int32_t i = 0; i < function.paramCount && i < function.frameSize; ++i) {
+        entry[i] = true;
+    }
+
+    std::vector<size_t> worklist;
+    auto flow = [&](size_t pc, const std::vector<bool> &state) {
+        if (pc >= count) {
+            return;
+        }
+        if (!reached[pc]) {
+            reached[pc] = true;
+            in[pc] = state;
+            worklist.push_back(pc);
+            return;
+        }
+        bool changed = false;
+        for (size_t r = 0; r < state.size(); ++r) {
+            if (in[pc][r] && !state[r]) {
+                in[pc][r] = false;
+                changed = true;
+            }
+        }
+        if (changed) {
+            worklist.push_back(pc);
+        }
+    };
+    if (count > 0) {
+        flow(0, entry);
+    }
+    while (!worklist.empty()) {
+        size_t pc = worklist.back();
+        worklist.pop_back();
+        const RegisterInstruction &instruction = function.code[pc];
+        std::vector<bool> out = in[pc];
+        if (writesRegister(instruction.opcode)
+            || (id == RegisterTypes::MAIN && instruction.opcode == SET_GLOBAL)) {
+            out[instruction.dst] = true;
+        }
+        switch (instruction.opcode) {
+        case JUMP:
+            flow(instruction.dst, out);
+            break;
+        case JUMP_IF_FALSE:
+        case BRANCH_UNLESS:
+            flow(pc + 1, out);
+            flow(instruction.dst, out);
+            break;
+        case RETURN:
+        case RETURN_VALUE:
+            if (id == RegisterTypes::MAIN) {
+                flow(pc + 1, out); // an error, then execution goes on
+            }
+            break;
+        case HALT:
+            break;
+        default:
+            flow(pc + 1, out);
+            break;
+        }
+    }
+
+    std::vector<bool> globalsRead(code.main.frameSize, false);
+    for (const auto &callee : code.functions) {
+        for (const auto &instruction : callee.code) {
+            if (instruction.opcode == GET_GLOBAL) {
+                globalsRead[instruction.a] = true;
+            }
+        }
+    }
+    for (size_t pc = 0; pc < count; ++pc) {
+        if (!reached[pc]) {
+            continue;
+        }
+        const RegisterInstruction &instruction = function.code[pc];
+        forEachRegisterRead(function, instruction, [&](int32_t reg) {
+            if (!in[pc][reg]) {
+                typesOf.registers[reg] = StaticType::Any;
+            }
+        });
+        if (id == RegisterTypes::MAIN && instruction.opcode == INVOKE_FUNCTION) {
+            for (int32_t reg = 0; reg < code.main.frameSize; ++reg) {
+                if (globalsRead[reg] && !in[pc][reg]) {
+                    typesOf.registers[reg] = StaticType::Any;
+                }
+            }
+        }
+    }
+}
+
+StaticType TypeInference::result(int32_t id, const RegisterInstruction &instruction) const
+{
+    switch (instruction.opcode) {
+    case GET_GLOBAL:
+        return types.main.registers[instruction.a];
+    case INVOKE_FUNCTION:
+        return instruction.a < 0 ? StaticType::Any : types.functions[instruction.a].result;
+    default: {
+        bool unary = isUnaryOperation(instruction.opcode);
+        return resultType(instruction.opcode, types.operand(id, instruction.a),
+                          unary ? StaticType::Any : types.operand(id, instruction.b),
+                          !unary && types.nonZero(instruction.b));
+    }
+    }
+}
+
+bool TypeInference::inferFunction(int32_t id)
+{
+    const RegisterFunction &function = functionAt(id);
+    bool changed = false;
+    auto assign = [&changed](StaticType &slot, StaticType type) {
+        StaticType joined = joinTypes(slot, type);
+        if (type != StaticType::Unknown && joined != slot) {
+            slot = joined;
+            changed = true;
+        }
+    };
+
+    for (const auto &instruction : function.code) {
+        switch (instruction.opcode) {
+        case SET_GLOBAL:
+            assign(types.main.registers[instruction.dst], types.operand(id, instruction.a));
+            break;
+        case RETURN:
+            if (id != RegisterTypes::MAIN) {
+                assign(types.of(id).result, StaticType::Any);
+            }
+            break;
+        case RETURN_VALUE:
+            if (id != RegisterTypes::MAIN) {
+                assign(types.of(id).result, types.operand(id, instruction.a));
+            }
+            break;
+        case INVOKE_FUNCTION:
+            if (instruction.a >= 0) {
+                RegisterTypes::Function &callee = types.functions[instruction.a];
+                for (uint16_t i = 0; i < instruction.aux; ++i) {
+                    assign(callee.registers[i],
+                           types.operand(id, function.arguments[instruction.b + i]));
+                }
+            }
+            assign(types.of(id).registers[instruction.dst], result(id, instruction));
+            break;
+        default:
+            if (writesRegister(instruction.opcode)) {
+                assign(types.of(id).registers[instruction.dst], result(id, instruction));
+            }
+            break;
+        }
+    }
+    return changed;
+}
+
+void TypeInference::run()
+{
+    typeConstants();
+    types.main.registers.assign(code.main.frameSize, StaticType::Unknown);
+    types.functions.resize(code.functions.size());
+    for (size_t id = 0; id < code.functions.size(); ++id) {
+        types.functions[id].registers.assign(code.functions[id].frameSize, StaticType::Unknown);
+    }
+
+    types.globals.assign(code.main.frameSize, false);
+    std::vector<bool> called(code.functions.size(), false);
+    auto scan = [&](const RegisterFunction &function) {
+        for (const auto &instruction : function.code) {
+            if (instruction.opcode == INVOKE_FUNCTION && instruction.a >= 0) {
+                called[instruction.a] = true;
+            } else if (instruction.opcode == GET_GLOBAL) {
+                types.globals[instruction.a] = true;
+            } else if (instruction.opcode == SET_GLOBAL) {
+                types.globals[instruction.dst] = true;
+            }
+        }
+    };
+    scan(code.main);
+    for (const auto &function : code.functions) {
+        scan(function);
+    }
+    for (size_t id = 0; id < code.functions.size(); ++id) {
+        if (!called[id]) {
+            for (int32_t i = 0; i < code.functions[id].paramCount; ++i) {
+                types.functions[id].registers[i] = StaticType::Any;
+            }
+        }
+    }
+
+    seedUnassignedReads(RegisterTypes::MAIN);
+    for (size_t id = 0; id < code.functions.size(); ++id) {
+        seedUnassignedReads(static_cast<int32_t>(id));
+    }
+
+    auto fixpoint = [&] {
+        bool changed;
+        do {
+            changed = inferFunction(RegisterTypes::MAIN);
+            for (size_t id = 0; id < code.functions.size(); ++id) {
+                changed |= inferFunction(static_cast<int32_t>(id));
+            }
+        } while (changed);
+    };
+    fixpoint();
+
+    // What is still Unknown is never written, or comes from a function that never returns:
+    // Any is the safe choice, and the values derived from it must follow.
+    auto settle = [](RegisterTypes::Function &function) {
+        for (auto &type : function.registers) {
+            type = type == StaticType::Unknown ? StaticType::Any : type;
+        }
+        function.result = function.result == StaticType::Unknown ? StaticType::Any
+                                                                  : function.result;
+    };
+    settle(types.main);
+    for (auto &function : types.functions) {
+        settle(function);
+    }
+    fixpoint();
+}
+
+} // namespace
+
+RegisterTypes RegisterTypes::infer(const RegisterProgram &code)
+{
+    RegisterTypes types;
+    TypeInference(code, types).run();
+    return types;
+}
@@ -0,0 +1,105 @@
+#ifndef REGTYPES_HH
+#define REGTYPES_HH
+
+#include "regcode.hh"
+#include <cstdint>
+#include <vector>
+
+// What a register holds wherever it is read, as far as the code shows. Unknown only exists
+// while inferring.
+enum class StaticType : uint8_t { Unknown, Bool, Int, Float, Any };
+
+StaticType joinTypes(StaticType a, StaticType b);
+
+// Type of `a <opcode> b` as ValueOperations computes it; b is ignored for unary opcodes and
+// MOVE. nonZeroDivisor says b is a constant other than zero, so a division cannot fail into
+// nil. Throws std::runtime_error for opcodes that are not operations.
+StaticType resultType(uint16_t opcode, StaticType a, StaticType b, bool nonZeroDivisor);
+
+// MOVE and the operations that only read `a`
+bool isUnaryOperation(uint16_t opcode);
+
+// Whether dst of the register instruction is a register it writes
+bool writesRegister(uint16_t opcode);
+
+// Calls f(register) for every register of its own frame the instruction reads
+template<typename F>
+void forEachRegisterRead(const RegisterFunction &function, const RegisterInstruction &instruction,
+                         F f)
+{
+    auto read = [&](int32_t operand) {
+        if (!isConstantOperand(operand)) {
+            f(operand);
+        }
+    };
+    switch (instruction.opcode) {
+    case NOP:
+    case JUMP:
+    case RETURN:
+    case HALT:
+    case GET_GLOBAL:
+        break;
+    case INVOKE_FUNCTION:
+        if (instruction.a >= 0) {
+            for (uint16_t i = 0; i < instruction.aux; ++i) {
+                read(function.arguments[instruction.b + i]);
+            }
+        }
+        break;
+    case MOVE:
+    case PRINT:
+    case JUMP_IF_FALSE:
+    case SET_GLOBAL:
+    case RETURN_VALUE:
+    case NEGATE:
+    case NOT:
+    case NEG_I64:
+    case NEG_F64:
+    case TO_INT64:
+    case TO_FLOAT64:
+        read(instruction.a);
+        break;
+    default:
+        read(instruction.a);
+        read(instruction.b);
+        break;
+    }
+}
+
+// Static types for every register of a RegisterProgram, for the ahead-of-time backends. A
+// register gets a scalar type when every write to it produces that type and no read can see
+// it before something wrote it (fresh frames hold nil); parameter and return types follow
+// from the call sites and returns of the whole program.
+struct RegisterTypes
+{
+    struct Function
+    {
+        std::vector<StaticType> registers;
+        StaticType result = StaticType::Unknown;
+    };
+
+    static constexpr int32_t MAIN = -1; // function id of the top level
+
+    Function main;
+    std::vector<Function> functions;  // indexed by function id
+    std::vector<StaticType> constants; // Any for nil and strings
+    std::vector<bool> nonZeroConstants; // numbers other than zero, safe divisors
+    std::vector<bool> globals; // main registers functions reach through GET/SET_GLOBAL
+
+    // Throws std::runtime_error for constants other than scalars and strings.
+    static RegisterTypes infer(const RegisterProgram &code);
+
+    Function &of(int32_t id) { return id == MAIN ? main : functions[id]; }
+    const Function &of(int32_t id) const { return id == MAIN ? main : functions[id]; }
+
+    StaticType operand(int32_t id, int32_t operand) const
+    {
+        return isConstantOperand(operand) ? constants[~operand] : of(id).registers[operand];
+    }
+    bool nonZero(int32_t operand) const
+    {
+        return isConstantOperand(operand) && nonZeroConstants[~operand];
+    }
+};
+
+#endif // REGTYPES_HH
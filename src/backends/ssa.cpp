@@ -0,0 +1,1581 @@
+#include "ssa.hh"
+#include "bytecode.hh"
+#include <algorithm>
+#include <map>
+#include <set>
+#include <stdexcept>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <variant>
+
+std::string ssaOpcodeName(uint16_t opcode)
+{
+    switch (opcode) {
+    case PARAM:
+        return "PARAM";
+    case PHI:
+        return "PHI";
+    case NIL:
+        return "NIL";
+    case END:
+        return "END";
+    default:
+        return registerOpcodeName(opcode);
+    }
+}
+
+namespace {
+
+constexpr size_t PROGRAM_END = SIZE_MAX; // where control goes when it runs off the program
+
+bool isConstantLoad(uint16_t opcode)
+{
+    return opcode == LOAD_CONST || opcode == LOAD_STR || opcode == BOOLEAN;
+}
+
+bool isUnaryOpcode(uint16_t opcode)
+{
+    return opcode != MOVE && isUnaryOperation(opcode);
+}
+
+bool isBinaryOpcode(uint16_t opcode)
+{
+    switch (opcode) {
+    case ADD:
+    case SUBTRACT:
+    case MULTIPLY:
+    case DIVIDE:
+    case MODULUS:
+    case EQUAL:
+    case NOT_EQUAL:
+    case LESS_THAN:
+    case LESS_THAN_OR_EQUAL:
+    case GREATER_THAN:
+    case GREATER_THAN_OR_EQUAL:
+    case AND:
+    case OR:
+    case CONCATENATE_STR:
+    case INTERPOLATE_STRING:
+    case ADD_I64:
+    case SUB_I64:
+    case MUL_I64:
+    case DIV_I64:
+    case MOD_I64:
+    case ADD_F64:
+    case SUB_F64:
+    case MUL_F64:
+    case DIV_F64:
+    case MOD_F64:
+    case EQ_I64:
+    case NE_I64:
+    case LT_I64:
+    case LE_I64:
+    case GT_I64:
+    case GE_I64:
+    case EQ_F64:
+    case NE_F64:
+    case LT_F64:
+    case LE_F64:
+    case GT_F64:
+    case GE_F64:
+    case EQ_STR:
+    case NE_STR:
+        return true;
+    default:
+        return false;
+    }
+}
+
+bool isTerminator(uint16_t opcode)
+{
+    switch (opcode) {
+    case JUMP:
+    case JUMP_IF_FALSE:
+    case RETURN:
+    case RETURN_VALUE:
+    case HALT:
+    case END:
+        return true;
+    default:
+        return false;
+    }
+}
+
+size_t successorCount(uint16_t opcode)
+{
+    return opcode == JUMP ? 1 : opcode == JUMP_IF_FALSE ? 2 : 0;
+}
+
+// Typed operations on integer operands; the backends do not check the operand kinds
+bool isIntegerOperation(uint16_t opcode)
+{
+    switch (opcode) {
+    case ADD_I64:
+    case SUB_I64:
+    case MUL_I64:
+    case DIV_I64:
+    case MOD_I64:
+    case NEG_I64:
+    case EQ_I64:
+    case NE_I64:
+    case LT_I64:
+    case LE_I64:
+    case GT_I64:
+    case GE_I64:
+        return true;
+    default:
+        return false;
+    }
+}
+
+bool isFloatOperation(uint16_t opcode)
+{
+    switch (opcode) {
+    case ADD_F64:
+    case SUB_F64:
+    case MUL_F64:
+    case DIV_F64:
+    case MOD_F64:
+    case NEG_F64:
+    case EQ_F64:
+    case NE_F64:
+    case LT_F64:
+    case LE_F64:
+    case GT_F64:
+    case GE_F64:
+        return true;
+    default:
+        return false;
+    }
+}
+
+bool isCommutative(uint16_t opcode)
+{
+    switch (opcode) {
+    case ADD_I64:
+    case MUL_I64:
+    case ADD_F64:
+    case MUL_F64:
+    case EQ_I64:
+    case NE_I64:
+    case EQ_F64:
+    case NE_F64:
+        return true;
+    default:
+        return false;
+    }
+}
+
+bool isNumber(StaticType type)
+{
+    return type == StaticType::Int || type == StaticType::Float;
+}
+
+std::string typeName(StaticType type)
+{
+    switch (type) {
+    case StaticType::Unknown:
+        return "unknown";
+    case StaticType::Bool:
+        return "bool";
+    case StaticType::Int:
+        return "int";
+    case StaticType::Float:
+        return "float";
+    default:
+        return "any";
+    }
+}
+
+StaticType constantType(const ValuePtr &constant)
+{
+    StaticType type = StaticType::Any;
+    std::visit(
+        [&](const auto &v) {
+            using T = std::decay_t<decltype(v)>;
+            if constexpr (std::is_same_v<T, bool>) {
+                type = StaticType::Bool;
+            } else if constexpr (std::is_integral_v<T>) {
+                type = StaticType::Int;
+            } else if constexpr (std::is_floating_point_v<T>) {
+                type = StaticType::Float;
+            }
+        },
+        constant->data);
+    return type;
+}
+
+std::string constantText(const ValuePtr &constant)
+{
+    std::string text = "nil";
+    std::visit(
+        [&](const auto &v) {
+            using T = std::decay_t<decltype(v)>;
+            if constexpr (std::is_same_v<T, bool>) {
+                text = v ? "true" : "false";
+            } else if constexpr (std::is_arithmetic_v<T>) {
+                text = std::to_string(v);
+            } else if constexpr (std::is_same_v<T, std::string>) {
+                text = "\"" + v + "\"";
+            } else if constexpr (!std::is_same_v<T, std::monostate>) {
+                text = "<constant>";
+            }
+        },
+        constant->data);
+    return text;
+}
+
+bool isNonZeroConstant(const ValuePtr &constant)
+{
+    bool nonZero = false;
+    std::visit(
+        [&](const auto &v) {
+            using T = std::decay_t<decltype(v)>;
+            if constexpr (std::is_arithmetic_v<T> && !std::is_same_v<T, bool>) {
+                nonZero = v != 0;
+            }
+        },
+        constant->data);
+    return nonZero;
+}
+
+// The instruction defining each value, nullptr for values nothing defines
+template<typename Function, typename Instruction>
+std::vector<Instruction *> definitions(Function &function)
+{
+    std::vector<Instruction *> result(function.valueCount, nullptr);
+    for (auto &block : function.blocks) {
+        for (auto *list : {&block.phis, &block.code}) {
+            for (auto &instruction : *list) {
+                if (instruction.result >= 0 && instruction.result < function.valueCount) {
+                    result[instruction.result] = &instruction;
+                }
+            }
+        }
+    }
+    return result;
+}
+
+std::vector<const SSAInstruction *> definitionsOf(const SSAFunction &function)
+{
+    return definitions<const SSAFunction, const SSAInstruction>(function);
+}
+
+std::vector<SSAInstruction *> definitionsOf(SSAFunction &function)
+{
+    return definitions<SSAFunction, SSAInstruction>(function);
+}
+
+// Blocks reachable from the entry, in reverse postorder
+std::vector<int32_t> reversePostorder(const SSAFunction &function)
+{
+    std::vector<int32_t> order;
+    std::vector<bool> seen(function.blocks.size(), false);
+    std::vector<std::pair<int32_t, size_t>> stack{{0, 0}};
+    seen[0] = true;
+    while (!stack.empty()) {
+        auto &[block, next] = stack.back();
+        const auto &successors = function.blocks[block].successors;
+        if (next < successors.size()) {
+            int32_t successor = successors[next++];
+            if (successor >= 0 && successor < int32_t(seen.size()) && !seen[successor]) {
+                seen[successor] = true;
+                stack.push_back({successor, 0});
+            }
+            continue;
+        }
+        order.push_back(block);
+        stack.pop_back();
+    }
+    std::reverse(order.begin(), order.end());
+    return order;
+}
+
+// Immediate dominator of each block, -1 for unreachable ones (Cooper, Harvey and Kennedy)
+std::vector<int32_t> immediateDominators(const SSAFunction &function,
+                                         const std::vector<int32_t> &order)
+{
+    std::vector<int32_t> position(function.blocks.size(), -1);
+    for (size_t i = 0; i < order.size(); ++i) {
+        position[order[i]] = int32_t(i);
+    }
+    std::vector<int32_t> idom(function.blocks.size(), -1);
+    idom[0] = 0;
+    auto intersect = [&](int32_t a, int32_t b) {
+        while (a != b) {
+            while (position[a] > position[b]) {
+                a = idom[a];
+            }
+            while (position[b] > position[a]) {
+                b = idom[b];
+            }
+        }
+        return a;
+    };
+    for (bool changed = true; changed;) {
+        changed = false;
+        for (size_t i = 1; i < order.size(); ++i) {
+            int32_t block = order[i];
+            int32_t dominator = -1;
+            for (int32_t predecessor : function.blocks[block].predecessors) {
+                if (predecessor < 0 || predecessor >= int32_t(idom.size())
+                    || idom[predecessor] < 0) {
+                    continue;
+                }
+                dominator = dominator < 0 ? predecessor : intersect(predecessor, dominator);
+            }
+            if (dominator != idom[block]) {
+                idom[block] = dominator;
+                changed = true;
+            }
+        }
+    }
+    return idom;
+}
+
+bool dominates(const std::vector<int32_t> &idom, int32_t a, int32_t b)
+{
+    while (b != a && b != 0 && b >= 0) {
+        b = idom[b];
+    }
+    return b == a;
+}
+
+// Operations that cannot fail, print or touch memory, whatever they are applied to
+bool isPure(const SSAInstruction &instruction,
+            const std::vector<const SSAInstruction *> &defined)
+{
+    uint16_t opcode = instruction.opcode;
+    if (opcode == TO_INT64 || opcode == TO_FLOAT64) {
+        const SSAInstruction *operand = defined[instruction.arguments[0]];
+        return operand && isNumber(operand->type);
+    }
+    return (isIntegerOperation(opcode) && opcode != DIV_I64 && opcode != MOD_I64)
+           || (isFloatOperation(opcode) && opcode != DIV_F64 && opcode != MOD_F64);
+}
+
+// Drops phis, constants and pure operations whose value nothing needs
+void removeDeadValues(SSAFunction &function)
+{
+    std::vector<const SSAInstruction *> defined = definitionsOf(std::as_const(function));
+    auto removable = [&](const SSAInstruction &instruction) {
+        uint16_t opcode = instruction.opcode;
+        return instruction.result >= 0
+               && (opcode == PHI || opcode == NIL || isConstantLoad(opcode)
+                   || isPure(instruction, defined));
+    };
+    std::vector<bool> live(function.valueCount, false);
+    std::vector<int32_t> work;
+    auto use = [&](int32_t value) {
+        if (value >= 0 && value < function.valueCount && !live[value]) {
+            live[value] = true;
+            work.push_back(value);
+        }
+    };
+    for (const auto &block : function.blocks) {
+        for (const auto &instruction : block.code) {
+            if (!removable(instruction)) {
+                use(instruction.result);
+                for (int32_t argument : instruction.arguments) {
+                    use(argument);
+                }
+            }
+        }
+    }
+    while (!work.empty()) {
+        int32_t value = work.back();
+        work.pop_back();
+        if (const SSAInstruction *definition = defined[value]) {
+            for (int32_t argument : definition->arguments) {
+                use(argument);
+            }
+        }
+    }
+    for (auto &block : function.blocks) {
+        for (auto *list : {&block.phis, &block.code}) {
+            list->erase(std::remove_if(list->begin(), list->end(),
+                                       [&](const SSAInstruction &instruction) {
+                                           return removable(instruction)
+                                                  && !live[instruction.result];
+                                       }),
+                        list->end());
+        }
+    }
+}
+
+class Builder;
+
+// Builds one function with the algorithm of Braun et al., "Simple and Efficient Construction
+// of Static Single Assignment Form": variables (and operand stack slots live across a block
+// boundary, keyed -(depth + 1)) are looked up backwards through the predecessors, and blocks
+// get phis where lookups meet. A block is sealed once all its predecessors are filled.
+class FunctionBuilder
+{
+public:
+    FunctionBuilder(Builder &shared, SSAFunction &function, int32_t id);
+
+    void run();
+
+private:
+    struct Span
+    {
+        size_t first = 0;
+        size_t last = 0;
+        bool fallsThrough = false; // ends before a leader, with no jump of its own
+    };
+
+    Builder &shared;
+    const std::vector<Instruction> &program;
+    SSAFunction &function;
+    int32_t id; // -1 for main
+    size_t start;
+    std::set<int64_t> promoted;
+
+    std::vector<Span> spans; // by block; block 0 has none
+    std::vector<std::unordered_map<int64_t, int32_t>> currentDef;
+    std::vector<std::map<int64_t, int32_t>> incomplete;
+    std::vector<bool> sealed;
+    std::vector<bool> filled;
+    std::vector<int> entryDepth;
+    std::vector<int32_t> forward; // by value: the value it was replaced by, itself if none
+    std::vector<std::pair<int32_t, size_t>> phiSite; // by value: block and index of a phi
+    int32_t nil = -1;
+
+    int64_t operand(size_t pc) const { return DecodedProgram::integerOperand(program[pc].value); }
+    bool inRegion(size_t pc) const;
+    std::string where(size_t pc) const;
+    void flow(size_t pc, std::vector<size_t> &next, bool &ends) const;
+
+    void discover();
+    int32_t newValue(int64_t origin);
+    int32_t emit(int32_t block, SSAInstruction instruction, bool defines);
+    int32_t find(int32_t value);
+    int32_t undefined(int64_t key);
+    int32_t newPhi(int32_t block, int64_t key);
+    void writeVariable(int64_t key, int32_t block, int32_t value);
+    int32_t readVariable(int64_t key, int32_t block);
+    int32_t addPhiOperands(int64_t key, int32_t phi);
+    int32_t tryRemoveTrivialPhi(int32_t phi);
+    void seal(int32_t block);
+    void fill(int32_t block);
+    void finish();
+};
+
+class Builder
+{
+public:
+    Builder(const std::vector<Instruction> &program, SSAProgram &ssa)
+        : program(program)
+        , ssa(ssa)
+    {}
+
+    void run();
+
+private:
+    friend class FunctionBuilder;
+
+    const std::vector<Instruction> &program;
+    SSAProgram &ssa;
+    std::map<std::string, int32_t> functionIds;
+    std::vector<size_t> defines; // by function id
+    std::vector<size_t> ends;    // one past each body
+    std::vector<int32_t> owner;  // function whose body each pc is in, -1 for main
+    std::set<int64_t> functionSlots;
+
+    int64_t operand(size_t pc) const { return DecodedProgram::integerOperand(program[pc].value); }
+    size_t jumpTarget(size_t pc) const
+    {
+        return program[pc].opcode == JUMP ? pc + 1 + operand(pc) : operand(pc);
+    }
+    void scan();
+    int32_t parameterCount(size_t entry, size_t end) const;
+    void inferTypes();
+};
+
+// The caller leaves the arguments on the stack and the prologue pops them, so the parameter
+// count is how far the straight-line start of the body dips below its entry depth, the
+// same rule every backend applies
+int32_t Builder::parameterCount(size_t entry, size_t end) const
+{
+    int depth = 0;
+    int lowest = 0;
+    for (size_t pc = entry; pc < end; ++pc) {
+        uint16_t opcode = program[pc].opcode;
+        int pops = 0;
+        int pushes = 0;
+        if (isUnaryOpcode(opcode)) {
+            pops = pushes = 1;
+        } else if (isBinaryOpcode(opcode)) {
+            pops = 2;
+            pushes = 1;
+        } else if (isConstantLoad(opcode) || opcode == LOAD_VARIABLE) {
+            pushes = 1;
+        } else if (opcode == STORE_VARIABLE || opcode == PRINT || opcode == POP) {
+            pops = 1;
+        } else if (opcode != NOP && opcode != DECLARE_VARIABLE) {
+            break;
+        }
+        depth -= pops;
+        lowest = std::min(lowest, depth);
+        depth += pushes;
+    }
+    return -lowest;
+}
+
+void Builder::scan()
+{
+    size_t n = program.size();
+    owner.assign(n, -1);
+    for (size_t pc = 0; pc < n; ++pc) {
+        Opcode opcode = program[pc].opcode;
+        if (opcode == DECLARE_VARIABLE || opcode == LOAD_VARIABLE || opcode == STORE_VARIABLE) {
+            ssa.slotCount = std::max(ssa.slotCount, operand(pc) + 1);
+        }
+        if (opcode != DEFINE_FUNCTION) {
+            continue;
+        }
+        if (owner[pc] >= 0) {
+            throw std::runtime_error("nested function definition at line "
+                                     + std::to_string(program[pc].lineNumber));
+        }
+        if (!program[pc].value || !std::holds_alternative<std::string>(program[pc].value->data)
+            || pc + 1 >= n || program[pc + 1].opcode != JUMP) {
+            throw std::runtime_error("function without a body at line "
+                                     + std::to_string(program[pc].lineNumber));
+        }
+        const std::string &name = std::get<std::string>(program[pc].value->data);
+        int32_t id = int32_t(defines.size());
+        if (!functionIds.emplace(name, id).second) {
+            throw std::runtime_error("function " + name + " is defined twice");
+        }
+        size_t end = std::min(jumpTarget(pc + 1), n);
+        defines.push_back(pc);
+        ends.push_back(end);
+        for (size_t body = pc + 2; body < end; ++body) {
+            owner[body] = id;
+        }
+    }
+    for (size_t pc = 0; pc < n; ++pc) {
+        Opcode opcode = program[pc].opcode;
+        if (owner[pc] >= 0
+            && (opcode == DECLARE_VARIABLE || opcode == LOAD_VARIABLE
+                || opcode == STORE_VARIABLE)) {
+            functionSlots.insert(operand(pc));
+        }
+    }
+}
+
+void Builder::run()
+{
+    scan();
+    for (size_t id = 0; id < defines.size(); ++id) {
+        const Instruction &define = program[defines[id]];
+        SSAFunction function;
+        function.name = std::get<std::string>(define.value->data);
+        function.definition = define.value;
+        function.line = define.lineNumber;
+        function.paramCount = parameterCount(defines[id] + 2, ends[id]);
+        ssa.functions.push_back(std::move(function));
+    }
+    for (size_t id = 0; id < defines.size(); ++id) {
+        FunctionBuilder(*this, ssa.functions[id], int32_t(id)).run();
+    }
+    FunctionBuilder(*this, ssa.main, -1).run();
+    inferTypes();
+}
+
+// Types from the operations, then from call sites into parameters and from returns into
+// calls, until nothing changes. Parameters no call reaches, and results of functions that
+// never return a value, can hold anything.
+void Builder::inferTypes()
+{
+    std::vector<SSAFunction *> all{&ssa.main};
+    for (auto &function : ssa.functions) {
+        all.push_back(&function);
+    }
+    for (SSAFunction *function : all) {
+        function->result = StaticType::Unknown;
+        for (auto &block : function->blocks) {
+            for (auto *list : {&block.phis, &block.code}) {
+                for (auto &instruction : *list) {
+                    if (isConstantLoad(instruction.opcode)) {
+                        instruction.type = constantType(ssa.constants.at(instruction.operand));
+                    } else if (instruction.result >= 0 && instruction.opcode != NIL
+                               && instruction.opcode != LOAD_VARIABLE) {
+                        instruction.type = StaticType::Unknown;
+                    }
+                }
+            }
+        }
+    }
+
+    bool changed = true;
+    auto update = [&](StaticType &type, StaticType with) {
+        StaticType joined = joinTypes(type, with);
+        if (joined != type) {
+            type = joined;
+            changed = true;
+        }
+    };
+    while (changed) {
+        changed = false;
+        for (SSAFunction *function : all) {
+            std::vector<SSAInstruction *> defined = definitionsOf(*function);
+            auto typeOf = [&](int32_t value) {
+                return defined[value] ? defined[value]->type : StaticType::Any;
+            };
+            for (auto &block : function->blocks) {
+                for (auto &phi : block.phis) {
+                    for (int32_t argument : phi.arguments) {
+                        update(phi.type, typeOf(argument));
+                    }
+                }
+                for (auto &instruction : block.code) {
+                    uint16_t opcode = instruction.opcode;
+                    const auto &arguments = instruction.arguments;
+                    if (isUnaryOpcode(opcode)) {
+                        update(instruction.type,
+                               resultType(opcode, typeOf(arguments[0]), StaticType::Any, false));
+                    } else if (isBinaryOpcode(opcode)) {
+                        const SSAInstruction *divisor = defined[arguments[1]];
+                        bool nonZero = divisor && isConstantLoad(divisor->opcode)
+                                       && isNonZeroConstant(ssa.constants.at(divisor->operand));
+                        update(instruction.type, resultType(opcode, typeOf(arguments[0]),
+                                                            typeOf(arguments[1]), nonZero));
+                    } else if (opcode == INVOKE_FUNCTION) {
+                        SSAFunction &callee = ssa.functions[instruction.operand];
+                        for (size_t i = 0; i < arguments.size(); ++i) {
+                            update(callee.blocks[0].code[i].type, typeOf(arguments[i]));
+                        }
+                        update(instruction.type, callee.result);
+                    } else if (opcode == RETURN_VALUE) {
+                        update(function->result, typeOf(arguments[0]));
+                    } else if (opcode == RETURN) {
+                        update(function->result, StaticType::Any);
+                    }
+                }
+            }
+        }
+        if (changed) {
+            continue;
+        }
+        auto settle = [&](StaticType &type) {
+            if (type == StaticType::Unknown) {
+                type = StaticType::Any;
+                changed = true;
+            }
+        };
+        for (SSAFunction *function : all) {
+            for (auto &instruction : function->blocks[0].code) {
+                if (instruction.opcode == PARAM) {
+                    settle(instruction.type);
+                }
+            }
+            settle(function->result);
+        }
+    }
+    for (SSAFunction *function : all) {
+        for (auto &block : function->blocks) {
+            for (auto *list : {&block.phis, &block.code}) {
+                for (auto &instruction : *list) {
+                    if (instruction.type == StaticType::Unknown) {
+                        instruction.type = StaticType::Any;
+                    }
+                }
+            }
+        }
+    }
+}
+
+FunctionBuilder::FunctionBuilder(Builder &shared, SSAFunction &function, int32_t id)
+    : shared(shared)
+    , program(shared.program)
+    , function(function)
+    , id(id)
+    , start(id >= 0 ? shared.defines[id] + 2 : 0)
+{
+    size_t begin = id >= 0 ? start : 0;
+    size_t end = id >= 0 ? shared.ends[id] : program.size();
+    for (size_t pc = begin; pc < end; ++pc) {
+        if (program[pc].opcode == DECLARE_VARIABLE && shared.owner[pc] == id
+            && (id >= 0 || !shared.functionSlots.count(operand(pc)))) {
+            promoted.insert(operand(pc));
+        }
+    }
+}
+
+bool FunctionBuilder::inRegion(size_t pc) const
+{
+    return pc < program.size() && shared.owner[pc] == id
+           && (id < 0 || (pc >= start && pc < shared.ends[id]));
+}
+
+std::string FunctionBuilder::where(size_t pc) const
+{
+    return (id >= 0 ? function.name : std::string("main")) + " at line "
+           + std::to_string(pc < program.size() ? program[pc].lineNumber : 0);
+}
+
+// Successors of the instruction at `pc`, and whether a block has to end there
+void FunctionBuilder::flow(size_t pc, std::vector<size_t> &next, bool &ends) const
+{
+    next.clear();
+    ends = true;
+    switch (program[pc].opcode) {
+    case JUMP:
+        next.push_back(shared.jumpTarget(pc));
+        break;
+    case JUMP_IF_FALSE:
+        next.push_back(pc + 1);
+        next.push_back(shared.jumpTarget(pc));
+        break;
+    case DEFINE_FUNCTION:
+        next.push_back(shared.jumpTarget(pc + 1)); // the function is a jump over its body
+        break;
+    case RETURN:
+    case RETURN_VALUE:
+        if (id < 0) {
+            throw std::runtime_error("return outside of a function in " + where(pc));
+        }
+        break;
+    case HALT:
+        break;
+    default:
+        next.push_back(pc + 1);
+        ends = false;
+        break;
+    }
+    for (auto &target : next) {
+        if (id < 0 && target >= program.size()) {
+            target = PROGRAM_END;
+        } else if (!inRegion(target)) {
+            throw std::runtime_error("control leaves the code of " + where(pc));
+        }
+    }
+}
+
+// Finds the reachable instructions and splits them into blocks, with their edges
+void FunctionBuilder::discover()
+{
+    std::set<size_t> leaders{start};
+    std::set<size_t> reached;
+    std::vector<size_t> work{start};
+    std::vector<size_t> next;
+    bool ends;
+    while (!work.empty()) {
+        size_t pc = work.back();
+        work.pop_back();
+        if (pc == PROGRAM_END || !reached.insert(pc).second) {
+            continue;
+        }
+        flow(pc, next, ends);
+        for (size_t target : next) {
+            if (ends) {
+                leaders.insert(target);
+            }
+            work.push_back(target);
+        }
+    }
+
+    std::map<size_t, int32_t> blockAt;
+    spans.assign(1, Span{});
+    function.blocks.assign(1, SSABlock{});
+    function.blocks[0].pc = start;
+    for (size_t leader : leaders) {
+        if (!reached.count(leader)) {
+            continue;
+        }
+        Span span;
+        span.first = span.last = leader;
+        for (size_t pc = leader;; ++pc) {
+            span.last = pc;
+            flow(pc, next, ends);
+            if (ends) {
+                break;
+            }
+            if (next[0] == PROGRAM_END || leaders.count(next[0])) {
+                span.fallsThrough = true;
+                break;
+            }
+        }
+        blockAt[leader] = int32_t(function.blocks.size());
+        SSABlock block;
+        block.pc = leader;
+        function.blocks.push_back(std::move(block));
+        spans.push_back(span);
+    }
+
+    function.blocks[0].successors.push_back(blockAt.at(start));
+    for (size_t b = 1; b < function.blocks.size(); ++b) {
+        flow(spans[b].last, next, ends);
+        for (size_t target : next) {
+            if (target != PROGRAM_END) {
+                function.blocks[b].successors.push_back(blockAt.at(target));
+            }
+        }
+    }
+    for (size_t b = 0; b < function.blocks.size(); ++b) {
+        for (int32_t successor : function.blocks[b].successors) {
+            function.blocks[successor].predecessors.push_back(int32_t(b));
+        }
+    }
+}
+
+int32_t FunctionBuilder::newValue(int64_t origin)
+{
+    int32_t value = int32_t(forward.size());
+    forward.push_back(value);
+    phiSite.push_back({-1, 0});
+    function.origins.push_back(origin);
+    return value;
+}
+
+// Appends to the block's code, before its terminator if it already has one
+int32_t FunctionBuilder::emit(int32_t block, SSAInstruction instruction, bool defines)
+{
+    if (defines) {
+        instruction.result = newValue(-1);
+    }
+    auto &code = function.blocks[block].code;
+    size_t at = !code.empty() && isTerminator(code.back().opcode) ? code.size() - 1 : code.size();
+    int32_t result = instruction.result;
+    code.insert(code.begin() + at, std::move(instruction));
+    return result;
+}
+
+int32_t FunctionBuilder::find(int32_t value)
+{
+    int32_t root = value;
+    while (forward[root] != root) {
+        root = forward[root];
+    }
+    while (forward[value] != root) {
+        int32_t next = forward[value];
+        forward[value] = root;
+        value = next;
+    }
+    return root;
+}
+
+// What a read finds where nothing was stored: nil for a variable, as a call starts with nil
+// locals; an operand stack slot has to come from somewhere
+int32_t FunctionBuilder::undefined(int64_t key)
+{
+    if (key < 0) {
+        throw std::runtime_error("operand stack of " + where(start) + " does not balance");
+    }
+    if (nil < 0) {
+        SSAInstruction instruction{NIL};
+        instruction.line = function.line;
+        nil = emit(0, std::move(instruction), true);
+    }
+    return nil;
+}
+
+int32_t FunctionBuilder::newPhi(int32_t block, int64_t key)
+{
+    SSAInstruction phi{PHI};
+    phi.result = newValue(key >= 0 ? key : -1);
+    phi.line = program[function.blocks[block].pc].lineNumber;
+    phiSite[phi.result] = {block, function.blocks[block].phis.size()};
+    function.blocks[block].phis.push_back(std::move(phi));
+    return int32_t(forward.size()) - 1;
+}
+
+void FunctionBuilder::writeVariable(int64_t key, int32_t block, int32_t value)
+{
+    currentDef[block][key] = value;
+}
+
+int32_t FunctionBuilder::readVariable(int64_t key, int32_t block)
+{
+    auto it = currentDef[block].find(key);
+    if (it != currentDef[block].end()) {
+        return find(it->second);
+    }
+    const auto &predecessors = function.blocks[block].predecessors;
+    int32_t value;
+    if (!sealed[block]) {
+        value = newPhi(block, key);
+        incomplete[block][key] = value;
+    } else if (predecessors.size() == 1) {
+        value = readVariable(key, predecessors[0]);
+    } else if (predecessors.empty()) {
+        value = undefined(key);
+    } else {
+        value = newPhi(block, key);
+        currentDef[block][key] = value;
+        value = addPhiOperands(key, value);
+    }
+    currentDef[block][key] = value;
+    return value;
+}
+
+int32_t FunctionBuilder::addPhiOperands(int64_t key, int32_t phi)
+{
+    auto [block, index] = phiSite[phi];
+    std::vector<int32_t> predecessors = function.blocks[block].predecessors;
+    std::vector<int32_t> arguments;
+    for (int32_t predecessor : predecessors) {
+        arguments.push_back(readVariable(key, predecessor));
+    }
+    function.blocks[block].phis[index].arguments = std::move(arguments);
+    return tryRemoveTrivialPhi(phi);
+}
+
+// A phi whose arguments are all one value (or itself) is that value
+int32_t FunctionBuilder::tryRemoveTrivialPhi(int32_t phi)
+{
+    auto [block, index] = phiSite[phi];
+    int32_t same = -1;
+    for (int32_t argument : function.blocks[block].phis[index].arguments) {
+        argument = find(argument);
+        if (argument == same || argument == phi) {
+            continue;
+        }
+        if (same >= 0) {
+            return phi;
+        }
+        same = argument;
+    }
+    if (same < 0) {
+        same = undefined(function.origins[phi]);
+    }
+    forward[phi] = same;
+    return same;
+}
+
+void FunctionBuilder::seal(int32_t block)
+{
+    std::map<int64_t, int32_t> pending = std::move(incomplete[block]);
+    incomplete[block].clear();
+    for (const auto &[key, phi] : pending) {
+        addPhiOperands(key, phi);
+    }
+    sealed[block] = true;
+}
+
+void FunctionBuilder::fill(int32_t block)
+{
+    std::vector<int32_t> stack;
+    auto push = [&](int32_t value) { stack.push_back(value); };
+
+    if (block == 0) {
+        for (int32_t i = 0; i < function.paramCount; ++i) {
+            SSAInstruction param{PARAM};
+            param.operand = i;
+            param.line = function.line;
+            push(emit(0, std::move(param), true));
+        }
+        SSAInstruction jump{JUMP};
+        jump.line = function.line;
+        emit(0, std::move(jump), false);
+    } else {
+        for (int depth = 0; depth < entryDepth[block]; ++depth) {
+            push(readVariable(-(depth + 1), block));
+        }
+        const Span &span = spans[block];
+        for (size_t pc = span.first; pc <= span.last; ++pc) {
+            const Instruction &source = program[pc];
+            Opcode opcode = source.opcode;
+            auto pop = [&]() {
+                if (stack.empty()) {
+                    throw std::runtime_error(registerOpcodeName(opcode) + " pops an empty stack in "
+                                             + where(pc));
+                }
+                int32_t value = stack.back();
+                stack.pop_back();
+                return value;
+            };
+            SSAInstruction instruction{opcode};
+            instruction.line = source.lineNumber;
+            instruction.value = source.value;
+            switch (opcode) {
+            case NOP:
+                break;
+            case DECLARE_VARIABLE:
+                if (!promoted.count(operand(pc))) {
+                    instruction.operand = operand(pc);
+                    emit(block, std::move(instruction), false);
+                }
+                break;
+            case LOAD_CONST:
+            case LOAD_STR:
+            case BOOLEAN:
+                instruction.operand = operand(pc);
+                push(emit(block, std::move(instruction), true));
+                break;
+            case LOAD_VARIABLE:
+                if (promoted.count(operand(pc))) {
+                    push(readVariable(operand(pc), block));
+                } else {
+                    instruction.operand = operand(pc);
+                    push(emit(block, std::move(instruction), true));
+                }
+                break;
+            case STORE_VARIABLE: {
+                int64_t slot = operand(pc);
+                int32_t value = pop();
+                if (!promoted.count(slot)) {
+                    instruction.operand = slot;
+                    instruction.arguments = {value};
+                    emit(block, std::move(instruction), false);
+                } else {
+                    int64_t &origin = function.origins[value];
+                    if (origin < 0) {
+                        origin = slot;
+                    } else if (origin != slot) {
+                        ++shared.ssa.statistics.copies;
+                    }
+                    writeVariable(slot, block, value);
+                }
+                break;
+            }
+            case POP:
+                pop();
+                break;
+            case PRINT:
+                instruction.arguments = {pop()};
+                emit(block, std::move(instruction), false);
+                break;
+            case INVOKE_FUNCTION: {
+                auto callee = source.value && std::holds_alternative<std::string>(source.value->data)
+                                  ? shared.functionIds.find(std::get<std::string>(source.value->data))
+                                  : shared.functionIds.end();
+                if (callee == shared.functionIds.end()) {
+                    throw std::runtime_error("call of an undefined function in " + where(pc));
+                }
+                instruction.operand = callee->second;
+                instruction.arguments.resize(shared.ssa.functions[callee->second].paramCount);
+                for (auto it = instruction.arguments.rbegin(); it != instruction.arguments.rend();
+                     ++it) {
+                    *it = pop();
+                }
+                push(emit(block, std::move(instruction), true));
+                break;
+            }
+            case JUMP:
+            case DEFINE_FUNCTION:
+                instruction = SSAInstruction{JUMP};
+                instruction.line = source.lineNumber;
+                emit(block, std::move(instruction), false);
+                break;
+            case JUMP_IF_FALSE:
+                instruction.value = nullptr;
+                instruction.arguments = {pop()};
+                emit(block, std::move(instruction), false);
+                break;
+            case RETURN_VALUE:
+                instruction.arguments = {pop()};
+                [[fallthrough]];
+            case RETURN:
+                if (!stack.empty()) {
+                    throw std::runtime_error("return leaves values on the stack in " + where(pc));
+                }
+                emit(block, std::move(instruction), false);
+                break;
+            case HALT:
+                emit(block, std::move(instruction), false);
+                break;
+            default:
+                if (isUnaryOpcode(opcode)) {
+                    instruction.value = nullptr;
+                    instruction.arguments = {pop()};
+                } else if (isBinaryOpcode(opcode)) {
+                    instruction.value = nullptr;
+                    int32_t right = pop();
+                    instruction.arguments = {pop(), right};
+                } else {
+                    throw std::runtime_error(registerOpcodeName(opcode) + " has no SSA form, in "
+                                             + where(pc));
+                }
+                push(emit(block, std::move(instruction), true));
+                break;
+            }
+        }
+        if (span.fallsThrough) {
+            SSAInstruction instruction{function.blocks[block].successors.empty() ? uint16_t(END)
+                                                                                 : uint16_t(JUMP)};
+            instruction.line = program[span.last].lineNumber;
+            emit(block, std::move(instruction), false);
+        }
+    }
+
+    for (size_t depth = 0; depth < stack.size(); ++depth) {
+        writeVariable(-int64_t(depth + 1), block, stack[depth]);
+    }
+    for (int32_t successor : function.blocks[block].successors) {
+        if (entryDepth[successor] < 0) {
+            entryDepth[successor] = int(stack.size());
+        } else if (entryDepth[successor] != int(stack.size())) {
+            throw std::runtime_error("operand stack depths disagree where control flow meets in "
+                                     + where(function.blocks[successor].pc));
+        }
+    }
+}
+
+// Resolves replaced values, removes the phis that turned out trivial, then the dead values
+void FunctionBuilder::finish()
+{
+    for (bool changed = true; changed;) {
+        changed = false;
+        for (auto &block : function.blocks) {
+            for (auto *list : {&block.phis, &block.code}) {
+                for (auto &instruction : *list) {
+                    for (auto &argument : instruction.arguments) {
+                        argument = find(argument);
+                    }
+                }
+            }
+            block.phis.erase(std::remove_if(block.phis.begin(), block.phis.end(),
+                                            [&](const SSAInstruction &phi) {
+                                                return find(phi.result) != phi.result;
+                                            }),
+                             block.phis.end());
+            for (size_t index = 0; index < block.phis.size(); ++index) {
+                phiSite[block.phis[index].result].second = index;
+            }
+        }
+        for (size_t b = 0; b < function.blocks.size(); ++b) {
+            for (size_t index = 0; index < function.blocks[b].phis.size(); ++index) {
+                int32_t phi = function.blocks[b].phis[index].result;
+                phiSite[phi] = {int32_t(b), index};
+                if (tryRemoveTrivialPhi(phi) != phi) {
+                    changed = true;
+                }
+            }
+        }
+    }
+    function.valueCount = int32_t(forward.size());
+    removeDeadValues(function);
+}
+
+void FunctionBuilder::run()
+{
+    discover();
+    size_t count = function.blocks.size();
+    currentDef.assign(count, {});
+    incomplete.assign(count, {});
+    sealed.assign(count, false);
+    filled.assign(count, false);
+    entryDepth.assign(count, -1);
+    entryDepth[0] = 0;
+
+    std::vector<int32_t> order = reversePostorder(function);
+    sealed[0] = true;
+    for (int32_t block : order) {
+        fill(block);
+        filled[block] = true;
+        for (int32_t successor : function.blocks[block].successors) {
+            const auto &predecessors = function.blocks[successor].predecessors;
+            if (!sealed[successor]
+                && std::all_of(predecessors.begin(), predecessors.end(),
+                               [&](int32_t predecessor) { return bool(filled[predecessor]); })) {
+                seal(successor);
+            }
+        }
+    }
+    for (size_t block = 0; block < count; ++block) {
+        if (!sealed[block]) {
+            seal(int32_t(block));
+        }
+    }
+    finish();
+}
+
+} // namespace
+
+SSAProgram SSAProgram::build(const std::vector<Instruction> &program,
+                             const ConstantPool &constants)
+{
+    SSAProgram ssa;
+    ssa.constants = constants.values();
+    Builder(program, ssa).run();
+    return ssa;
+}
+
+std::vector<std::string> SSAProgram::verify() const
+{
+    std::vector<std::string> problems;
+    auto check = [&](const SSAFunction &function) {
+        std::string name = function.name.empty() ? "main" : function.name;
+        auto problem = [&](size_t block, const std::string &text) {
+            problems.push_back(name + ": b" + std::to_string(block) + ": " + text);
+        };
+        if (function.blocks.empty()) {
+            problems.push_back(name + ": no entry block");
+            return;
+        }
+        if (!function.blocks[0].predecessors.empty()) {
+            problem(0, "the entry block has predecessors");
+        }
+
+        // Control flow
+        int32_t blockCount = int32_t(function.blocks.size());
+        std::map<std::pair<int32_t, int32_t>, int> edges;
+        for (int32_t b = 0; b < blockCount; ++b) {
+            const SSABlock &block = function.blocks[b];
+            if (block.code.empty() || !isTerminator(block.code.back().opcode)) {
+                problem(b, "does not end in a terminator");
+            }
+            for (size_t i = 0; i + 1 < block.code.size(); ++i) {
+                if (isTerminator(block.code[i].opcode)) {
+                    problem(b, "terminator " + ssaOpcodeName(block.code[i].opcode)
+                                   + " before the end of the block");
+                }
+            }
+            if (!block.code.empty()
+                && block.successors.size() != successorCount(block.code.back().opcode)) {
+                problem(b, "wrong number of successors for "
+                               + ssaOpcodeName(block.code.back().opcode));
+            }
+            for (int32_t successor : block.successors) {
+                if (successor <= 0 || successor >= blockCount) {
+                    problem(b, "successor b" + std::to_string(successor) + " does not exist");
+                } else {
+                    ++edges[{b, successor}];
+                }
+            }
+            for (int32_t predecessor : block.predecessors) {
+                if (predecessor < 0 || predecessor >= blockCount) {
+                    problem(b, "predecessor b" + std::to_string(predecessor) + " does not exist");
+                } else {
+                    --edges[{predecessor, b}];
+                }
+            }
+        }
+        for (const auto &[edge, balance] : edges) {
+            if (balance != 0) {
+                problem(edge.first, "edge to b" + std::to_string(edge.second)
+                                        + " is not mirrored by the predecessor list");
+            }
+        }
+        std::vector<int32_t> order = reversePostorder(function);
+        std::vector<int32_t> idom = immediateDominators(function, order);
+        for (int32_t b = 0; b < blockCount; ++b) {
+            if (idom[b] < 0) {
+                problem(b, "is unreachable");
+            }
+        }
+
+        // Definitions
+        std::vector<std::pair<int32_t, int32_t>> definedAt(function.valueCount, {-1, -1});
+        std::vector<const SSAInstruction *> defined(function.valueCount, nullptr);
+        for (int32_t b = 0; b < blockCount; ++b) {
+            const SSABlock &block = function.blocks[b];
+            int32_t position = 0;
+            for (const auto *list : {&block.phis, &block.code}) {
+                for (const auto &instruction : *list) {
+                    int32_t result = instruction.result;
+                    if (result >= function.valueCount) {
+                        problem(b, "%" + std::to_string(result) + " is out of range");
+                    } else if (result >= 0 && defined[result]) {
+                        problem(b, "%" + std::to_string(result) + " is defined twice");
+                    } else if (result >= 0) {
+                        defined[result] = &instruction;
+                        definedAt[result] = {b, position};
+                    }
+                    ++position;
+                }
+            }
+        }
+        auto available = [&](int32_t value, int32_t block, int32_t position) {
+            if (value < 0 || value >= function.valueCount || !defined[value]) {
+                return false;
+            }
+            auto [at, index] = definedAt[value];
+            return at == block ? index < position : idom[block] >= 0 && dominates(idom, at, block);
+        };
+
+        // Instructions
+        for (int32_t b = 0; b < blockCount; ++b) {
+            const SSABlock &block = function.blocks[b];
+            for (const auto &phi : block.phis) {
+                std::string label = "%" + std::to_string(phi.result);
+                if (phi.opcode != PHI || phi.result < 0) {
+                    problem(b, label + ": " + ssaOpcodeName(phi.opcode) + " among the phis");
+                    continue;
+                }
+                if (phi.arguments.size() != block.predecessors.size()) {
+                    problem(b, label + ": phi has " + std::to_string(phi.arguments.size())
+                                   + " arguments for " + std::to_string(block.predecessors.size())
+                                   + " predecessors");
+                    continue;
+                }
+                StaticType joined = StaticType::Unknown;
+                for (size_t i = 0; i < phi.arguments.size(); ++i) {
+                    int32_t predecessor = block.predecessors[i];
+                    int32_t end = predecessor >= 0 && predecessor < blockCount
+                                      ? int32_t(function.blocks[predecessor].phis.size()
+                                                + function.blocks[predecessor].code.size())
+                                      : 0;
+                    if (!available(phi.arguments[i], predecessor, end)) {
+                        problem(b, label + ": argument %" + std::to_string(phi.arguments[i])
+                                       + " is not available at the end of b"
+                                       + std::to_string(predecessor));
+                    } else {
+                        joined = joinTypes(joined, defined[phi.arguments[i]]->type);
+                    }
+                }
+                if (joinTypes(phi.type, joined) != phi.type) {
+                    problem(b, label + ": phi typed " + typeName(phi.type) + " joins "
+                                   + typeName(joined));
+                }
+            }
+            int32_t position = int32_t(block.phis.size());
+            for (const auto &instruction : block.code) {
+                uint16_t opcode = instruction.opcode;
+                std::string label = ssaOpcodeName(opcode);
+                if (instruction.result >= 0) {
+                    label = "%" + std::to_string(instruction.result) + " = " + label;
+                }
+                size_t arity = 0;
+                bool result = false;
+                if (opcode == PHI || (opcode == PARAM && b != 0)) {
+                    problem(b, label + " outside its place");
+                } else if (isUnaryOpcode(opcode)) {
+                    arity = 1;
+                    result = true;
+                } else if (isBinaryOpcode(opcode)) {
+                    arity = 2;
+                    result = true;
+                } else if (opcode == INVOKE_FUNCTION) {
+                    result = true;
+                    if (instruction.operand < 0 || instruction.operand >= int64_t(functions.size())) {
+                        problem(b, label + " calls an undefined function");
+                    } else {
+                        arity = functions[instruction.operand].paramCount;
+                    }
+                } else if (opcode == PRINT || opcode == STORE_VARIABLE || opcode == JUMP_IF_FALSE
+                           || opcode == RETURN_VALUE) {
+                    arity = 1;
+                } else {
+                    result = opcode == PARAM || opcode == NIL || opcode == LOAD_VARIABLE
+                             || isConstantLoad(opcode);
+                }
+                if (instruction.arguments.size() != arity) {
+                    problem(b, label + " has " + std::to_string(instruction.arguments.size())
+                                   + " arguments instead of " + std::to_string(arity));
+                }
+                if (result != (instruction.result >= 0)) {
+                    problem(b, label + (result ? " defines no value" : " defines a value"));
+                }
+                bool argumentsAvailable = true;
+                for (int32_t argument : instruction.arguments) {
+                    if (!available(argument, b, position)) {
+                        problem(b, label + ": %" + std::to_string(argument)
+                                       + " is used where its definition does not dominate");
+                        argumentsAvailable = false;
+                    }
+                }
+                ++position;
+                if (!argumentsAvailable || instruction.arguments.size() != arity) {
+                    continue;
+                }
+
+                // Types
+                auto typeOf = [&](size_t i) { return defined[instruction.arguments[i]]->type; };
+                if (instruction.result >= 0 && instruction.type == StaticType::Unknown) {
+                    problem(b, label + " has no type");
+                }
+                StaticType expected = StaticType::Unknown;
+                if (isUnaryOpcode(opcode)) {
+                    expected = resultType(opcode, typeOf(0), StaticType::Any, false);
+                } else if (isBinaryOpcode(opcode)) {
+                    const SSAInstruction *divisor = defined[instruction.arguments[1]];
+                    bool nonZero = isConstantLoad(divisor->opcode)
+                                   && isNonZeroConstant(constants.at(divisor->operand));
+                    expected = resultType(opcode, typeOf(0), typeOf(1), nonZero);
+                } else if (opcode == INVOKE_FUNCTION) {
+                    expected = functions[instruction.operand].result;
+                } else if (isConstantLoad(opcode)) {
+                    expected = constantType(constants.at(instruction.operand));
+                }
+                if (joinTypes(instruction.type, expected) != instruction.type) {
+                    problem(b, label + " is typed " + typeName(instruction.type) + " but produces "
+                                   + typeName(expected));
+                }
+                for (size_t i = 0; i < arity; ++i) {
+                    StaticType type = typeOf(i);
+                    bool conflicts = type != StaticType::Any
+                                     && ((isIntegerOperation(opcode) && type != StaticType::Int)
+                                         || (isFloatOperation(opcode) && type != StaticType::Float));
+                    if (conflicts) {
+                        problem(b, label + " applied to a " + typeName(type) + " operand");
+                    }
+                }
+            }
+        }
+    };
+    check(main);
+    for (const auto &function : functions) {
+        check(function);
+    }
+    return problems;
+}
+
+void SSAProgram::print(std::ostream &out) const
+{
+    auto printFunction = [&](const SSAFunction &function) {
+        const auto &entry = function.blocks.empty() ? std::vector<SSAInstruction>{}
+                                                    : function.blocks[0].code;
+        if (function.name.empty()) {
+            out << "function <main>" << std::endl;
+        } else {
+            out << "function " << function.name << "(";
+            std::string separator;
+            for (const auto &instruction : entry) {
+                if (instruction.opcode == PARAM) {
+                    out << separator << "%" << instruction.result << ": "
+                        << typeName(instruction.type);
+                    separator = ", ";
+                }
+            }
+            out << ") -> " << typeName(function.result) << std::endl;
+        }
+        for (size_t b = 0; b < function.blocks.size(); ++b) {
+            const SSABlock &block = function.blocks[b];
+            out << "  b" << b << ":";
+            if (!block.predecessors.empty()) {
+                out << "  ; preds";
+                for (int32_t predecessor : block.predecessors) {
+                    out << " b" << predecessor;
+                }
+            }
+            out << std::endl;
+            for (const auto *list : {&block.phis, &block.code}) {
+                for (const auto &instruction : *list) {
+                    uint16_t opcode = instruction.opcode;
+                    out << "    ";
+                    if (instruction.result >= 0) {
+                        out << "%" << instruction.result << " = ";
+                    }
+                    out << ssaOpcodeName(opcode);
+                    std::string separator = " ";
+                    if (isConstantLoad(opcode)) {
+                        out << " " << constantText(constants.at(instruction.operand));
+                    } else if (opcode == PARAM) {
+                        out << " " << instruction.operand;
+                    } else if (opcode == LOAD_VARIABLE || opcode == STORE_VARIABLE
+                               || opcode == DECLARE_VARIABLE) {
+                        out << " v" << instruction.operand;
+                        separator = ", ";
+                    } else if (opcode == INVOKE_FUNCTION) {
+                        out << " " << functions.at(instruction.operand).name << "(";
+                        separator = "";
+                    }
+                    for (int32_t argument : instruction.arguments) {
+                        out << separator << "%" << argument;
+                        separator = ", ";
+                    }
+                    if (opcode == INVOKE_FUNCTION) {
+                        out << ")";
+                    }
+                    if (opcode == JUMP || opcode == JUMP_IF_FALSE) {
+                        for (int32_t successor : block.successors) {
+                            out << separator << "b" << successor;
+                            separator = ", ";
+                        }
+                    }
+                    if (instruction.result >= 0) {
+                        out << " : " << typeName(instruction.type);
+                    }
+                    out << std::endl;
+                }
+            }
+        }
+    };
+    for (const auto &function : functions) {
+        printFunction(function);
+    }
+    printFunction(main);
+}
+
+void SSAProgram::eliminateCommonSubexpressions()
+{
+    auto eliminate = [&](SSAFunction &function) {
+        std::vector<int32_t> order = reversePostorder(function);
+        std::vector<int32_t> idom = immediateDominators(function, order);
+        std::vector<std::vector<int32_t>> children(function.blocks.size());
+        for (int32_t block : order) {
+            if (block != 0) {
+                children[idom[block]].push_back(block);
+            }
+        }
+        std::vector<const SSAInstruction *> defined = definitionsOf(std::as_const(function));
+        std::vector<int32_t> replacement(function.valueCount);
+        for (int32_t value = 0; value < function.valueCount; ++value) {
+            replacement[value] = value;
+        }
+
+        // Walks the dominator tree; the table holds the operations of the blocks on the path
+        // from the entry, so every value found dominates the block being visited
+        std::map<std::vector<int64_t>, int32_t> available;
+        std::vector<std::pair<int32_t, size_t>> stack{{0, 0}};
+        std::vector<std::vector<std::vector<int64_t>>> added(function.blocks.size());
+        auto visit = [&](int32_t b) {
+            for (auto &instruction : function.blocks[b].code) {
+                for (auto &argument : instruction.arguments) {
+                    argument = replacement[argument];
+                }
+                if (instruction.result < 0 || !isPure(instruction, defined)) {
+                    continue;
+                }
+                // Constants by pool index, since every load of one is a value of its own
+                std::vector<int64_t> key{instruction.opcode};
+                for (int32_t argument : instruction.arguments) {
+                    const SSAInstruction *operand = defined[argument];
+                    key.push_back(isConstantLoad(operand->opcode) ? -1 - operand->operand
+                                                                  : argument);
+                }
+                if (isCommutative(instruction.opcode)) {
+                    std::sort(key.begin() + 1, key.end());
+                }
+                auto [it, inserted] = available.emplace(key, instruction.result);
+                if (inserted) {
+                    added[b].push_back(std::move(key));
+                } else {
+                    replacement[instruction.result] = it->second;
+                    ++statistics.commonSubexpressions;
+                }
+            }
+        };
+        visit(0);
+        while (!stack.empty()) {
+            auto &[block, next] = stack.back();
+            if (next < children[block].size()) {
+                int32_t child = children[block][next++];
+                visit(child);
+                stack.push_back({child, 0});
+                continue;
+            }
+            for (const auto &key : added[block]) {
+                available.erase(key);
+            }
+            stack.pop_back();
+        }
+
+        for (auto &block : function.blocks) {
+            for (auto *list : {&block.phis, &block.code}) {
+                for (auto &instruction : *list) {
+                    for (auto &argument : instruction.arguments) {
+                        argument = replacement[argument];
+                    }
+                }
+            }
+            block.code.erase(std::remove_if(block.code.begin(), block.code.end(),
+                                            [&](const SSAInstruction &instruction) {
+                                                return instruction.result >= 0
+                                                       && replacement[instruction.result]
+                                                              != instruction.result;
+                                            }),
+                             block.code.end());
+        }
+        removeDeadValues(function);
+    };
+    eliminate(main);
+    for (auto &function : functions) {
+        eliminate(function);
+    }
+}
@@ -0,0 +1,111 @@
+#ifndef SSA_HH
+#define SSA_HH
+
+#include "../constants.hh"
+#include "../instructions.hh"
+#include "regtypes.hh"
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Opcodes that only exist in SSA form. Everything else reuses the source opcodes.
+enum SSAOpcode : uint16_t {
+    PARAM = REGISTER_OPCODE_COUNT, // argument `operand` of the call, in the entry block
+    PHI,                           // one argument per predecessor, in predecessor order
+    NIL,                           // a variable read before anything was stored to it
+    END,                           // terminator: runs off the end of the program (main only)
+
+    SSA_OPCODE_COUNT
+};
+
+// Name of a source or SSA opcode, for the printer and verifier messages.
+std::string ssaOpcodeName(uint16_t opcode);
+
+// One instruction. Values are numbered per function and every value is defined by exactly
+// one instruction. `value` is the operand the source instruction carried (constant index,
+// variable slot, function name), `operand` its integer form where it has one: the constant
+// index, the slot, the parameter index or the callee's function id.
+struct SSAInstruction
+{
+    uint16_t opcode;
+    int32_t result = -1; // the value defined, -1 for none
+    StaticType type = StaticType::Any;
+    int64_t operand = 0;
+    ValuePtr value = nullptr;
+    std::vector<int32_t> arguments = {}; // values read, in the order the stack code pushed them
+    uint32_t line = 0;
+};
+
+// A basic block: phis, then straight-line code ending in exactly one terminator (JUMP,
+// JUMP_IF_FALSE, RETURN, RETURN_VALUE, HALT or END). Successors of JUMP_IF_FALSE are the
+// fall-through block first and the jump target second.
+struct SSABlock
+{
+    std::vector<SSAInstruction> phis;
+    std::vector<SSAInstruction> code;
+    std::vector<int32_t> predecessors;
+    std::vector<int32_t> successors;
+    size_t pc = 0; // first source instruction, which orders the blocks when lowering
+};
+
+// The code of one function, or of the top level. Block 0 is the entry: it holds the PARAMs
+// and the NIL value, and jumps to the first block of the body.
+//
+// Variables the function declares, and top-level variables no function touches, exist only
+// as values. Every other variable is memory: LOAD_VARIABLE and STORE_VARIABLE instructions
+// that keep their place in the code.
+struct SSAFunction
+{
+    std::string name; // empty for the top level
+    ValuePtr definition; // the DEFINE_FUNCTION operand
+    uint32_t line = 0;
+    int32_t paramCount = 0;
+    StaticType result = StaticType::Unknown; // what calls of the function produce
+    std::vector<SSABlock> blocks;
+    std::vector<int64_t> origins; // by value: the variable slot it was first stored to, or -1
+    int32_t valueCount = 0;
+};
+
+// What the SSA stage did, see optimizeSSA()
+struct SSAStatistics
+{
+    size_t commonSubexpressions = 0; // instructions replaced by an equal earlier value
+    size_t copies = 0;               // variable-to-variable assignments that needed no code
+};
+
+// A program in SSA form, built from stack code: every operand stack slot and variable becomes
+// a value, and control flow merges get phis. Types are explicit: each value carries the
+// StaticType ValueOperations gives it, with parameter and result types from all call sites.
+struct SSAProgram
+{
+    SSAFunction main;
+    std::vector<SSAFunction> functions; // by function id, in definition order
+    std::vector<ValuePtr> constants;    // the parser's constant pool
+    int64_t slotCount = 0;              // one past the largest variable slot in use
+    SSAStatistics statistics;
+
+    // Throws std::runtime_error for code without an SSA form: instructions other than
+    // variables, constants, operations, calls of defined functions, printing and control
+    // flow, or operand stacks that do not balance.
+    static SSAProgram build(const std::vector<Instruction> &program, const ConstantPool &constants);
+
+    // Problems with the form, none when it is well formed: every block ends in one
+    // terminator whose successors mirror the predecessor lists, phis have an argument per
+    // predecessor, every value is defined once and dominates its uses, and the types agree
+    // with the opcodes.
+    std::vector<std::string> verify() const;
+
+    void print(std::ostream &out) const;
+
+    // Replaces pure typed operations by an equal one that dominates them, then drops the
+    // values nothing uses.
+    void eliminateCommonSubexpressions();
+
+    // Stack code for the program again. Values used once, right where they were computed,
+    // stay on the operand stack; the others live in variable slots, each variable's values
+    // in its own slot wherever their lifetimes allow.
+    std::vector<Instruction> lower() const;
+};
+
+#endif // SSA_HH
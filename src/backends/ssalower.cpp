@@ -0,0 +1,603 @@
+#include "optimizer.hh"
+#include "ssa.hh"
+#include <algorithm>
+#include <functional>
+#include <map>
+#include <set>
+#include <stdexcept>
+#include <unordered_set>
+
+namespace {
+
+ValuePtr integerOperand(int64_t value)
+{
+    return std::make_shared<Value>(
+        Value{std::make_shared<Type>(TypeTag::Int), static_cast<int32_t>(value)});
+}
+
+bool isConstantLoad(uint16_t opcode)
+{
+    return opcode == LOAD_CONST || opcode == LOAD_STR || opcode == BOOLEAN;
+}
+
+// Lowers one function (or main) to stack code appended to `out`. Every value either stays on
+// the operand stack, from its definition straight into the one instruction that uses it, or
+// gets a variable slot. Constants and nil are loaded again wherever they are used.
+class FunctionLowering
+{
+public:
+    FunctionLowering(const SSAFunction &function, int64_t &nextSlot, std::vector<Instruction> &out)
+        : function(function)
+        , nextSlot(nextSlot)
+        , out(out)
+    {}
+
+    void run();
+
+private:
+    const SSAFunction &function;
+    int64_t &nextSlot;
+    std::vector<Instruction> &out;
+
+    std::vector<const SSAInstruction *> defined;
+    std::vector<int32_t> uses;
+    std::vector<bool> temporary;
+    std::vector<bool> fused;        // parameter conversions done by the prologue
+    std::vector<int32_t> prologue;  // by parameter: the value its prologue step stores
+    std::vector<int64_t> slot;      // by value, -1 for none
+    int64_t nilSlot = -1;
+    std::vector<int32_t> layout;    // blocks in emission order, the entry excepted
+    std::vector<size_t> blockStart; // by block: where its code starts in `out`
+    std::vector<std::pair<size_t, int32_t>> jumps; // (instruction, target block)
+
+    bool materialized(int32_t value) const { return value >= 0 && slot[value] >= 0; }
+    bool emitted(const SSAInstruction &instruction) const;
+    bool isRoot(const SSAInstruction &instruction) const
+    {
+        return emitted(instruction)
+               && (instruction.result < 0 || !temporary[instruction.result]);
+    }
+
+    void countUses();
+    void fuseConversions();
+    void findTemporaries(const SSABlock &block);
+    template<typename F>
+    void forEachLeaf(const SSAInstruction &instruction, F f) const;
+    void assignSlots();
+
+    void append(Opcode opcode, uint32_t line, ValuePtr value);
+    void jump(Opcode opcode, uint32_t line, int32_t block);
+    void operand(int32_t value, uint32_t line);
+    void emitTree(const SSAInstruction &instruction);
+    std::vector<std::pair<int32_t, int32_t>> edgeCopies(int32_t from, size_t successor) const;
+    void copies(int32_t from, size_t successor, uint32_t line);
+};
+
+// Everything but constants, nil and parameters has a place in the code
+bool FunctionLowering::emitted(const SSAInstruction &instruction) const
+{
+    uint16_t opcode = instruction.opcode;
+    return opcode != PARAM && opcode != NIL && !isConstantLoad(opcode)
+           && (instruction.result < 0 || !fused[instruction.result]);
+}
+
+void FunctionLowering::countUses()
+{
+    defined.assign(function.valueCount, nullptr);
+    uses.assign(function.valueCount, 0);
+    for (const auto &block : function.blocks) {
+        for (const auto *list : {&block.phis, &block.code}) {
+            for (const auto &instruction : *list) {
+                if (instruction.result >= 0) {
+                    defined[instruction.result] = &instruction;
+                }
+                for (int32_t argument : instruction.arguments) {
+                    ++uses[argument];
+                }
+            }
+        }
+    }
+}
+
+// The parser's prologue converts typed parameters as it stores them. A conversion of a
+// parameter used nowhere else, at the start of a body only the entry leads to, stays there.
+void FunctionLowering::fuseConversions()
+{
+    fused.assign(function.valueCount, false);
+    prologue.assign(function.paramCount, -1);
+    for (const auto &instruction : function.blocks[0].code) {
+        if (instruction.opcode == PARAM) {
+            prologue[instruction.operand] = instruction.result;
+        }
+    }
+    const SSABlock &first = function.blocks[function.blocks[0].successors[0]];
+    if (first.predecessors.size() != 1 || !first.phis.empty()) {
+        return;
+    }
+    for (const auto &instruction : first.code) {
+        if (instruction.opcode != TO_INT64 && instruction.opcode != TO_FLOAT64) {
+            break;
+        }
+        const SSAInstruction *param = defined[instruction.arguments[0]];
+        if (param->opcode != PARAM || uses[param->result] != 1
+            || prologue[param->operand] != param->result) {
+            break;
+        }
+        fused[instruction.result] = true;
+        prologue[param->operand] = instruction.result;
+    }
+}
+
+// Calls f(value) for the values the tree rooted at `instruction` reads from slots
+template<typename F>
+void FunctionLowering::forEachLeaf(const SSAInstruction &instruction, F f) const
+{
+    for (int32_t argument : instruction.arguments) {
+        if (temporary[argument]) {
+            forEachLeaf(*defined[argument], f);
+        } else if (materialized(argument)) {
+            f(argument);
+        }
+    }
+}
+
+// A value used once, by a later instruction of its block, can stay on the stack when the
+// instructions of each expression tree are exactly the ones right before its root, in the
+// order the tree runs them: then nothing with an effect moves. Operands out of place get a
+// slot instead, and so do values left behind between two trees.
+void FunctionLowering::findTemporaries(const SSABlock &block)
+{
+    std::vector<const SSAInstruction *> code;
+    std::map<int32_t, size_t> position; // by value, for the emitted instructions
+    for (const auto &instruction : block.code) {
+        if (emitted(instruction)) {
+            if (instruction.result >= 0) {
+                position[instruction.result] = code.size();
+            }
+            code.push_back(&instruction);
+        }
+    }
+    for (size_t index = 0; index < code.size(); ++index) {
+        for (int32_t argument : code[index]->arguments) {
+            auto it = position.find(argument);
+            if (it != position.end() && it->second < index && uses[argument] == 1) {
+                temporary[argument] = true;
+            }
+        }
+    }
+
+    bool changed = true;
+    // Where the tree of code[index] starts. The last operand's tree has to end right before
+    // the root, the one before it right before that, and so on; loaded operands take no room.
+    std::function<size_t(size_t)> place = [&](size_t index) {
+        size_t start = index;
+        const auto &arguments = code[index]->arguments;
+        for (auto argument = arguments.rbegin(); argument != arguments.rend(); ++argument) {
+            if (!temporary[*argument]) {
+                continue;
+            }
+            if (position[*argument] + 1 != start) {
+                temporary[*argument] = false;
+                changed = true;
+                continue;
+            }
+            start = place(start - 1);
+        }
+        return start;
+    };
+    while (changed) {
+        changed = false;
+        size_t next = 0;
+        for (size_t index = 0; index < code.size(); ++index) {
+            if (!isRoot(*code[index])) {
+                continue;
+            }
+            size_t start = place(index);
+            for (size_t stranded = next; stranded < start; ++stranded) {
+                temporary[code[stranded]->result] = false;
+                changed = true;
+            }
+            next = index + 1;
+        }
+    }
+}
+
+// Gives each value that needs one a slot: its variable's own where no other value of the
+// variable is live at the same time, else the first fresh slot free for its whole lifetime
+void FunctionLowering::assignSlots()
+{
+    size_t blockCount = function.blocks.size();
+    slot.assign(function.valueCount, -1);
+    std::vector<bool> needsSlot(function.valueCount, false);
+    for (const auto &block : function.blocks) {
+        for (const auto *list : {&block.phis, &block.code}) {
+            for (const auto &instruction : *list) {
+                int32_t value = instruction.result;
+                if (value < 0 || uses[value] == 0) {
+                    continue;
+                }
+                needsSlot[value] = instruction.opcode == PHI || isRoot(instruction) || fused[value]
+                                   || (instruction.opcode == PARAM
+                                       && prologue[instruction.operand] == value);
+            }
+        }
+    }
+    // Provisional, so materialized() sees which values will have a slot
+    for (int32_t value = 0; value < function.valueCount; ++value) {
+        slot[value] = needsSlot[value] ? 0 : -1;
+    }
+
+    // What each block reads from slots and defines, in order; the entry defines the
+    // prologue's values
+    struct Step
+    {
+        int32_t defines = -1;
+        std::vector<int32_t> reads;
+    };
+    std::vector<std::vector<Step>> steps(blockCount);
+    for (int32_t k = function.paramCount - 1; k >= 0; --k) {
+        if (materialized(prologue[k])) {
+            steps[0].push_back(Step{prologue[k], {}});
+        }
+    }
+    for (size_t b = 1; b < blockCount; ++b) {
+        for (const auto &instruction : function.blocks[b].code) {
+            if (!isRoot(instruction)) {
+                continue;
+            }
+            Step step;
+            step.defines = materialized(instruction.result) ? instruction.result : -1;
+            forEachLeaf(instruction, [&](int32_t value) { step.reads.push_back(value); });
+            steps[b].push_back(std::move(step));
+        }
+    }
+    // Phi arguments are read at the end of the predecessor, on the edge
+    auto edgeReads = [&](size_t b, std::set<int32_t> &live) {
+        const SSABlock &block = function.blocks[b];
+        for (size_t k = 0; k < block.successors.size(); ++k) {
+            int32_t successor = block.successors[k];
+            const SSABlock &target = function.blocks[successor];
+            size_t occurrence = std::count(block.successors.begin(), block.successors.begin() + k,
+                                           successor);
+            for (size_t j = 0; j < target.predecessors.size(); ++j) {
+                if (target.predecessors[j] != int32_t(b) || occurrence-- != 0) {
+                    continue;
+                }
+                for (const auto &phi : target.phis) {
+                    if (materialized(phi.arguments[j])) {
+                        live.insert(phi.arguments[j]);
+                    }
+                }
+                break;
+            }
+        }
+    };
+
+    std::vector<std::set<int32_t>> liveIn(blockCount);
+    std::vector<std::set<int32_t>> liveOut(blockCount);
+    auto computeLiveOut = [&](size_t b) {
+        std::set<int32_t> live;
+        for (int32_t successor : function.blocks[b].successors) {
+            for (int32_t value : liveIn[successor]) {
+                live.insert(value);
+            }
+        }
+        edgeReads(b, live);
+        return live;
+    };
+    for (bool changed = true; changed;) {
+        changed = false;
+        for (size_t b = blockCount; b-- > 0;) {
+            std::set<int32_t> live = computeLiveOut(b);
+            liveOut[b] = live;
+            for (auto step = steps[b].rbegin(); step != steps[b].rend(); ++step) {
+                live.erase(step->defines);
+                live.insert(step->reads.begin(), step->reads.end());
+            }
+            for (const auto &phi : function.blocks[b].phis) {
+                live.erase(phi.result);
+            }
+            if (live != liveIn[b]) {
+                liveIn[b] = std::move(live);
+                changed = true;
+            }
+        }
+    }
+
+    // Two values interfere when one is live where the other is defined
+    std::vector<std::unordered_set<int32_t>> interferes(function.valueCount);
+    auto conflict = [&](int32_t a, int32_t b) {
+        if (a != b) {
+            interferes[a].insert(b);
+            interferes[b].insert(a);
+        }
+    };
+    std::vector<int32_t> order; // definitions in program order
+    for (size_t b = 0; b < blockCount; ++b) {
+        std::set<int32_t> live = liveOut[b];
+        for (auto step = steps[b].rbegin(); step != steps[b].rend(); ++step) {
+            if (step->defines >= 0) {
+                for (int32_t other : live) {
+                    conflict(step->defines, other);
+                }
+                live.erase(step->defines);
+            }
+            live.insert(step->reads.begin(), step->reads.end());
+        }
+        for (const auto &phi : function.blocks[b].phis) {
+            live.insert(phi.result);
+        }
+        for (const auto &phi : function.blocks[b].phis) {
+            for (int32_t other : live) {
+                conflict(phi.result, other);
+            }
+        }
+    }
+    for (const auto &step : steps[0]) {
+        order.push_back(step.defines);
+    }
+    for (int32_t b : layout) {
+        for (const auto &phi : function.blocks[b].phis) {
+            order.push_back(phi.result);
+        }
+        for (const auto &step : steps[b]) {
+            if (step.defines >= 0) {
+                order.push_back(step.defines);
+            }
+        }
+    }
+
+    std::map<int64_t, std::vector<int32_t>> holders;
+    std::vector<int64_t> fresh;
+    auto freeFor = [&](int64_t candidate, int32_t value) {
+        for (int32_t holder : holders[candidate]) {
+            if (interferes[value].count(holder)) {
+                return false;
+            }
+        }
+        return true;
+    };
+    std::fill(slot.begin(), slot.end(), -1);
+    for (int32_t value : order) {
+        int64_t chosen = -1;
+        int64_t origin = function.origins[value];
+        if (origin >= 0 && freeFor(origin, value)) {
+            chosen = origin;
+        }
+        for (size_t i = 0; chosen < 0 && i < fresh.size(); ++i) {
+            if (freeFor(fresh[i], value)) {
+                chosen = fresh[i];
+            }
+        }
+        if (chosen < 0) {
+            chosen = nextSlot++;
+            fresh.push_back(chosen);
+        }
+        slot[value] = chosen;
+        holders[chosen].push_back(value);
+    }
+}
+
+void FunctionLowering::append(Opcode opcode, uint32_t line, ValuePtr value)
+{
+    out.push_back(value ? Instruction(opcode, line, value) : Instruction(opcode, line));
+}
+
+void FunctionLowering::jump(Opcode opcode, uint32_t line, int32_t block)
+{
+    jumps.push_back({out.size(), block});
+    append(opcode, line, nullptr);
+}
+
+void FunctionLowering::operand(int32_t value, uint32_t line)
+{
+    const SSAInstruction &definition = *defined[value];
+    if (isConstantLoad(definition.opcode)) {
+        append(Opcode(definition.opcode), definition.line, definition.value);
+    } else if (definition.opcode == NIL) {
+        append(LOAD_VARIABLE, line, integerOperand(nilSlot));
+    } else if (temporary[value]) {
+        emitTree(definition);
+    } else {
+        append(LOAD_VARIABLE, line, integerOperand(slot[value]));
+    }
+}
+
+void FunctionLowering::emitTree(const SSAInstruction &instruction)
+{
+    for (int32_t argument : instruction.arguments) {
+        operand(argument, instruction.line);
+    }
+    if (instruction.opcode < OPCODE_COUNT) {
+        append(Opcode(instruction.opcode), instruction.line, instruction.value);
+    }
+}
+
+// (source, phi) for the phis of the successor-th successor of `from` whose source is not
+// already in the phi's slot
+std::vector<std::pair<int32_t, int32_t>> FunctionLowering::edgeCopies(int32_t from,
+                                                                      size_t successor) const
+{
+    const SSABlock &block = function.blocks[from];
+    int32_t target = block.successors[successor];
+    size_t occurrence =
+        std::count(block.successors.begin(), block.successors.begin() + successor, target);
+    const auto &predecessors = function.blocks[target].predecessors;
+    size_t j = 0;
+    for (; j < predecessors.size(); ++j) {
+        if (predecessors[j] == from && occurrence-- == 0) {
+            break;
+        }
+    }
+    std::vector<std::pair<int32_t, int32_t>> result;
+    for (const auto &phi : function.blocks[target].phis) {
+        int32_t source = phi.arguments[j];
+        if (!materialized(source) || slot[source] != slot[phi.result]) {
+            result.push_back({source, phi.result});
+        }
+    }
+    return result;
+}
+
+// The copies of an edge load all sources before storing any phi, so they may overlap
+void FunctionLowering::copies(int32_t from, size_t successor, uint32_t line)
+{
+    std::vector<std::pair<int32_t, int32_t>> pairs = edgeCopies(from, successor);
+    for (const auto &[source, phi] : pairs) {
+        operand(source, line);
+    }
+    for (auto it = pairs.rbegin(); it != pairs.rend(); ++it) {
+        append(STORE_VARIABLE, line, integerOperand(slot[it->second]));
+    }
+}
+
+void FunctionLowering::run()
+{
+    countUses();
+    fuseConversions();
+    for (size_t b = 1; b < function.blocks.size(); ++b) {
+        layout.push_back(int32_t(b));
+    }
+    std::stable_sort(layout.begin(), layout.end(), [&](int32_t a, int32_t b) {
+        return function.blocks[a].pc < function.blocks[b].pc;
+    });
+    temporary.assign(function.valueCount, false);
+    for (int32_t b : layout) {
+        findTemporaries(function.blocks[b]);
+    }
+    assignSlots();
+
+    std::set<int64_t> slots;
+    for (int32_t value = 0; value < function.valueCount; ++value) {
+        if (slot[value] >= 0) {
+            slots.insert(slot[value]);
+        }
+        if (defined[value] && defined[value]->opcode == NIL && uses[value] > 0 && nilSlot < 0) {
+            nilSlot = nextSlot++;
+        }
+    }
+    if (nilSlot >= 0) {
+        slots.insert(nilSlot); // declared, never stored
+    }
+
+    size_t header = out.size();
+    if (!function.name.empty()) {
+        ValuePtr definition = function.definition;
+        append(DEFINE_FUNCTION, function.line, definition);
+        append(JUMP, function.line, nullptr);
+    }
+    for (int64_t declared : slots) {
+        append(DECLARE_VARIABLE, function.line, integerOperand(declared));
+    }
+    for (int32_t k = function.paramCount - 1; k >= 0; --k) {
+        int32_t value = prologue[k];
+        if (fused[value]) {
+            append(Opcode(defined[value]->opcode), defined[value]->line, nullptr);
+        }
+        if (materialized(value)) {
+            append(STORE_VARIABLE, function.line, integerOperand(slot[value]));
+        } else {
+            append(POP, function.line, nullptr);
+        }
+    }
+
+    // Blocks, then the copies of false edges that need any
+    blockStart.assign(function.blocks.size(), 0);
+    std::vector<std::pair<size_t, std::pair<int32_t, uint32_t>>> stubs; // (jump, (block, line))
+    for (size_t i = 0; i < layout.size(); ++i) {
+        int32_t b = layout[i];
+        int32_t next = i + 1 < layout.size() ? layout[i + 1] : -1;
+        const SSABlock &block = function.blocks[b];
+        blockStart[b] = out.size();
+        for (const auto &instruction : block.code) {
+            if (!isRoot(instruction)) {
+                continue;
+            }
+            uint32_t line = instruction.line;
+            switch (instruction.opcode) {
+            case JUMP:
+                copies(b, 0, line);
+                if (block.successors[0] != next) {
+                    jump(JUMP, line, block.successors[0]);
+                }
+                break;
+            case JUMP_IF_FALSE: {
+                operand(instruction.arguments[0], line);
+                if (!edgeCopies(b, 1).empty()) {
+                    stubs.push_back({out.size(), {b, line}});
+                    append(JUMP_IF_FALSE, line, nullptr);
+                } else {
+                    jump(JUMP_IF_FALSE, line, block.successors[1]);
+                }
+                copies(b, 0, line);
+                if (block.successors[0] != next) {
+                    jump(JUMP, line, block.successors[0]);
+                }
+                break;
+            }
+            case END:
+                // Only main ends like this, and it comes last: stopping there is the same
+                append(HALT, line, nullptr);
+                break;
+            default:
+                emitTree(instruction);
+                if (materialized(instruction.result)) {
+                    append(STORE_VARIABLE, line, integerOperand(slot[instruction.result]));
+                } else if (instruction.result >= 0) {
+                    append(POP, line, nullptr);
+                }
+                break;
+            }
+        }
+    }
+    for (const auto &[at, edge] : stubs) {
+        out[at].value = integerOperand(int64_t(out.size()));
+        copies(edge.first, 1, edge.second);
+        jump(JUMP, edge.second, function.blocks[edge.first].successors[1]);
+    }
+
+    for (const auto &[at, block] : jumps) {
+        int64_t target = int64_t(blockStart[block]);
+        out[at].value = integerOperand(out[at].opcode == JUMP ? target - int64_t(at) - 1 : target);
+    }
+    if (!function.name.empty()) {
+        out[header + 1].value = integerOperand(int64_t(out.size()) - int64_t(header) - 2);
+    }
+}
+
+} // namespace
+
+std::vector<Instruction> SSAProgram::lower() const
+{
+    std::vector<Instruction> out;
+    int64_t nextSlot = slotCount;
+    for (const auto &function : functions) {
+        FunctionLowering(function, nextSlot, out).run();
+    }
+    FunctionLowering(main, nextSlot, out).run();
+    return out;
+}
+
+void optimizeSSA(std::vector<Instruction> &program, const ConstantPool &constants,
+                 OptimizerReport &report)
+{
+    SSAProgram ssa;
+    try {
+        ssa = SSAProgram::build(program, constants);
+    } catch (const std::runtime_error &error) {
+        report.outOfSSA = error.what();
+        return;
+    }
+    std::vector<std::string> problems = ssa.verify();
+    if (problems.empty()) {
+        ssa.eliminateCommonSubexpressions();
+        problems = ssa.verify();
+    }
+    if (!problems.empty()) {
+        report.outOfSSA = "malformed SSA form, " + problems.front();
+        return;
+    }
+    program = ssa.lower();
+    report.commonSubexpressions = ssa.statistics.commonSubexpressions;
+    report.copies = ssa.statistics.copies;
+}
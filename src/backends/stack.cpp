@@ -1,48 +1,74 @@
 #include "stack.hh"
+#include "fusion.hh"
+#include <algorithm>
 #include <chrono>
 #include <cmath>
 #include <iostream>
 #include <stdexcept>
 #include <type_traits>
 
-StackBackend::StackBackend(std::vector<Instruction> &program)
-    : program(program)
-    , memoryManager(true)
-    , globalRegion(memoryManager)
+void OperandStack::reserve(size_t capacity)
 {
-    regionStack.push(&globalRegion);
+    if (capacity <= this->capacity()) {
+        return;
+    }
+    auto *grown = static_cast<TaggedValue *>(::operator new(capacity * sizeof(TaggedValue)));
+    size_t count = size();
+    for (size_t i = 0; i < count; ++i) {
+        new (grown + i) TaggedValue(std::move(base[i]));
+        base[i].~TaggedValue();
+    }
+    ::operator delete(base);
+    base = grown;
+    top = base + count;
+    limit = base + capacity;
 }
 
+StackBackend::StackBackend(std::vector<Instruction> &program, const ConstantPool &constantPool)
+    : memoryManager(Logger::memory().isEnabled(LogLevel::Debug))
+    , globalRegion(memoryManager)
+    , constantPool(constantPool)
+    , program(program)
+{}
+
 StackBackend::~StackBackend()
 {
     std::cout << "Starting StackBackend destruction" << std::endl;
     clearStack();
     memoryManager.printStatistics();
-    while (!regionStack.empty()) {
-        //  std::cout << "Popping region" << std::endl;
-        popRegion();
-    }
     std::cout << "StackBackend destruction complete" << std::endl;
 }
 
 void StackBackend::run(const std::vector<Instruction> &program)
 {
     this->program = program;
+    DecodedProgram decoded;
+    try {
+        decoded = DecodedProgram::decode(this->program, constantPool.values());
+    } catch (const std::exception &ex) {
+        std::cerr << "Exception occurred during VM execution: " << ex.what() << std::endl;
+        return;
+    }
+    run(decoded);
+}
+
+void StackBackend::run(const DecodedProgram &program)
+{
     auto start_time = std::chrono::high_resolution_clock::now();
     try {
+        load(program);
         pc = 0;
         auto start_time = std::chrono::high_resolution_clock::now();
-        while (pc < program.size()) {
-            const Instruction &instruction = program[pc];
-
-            if (instruction.opcode == HALT) {
-                std::cout << "Program halted normally." << std::endl;
-                break;
-            }
-            execute(instruction);
-            pc++;
+#if STACK_THREADED_DISPATCH
+        if (verification.verified) {
+            runThreaded<true>();
+        } else {
+            runThreaded<false>();
         }
-        if (pc >= program.size()) {
+#else
+        runSwitch();
+#endif
+        if (pc >= decoded.code.size()) {
             std::cerr << "Warning: Reached end of program without HALT instruction." << std::endl;
         }
         auto end_time = std::chrono::high_resolution_clock::now();
@@ -55,41 +81,509 @@ void StackBackend::run(const std::vector<Instruction> &program)
     auto end_time = std::chrono::high_resolution_clock::now();
     auto duration = std::chrono::duration_cast<std::chrono::microseconds>(end_time - start_time);
     std::cout << "VM ran for a total of  " << duration.count() << " microseconds." << std::endl;
+}
 
-    // Print memory statistics
-    memoryManager.~MemoryManager();
+void StackBackend::load(const DecodedProgram &program)
+{
+    decoded = program;
+    verification = verifying ? verifyProgram(decoded) : Verification{};
+    specializedOperations = specializeOperations(decoded, verification);
+    if (verification.verified) {
+        // Verified code pushes without checking for room and reads variables without
+        // checking that they were declared
+        stack.reserve(stack.size() + verification.maxDepth);
+        if (variables.size() < static_cast<size_t>(verification.variableCount)) {
+            variables.resize(verification.variableCount);
+        }
+    }
+    fuseSuperinstructions(decoded);
+    frames.clear();
+    locals.clear();
+    localsBase = 0;
+
+    // Every pool entry is converted exactly once. LOAD_CONST then copies a TaggedValue out
+    // of this table: scalars by value, strings by sharing the boxed entry.
+    constants.clear();
+    constants.reserve(decoded.constants.size());
+    for (const auto &constant : decoded.constants) {
+        constants.push_back(TaggedValue::fromValue(*constant, globalRegion));
+    }
+
+    // Every generic operation the parser could not type gets a feedback slot
+    siteFeedback.clear();
+    for (size_t i = 0; i < decoded.code.size(); ++i) {
+        DecodedInstruction &record = decoded.code[i];
+        switch (record.opcode) {
+        case ADD:
+        case SUBTRACT:
+        case MULTIPLY:
+        case EQUAL:
+        case NOT_EQUAL:
+        case LESS_THAN:
+        case LESS_THAN_OR_EQUAL:
+        case GREATER_THAN:
+        case GREATER_THAN_OR_EQUAL:
+            record.aux = record.opcode;
+            record.b = static_cast<int32_t>(siteFeedback.size());
+            siteFeedback.push_back(SiteFeedback{i});
+            break;
+        default:
+            break;
+        }
+    }
+
+    loops.assign(decoded.code.size(), LoopState{});
+    traces.clear();
+    traceAborts.clear();
 }
 
-void StackBackend::execute(const Instruction &instruction)
+void StackBackend::runSwitch()
 {
+    std::vector<DecodedInstruction> &code = decoded.code;
+    while (pc < code.size()) {
+        DecodedInstruction &instruction = code[pc];
+
+        if (instruction.opcode == HALT) {
+            std::cout << "Program halted normally." << std::endl;
+            break;
+        }
+        step(instruction);
+        pc++;
+    }
+}
+
+template<bool Verified>
+void StackBackend::runThreaded()
+{
+#if STACK_THREADED_DISPATCH
+    // One label per opcode family so the indirect branch at the end of every handler gets
+    // its own prediction slot. The table covers every opcode step() understands; the
+    // rest fall through to the same "unknown opcode" diagnostic.
+    static void *dispatchTable[DECODED_OPCODE_COUNT];
+    static bool tableReady = false;
+    if (!tableReady) {
+        for (auto &label : dispatchTable) {
+            label = &&op_unknown;
+        }
+        dispatchTable[NOP] = &&op_nop;
+        dispatchTable[NEGATE] = &&op_unary;
+        dispatchTable[NOT] = &&op_unary;
+        for (Opcode opcode : {ADD, SUBTRACT, MULTIPLY, EQUAL, NOT_EQUAL, LESS_THAN,
+                              LESS_THAN_OR_EQUAL, GREATER_THAN, GREATER_THAN_OR_EQUAL}) {
+            dispatchTable[opcode] = &&op_site;
+        }
+        dispatchTable[DIVIDE] = &&op_binary;
+        dispatchTable[MODULUS] = &&op_binary;
+        dispatchTable[QUICK_ADD_INT] = &&op_quick_add_int;
+        dispatchTable[QUICK_SUB_INT] = &&op_quick_sub_int;
+        dispatchTable[QUICK_MUL_INT] = &&op_quick_mul_int;
+        dispatchTable[QUICK_EQ_INT] = &&op_quick_eq_int;
+        dispatchTable[QUICK_NE_INT] = &&op_quick_ne_int;
+        dispatchTable[QUICK_LT_INT] = &&op_quick_lt_int;
+        dispatchTable[QUICK_LE_INT] = &&op_quick_le_int;
+        dispatchTable[QUICK_GT_INT] = &&op_quick_gt_int;
+        dispatchTable[QUICK_GE_INT] = &&op_quick_ge_int;
+        dispatchTable[QUICK_ADD_FLOAT] = &&op_quick_add_float;
+        dispatchTable[QUICK_SUB_FLOAT] = &&op_quick_sub_float;
+        dispatchTable[QUICK_MUL_FLOAT] = &&op_quick_mul_float;
+        dispatchTable[QUICK_EQ_FLOAT] = &&op_quick_eq_float;
+        dispatchTable[QUICK_NE_FLOAT] = &&op_quick_ne_float;
+        dispatchTable[QUICK_LT_FLOAT] = &&op_quick_lt_float;
+        dispatchTable[QUICK_LE_FLOAT] = &&op_quick_le_float;
+        dispatchTable[QUICK_GT_FLOAT] = &&op_quick_gt_float;
+        dispatchTable[QUICK_GE_FLOAT] = &&op_quick_ge_float;
+        dispatchTable[AND] = &&op_logical;
+        dispatchTable[OR] = &&op_logical;
+        dispatchTable[LOAD_CONST] = &&op_load_const;
+        dispatchTable[LOAD_STR] = &&op_load_const;
+        dispatchTable[BOOLEAN] = &&op_load_const;
+        dispatchTable[INTERPOLATE_STRING] = &&op_interpolate;
+        dispatchTable[PRINT] = &&op_print;
+        dispatchTable[HALT] = &&op_halt;
+        dispatchTable[DECLARE_VARIABLE] = &&op_declare_variable;
+        dispatchTable[LOAD_VARIABLE] = &&op_load_variable;
+        dispatchTable[STORE_VARIABLE] = &&op_store_variable;
+        dispatchTable[ADD_I64] = &&op_add_i64;
+        dispatchTable[SUB_I64] = &&op_sub_i64;
+        dispatchTable[MUL_I64] = &&op_mul_i64;
+        dispatchTable[EQ_I64] = &&op_eq_i64;
+        dispatchTable[NE_I64] = &&op_ne_i64;
+        dispatchTable[LT_I64] = &&op_lt_i64;
+        dispatchTable[LE_I64] = &&op_le_i64;
+        dispatchTable[GT_I64] = &&op_gt_i64;
+        dispatchTable[GE_I64] = &&op_ge_i64;
+        dispatchTable[ADD_F64] = &&op_add_f64;
+        dispatchTable[SUB_F64] = &&op_sub_f64;
+        dispatchTable[MUL_F64] = &&op_mul_f64;
+        dispatchTable[EQ_F64] = &&op_eq_f64;
+        dispatchTable[NE_F64] = &&op_ne_f64;
+        dispatchTable[LT_F64] = &&op_lt_f64;
+        dispatchTable[LE_F64] = &&op_le_f64;
+        dispatchTable[GT_F64] = &&op_gt_f64;
+        dispatchTable[GE_F64] = &&op_ge_f64;
+        for (Opcode opcode : {DIV_I64, MOD_I64, NEG_I64, DIV_F64, MOD_F64, NEG_F64, EQ_STR, NE_STR,
+                              CONCATENATE_STR, TO_INT64, TO_FLOAT64}) {
+            dispatchTable[opcode] = &&op_typed;
+        }
+        dispatchTable[LOAD_LOCAL] = &&op_load_local;
+        dispatchTable[STORE_LOCAL] = &&op_store_local;
+        dispatchTable[DEFINE_FUNCTION] = &&op_nop; // resolved into the function table at load
+        dispatchTable[INVOKE_FUNCTION] = &&op_invoke_function;
+        dispatchTable[TAIL_CALL] = &&op_tail_call;
+        dispatchTable[RETURN] = &&op_return;
+        dispatchTable[RETURN_VALUE] = &&op_return_value;
+        dispatchTable[POP] = &&op_pop;
+        dispatchTable[PUSH_ARGS] = &&op_push_args;
+        dispatchTable[JUMP] = &&op_jump;
+        dispatchTable[INC_VAR_CONST] = &&op_superinstruction;
+        dispatchTable[INC_LOCAL_CONST] = &&op_superinstruction;
+        dispatchTable[JUMP_IF_VAR_LT_CONST] = &&op_superinstruction;
+        dispatchTable[JUMP_IF_LOCAL_LT_CONST] = &&op_superinstruction;
+        dispatchTable[JUMP_IF_FALSE] = &&op_jump_if_false;
+        dispatchTable[PARALLEL] = &&op_parallel;
+        dispatchTable[CONCURRENT] = &&op_concurrent;
+        tableReady = true;
+    }
+
+    DecodedInstruction *code = decoded.code.data(); // writable: sites quicken in place
+    const size_t size = decoded.code.size();
+
+#define DISPATCH() \
+    do { \
+        if (pc >= size) \
+            return; \
+        goto *dispatchTable[code[pc].opcode]; \
+    } while (0)
+#define NEXT() \
+    do { \
+        ++pc; \
+        DISPATCH(); \
+    } while (0)
+
+// Pushes of verified code go into the room load() and reserveFrame() made
+#define PUSH(value) \
+    do { \
+        if constexpr (Verified) { \
+            stack.pushReserved(value); \
+        } else { \
+            stack.push_back(value); \
+        } \
+    } while (0)
+
+// Quickened operations: the guard re-checks the tags the site was specialized for and
+// hands a miss back to the generic handler.
+#define QUICK_BINARY(guard, field, make, expr) \
+    do { \
+        size_t n = stack.size(); \
+        if ((Verified || n >= 2) && stack[n - 2].guard() && stack[n - 1].guard()) { \
+            auto a = stack[n - 2].as.field; \
+            auto b = stack[n - 1].as.field; \
+            stack.pop_back(); \
+            stack.back() = TaggedValue::make(expr); \
+            siteFeedback[code[pc].b].hits++; \
+        } else { \
+            dequicken(code[pc]); \
+        } \
+        NEXT(); \
+    } while (0)
+
+// Typed operations: the parser proved the operand types, so only the depth is checked,
+// unless the verifier proved that too
+#define TYPED_BINARY(field, make, expr) \
+    do { \
+        size_t n = stack.size(); \
+        if (Verified || n >= 2) { \
+            auto a = stack[n - 2].as.field; \
+            auto b = stack[n - 1].as.field; \
+            stack.pop_back(); \
+            stack.back() = TaggedValue::make(expr); \
+        } else { \
+            std::cerr << "Error: Stack underflow" << std::endl; \
+        } \
+        NEXT(); \
+    } while (0)
+
+    DISPATCH();
+
+op_nop:
+    NEXT();
+op_unary:
+    performUnaryOperation(static_cast<Opcode>(code[pc].opcode));
+    NEXT();
+op_site:
+    observeSite(code[pc]);
+    NEXT();
+op_binary:
+    performBinaryOperation(static_cast<Opcode>(code[pc].opcode));
+    NEXT();
+op_quick_add_int:
+    QUICK_BINARY(isInt, i, integer, IntArithmetic::add(a, b));
+op_quick_sub_int:
+    QUICK_BINARY(isInt, i, integer, IntArithmetic::subtract(a, b));
+op_quick_mul_int:
+    QUICK_BINARY(isInt, i, integer, IntArithmetic::multiply(a, b));
+op_quick_eq_int:
+    QUICK_BINARY(isInt, i, boolean, a == b);
+op_quick_ne_int:
+    QUICK_BINARY(isInt, i, boolean, a != b);
+op_quick_lt_int:
+    QUICK_BINARY(isInt, i, boolean, a < b);
+op_quick_le_int:
+    QUICK_BINARY(isInt, i, boolean, a <= b);
+op_quick_gt_int:
+    QUICK_BINARY(isInt, i, boolean, a > b);
+op_quick_ge_int:
+    QUICK_BINARY(isInt, i, boolean, a >= b);
+op_quick_add_float:
+    QUICK_BINARY(isFloat, f, number, a + b);
+op_quick_sub_float:
+    QUICK_BINARY(isFloat, f, number, a - b);
+op_quick_mul_float:
+    QUICK_BINARY(isFloat, f, number, a * b);
+op_quick_eq_float:
+    QUICK_BINARY(isFloat, f, boolean, a == b);
+op_quick_ne_float:
+    QUICK_BINARY(isFloat, f, boolean, a != b);
+op_quick_lt_float:
+    QUICK_BINARY(isFloat, f, boolean, a < b);
+op_quick_le_float:
+    QUICK_BINARY(isFloat, f, boolean, a <= b);
+op_quick_gt_float:
+    QUICK_BINARY(isFloat, f, boolean, a > b);
+op_quick_ge_float:
+    QUICK_BINARY(isFloat, f, boolean, a >= b);
+op_logical:
+    performLogicalOperation(static_cast<Opcode>(code[pc].opcode));
+    NEXT();
+op_add_i64:
+    TYPED_BINARY(i, integer, IntArithmetic::add(a, b));
+op_sub_i64:
+    TYPED_BINARY(i, integer, IntArithmetic::subtract(a, b));
+op_mul_i64:
+    TYPED_BINARY(i, integer, IntArithmetic::multiply(a, b));
+op_eq_i64:
+    TYPED_BINARY(i, boolean, a == b);
+op_ne_i64:
+    TYPED_BINARY(i, boolean, a != b);
+op_lt_i64:
+    TYPED_BINARY(i, boolean, a < b);
+op_le_i64:
+    TYPED_BINARY(i, boolean, a <= b);
+op_gt_i64:
+    TYPED_BINARY(i, boolean, a > b);
+op_ge_i64:
+    TYPED_BINARY(i, boolean, a >= b);
+op_add_f64:
+    TYPED_BINARY(f, number, a + b);
+op_sub_f64:
+    TYPED_BINARY(f, number, a - b);
+op_mul_f64:
+    TYPED_BINARY(f, number, a * b);
+op_eq_f64:
+    TYPED_BINARY(f, boolean, a == b);
+op_ne_f64:
+    TYPED_BINARY(f, boolean, a != b);
+op_lt_f64:
+    TYPED_BINARY(f, boolean, a < b);
+op_le_f64:
+    TYPED_BINARY(f, boolean, a <= b);
+op_gt_f64:
+    TYPED_BINARY(f, boolean, a > b);
+op_ge_f64:
+    TYPED_BINARY(f, boolean, a >= b);
+op_typed:
+    performTypedOperation(static_cast<Opcode>(code[pc].opcode));
+    NEXT();
+op_load_const:
+    PUSH(constants[code[pc].a]);
+    NEXT();
+op_interpolate:
+    handleInterpolateString();
+    NEXT();
+op_print:
+    handlePrint();
+    NEXT();
+op_halt:
+    std::cout << "Program halted normally." << std::endl;
+    return;
+op_declare_variable:
+    if constexpr (!Verified) { // load() made room for every variable
+        handleDeclareVariable(code[pc].a);
+    }
+    NEXT();
+op_load_variable:
+    if constexpr (Verified) {
+        PUSH(variables[code[pc].a]);
+    } else {
+        handleLoadVariable(code[pc].a);
+    }
+    NEXT();
+op_store_variable:
+    if constexpr (Verified) {
+        variables[code[pc].a] = stack.take();
+    } else {
+        handleStoreVariable(code[pc].a);
+    }
+    NEXT();
+op_load_local:
+    PUSH(locals[localsBase + code[pc].a]);
+    NEXT();
+op_store_local:
+    if constexpr (Verified) {
+        locals[localsBase + code[pc].a] = stack.take();
+    } else {
+        handleStoreLocal(code[pc].a);
+    }
+    NEXT();
+op_invoke_function:
+    handleCallFunction(code[pc].a, code[pc].b);
+    NEXT();
+op_tail_call:
+    handleTailCall(code[pc].a);
+    NEXT();
+op_return:
+    handleReturn(false);
+    NEXT();
+op_return_value:
+    handleReturn(true);
+    NEXT();
+op_pop:
+    if constexpr (Verified) {
+        stack.pop_back();
+    } else {
+        pop();
+    }
+    NEXT();
+op_push_args:
+    handlePushArg(code[pc].a);
+    NEXT();
+op_jump:
+    if (code[pc].a <= static_cast<int32_t>(pc)) {
+        pc = enterLoop(code[pc].a);
+        DISPATCH();
+    }
+    pc = code[pc].a;
+    DISPATCH();
+op_jump_if_false: {
+    auto condition = Verified ? stack.take() : pop();
+    if (!condition.isBool()) {
+        std::cerr << "Error: JUMP_IF_FALSE requires a boolean condition" << std::endl;
+        NEXT();
+    }
+    if (!condition.as.b) {
+        pc = code[pc].a;
+        DISPATCH();
+    }
+    NEXT();
+}
+op_superinstruction:
+    handleSuperinstruction(code[pc]);
+    NEXT();
+op_parallel:
+    handleParallel(code[pc].a);
+    NEXT();
+op_concurrent:
+    handleConcurrent(code[pc].a);
+    NEXT();
+op_unknown:
+    std::cerr << "Unknown opcode.: " << decodedOpcodeName(code[pc].opcode) << std::endl;
+    NEXT();
+
+#undef TYPED_BINARY
+#undef QUICK_BINARY
+#undef PUSH
+#undef NEXT
+#undef DISPATCH
+#else
+    runSwitch();
+#endif
+}
+
+void StackBackend::step(DecodedInstruction &instruction)
+{
+    // Decoded opcodes are not Opcode enumerators, so switch on the raw value.
+    const auto opcode = static_cast<Opcode>(instruction.opcode);
     switch (instruction.opcode) {
+    case NOP:
+        break;
     case NEGATE:
     case NOT:
-        performUnaryOperation(instruction);
+        performUnaryOperation(opcode);
         break;
     case ADD:
     case SUBTRACT:
     case MULTIPLY:
-    case DIVIDE:
-    case MODULUS:
-        performBinaryOperation(instruction);
-        break;
     case EQUAL:
     case NOT_EQUAL:
     case LESS_THAN:
     case LESS_THAN_OR_EQUAL:
     case GREATER_THAN:
     case GREATER_THAN_OR_EQUAL:
-        performComparisonOperation(instruction);
+        observeSite(instruction);
+        break;
+    case QUICK_ADD_INT:
+    case QUICK_SUB_INT:
+    case QUICK_MUL_INT:
+    case QUICK_EQ_INT:
+    case QUICK_NE_INT:
+    case QUICK_LT_INT:
+    case QUICK_LE_INT:
+    case QUICK_GT_INT:
+    case QUICK_GE_INT:
+    case QUICK_ADD_FLOAT:
+    case QUICK_SUB_FLOAT:
+    case QUICK_MUL_FLOAT:
+    case QUICK_EQ_FLOAT:
+    case QUICK_NE_FLOAT:
+    case QUICK_LT_FLOAT:
+    case QUICK_LE_FLOAT:
+    case QUICK_GT_FLOAT:
+    case QUICK_GE_FLOAT:
+        performQuickenedOperation(instruction);
+        break;
+    case DIVIDE:
+    case MODULUS:
+        performBinaryOperation(opcode);
         break;
     case AND:
     case OR:
-        performLogicalOperation(instruction);
+        performLogicalOperation(opcode);
+        break;
+    case ADD_I64:
+    case SUB_I64:
+    case MUL_I64:
+    case DIV_I64:
+    case MOD_I64:
+    case NEG_I64:
+    case ADD_F64:
+    case SUB_F64:
+    case MUL_F64:
+    case DIV_F64:
+    case MOD_F64:
+    case NEG_F64:
+    case EQ_I64:
+    case NE_I64:
+    case LT_I64:
+    case LE_I64:
+    case GT_I64:
+    case GE_I64:
+    case EQ_F64:
+    case NE_F64:
+    case LT_F64:
+    case LE_F64:
+    case GT_F64:
+    case GE_F64:
+    case EQ_STR:
+    case NE_STR:
+    case CONCATENATE_STR:
+    case TO_INT64:
+    case TO_FLOAT64:
+        performTypedOperation(opcode);
         break;
     case LOAD_CONST:
     case LOAD_STR:
     case BOOLEAN:
-        handleLoadConst(instruction.value);
+        handleLoadConst(instruction.a);
         break;
     case INTERPOLATE_STRING:
         handleInterpolateString();
@@ -101,74 +595,295 @@ void StackBackend::execute(const Instruction &instruction)
         handleHalt();
         return;
     case DECLARE_VARIABLE:
-        handleDeclareVariable(std::get<int32_t>(instruction.value->data));
+        handleDeclareVariable(instruction.a);
         break;
     case LOAD_VARIABLE:
-        handleLoadVariable(std::get<int32_t>(instruction.value->data));
+        handleLoadVariable(instruction.a);
         break;
     case STORE_VARIABLE:
-        handleStoreVariable(std::get<int32_t>(instruction.value->data));
+        handleStoreVariable(instruction.a);
         break;
-    case DEFINE_FUNCTION:
-        handleDeclareFunction(std::get<std::string>(instruction.value->data));
+    case LOAD_LOCAL:
+        handleLoadLocal(instruction.a);
         break;
+    case STORE_LOCAL:
+        handleStoreLocal(instruction.a);
+        break;
+    case DEFINE_FUNCTION:
+        break; // resolved into the function table at load
     case INVOKE_FUNCTION:
-        handleCallFunction(std::get<std::string>(instruction.value->data));
+        handleCallFunction(instruction.a, instruction.b);
+        break;
+    case TAIL_CALL:
+        handleTailCall(instruction.a);
+        break;
+    case RETURN:
+        handleReturn(false);
+        break;
+    case RETURN_VALUE:
+        handleReturn(true);
+        break;
+    case POP:
+        pop();
         break;
     case PUSH_ARGS:
-        handlePushArg(instruction);
+        handlePushArg(instruction.a);
         break;
     case JUMP:
-        handleJump();
+        handleJump(instruction.a);
         break;
     case JUMP_IF_FALSE:
-        handleJumpZero();
+        handleJumpZero(instruction.a);
+        break;
+    case INC_VAR_CONST:
+    case INC_LOCAL_CONST:
+    case JUMP_IF_VAR_LT_CONST:
+    case JUMP_IF_LOCAL_LT_CONST:
+        handleSuperinstruction(instruction);
         break;
     case PARALLEL:
-        handleParallel(std::get<int32_t>(instruction.value->data));
+        handleParallel(instruction.a);
         break;
     case CONCURRENT:
-        handleConcurrent(std::get<int32_t>(instruction.value->data));
+        handleConcurrent(instruction.a);
         break;
     default:
-        std::cerr << "Unknown opcode.: " << instruction.opcodeToString(instruction.opcode)
+        std::cerr << "Unknown opcode.: " << Instruction(opcode, 0).opcodeToString(opcode)
                   << std::endl;
     }
 }
 
+void StackBackend::execute(const Instruction &instruction)
+{
+    // Instructions of the loaded program already have a decoded record; anything else is
+    // decoded on its own, with its operand resolved against a one-entry table.
+    if (&instruction >= program.data() && &instruction < program.data() + program.size()) {
+        step(decoded.code[&instruction - program.data()]);
+        return;
+    }
+
+    switch (instruction.opcode) {
+    case LOAD_CONST:
+    case LOAD_STR:
+    case BOOLEAN:
+        handleLoadConst(static_cast<int32_t>(DecodedProgram::integerOperand(instruction.value)));
+        break;
+    case PUSH_ARGS:
+        push(TaggedValue::fromValue(*instruction.value, globalRegion));
+        break;
+    case DEFINE_FUNCTION:
+        break; // resolved into the function table at load
+    case INVOKE_FUNCTION:
+        // A call transfers control, which only means something inside the loaded program
+        std::cerr << "Error: INVOKE_FUNCTION outside the loaded program" << std::endl;
+        break;
+    case ADD:
+    case SUBTRACT:
+    case MULTIPLY:
+        performBinaryOperation(instruction.opcode); // no feedback slot outside the program
+        break;
+    case EQUAL:
+    case NOT_EQUAL:
+    case LESS_THAN:
+    case LESS_THAN_OR_EQUAL:
+    case GREATER_THAN:
+    case GREATER_THAN_OR_EQUAL:
+        performComparisonOperation(instruction.opcode);
+        break;
+    default:
+        step(DecodedProgram::decode({instruction}, constantPool.values()).code.front());
+    }
+}
+
+// Quickened opcode for a generic site whose operands were all `tag`
+static uint16_t quickenedOpcode(uint16_t generic, TaggedValue::Tag tag)
+{
+    bool isInt = tag == TaggedValue::Tag::Int;
+    switch (generic) {
+    case ADD:
+        return isInt ? QUICK_ADD_INT : QUICK_ADD_FLOAT;
+    case SUBTRACT:
+        return isInt ? QUICK_SUB_INT : QUICK_SUB_FLOAT;
+    case MULTIPLY:
+        return isInt ? QUICK_MUL_INT : QUICK_MUL_FLOAT;
+    case EQUAL:
+        return isInt ? QUICK_EQ_INT : QUICK_EQ_FLOAT;
+    case NOT_EQUAL:
+        return isInt ? QUICK_NE_INT : QUICK_NE_FLOAT;
+    case LESS_THAN:
+        return isInt ? QUICK_LT_INT : QUICK_LT_FLOAT;
+    case LESS_THAN_OR_EQUAL:
+        return isInt ? QUICK_LE_INT : QUICK_LE_FLOAT;
+    case GREATER_THAN:
+        return isInt ? QUICK_GT_INT : QUICK_GT_FLOAT;
+    default:
+        return isInt ? QUICK_GE_INT : QUICK_GE_FLOAT;
+    }
+}
+
+void StackBackend::observeSite(DecodedInstruction &instruction)
+{
+    SiteFeedback &site = siteFeedback[instruction.b];
+    site.executions++;
+
+    size_t n = stack.size();
+    if (n >= 2 && site.misses < MAX_SITE_MISSES) {
+        TaggedValue::Tag tag = stack[n - 1].tag;
+        bool quickenable = stack[n - 2].tag == tag
+                           && (tag == TaggedValue::Tag::Int || tag == TaggedValue::Tag::Float);
+        if (!quickenable) {
+            site.streak = 0;
+        } else if (tag != site.lastTag) {
+            site.lastTag = tag;
+            site.streak = 1;
+        } else if (++site.streak >= QUICKEN_AFTER) {
+            instruction.opcode = quickenedOpcode(instruction.aux, tag);
+            site.quickenings++;
+            site.streak = 0;
+        }
+    }
+
+    auto generic = static_cast<Opcode>(instruction.aux);
+    if (generic == ADD || generic == SUBTRACT || generic == MULTIPLY) {
+        performBinaryOperation(generic);
+    } else {
+        performComparisonOperation(generic);
+    }
+}
+
+void StackBackend::dequicken(DecodedInstruction &instruction)
+{
+    siteFeedback[instruction.b].misses++;
+    instruction.opcode = instruction.aux;
+    observeSite(instruction);
+}
+
+void StackBackend::performQuickenedOperation(DecodedInstruction &instruction)
+{
+    bool isInt = instruction.opcode <= QUICK_GE_INT;
+    size_t n = stack.size();
+    if (n < 2 || stack[n - 2].tag != stack[n - 1].tag
+        || stack[n - 1].tag != (isInt ? TaggedValue::Tag::Int : TaggedValue::Tag::Float)) {
+        dequicken(instruction);
+        return;
+    }
+
+    const TaggedValue &lhs = stack[n - 2];
+    const TaggedValue &rhs = stack[n - 1];
+    TaggedValue result;
+    switch (instruction.aux) {
+    case ADD:
+        result = isInt ? TaggedValue::integer(IntArithmetic::add(lhs.as.i, rhs.as.i))
+                       : TaggedValue::number(lhs.as.f + rhs.as.f);
+        break;
+    case SUBTRACT:
+        result = isInt ? TaggedValue::integer(IntArithmetic::subtract(lhs.as.i, rhs.as.i))
+                       : TaggedValue::number(lhs.as.f - rhs.as.f);
+        break;
+    case MULTIPLY:
+        result = isInt ? TaggedValue::integer(IntArithmetic::multiply(lhs.as.i, rhs.as.i))
+                       : TaggedValue::number(lhs.as.f * rhs.as.f);
+        break;
+    case EQUAL:
+        result = TaggedValue::boolean(isInt ? lhs.as.i == rhs.as.i : lhs.as.f == rhs.as.f);
+        break;
+    case NOT_EQUAL:
+        result = TaggedValue::boolean(isInt ? lhs.as.i != rhs.as.i : lhs.as.f != rhs.as.f);
+        break;
+    case LESS_THAN:
+        result = TaggedValue::boolean(isInt ? lhs.as.i < rhs.as.i : lhs.as.f < rhs.as.f);
+        break;
+    case LESS_THAN_OR_EQUAL:
+        result = TaggedValue::boolean(isInt ? lhs.as.i <= rhs.as.i : lhs.as.f <= rhs.as.f);
+        break;
+    case GREATER_THAN:
+        result = TaggedValue::boolean(isInt ? lhs.as.i > rhs.as.i : lhs.as.f > rhs.as.f);
+        break;
+    default:
+        result = TaggedValue::boolean(isInt ? lhs.as.i >= rhs.as.i : lhs.as.f >= rhs.as.f);
+        break;
+    }
+    stack.pop_back();
+    stack.back() = std::move(result);
+    siteFeedback[instruction.b].hits++;
+}
+
+void StackBackend::dumpSiteFeedback() const
+{
+    std::cout << "Type feedback:\n";
+    for (const auto &site : siteFeedback) {
+        if (site.executions == 0 && site.hits == 0) {
+            continue;
+        }
+        const DecodedInstruction &record = decoded.code[site.pc];
+        std::cout << "  pc " << site.pc << " (line " << decoded.lineAt(site.pc) << ") "
+                  << Instruction(static_cast<Opcode>(record.aux), 0)
+                         .opcodeToString(static_cast<Opcode>(record.aux))
+                  << (record.opcode != record.aux ? " [quickened]" : "")
+                  << ": generic " << site.executions << ", quick " << site.hits
+                  << ", quickened " << site.quickenings << "x, misses " << site.misses << "\n";
+    }
+}
+
+void StackBackend::dumpTraces() const
+{
+    std::cout << "Traces:\n";
+    for (const auto &trace : traces) {
+        std::cout << "  loop at pc " << trace->header << " (line " << decoded.lineAt(trace->header)
+                  << "): " << trace->length << " instructions, " << trace->codeSize
+                  << " bytes, entered " << trace->entries << "x, entry guard failures "
+                  << trace->guardFailures << "\n";
+    }
+    for (const auto &[header, reason] : traceAborts) {
+        std::cout << "  loop at pc " << header << " not traced: " << reason << "\n";
+    }
+}
+
+void StackBackend::dumpVerification() const
+{
+    if (!verifying) {
+        std::cout << "Verification: off\n";
+    } else if (!verification.verified) {
+        std::cout << "Verification: failed at " << verification.problem
+                  << ", ran with run-time checks\n";
+    } else {
+        std::cout << "Verification: verified, max stack depth " << verification.maxDepth;
+        for (size_t id = 0; id < decoded.functions.size(); ++id) {
+            std::cout << ", " << verification.functionDepths[id] << " in "
+                      << decoded.names[decoded.functions[id].nameIndex];
+        }
+        std::cout << "; " << specializedOperations << " operations specialized\n";
+    }
+}
+
 void StackBackend::dumpRegisters()
 {
     std::cout << "Stack:\n";
-    std::stack<MemoryManager<>::Ref<Value>> tempStack = stack;
-    while (!tempStack.empty()) {
-        auto value = tempStack.top();
-        tempStack.pop();
-        std::visit([](const auto &val) { std::cout << val; }, value->data);
-        std::cout << "\n";
+    for (size_t i = stack.size(); i-- > 0;) {
+        std::cout << stack[i] << "\n";
     }
 
     std::cout << "Constants:\n";
     for (size_t i = 0; i < constants.size(); ++i) {
-        std::cout << "C-" << i << ": ";
-        std::visit([](const auto &value) { std::cout << value; }, constants[i]->data);
-        std::cout << "\n";
+        std::cout << "C-" << i << ": " << constants[i] << "\n";
     }
 
     std::cout << "Variables:\n";
     for (size_t i = 0; i < variables.size(); ++i) {
-        std::cout << "V-" << i << ": ";
-        std::visit([](const auto &value) { std::cout << value; }, variables[i]->data);
-        std::cout << "\n";
+        std::cout << "V-" << i << ": " << variables[i] << "\n";
     }
 
     std::cout << "Functions:\n";
-    for (const auto &[name, _] : functions) {
-        std::cout << "Function: " << name << "\n";
+    for (const auto &function : decoded.functions) {
+        std::cout << "Function: " << decoded.names[function.nameIndex] << "\n";
     }
+    dumpVerification();
+    dumpSiteFeedback();
+    dumpTraces();
     std::cout << "End of Dump Registers\n";
 }
 
-void StackBackend::performUnaryOperation(const Instruction &instruction)
+void StackBackend::performUnaryOperation(Opcode opcode)
 {
     if (stack.empty()) {
         std::cerr << "Error: Invalid value stack for unary operation" << std::endl;
@@ -177,39 +892,33 @@ void StackBackend::performUnaryOperation(const Instruction &instruction)
 
     auto value = pop();
 
-    ValuePtr result = std::make_shared<Value>();
-    result->type = value->type;
-
-    switch (instruction.opcode) {
+    switch (opcode) {
     case NEGATE:
-        if (typeSystem.isCompatible(typeSystem.INT_TYPE, value->type)) {
-            result->data = -std::get<int64_t>(value->data);
-        } else if (typeSystem.isCompatible(typeSystem.FLOAT64_TYPE, value->type)) {
-            result->data = -std::get<double>(value->data);
+        if (value.isInt()) {
+            push(TaggedValue::integer(IntArithmetic::negate(value.as.i)));
+        } else if (value.isFloat()) {
+            push(TaggedValue::number(-value.as.f));
         } else {
             std::cerr << "Error: Unsupported type for NEGATE operation" << std::endl;
-            return;
+            push(TaggedValue());
         }
         break;
 
     case NOT:
-        if (typeSystem.isCompatible(typeSystem.BOOL_TYPE, value->type)) {
-            result->data = !std::get<bool>(value->data);
+        if (value.isBool()) {
+            push(TaggedValue::boolean(!value.as.b));
         } else {
             std::cerr << "Error: Unsupported type for NOT operation" << std::endl;
-            return;
+            push(TaggedValue());
         }
         break;
 
     default:
         std::cerr << "Error: Invalid unary operation opcode" << std::endl;
-        return;
     }
-
-    push(result);
 }
 
-void StackBackend::performBinaryOperation(const Instruction &instruction)
+void StackBackend::performBinaryOperation(Opcode opcode)
 {
     if (stack.size() < 2) {
         std::cerr << "Error: Invalid value stack for binary operation" << std::endl;
@@ -219,85 +928,77 @@ void StackBackend::performBinaryOperation(const Instruction &instruction)
     auto value2 = pop();
     auto value1 = pop();
 
-    // Get common type between the two values
-    TypePtr commonType = typeSystem.getCommonType(value1->type, value2->type);
-    if (!commonType) {
-        std::cerr << "Error: Incompatible types for binary operation" << std::endl;
-        return;
-    }
-
-    ValuePtr result = std::make_shared<Value>();
-    result->type = commonType;
+    if (value1.isInt() && value2.isInt()) {
+        int64_t v1 = value1.as.i;
+        int64_t v2 = value2.as.i;
 
-    if (commonType->tag == TypeTag::Int) {
-        int64_t v1 = std::get<int64_t>(value1->data);
-        int64_t v2 = std::get<int64_t>(value2->data);
-
-        switch (instruction.opcode) {
+        switch (opcode) {
         case ADD:
-            result->data = v1 + v2;
+            push(TaggedValue::integer(IntArithmetic::add(v1, v2)));
             break;
         case SUBTRACT:
-            result->data = v1 - v2;
+            push(TaggedValue::integer(IntArithmetic::subtract(v1, v2)));
             break;
         case MULTIPLY:
-            result->data = v1 * v2;
+            push(TaggedValue::integer(IntArithmetic::multiply(v1, v2)));
             break;
         case DIVIDE:
             if (v2 == 0) {
                 std::cerr << "Error: Division by zero" << std::endl;
+                push(TaggedValue());
                 return;
             }
-            result->data = v1 / v2;
+            push(TaggedValue::integer(IntArithmetic::divide(v1, v2)));
             break;
         case MODULUS:
             if (v2 == 0) {
                 std::cerr << "Error: Modulo by zero" << std::endl;
+                push(TaggedValue());
                 return;
             }
-            result->data = v1 % v2;
+            push(TaggedValue::integer(IntArithmetic::remainder(v1, v2)));
             break;
         default:
             std::cerr << "Error: Invalid binary operation opcode" << std::endl;
-            return;
         }
-    } else if (commonType->tag == TypeTag::Float64) {
-        double v1 = std::get<double>(value1->data);
-        double v2 = std::get<double>(value2->data);
+    } else if (value1.isNumber() && value2.isNumber()) {
+        double v1 = value1.asDouble();
+        double v2 = value2.asDouble();
 
-        switch (instruction.opcode) {
+        switch (opcode) {
         case ADD:
-            result->data = v1 + v2;
+            push(TaggedValue::number(v1 + v2));
             break;
         case SUBTRACT:
-            result->data = v1 - v2;
+            push(TaggedValue::number(v1 - v2));
             break;
         case MULTIPLY:
-            result->data = v1 * v2;
+            push(TaggedValue::number(v1 * v2));
             break;
         case DIVIDE:
             if (v2 == 0.0) {
                 std::cerr << "Error: Division by zero" << std::endl;
+                push(TaggedValue());
                 return;
             }
-            result->data = v1 / v2;
+            push(TaggedValue::number(v1 / v2));
             break;
         case MODULUS:
-            result->data = std::fmod(v1, v2);
+            push(TaggedValue::number(std::fmod(v1, v2)));
             break;
         default:
             std::cerr << "Error: Invalid binary operation opcode" << std::endl;
-            return;
         }
+    } else if (opcode == ADD && value1.isString() && value2.isString()) {
+        push(TaggedValue::object(globalRegion,
+                                 Value{typeSystem.STRING_TYPE, value1.string() + value2.string()}));
     } else {
         std::cerr << "Error: Unsupported types for binary operation" << std::endl;
-        return;
+        push(TaggedValue());
     }
-
-    push(result);
 }
 
-void StackBackend::performLogicalOperation(const Instruction &instruction)
+void StackBackend::performLogicalOperation(Opcode opcode)
 {
     if (stack.size() < 2) {
         std::cerr << "Error: Insufficient value stack for logical operation" << std::endl;
@@ -309,34 +1010,28 @@ void StackBackend::performLogicalOperation(const Instruction &instruction)
     auto value1 = pop();
 
     // Ensure both values are of type bool
-    if (!typeSystem.isCompatible(typeSystem.BOOL_TYPE, value1->type)
-        || !typeSystem.isCompatible(typeSystem.BOOL_TYPE, value2->type)) {
+    if (!value1.isBool() || !value2.isBool()) {
         std::cerr << "Error: Unsupported types for logical operation" << std::endl;
+        push(TaggedValue());
         return;
     }
 
-    ValuePtr result = std::make_shared<Value>();
-    result->type = typeSystem.BOOL_TYPE;
-
-    bool v1 = std::get<bool>(value1->data);
-    bool v2 = std::get<bool>(value2->data);
+    bool v1 = value1.as.b;
+    bool v2 = value2.as.b;
 
-    switch (instruction.opcode) {
+    switch (opcode) {
     case AND:
-        result->data = v1 && v2;
+        push(TaggedValue::boolean(v1 && v2));
         break;
     case OR:
-        result->data = v1 || v2;
+        push(TaggedValue::boolean(v1 || v2));
         break;
     default:
         std::cerr << "Error: Invalid logical operation opcode" << std::endl;
-        return;
     }
-
-    push(result);
 }
 
-void StackBackend::performComparisonOperation(const Instruction &instruction)
+void StackBackend::performComparisonOperation(Opcode opcode)
 {
     if (stack.size() < 2) {
         std::cerr << "Error: Insufficient value stack for comparison operation" << std::endl;
@@ -347,72 +1042,202 @@ void StackBackend::performComparisonOperation(const Instruction &instruction)
 
     auto value1 = pop();
 
-    // Get common type between the two values
-    TypePtr commonType = typeSystem.getCommonType(value1->type, value2->type);
-    if (!commonType) {
-        std::cerr << "Error: Cannot compare values of different types" << std::endl;
-        return;
-    }
-
-    ValuePtr result = std::make_shared<Value>();
-    result->type = typeSystem.BOOL_TYPE;
-
-    auto compareValues = [&](auto v1, auto v2) {
-        switch (instruction.opcode) {
+    auto compareValues = [&](const auto &v1, const auto &v2) {
+        switch (opcode) {
         case EQUAL:
-            result->data = (v1 == v2);
+            push(TaggedValue::boolean(v1 == v2));
             break;
         case NOT_EQUAL:
-            result->data = (v1 != v2);
+            push(TaggedValue::boolean(v1 != v2));
             break;
         case LESS_THAN:
-            result->data = (v1 < v2);
+            push(TaggedValue::boolean(v1 < v2));
             break;
         case LESS_THAN_OR_EQUAL:
-            result->data = (v1 <= v2);
+            push(TaggedValue::boolean(v1 <= v2));
             break;
         case GREATER_THAN:
-            result->data = (v1 > v2);
+            push(TaggedValue::boolean(v1 > v2));
             break;
         case GREATER_THAN_OR_EQUAL:
-            result->data = (v1 >= v2);
+            push(TaggedValue::boolean(v1 >= v2));
             break;
         default:
             std::cerr << "Error: Invalid comparison operation opcode" << std::endl;
-            return false;
         }
-        return true;
     };
 
-    if (commonType->tag == TypeTag::Int) {
-        if (!compareValues(std::get<int64_t>(value1->data), std::get<int64_t>(value2->data))) {
+    if (value1.isInt() && value2.isInt()) {
+        compareValues(value1.as.i, value2.as.i);
+    } else if (value1.isNumber() && value2.isNumber()) {
+        compareValues(value1.asDouble(), value2.asDouble());
+    } else if (value1.isString() && value2.isString()) {
+        compareValues(value1.string(), value2.string());
+    } else if (value1.isBool() && value2.isBool()
+               && (opcode == EQUAL || opcode == NOT_EQUAL)) {
+        compareValues(value1.as.b, value2.as.b);
+    } else {
+        std::cerr << "Error: Unsupported type for comparison operation" << std::endl;
+        push(TaggedValue());
+    }
+}
+
+void StackBackend::performTypedOperation(Opcode opcode)
+{
+    // Unary forms work on the top of the stack in place
+    if (opcode == TO_INT64 || opcode == TO_FLOAT64 || opcode == NEG_I64 || opcode == NEG_F64) {
+        if (stack.empty()) {
+            std::cerr << "Error: Stack underflow" << std::endl;
             return;
         }
-    } else if (commonType->tag == TypeTag::Float64) {
-        if (!compareValues(std::get<double>(value1->data), std::get<double>(value2->data))) {
+        TaggedValue &value = stack.back();
+        switch (opcode) {
+        case TO_INT64:
+            if (value.isFloat()) {
+                value = TaggedValue::integer(static_cast<int64_t>(value.as.f));
+            } else if (!value.isInt() && !value.isNil()) {
+                // The typed operations after it read the payload as an integer
+                std::cerr << "Error: Cannot convert a non-number to int" << std::endl;
+                value = TaggedValue();
+            }
+            break;
+        case TO_FLOAT64:
+            if (value.isInt()) {
+                value = TaggedValue::number(static_cast<double>(value.as.i));
+            } else if (!value.isFloat() && !value.isNil()) {
+                std::cerr << "Error: Cannot convert a non-number to float" << std::endl;
+                value = TaggedValue();
+            }
+            break;
+        case NEG_I64:
+            value.as.i = IntArithmetic::negate(value.as.i);
+            break;
+        default:
+            value.as.f = -value.as.f;
+            break;
+        }
+        return;
+    }
+
+    if (stack.size() < 2) {
+        std::cerr << "Error: Stack underflow" << std::endl;
+        return;
+    }
+    const TaggedValue &lhs = stack[stack.size() - 2];
+    const TaggedValue &rhs = stack.back();
+    TaggedValue result;
+
+    switch (opcode) {
+    case CONCATENATE_STR:
+    case EQ_STR:
+    case NE_STR:
+        // A `str` variable can still be handed a non-string through `any`
+        if (!lhs.isString() || !rhs.isString()) {
+            if (opcode == CONCATENATE_STR) {
+                performBinaryOperation(ADD);
+            } else {
+                performComparisonOperation(opcode == EQ_STR ? EQUAL : NOT_EQUAL);
+            }
             return;
         }
-    } else if (commonType->tag == TypeTag::String) {
-        if (!compareValues(std::get<std::string>(value1->data),
-                           std::get<std::string>(value2->data))) {
+        if (opcode == CONCATENATE_STR) {
+            result = TaggedValue::object(globalRegion,
+                                         Value{typeSystem.STRING_TYPE, lhs.string() + rhs.string()});
+        } else {
+            result = TaggedValue::boolean((lhs.string() == rhs.string()) == (opcode == EQ_STR));
+        }
+        break;
+    case ADD_I64:
+        result = TaggedValue::integer(IntArithmetic::add(lhs.as.i, rhs.as.i));
+        break;
+    case SUB_I64:
+        result = TaggedValue::integer(IntArithmetic::subtract(lhs.as.i, rhs.as.i));
+        break;
+    case MUL_I64:
+        result = TaggedValue::integer(IntArithmetic::multiply(lhs.as.i, rhs.as.i));
+        break;
+    case DIV_I64:
+    case MOD_I64:
+        if (rhs.as.i == 0) {
+            std::cerr << "Error: " << (opcode == DIV_I64 ? "Division" : "Modulo") << " by zero"
+                      << std::endl;
+            stack.pop_back();
+            stack.back() = TaggedValue();
             return;
         }
-    } else {
-        std::cerr << "Error: Unsupported type for comparison operation" << std::endl;
+        result = TaggedValue::integer(opcode == DIV_I64
+                                          ? IntArithmetic::divide(lhs.as.i, rhs.as.i)
+                                          : IntArithmetic::remainder(lhs.as.i, rhs.as.i));
+        break;
+    case ADD_F64:
+        result = TaggedValue::number(lhs.as.f + rhs.as.f);
+        break;
+    case SUB_F64:
+        result = TaggedValue::number(lhs.as.f - rhs.as.f);
+        break;
+    case MUL_F64:
+        result = TaggedValue::number(lhs.as.f * rhs.as.f);
+        break;
+    case DIV_F64:
+        if (rhs.as.f == 0.0) { // as DIVIDE reports it
+            std::cerr << "Error: Division by zero" << std::endl;
+            stack.pop_back();
+            stack.back() = TaggedValue();
+            return;
+        }
+        result = TaggedValue::number(lhs.as.f / rhs.as.f);
+        break;
+    case MOD_F64:
+        result = TaggedValue::number(std::fmod(lhs.as.f, rhs.as.f));
+        break;
+    case EQ_I64:
+        result = TaggedValue::boolean(lhs.as.i == rhs.as.i);
+        break;
+    case NE_I64:
+        result = TaggedValue::boolean(lhs.as.i != rhs.as.i);
+        break;
+    case LT_I64:
+        result = TaggedValue::boolean(lhs.as.i < rhs.as.i);
+        break;
+    case LE_I64:
+        result = TaggedValue::boolean(lhs.as.i <= rhs.as.i);
+        break;
+    case GT_I64:
+        result = TaggedValue::boolean(lhs.as.i > rhs.as.i);
+        break;
+    case GE_I64:
+        result = TaggedValue::boolean(lhs.as.i >= rhs.as.i);
+        break;
+    case EQ_F64:
+        result = TaggedValue::boolean(lhs.as.f == rhs.as.f);
+        break;
+    case NE_F64:
+        result = TaggedValue::boolean(lhs.as.f != rhs.as.f);
+        break;
+    case LT_F64:
+        result = TaggedValue::boolean(lhs.as.f < rhs.as.f);
+        break;
+    case LE_F64:
+        result = TaggedValue::boolean(lhs.as.f <= rhs.as.f);
+        break;
+    case GT_F64:
+        result = TaggedValue::boolean(lhs.as.f > rhs.as.f);
+        break;
+    case GE_F64:
+        result = TaggedValue::boolean(lhs.as.f >= rhs.as.f);
+        break;
+    default:
+        std::cerr << "Error: Invalid typed operation opcode" << std::endl;
         return;
     }
 
-    push(result);
+    stack.pop_back();
+    stack.back() = std::move(result);
 }
 
-void StackBackend::handleLoadConst(const ValuePtr &constantValue)
+void StackBackend::handleLoadConst(int32_t constantIndex)
 {
-    //push(constantValue);
-    auto linearValue = memoryManager.makeLinear<Value>(currentRegion(), *constantValue);
-    auto sharedValue = std::make_shared<Value>(*linearValue);
-
-    // Push the linear value onto the stack
-    push(sharedValue);
+    push(constants[constantIndex]);
 }
 
 void StackBackend::handleInterpolateString()
@@ -428,56 +1253,27 @@ void StackBackend::handleInterpolateString()
     // Pop the template string
     auto templateStr = pop();
 
-    std::string result;
-    std::string templateString;
-
-    // Convert template to string
-    std::visit(
-        [&templateString](const auto &v) {
-            using T = std::decay_t<decltype(v)>;
-            if constexpr (std::is_same_v<T, std::string>) {
-                templateString = v;
-            } else {
-                std::cerr << "Error: Template is not a string" << std::endl;
-            }
-        },
-        templateStr->data);
+    if (!templateStr.isString()) {
+        std::cerr << "Error: Template is not a string" << std::endl;
+        push(TaggedValue());
+        return;
+    }
+    const std::string &templateString = templateStr.string();
 
     // Find the first occurrence of {}
     size_t pos = templateString.find("{}");
     if (pos == std::string::npos) {
         std::cerr << "Error: No {} found in template string" << std::endl;
+        push(TaggedValue());
         return;
     }
 
-    // Convert value to string
-    std::string interpolatedValue = std::visit(
-        [](const auto &v) -> std::string {
-            using T = std::decay_t<decltype(v)>;
-            if constexpr (std::is_same_v<T, std::monostate>) {
-                return "null";
-            } else if constexpr (std::is_same_v<T, bool>) {
-                return v ? "true" : "false";
-            } else if constexpr (std::is_arithmetic_v<T>) {
-                return std::to_string(v);
-            } else if constexpr (std::is_same_v<T, std::string>) {
-                return v;
-            } else {
-                return "Unsupported type";
-            }
-        },
-        value->data);
-
     // Perform the interpolation
-    result = templateString.substr(0, pos) + interpolatedValue + templateString.substr(pos + 2);
-
-    // Create a new Value for the interpolated string
-    ValuePtr interpolatedString = std::make_shared<Value>();
-    interpolatedString->type = typeSystem.STRING_TYPE;
-    interpolatedString->data = result;
+    std::string result = templateString.substr(0, pos) + value.toString()
+                         + templateString.substr(pos + 2);
 
-    // Push the result back onto the stack
-    push(interpolatedString);
+    // Push the interpolated string back onto the stack
+    push(TaggedValue::object(globalRegion, Value{typeSystem.STRING_TYPE, std::move(result)}));
 }
 
 void StackBackend::handlePrint()
@@ -488,17 +1284,7 @@ void StackBackend::handlePrint()
     }
 
     auto value = pop();
-
-    // Ensure that the value is managed by the memory manager
-    if (value->type == typeSystem.STRING_TYPE) {
-        // Example: Perform a memory management operation
-        auto managedValue = memoryManager.makeLinear<Value>(currentRegion(), *value);
-        std::visit([](const auto &val) { std::cout << "The result: " << val << std::endl; },
-                   managedValue->data);
-    } else {
-        std::visit([](const auto &val) { std::cout << "The result: " << val << std::endl; },
-                   value->data);
-    }
+    std::cout << "The result: " << std::boolalpha << value << std::endl;
 }
 
 void StackBackend::handleHalt()
@@ -512,21 +1298,16 @@ void StackBackend::handleDeclareVariable(int32_t variableIndex)
     if (variableIndex >= static_cast<int32_t>(variables.size())) {
         variables.resize(variableIndex + 1);
     }
-
-    // Initialize the variable in the current region
-    if (!variables[variableIndex].get()) {
-        auto linearValue = memoryManager.makeLinear<Value>(currentRegion());
-        variables[variableIndex] = memoryManager.makeRef<Value>(currentRegion());
-    }
 }
 
 void StackBackend::handleLoadVariable(int32_t variableIndex)
 {
     if (variableIndex >= static_cast<int32_t>(variables.size())) {
         std::cerr << "Error: Invalid variable index" << std::endl;
+        push(TaggedValue());
         return;
     }
-    stack.push(variables[variableIndex]);
+    push(variables[variableIndex]);
 }
 
 void StackBackend::handleStoreVariable(int32_t variableIndex)
@@ -538,206 +1319,271 @@ void StackBackend::handleStoreVariable(int32_t variableIndex)
         std::cerr << "Error: value stack underflow" << std::endl;
         return;
     }
-    //    auto value = pop();
-    //    variables[variableIndex] = memoryManager.makeRef<Value>(currentRegion(), value);
-    // Assuming pop returns ValuePtr
-    ValuePtr valuePtr = pop();
+    variables[variableIndex] = pop();
+}
 
-    if (valuePtr) {
-        // Extract the Value from ValuePtr
-        const Value &value = *valuePtr;
+void StackBackend::handleLoadLocal(int32_t slot)
+{
+    push(locals[localsBase + slot]);
+}
 
-        // Use the extracted Value to create a Ref<Value>
-        variables[variableIndex] = memoryManager.makeRef<Value>(currentRegion(), value);
-    } else {
-        std::cerr << "Error: Null value pointer" << std::endl;
+void StackBackend::handleStoreLocal(int32_t slot)
+{
+    if (stack.empty()) {
+        std::cerr << "Error: value stack underflow" << std::endl;
+        return;
     }
+    locals[localsBase + slot] = pop();
 }
 
-void StackBackend::handleDeclareFunction(const std::string &functionName)
+void StackBackend::handleCallFunction(int32_t functionId, int32_t nameIndex)
 {
-    if (functions.find(functionName) != functions.end()) {
-        std::cerr << "Error: Function " << functionName << " already declared" << std::endl;
+    if (functionId < 0) {
+        std::cerr << "Error: Function " << decoded.names[nameIndex] << " not declared" << std::endl;
         return;
     }
-    functions[functionName] = [this, functionName]() {
-        auto it = std::find_if(program.begin(),
-                               program.end(),
-                               [functionName](const Instruction &instr) {
-                                   return instr.opcode == Opcode::DEFINE_FUNCTION
-                                          && std::get<std::string>(instr.value->data)
-                                                 == functionName;
-                               });
-
-        if (it != program.end()) {
-            size_t index = std::distance(program.begin(), it);
-            std::stack<MemoryManager<>::Ref<Value>> localStack;
-            std::swap(stack, localStack); // Save current stack state
-            for (size_t i = index + 1; i < program.size() && program[i].opcode != Opcode::HALT;
-                 ++i) {
-                execute(program[i]);
-            }
-            std::swap(stack, localStack); // Restore previous stack state
-        } else {
-            std::cerr << "Error: Function not found" << std::endl;
-        }
-    };
+    if (frames.size() >= MAX_CALL_DEPTH) {
+        throw std::runtime_error("Call stack overflow in " + decoded.names[nameIndex]);
+    }
+
+    const FunctionInfo &function = decoded.functions[functionId];
+    if (verification.verified) {
+        reserveFrame(functionId);
+    }
+    frames.push_back(CallFrame{pc, locals.size()});
+    localsBase = locals.size();
+    locals.resize(localsBase + function.localCount);
+
+    // The arguments stay on the operand stack for the prologue to store
+    pc = function.entry - 1; // Subtract 1 because pc will be incremented after this function
 }
 
-void StackBackend::handleCallFunction(const std::string &functionName)
+// Runs the callee in the caller's frame: the caller's locals are dropped and the callee
+// returns straight to whoever called the caller, so tail recursion needs no extra frames
+void StackBackend::handleTailCall(int32_t functionId)
 {
-    pushRegion(); // Create a new region for the function call
-    if (functions.find(functionName) == functions.end()) {
-        std::cerr << "Error: Function not declared" << std::endl;
-        popRegion();
+    if (frames.empty()) {
+        handleCallFunction(functionId, decoded.functions[functionId].nameIndex);
         return;
     }
-    functions[functionName]();
-    popRegion();
+
+    const FunctionInfo &function = decoded.functions[functionId];
+    if (verification.verified) {
+        reserveFrame(functionId);
+    }
+    locals.resize(localsBase);
+    locals.resize(localsBase + function.localCount); // frames start out with nil locals
+
+    // The arguments stay on the operand stack for the prologue to store
+    pc = function.entry - 1; // Subtract 1 because pc will be incremented after this function
 }
 
-void StackBackend::handlePushArg(const Instruction &instruction)
+// The only place verified code makes room on the operand stack: enough for the callee's
+// whole frame, arguments included, on top of what is already there
+void StackBackend::reserveFrame(int32_t functionId)
 {
-    push(instruction.value);
+    size_t depth = static_cast<size_t>(verification.functionDepths[functionId]);
+    if (stack.room() < depth) {
+        stack.reserve(2 * stack.capacity() + depth);
+    }
 }
 
-void StackBackend::handleJump()
+void StackBackend::handleReturn(bool hasValue)
 {
-    auto offset = program[this->pc].value;
-
-    // Ensure offset is of type Int64 and convert if necessary
-    if (!typeSystem.checkType(offset, typeSystem.INT64_TYPE)) {
-        if (typeSystem.isCompatible(offset->type, typeSystem.INT64_TYPE)) {
-            offset = typeSystem.convert(offset, typeSystem.INT64_TYPE);
-            if (!typeSystem.checkType(offset, typeSystem.INT64_TYPE)) {
-                std::cerr << "Error: Conversion to Int64 failed" << std::endl;
-                return;
-            }
-        } else {
-            std::cerr << "Error: Invalid jump offset type, expected Int64" << std::endl;
-            return;
-        }
+    if (frames.empty()) {
+        std::cerr << "Error: RETURN outside of a function" << std::endl;
+        return;
     }
 
-    // Perform the jump
-    if (std::holds_alternative<int64_t>(offset->data)) {
-        auto offsetValue = std::get<int64_t>(offset->data);
-        pc += offsetValue;
-    } else {
-        std::cerr << "Error: After conversion, offset is still not Int64" << std::endl;
-    }
+    TaggedValue result = hasValue ? pop() : TaggedValue();
+    CallFrame frame = frames.back();
+    frames.pop_back();
+
+    locals.resize(frame.localsBase);
+    localsBase = frames.empty() ? 0 : frames.back().localsBase;
+    push(std::move(result));
+    pc = frame.returnPc; // pc will be incremented past the INVOKE_FUNCTION
 }
 
-void StackBackend::handleJumpZero()
+void StackBackend::handlePushArg(int32_t constantIndex)
 {
-    auto offset = program[this->pc].value;
-    auto condition = pop();
-
-    //    std::cout << "handleJumpZero: Current PC: " << this->pc << std::endl;
-    //    std::cout << "Current instruction: "
-    //              << program[this->pc].opcodeToString(program[this->pc].opcode) << std::endl;
+    push(constants[constantIndex]);
+}
 
-    // Ensure condition is boolean
-    if (!typeSystem.checkType(condition, typeSystem.BOOL_TYPE)) {
-        if (typeSystem.isCompatible(condition->type, typeSystem.BOOL_TYPE)) {
-            condition = typeSystem.convert(condition, typeSystem.BOOL_TYPE);
-        } else {
-            std::cerr << "Error: JUMP_IF_FALSE requires a boolean condition" << std::endl;
-            return;
-        }
+void StackBackend::handleJump(int32_t target)
+{
+    if (target <= static_cast<int32_t>(pc)) {
+        pc = enterLoop(target) - 1;
+        return;
     }
+    pc = target - 1; // Subtract 1 because pc will be incremented after this function
+}
 
-    // Ensure offset is of type Int64 and convert if necessary
-    if (!typeSystem.checkType(offset, typeSystem.INT64_TYPE)) {
-        if (typeSystem.isCompatible(offset->type, typeSystem.INT64_TYPE)) {
-            offset = typeSystem.convert(offset, typeSystem.INT64_TYPE);
-        } else {
-            std::cerr << "Error: Invalid jump zero offset type, expected Int64" << std::endl;
-            return;
-        }
+// Backward JUMP to `header`: runs the loop's trace if it has one, otherwise counts the
+// iteration and records the loop once it is hot. Returns the pc to continue at.
+size_t StackBackend::enterLoop(size_t header)
+{
+    if (!tracing || header >= loops.size()) {
+        return header;
     }
-
-    bool conditionValue = std::get<bool>(condition->data);
-
-    if (!conditionValue) {
-        // Perform the jump
-        if (std::holds_alternative<int64_t>(offset->data)) {
-            int64_t offsetValue = std::get<int64_t>(offset->data);
-            //            std::cout << "Condition value: " << (conditionValue ? "true" : "false") << std::endl;
-            //            std::cout << "Jump offset value: " << offsetValue << std::endl;
-            //            std::cout << "Condition is false, jumping to PC: " << offsetValue << std::endl;
-            //            // Show the instruction at the offsetValue
-            //            std::cout << "Instruction at jump target: "
-            //                      << program[offsetValue].opcodeToString(program[offsetValue].opcode)
-            //                      << std::endl;
-            pc = offsetValue - 1; // Subtract 1 because pc will be incremented after this function
-        } else {
-            std::cerr << "Error: After conversion, offset is still not Int64" << std::endl;
+    LoopState &loop = loops[header];
+    if (loop.trace >= 0) {
+        size_t exit = traces[loop.trace]->run(variables.data(), locals.data() + localsBase,
+                                              constants.data());
+        if (exit != header) {
+            loop.guardFailures = 0;
+        } else if (++loop.guardFailures >= MAX_GUARD_FAILURES) {
+            // The slot types keep changing under the trace; interpret the loop until it is hot
+            // again, and record it once more if it has attempts left
+            traceAborts.emplace(header, "entry guards failed "
+                                            + std::to_string(MAX_GUARD_FAILURES) + " times in a row");
+            loop.trace = -1;
+            loop.guardFailures = 0;
         }
-        //        std::cout << "Next PC will be: " << (pc + 1) << std::endl;
-        //        std::cout << std::endl; // Add a blank line for readabili
+        return exit;
+    }
+    if (loop.attempts >= MAX_TRACE_ATTEMPTS || ++loop.iterations < HOT_LOOP) {
+        return header;
     }
+    loop.iterations = 0;
+    loop.attempts++;
+    return recordTrace(header);
 }
 
-void StackBackend::pushRegion()
+// Runs one iteration of the loop at `header` through step(), noting every record executed
+// and the tag of every slot on first touch, then compiles it. Recording stops at the first
+// record a trace cannot contain, before executing it, so the interpreter simply carries on
+// from the returned pc.
+size_t StackBackend::recordTrace(size_t header)
 {
-    regionStack.push(new MemoryManager<>::Region(memoryManager));
-}
+    RecordedTrace trace{header, {}, {}};
+    pc = header;
+    auto abort = [&](const std::string &reason) {
+        traceAborts.emplace(header, reason);
+        return pc;
+    };
 
-void StackBackend::popRegion()
-{
-    //    if (regionStack.size() > 1) { // Always keep the global region
-    //        delete regionStack.top();
-    //        regionStack.pop();
-    //    }
-    if (regionStack.size() > 1) { // Always keep the global region
-        try {
-            delete regionStack.top();
-            regionStack.pop();
-        } catch (const std::exception &e) {
-            std::cerr << "Error during region cleanup: " << e.what() << std::endl;
+    while (pc < decoded.code.size()) {
+        DecodedInstruction &instruction = decoded.code[pc];
+        if (!RecordedTrace::canRecord(instruction.opcode)) {
+            return abort("cannot record " + decodedOpcodeName(instruction.opcode));
+        }
+        if (trace.pcs.size() >= MAX_TRACE_LENGTH) {
+            return abort("trace too long");
+        }
+
+        bool local;
+        int32_t index;
+        bool writes;
+        if (RecordedTrace::slotOf(instruction, local, index, writes)) {
+            bool seen = std::any_of(trace.slots.begin(), trace.slots.end(),
+                                    [&](const TraceSlot &slot) {
+                                        return slot.local == local && slot.index == index;
+                                    });
+            if (!seen) {
+                const TaggedValue *slot = local ? &locals[localsBase + index]
+                                          : index < static_cast<int32_t>(variables.size())
+                                              ? &variables[index]
+                                              : nullptr;
+                if (!slot && !writes) {
+                    return abort("invalid variable index");
+                }
+                trace.slots.push_back(TraceSlot{local, index,
+                                                slot ? slot->tag : TaggedValue::Tag::Nil, writes});
+            }
+        }
+
+        trace.pcs.push_back(pc);
+        if (instruction.opcode == JUMP && instruction.a <= static_cast<int32_t>(pc)) {
+            if (instruction.a != static_cast<int32_t>(header)) {
+                trace.pcs.pop_back();
+                return abort("inner loop");
+            }
+            try {
+                traces.push_back(CompiledTrace::compile(trace, decoded.code, constants));
+                loops[header].trace = static_cast<int32_t>(traces.size() - 1);
+            } catch (const std::exception &ex) {
+                traceAborts.emplace(header, ex.what());
+            }
+            return header;
         }
+        step(instruction);
+        pc++;
     }
+    return abort("ran off the end of the program");
 }
 
-MemoryManager<>::Region &StackBackend::currentRegion()
+void StackBackend::handleJumpZero(int32_t target)
 {
-    return *regionStack.top();
+    auto condition = pop();
+
+    if (!condition.isBool()) {
+        std::cerr << "Error: JUMP_IF_FALSE requires a boolean condition" << std::endl;
+        return;
+    }
+
+    if (!condition.as.b) {
+        pc = target - 1; // Subtract 1 because pc will be incremented after this function
+    }
 }
 
-void StackBackend::push(const ValuePtr &valuePtr)
+void StackBackend::handleSuperinstruction(const DecodedInstruction &instruction)
 {
-    auto refValue = memoryManager.makeRef<Value>(currentRegion(), *valuePtr);
+    const size_t start = pc;
+    const size_t next = start + instruction.aux;
+    const bool local = instruction.opcode == INC_LOCAL_CONST
+                       || instruction.opcode == JUMP_IF_LOCAL_LT_CONST;
+
+    TaggedValue *variable = nullptr;
+    if (local) {
+        variable = &locals[localsBase + instruction.a];
+    } else if (instruction.a < static_cast<int32_t>(variables.size())) {
+        variable = &variables[instruction.a];
+    }
+    const TaggedValue &constant = constants[instruction.b];
 
-    // Push the converted value onto the stack
-    stack.push(refValue);
+    if (variable && variable->tag == constant.tag && (constant.isInt() || constant.isFloat())) {
+        bool isInt = constant.isInt();
+        if (instruction.opcode == INC_VAR_CONST || instruction.opcode == INC_LOCAL_CONST) {
+            if (isInt) {
+                variable->as.i = IntArithmetic::add(variable->as.i, constant.as.i);
+            } else {
+                variable->as.f += constant.as.f;
+            }
+            pc = next - 1; // pc will be incremented after this function
+        } else {
+            bool less = isInt ? variable->as.i < constant.as.i : variable->as.f < constant.as.f;
+            pc = (less ? next : instruction.c) - 1;
+        }
+        return;
+    }
+
+    // Guard failed: run the records the superinstruction covers
+    if (local) {
+        handleLoadLocal(instruction.a);
+    } else {
+        handleLoadVariable(instruction.a);
+    }
+    for (size_t i = start + 1; i < next; ++i) {
+        pc = i;
+        step(decoded.code[i]);
+    }
 }
 
-ValuePtr StackBackend::pop()
+TaggedValue StackBackend::pop()
 {
     if (stack.empty()) {
         std::cerr << "Error: Stack underflow" << std::endl;
-        return nullptr;
+        return TaggedValue();
     }
 
-    // Pop the value from the stack
-    auto refValue = stack.top();
-    stack.pop();
-
-    // Convert MemoryManager<>::Ref<Value> to ValuePtr
-    return std::make_shared<Value>(*refValue);
+    return stack.take();
 }
 
 void StackBackend::clearStack()
 {
     std::cout << "Clearing stack" << std::endl;
-    while (!stack.empty()) {
-        try {
-            stack.pop();
-        } catch (const std::exception &e) {
-            std::cerr << "Error clearing stack: " << e.what() << std::endl;
-        }
-    }
+    stack.clear();
 }
 
 void StackBackend::concurrent(std::vector<std::function<void()>> tasks)
@@ -756,6 +1602,21 @@ void StackBackend::concurrent(std::vector<std::function<void()>> tasks)
 
     threads.clear();
 }
+// Runs program[start, end) for a PARALLEL or CONCURRENT task. The tasks share the operand
+// stack, the variables and the regions, and with them the plain reference counts of every
+// value in those (ValueMemory::Ref), so each instruction runs under mtx. The range can hold
+// the PARALLEL or CONCURRENT that started the task, which is skipped rather than run again.
+void StackBackend::runTask(size_t start, size_t end)
+{
+    for (size_t j = start; j < end; ++j) {
+        if (program[j].opcode == PARALLEL || program[j].opcode == CONCURRENT) {
+            continue;
+        }
+        std::lock_guard<std::mutex> lock(mtx);
+        execute(program[j]);
+    }
+}
+
 void StackBackend::handleParallel(int32_t taskCount)
 {
     std::vector<std::function<void()>> tasks;
@@ -765,11 +1626,7 @@ void StackBackend::handleParallel(int32_t taskCount)
         tasks.push_back([this, i, instructionsPerTask, &taskCount]() {
             unsigned int start = i * instructionsPerTask;
             unsigned int end = (i == taskCount - 1) ? program.size() : start + instructionsPerTask;
-
-            for (unsigned int j = start; j < end; ++j) {
-                const Instruction &instruction = program[j];
-                execute(instruction);
-            }
+            runTask(start, end);
         });
     }
 
@@ -786,12 +1643,7 @@ void StackBackend::handleConcurrent(int32_t taskCount)
     // Create tasks for each part of the program
     for (int32_t i = 0; i < taskCount; ++i) {
         tasks.push_back([this, i, instructionsPerTask]() {
-            int32_t start = i * instructionsPerTask;
-            int32_t end = (i + 1) * instructionsPerTask;
-            for (int32_t j = start; j < end; ++j) {
-                std::lock_guard<std::mutex> lock(this->mtx); // Lock for the duration of task
-                execute(program[j]);
-            }
+            runTask(i * instructionsPerTask, (i + 1) * instructionsPerTask);
         });
     }
 
@@ -1,85 +1,249 @@
 #ifndef STACK_HH
 #define STACK_HH
 
+#include "../constants.hh"
 #include "../memory.hh"
 #include "../types.hh"
 #include "backend.hh"
+#include "bytecode.hh"
+#include "tagged.hh"
+#include "trace.hh"
+#include "verifier.hh"
 #include <functional>
 #include <iostream>
 #include <map>
+#include <memory>
 #include <mutex>
-#include <stack>
+#include <new>
 #include <string>
 #include <thread>
+#include <unordered_map>
 #include <variant>
 #include <vector>
 
+// Computed-goto dispatch needs the GCC/Clang "labels as values" extension.
+#if defined(LUMINAR_THREADED_DISPATCH) && (defined(__GNUC__) || defined(__clang__))
+#define STACK_THREADED_DISPATCH 1
+#else
+#define STACK_THREADED_DISPATCH 0
+#endif
+
+// The StackBackend's operand stack: one allocation of TaggedValues. push_back() grows it like
+// a std::vector; pushReserved() checks nothing, for code whose depth was verified and whose
+// room was reserved beforehand.
+class OperandStack
+{
+public:
+    OperandStack() { reserve(64); }
+    ~OperandStack()
+    {
+        clear();
+        ::operator delete(base);
+    }
+    OperandStack(const OperandStack &) = delete;
+    OperandStack &operator=(const OperandStack &) = delete;
+
+    size_t size() const { return static_cast<size_t>(top - base); }
+    bool empty() const { return top == base; }
+    size_t capacity() const { return static_cast<size_t>(limit - base); }
+    size_t room() const { return static_cast<size_t>(limit - top); }
+
+    // Never shrinks
+    void reserve(size_t capacity);
+
+    void push_back(const TaggedValue &value)
+    {
+        if (top == limit) {
+            reserve(2 * capacity());
+        }
+        new (top++) TaggedValue(value);
+    }
+    void push_back(TaggedValue &&value)
+    {
+        if (top == limit) {
+            reserve(2 * capacity());
+        }
+        new (top++) TaggedValue(std::move(value));
+    }
+    void pushReserved(const TaggedValue &value) { new (top++) TaggedValue(value); }
+    void pushReserved(TaggedValue &&value) { new (top++) TaggedValue(std::move(value)); }
+
+    TaggedValue take()
+    {
+        TaggedValue value = std::move(*--top);
+        top->~TaggedValue();
+        return value;
+    }
+    void pop_back() { (--top)->~TaggedValue(); }
+    TaggedValue &back() { return top[-1]; }
+    TaggedValue &operator[](size_t index) { return base[index]; }
+    const TaggedValue &operator[](size_t index) const { return base[index]; }
+
+    void clear()
+    {
+        while (!empty()) {
+            pop_back();
+        }
+    }
+
+private:
+    TaggedValue *base = nullptr; // slots from top to limit hold no value
+    TaggedValue *top = nullptr;
+    TaggedValue *limit = nullptr;
+};
+
 class StackBackend : public Backend
 {
 public:
-    explicit StackBackend(std::vector<Instruction> &program);
+    StackBackend(std::vector<Instruction> &program, const ConstantPool &constantPool);
     ~StackBackend();
 
     void run(const std::vector<Instruction> &program) override;
+    void run(const DecodedProgram &program) override;
     void execute(const Instruction &instruction) override;
     void dumpRegisters() override;
 
     void setUnsafeMode(bool enable) { unsafeMode = enable; }
     bool isUnsafeMode() const { return unsafeMode; }
 
+    // Type feedback for one generic ADD/SUBTRACT/MULTIPLY/comparison instruction
+    struct SiteFeedback
+    {
+        size_t pc;
+        uint64_t executions = 0;  // runs through the generic handler
+        uint64_t hits = 0;        // runs through the quickened form
+        uint32_t quickenings = 0; // times the site was rewritten to a quickened form
+        uint32_t misses = 0;      // guard failures that restored the generic form
+        TaggedValue::Tag lastTag = TaggedValue::Tag::Nil;
+        uint32_t streak = 0; // consecutive executions that saw `lastTag` on both sides
+    };
+    const std::vector<SiteFeedback> &getSiteFeedback() const { return siteFeedback; }
+    void dumpSiteFeedback() const;
+
+    // Hot loops are recorded and compiled to native traces unless this is turned off
+    void setTracing(bool enable) { tracing = enable; }
+    bool isTracing() const { return tracing; }
+    void dumpTraces() const;
+
+    // Programs are verified at load (see verifyProgram()); verified ones run without the
+    // per-instruction checks of their operand stack and variables unless this is turned off
+    void setVerifying(bool enable) { verifying = enable; }
+    bool isVerifying() const { return verifying; }
+    const Verification &getVerification() const { return verification; }
+    void dumpVerification() const;
+
 private:
-    //    std::stack<ValuePtr> stack;
-    //    std::vector<ValuePtr> constants;
-    //    std::vector<ValuePtr> variables;
-    std::stack<MemoryManager<>::Ref<Value>> stack;
-    std::vector<MemoryManager<>::Ref<Value>> constants;
-    std::vector<MemoryManager<>::Ref<Value>> variables;
-    std::map<std::string, std::function<void()>> functions;
+    // The memory manager and the region that owns boxed heap values are declared first so
+    // they outlive every TaggedValue held by the stack, variables and constants. It audits its
+    // allocations only when memory.log is at debug level, where the audit lines go.
+    ValueMemory memoryManager;
+    ValueMemory::Region globalRegion;
+
+    OperandStack stack;
+    std::vector<TaggedValue> constants; // decoded.constants, converted once per run
+    ConstantPool constantPool;          // literals referenced by LOAD_CONST/LOAD_STR/BOOLEAN
+    std::vector<TaggedValue> variables;
+
+    // One frame per active call. Locals of all active calls live in one vector; a frame
+    // only remembers where its slots start and where to resume the caller.
+    struct CallFrame
+    {
+        size_t returnPc;   // the INVOKE_FUNCTION that made the call
+        size_t localsBase; // first slot of the frame in `locals`
+    };
+    static constexpr size_t MAX_CALL_DEPTH = 100000;
+    std::vector<CallFrame> frames;
+    std::vector<TaggedValue> locals;
+    size_t localsBase = 0; // frames.back().localsBase, or 0 outside any call
+
     std::vector<std::thread> threads;
-    std::mutex mtx;
+    std::mutex mtx; // held by a PARALLEL or CONCURRENT task for each instruction it runs
     std::vector<Instruction> program;
+    DecodedProgram decoded;
     size_t pc = 0;
     TypeSystem typeSystem;
     bool unsafeMode = false;
 
-    // Add MemoryManager
-    MemoryManager<> memoryManager;
-    MemoryManager<>::Region globalRegion;
-    std::stack<MemoryManager<>::Region *> regionStack;
+    // A site is quickened after this many consecutive same-typed executions, and stays
+    // generic for good once it has missed MAX_SITE_MISSES guards.
+    static constexpr uint32_t QUICKEN_AFTER = 4;
+    static constexpr uint32_t MAX_SITE_MISSES = 4;
+    std::vector<SiteFeedback> siteFeedback;
+
+    // Tracing tier. Backward JUMPs count iterations per loop header; after HOT_LOOP of them
+    // the next iteration is recorded and compiled. A trace whose entry guards fail
+    // MAX_GUARD_FAILURES times in a row is dropped, and the loop counts towards another
+    // recording. A loop recorded MAX_TRACE_ATTEMPTS times without a trace stays interpreted.
+    struct LoopState
+    {
+        uint32_t iterations = 0;
+        uint32_t attempts = 0;
+        uint32_t guardFailures = 0; // in a row, of the current trace
+        int32_t trace = -1;         // into traces
+    };
+    static constexpr uint32_t HOT_LOOP = 50;
+    static constexpr uint32_t MAX_TRACE_ATTEMPTS = 2;
+    static constexpr uint32_t MAX_GUARD_FAILURES = 8;
+    static constexpr size_t MAX_TRACE_LENGTH = 512;
+    bool tracing = true;
+    std::vector<LoopState> loops; // by header pc
+    std::vector<std::unique_ptr<CompiledTrace>> traces;
+    std::map<size_t, std::string> traceAborts; // why each header has no trace, the first time
+
+    // Verification of the loaded program. A verified program runs through runThreaded<true>,
+    // which pushes into room reserved up front: the top level's maximum depth at load, and
+    // each callee's at the call. Generic operations whose operand types it proved were
+    // rewritten into their typed forms.
+    bool verifying = true;
+    Verification verification;
+    size_t specializedOperations = 0;
 
-    void performUnaryOperation(const Instruction &instruction);
-    void performBinaryOperation(const Instruction &instruction);
-    void performComparisonOperation(const Instruction &instruction);
-    void performLogicalOperation(const Instruction &instruction);
-    void handleLoadConst(const ValuePtr &constantValue);
+    void load(const DecodedProgram &program);
+    void runSwitch();
+    template<bool Verified>
+    void runThreaded();
+    void reserveFrame(int32_t functionId);
+    void step(DecodedInstruction &instruction);
+    void observeSite(DecodedInstruction &instruction);
+    void performQuickenedOperation(DecodedInstruction &instruction);
+    void dequicken(DecodedInstruction &instruction);
+    size_t enterLoop(size_t header);
+    size_t recordTrace(size_t header);
+
+    void performUnaryOperation(Opcode opcode);
+    void performBinaryOperation(Opcode opcode);
+    void performComparisonOperation(Opcode opcode);
+    void performLogicalOperation(Opcode opcode);
+    void performTypedOperation(Opcode opcode);
+    void handleLoadConst(int32_t constantIndex);
     void handleInterpolateString();
     void handlePrint();
     void handleHalt();
     void handleDeclareVariable(int32_t variableIndex);
     void handleLoadVariable(int32_t variableIndex);
     void handleStoreVariable(int32_t variableIndex);
-    void handleDeclareFunction(const std::string &functionName);
-    void handleCallFunction(const std::string &functionName);
-    void handlePushArg(const Instruction &instruction);
-    void handleJump();
-    void handleJumpZero();
+    void handleLoadLocal(int32_t slot);
+    void handleStoreLocal(int32_t slot);
+    void handleCallFunction(int32_t functionId, int32_t nameIndex);
+    void handleTailCall(int32_t functionId);
+    void handleReturn(bool hasValue);
+    void handlePushArg(int32_t constantIndex);
+    void handleJump(int32_t target);
+    void handleJumpZero(int32_t target);
+    void handleSuperinstruction(const DecodedInstruction &instruction);
     void handleParallel(int32_t taskCount);
     void handleConcurrent(int32_t taskCount);
     void concurrent(std::vector<std::function<void()>> tasks);
+    void runTask(size_t start, size_t end);
 
     void handleAlloc(const Instruction &instruction);
     void handleDealloc(const Instruction &instruction);
     void handleResize(const Instruction &instruction);
 
-    // New methods for region management
-    void pushRegion();
-    void popRegion();
-    MemoryManager<>::Region &currentRegion();
-
     //push ansd pop
-    void push(const ValuePtr &valuePtr);
+    void push(TaggedValue value) { stack.push_back(std::move(value)); }
 
-    ValuePtr pop();
+    TaggedValue pop();
     void clearStack();
 };
 
@@ -0,0 +1,280 @@
+#ifndef TAGGED_HH
+#define TAGGED_HH
+
+#include "../memory.hh"
+#include "../types.hh"
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+// Memory manager of the backends' boxed values. HeapObjects are all the same size and are
+// freed one at a time as their last reference goes, which the slab allocator's free lists
+// serve in O(1).
+using ValueMemory = MemoryManager<SlabAllocator>;
+
+// Heap cell for values that do not fit in a TaggedValue (strings, lists, dicts, ...): the
+// same object a ValueMemory::Ref<Value> points to, with its count in the header next to the
+// payload so copying a TaggedValue never allocates. A TaggedValue holding one owns a
+// reference it counts through HeapRef, so the manager's reference statistics cover boxed
+// values. The count is not atomic; a VM's values stay on its thread.
+using HeapRef = ValueMemory::Ref<Value>;
+using HeapObject = HeapRef::Object;
+
+// Compact 16-byte operand used by the StackBackend for its stack, variables and constants.
+// Scalars (nil/bool/int64/double) are stored inline; everything else is a pointer to a
+// reference counted HeapObject.
+struct TaggedValue
+{
+    enum class Tag : uint8_t { Nil, Bool, Int, Float, Object };
+
+    Tag tag;
+    union {
+        bool b;
+        int64_t i;
+        double f;
+        HeapObject *obj;
+    } as;
+
+    TaggedValue()
+        : tag(Tag::Nil)
+    {
+        as.i = 0;
+    }
+
+    static TaggedValue boolean(bool v)
+    {
+        TaggedValue t;
+        t.tag = Tag::Bool;
+        t.as.b = v;
+        return t;
+    }
+
+    static TaggedValue integer(int64_t v)
+    {
+        TaggedValue t;
+        t.tag = Tag::Int;
+        t.as.i = v;
+        return t;
+    }
+
+    static TaggedValue number(double v)
+    {
+        TaggedValue t;
+        t.tag = Tag::Float;
+        t.as.f = v;
+        return t;
+    }
+
+    // Box a non-scalar value in the given region. The returned value owns the only reference.
+    static TaggedValue object(ValueMemory::Region &region, Value value)
+    {
+        TaggedValue t;
+        t.tag = Tag::Object;
+        t.as.obj = region.getManager().makeRef<Value>(region, std::move(value)).detach();
+        return t;
+    }
+
+    // Convert an instruction operand or parser constant into its compact form.
+    // Only non-scalar values touch the region.
+    static TaggedValue fromValue(const Value &value, ValueMemory::Region &region)
+    {
+        return std::visit(
+            [&](const auto &v) -> TaggedValue {
+                using T = std::decay_t<decltype(v)>;
+                if constexpr (std::is_same_v<T, std::monostate>) {
+                    return TaggedValue();
+                } else if constexpr (std::is_same_v<T, bool>) {
+                    return boolean(v);
+                } else if constexpr (std::is_integral_v<T>) {
+                    return integer(static_cast<int64_t>(v));
+                } else if constexpr (std::is_floating_point_v<T>) {
+                    return number(static_cast<double>(v));
+                } else {
+                    return object(region, value);
+                }
+            },
+            value.data);
+    }
+
+    TaggedValue(const TaggedValue &other)
+        : tag(other.tag)
+        , as(other.as)
+    {
+        retain();
+    }
+
+    TaggedValue(TaggedValue &&other) noexcept
+        : tag(other.tag)
+        , as(other.as)
+    {
+        other.tag = Tag::Nil;
+    }
+
+    TaggedValue &operator=(const TaggedValue &other)
+    {
+        if (this != &other) {
+            other.retain();
+            release();
+            tag = other.tag;
+            as = other.as;
+        }
+        return *this;
+    }
+
+    TaggedValue &operator=(TaggedValue &&other) noexcept
+    {
+        if (this != &other) {
+            release();
+            tag = other.tag;
+            as = other.as;
+            other.tag = Tag::Nil;
+        }
+        return *this;
+    }
+
+    ~TaggedValue() { release(); }
+
+    bool isNil() const { return tag == Tag::Nil; }
+    bool isBool() const { return tag == Tag::Bool; }
+    bool isInt() const { return tag == Tag::Int; }
+    bool isFloat() const { return tag == Tag::Float; }
+    bool isNumber() const { return tag == Tag::Int || tag == Tag::Float; }
+    bool isObject() const { return tag == Tag::Object; }
+    bool isString() const
+    {
+        return tag == Tag::Object && std::holds_alternative<std::string>(as.obj->value.data);
+    }
+
+    double asDouble() const { return tag == Tag::Int ? static_cast<double>(as.i) : as.f; }
+    const Value &object() const { return as.obj->value; }
+    const std::string &string() const { return std::get<std::string>(as.obj->value.data); }
+
+    // Expand back into a full Value, used for debugging output and slow paths.
+    ValuePtr toValue(TypeSystem &typeSystem) const
+    {
+        switch (tag) {
+        case Tag::Nil:
+            return std::make_shared<Value>(Value{typeSystem.NIL_TYPE, std::monostate{}});
+        case Tag::Bool:
+            return std::make_shared<Value>(Value{typeSystem.BOOL_TYPE, as.b});
+        case Tag::Int:
+            return std::make_shared<Value>(Value{typeSystem.INT_TYPE, as.i});
+        case Tag::Float:
+            return std::make_shared<Value>(Value{typeSystem.FLOAT64_TYPE, as.f});
+        case Tag::Object:
+            return std::make_shared<Value>(as.obj->value);
+        }
+        return nullptr;
+    }
+
+    // Textual form used by string interpolation.
+    std::string toString() const
+    {
+        switch (tag) {
+        case Tag::Nil:
+            return "null";
+        case Tag::Bool:
+            return as.b ? "true" : "false";
+        case Tag::Int:
+            return std::to_string(as.i);
+        case Tag::Float:
+            return std::to_string(as.f);
+        case Tag::Object:
+            return std::visit(
+                [](const auto &v) -> std::string {
+                    using T = std::decay_t<decltype(v)>;
+                    if constexpr (std::is_same_v<T, std::string>) {
+                        return v;
+                    } else if constexpr (std::is_arithmetic_v<T>) {
+                        return std::to_string(v);
+                    } else {
+                        return "Unsupported type";
+                    }
+                },
+                as.obj->value.data);
+        }
+        return "";
+    }
+
+private:
+    void retain() const
+    {
+        if (tag == Tag::Object) {
+            HeapRef::share(as.obj);
+        }
+    }
+
+    void release()
+    {
+        if (tag == Tag::Object) {
+            HeapRef dropped(as.obj);
+        }
+        tag = Tag::Nil;
+    }
+};
+
+static_assert(sizeof(TaggedValue) == 16, "TaggedValue must stay a 16-byte tagged union");
+
+// Integer arithmetic of the language. It wraps on overflow like the C runtime's lm_*_i64,
+// instead of being undefined, and INT64_MIN / -1 gives INT64_MIN and INT64_MIN % -1 gives 0
+// rather than trapping. Division by zero is left to the caller to report.
+namespace IntArithmetic {
+
+inline int64_t add(int64_t a, int64_t b)
+{
+    return static_cast<int64_t>(static_cast<uint64_t>(a) + static_cast<uint64_t>(b));
+}
+
+inline int64_t subtract(int64_t a, int64_t b)
+{
+    return static_cast<int64_t>(static_cast<uint64_t>(a) - static_cast<uint64_t>(b));
+}
+
+inline int64_t multiply(int64_t a, int64_t b)
+{
+    return static_cast<int64_t>(static_cast<uint64_t>(a) * static_cast<uint64_t>(b));
+}
+
+inline int64_t negate(int64_t a)
+{
+    return subtract(0, a);
+}
+
+inline int64_t divide(int64_t a, int64_t b)
+{
+    return b == -1 ? negate(a) : a / b;
+}
+
+inline int64_t remainder(int64_t a, int64_t b)
+{
+    return b == -1 ? 0 : a % b;
+}
+
+} // namespace IntArithmetic
+
+// Prints the raw payload the same way std::visit over Value::data does.
+inline std::ostream &operator<<(std::ostream &os, const TaggedValue &value)
+{
+    switch (value.tag) {
+    case TaggedValue::Tag::Nil:
+        os << std::monostate{};
+        break;
+    case TaggedValue::Tag::Bool:
+        os << value.as.b;
+        break;
+    case TaggedValue::Tag::Int:
+        os << value.as.i;
+        break;
+    case TaggedValue::Tag::Float:
+        os << value.as.f;
+        break;
+    case TaggedValue::Tag::Object:
+        std::visit([&os](const auto &v) { os << v; }, value.object().data);
+        break;
+    }
+    return os;
+}
+
+#endif // TAGGED_HH
@@ -0,0 +1,662 @@
+#include "trace.hh"
+#include <algorithm>
+#include <cstddef>
+#include <stdexcept>
+
+bool RecordedTrace::canRecord(uint16_t opcode)
+{
+    switch (opcode) {
+    case NOP:
+    case DECLARE_VARIABLE:
+    case LOAD_CONST:
+    case LOAD_STR:
+    case BOOLEAN:
+    case LOAD_VARIABLE:
+    case STORE_VARIABLE:
+    case LOAD_LOCAL:
+    case STORE_LOCAL:
+    case POP:
+    case JUMP:
+    case JUMP_IF_FALSE:
+    case NOT:
+    case ADD:
+    case SUBTRACT:
+    case MULTIPLY:
+    case EQUAL:
+    case NOT_EQUAL:
+    case LESS_THAN:
+    case LESS_THAN_OR_EQUAL:
+    case GREATER_THAN:
+    case GREATER_THAN_OR_EQUAL:
+    case ADD_I64:
+    case SUB_I64:
+    case MUL_I64:
+    case NEG_I64:
+    case EQ_I64:
+    case NE_I64:
+    case LT_I64:
+    case LE_I64:
+    case GT_I64:
+    case GE_I64:
+    case ADD_F64:
+    case SUB_F64:
+    case MUL_F64:
+    case EQ_F64:
+    case NE_F64:
+    case LT_F64:
+    case LE_F64:
+    case GT_F64:
+    case GE_F64:
+    case INC_VAR_CONST:
+    case INC_LOCAL_CONST:
+    case JUMP_IF_VAR_LT_CONST:
+    case JUMP_IF_LOCAL_LT_CONST:
+        return true;
+    default:
+        return opcode >= QUICK_ADD_INT && opcode <= QUICK_GE_FLOAT;
+    }
+}
+
+bool RecordedTrace::slotOf(const DecodedInstruction &instruction, bool &local, int32_t &index,
+                           bool &writes)
+{
+    index = instruction.a;
+    writes = false;
+    switch (instruction.opcode) {
+    case STORE_VARIABLE:
+        writes = true;
+        [[fallthrough]];
+    case LOAD_VARIABLE:
+    case INC_VAR_CONST:
+    case JUMP_IF_VAR_LT_CONST:
+        local = false;
+        return true;
+    case STORE_LOCAL:
+        writes = true;
+        [[fallthrough]];
+    case LOAD_LOCAL:
+    case INC_LOCAL_CONST:
+    case JUMP_IF_LOCAL_LT_CONST:
+        local = true;
+        return true;
+    default:
+        return false;
+    }
+}
+
+#if LUMINAR_X64_JIT
+namespace {
+
+using namespace x64;
+
+constexpr int32_t VALUE_SIZE = sizeof(TaggedValue);
+constexpr int32_t PAYLOAD = offsetof(TaggedValue, as);
+
+// Trace code gets (variables, locals, constants) and keeps them where they arrive
+constexpr Reg VARIABLES = RDI;
+constexpr Reg LOCALS = RSI;
+constexpr Reg CONSTANTS = RDX;
+
+// RAX and RCX are scratch, XMM7 too; the rest hold operand stack entries
+constexpr Reg INT_REGISTERS[] = {R8, R9, R10, R11, R12, R13, R14, R15};
+constexpr Xmm FLOAT_REGISTERS[] = {XMM0, XMM1, XMM2, XMM3, XMM4, XMM5, XMM6};
+constexpr Reg SAVED_REGISTERS[] = {R12, R13, R14, R15};
+
+using Tag = TaggedValue::Tag;
+
+uint8_t tagByte(Tag tag)
+{
+    return static_cast<uint8_t>(tag);
+}
+
+// Generic form of a site opcode; load() keeps it in aux for generic and quickened records
+uint16_t genericOpcode(const DecodedInstruction &instruction)
+{
+    if (instruction.opcode >= QUICK_ADD_INT && instruction.opcode <= QUICK_GE_FLOAT) {
+        return instruction.aux;
+    }
+    return instruction.opcode;
+}
+
+class TraceCompiler
+{
+public:
+    TraceCompiler(const RecordedTrace &trace, const std::vector<DecodedInstruction> &code,
+                  const std::vector<TaggedValue> &constants)
+        : trace(trace)
+        , code(code)
+        , constants(constants)
+    {}
+
+    Emitter as;
+
+    void compile()
+    {
+        for (Reg reg : INT_REGISTERS) {
+            freeInts.push_back(reg);
+        }
+        for (Xmm reg : FLOAT_REGISTERS) {
+            freeFloats.push_back(reg);
+        }
+        epilogue = as.newLabel();
+        Label loop = as.newLabel();
+
+        for (Reg reg : SAVED_REGISTERS) {
+            as.push(reg);
+        }
+        // Entry guards: every slot still has the type the trace was specialized for
+        Label entryFailed = exitTo(trace.header);
+        for (const TraceSlot &slot : trace.slots) {
+            Mem tag = slotMem(slot.local, slot.index);
+            if (slot.writtenFirst) {
+                as.cmpByte(tag, tagByte(Tag::Object));
+                as.jcc(E, entryFailed);
+            } else {
+                as.cmpByte(tag, tagByte(slot.tag));
+                as.jcc(NE, entryFailed);
+            }
+            types.push_back(slot.tag);
+        }
+
+        as.bind(loop);
+        for (size_t i = 0; i < trace.pcs.size(); ++i) {
+            size_t pc = trace.pcs[i];
+            size_t next = i + 1 < trace.pcs.size() ? trace.pcs[i + 1] : trace.header;
+            const DecodedInstruction &instruction = code[pc];
+            if (!stack.empty() && stack.back().kind == Entry::Flags
+                && instruction.opcode != JUMP_IF_FALSE) {
+                materialize();
+            }
+            compileInstruction(instruction, pc, next, loop);
+        }
+
+        for (const auto &[label, pc] : exits) {
+            as.bind(label);
+            as.movImm(RAX, pc);
+            as.jmp(epilogue);
+        }
+        as.bind(epilogue);
+        for (auto reg = std::rbegin(SAVED_REGISTERS); reg != std::rend(SAVED_REGISTERS); ++reg) {
+            as.pop(*reg);
+        }
+        as.ret();
+        as.finish();
+    }
+
+private:
+    // Operand stack entry: an integer or boolean in a general register, a double in an XMM
+    // register, or a comparison still in the flags for the JUMP_IF_FALSE right after it
+    struct Entry
+    {
+        enum Kind { Int, Float, Bool, Flags } kind;
+        Reg reg;
+        Xmm xmm;
+        Cond cond;
+    };
+
+    const RecordedTrace &trace;
+    const std::vector<DecodedInstruction> &code;
+    const std::vector<TaggedValue> &constants;
+
+    std::vector<Entry> stack;
+    std::vector<Reg> freeInts;
+    std::vector<Xmm> freeFloats;
+    std::vector<Tag> types; // current type of each trace.slots entry
+    std::vector<std::pair<Label, size_t>> exits;
+    Label epilogue;
+
+    Label exitTo(size_t pc)
+    {
+        Label label = as.newLabel();
+        exits.emplace_back(label, pc);
+        return label;
+    }
+
+    Mem slotMem(bool local, int32_t index) const
+    {
+        return Mem{local ? LOCALS : VARIABLES, index * VALUE_SIZE};
+    }
+
+    static Mem payload(Mem value) { return Mem{value.base, value.disp + PAYLOAD}; }
+
+    Mem constantMem(int32_t index) const { return Mem{CONSTANTS, index * VALUE_SIZE}; }
+
+    size_t slotIndex(const DecodedInstruction &instruction) const
+    {
+        bool local;
+        int32_t index;
+        bool writes;
+        RecordedTrace::slotOf(instruction, local, index, writes);
+        for (size_t i = 0; i < trace.slots.size(); ++i) {
+            if (trace.slots[i].local == local && trace.slots[i].index == index) {
+                return i;
+            }
+        }
+        throw std::runtime_error("slot missing from the trace");
+    }
+
+    Reg takeInt()
+    {
+        if (freeInts.empty()) {
+            throw std::runtime_error("operand stack too deep");
+        }
+        Reg reg = freeInts.back();
+        freeInts.pop_back();
+        return reg;
+    }
+
+    Xmm takeFloat()
+    {
+        if (freeFloats.empty()) {
+            throw std::runtime_error("operand stack too deep");
+        }
+        Xmm reg = freeFloats.back();
+        freeFloats.pop_back();
+        return reg;
+    }
+
+    void push(Entry::Kind kind, Reg reg) { stack.push_back(Entry{kind, reg, XMM0, O}); }
+    void pushFloat(Xmm xmm) { stack.push_back(Entry{Entry::Float, RAX, xmm, O}); }
+    void pushFlags(Cond cond) { stack.push_back(Entry{Entry::Flags, RAX, XMM0, cond}); }
+
+    Entry pop()
+    {
+        if (stack.empty()) {
+            throw std::runtime_error("operand stack underflow");
+        }
+        Entry entry = stack.back();
+        stack.pop_back();
+        if (entry.kind == Entry::Float) {
+            freeFloats.push_back(entry.xmm);
+        } else if (entry.kind != Entry::Flags) {
+            freeInts.push_back(entry.reg);
+        }
+        return entry;
+    }
+
+    // Turns a pending comparison into a boolean register
+    void materialize()
+    {
+        Entry entry = pop();
+        as.setcc(entry.cond, RAX);
+        as.movzxByte(RAX, RAX);
+        Reg reg = takeInt();
+        as.mov(reg, RAX);
+        push(Entry::Bool, reg);
+    }
+
+    static Tag tagOf(Entry::Kind kind)
+    {
+        switch (kind) {
+        case Entry::Int:
+            return Tag::Int;
+        case Entry::Float:
+            return Tag::Float;
+        default:
+            return Tag::Bool;
+        }
+    }
+
+    void load(Mem slot, Tag tag)
+    {
+        switch (tag) {
+        case Tag::Int: {
+            Reg reg = takeInt();
+            as.mov(reg, payload(slot));
+            push(Entry::Int, reg);
+            break;
+        }
+        case Tag::Bool: {
+            Reg reg = takeInt();
+            as.movzxByte(reg, payload(slot));
+            push(Entry::Bool, reg);
+            break;
+        }
+        case Tag::Float: {
+            Xmm xmm = takeFloat();
+            as.movsd(xmm, payload(slot));
+            pushFloat(xmm);
+            break;
+        }
+        default:
+            throw std::runtime_error("trace reads a nil or heap value");
+        }
+    }
+
+    void store(Mem slot, size_t index)
+    {
+        Entry entry = pop();
+        if (entry.kind == Entry::Float) {
+            as.movsd(payload(slot), entry.xmm);
+        } else {
+            as.mov(payload(slot), entry.reg);
+        }
+        types[index] = tagOf(entry.kind);
+        as.movByte(slot, tagByte(types[index]));
+    }
+
+    void loadConstant(int32_t index)
+    {
+        const TaggedValue &constant = constants[index];
+        if (constant.isFloat()) {
+            Xmm xmm = takeFloat();
+            as.movsd(xmm, payload(constantMem(index)));
+            pushFloat(xmm);
+        } else if (constant.isInt() || constant.isBool()) {
+            Reg reg = takeInt();
+            as.movImm(reg, constant.isInt() ? static_cast<uint64_t>(constant.as.i) : constant.as.b);
+            push(constant.isInt() ? Entry::Int : Entry::Bool, reg);
+        } else {
+            throw std::runtime_error("trace loads a heap constant");
+        }
+    }
+
+    static bool isComparison(uint16_t opcode)
+    {
+        switch (opcode) {
+        case EQUAL:
+        case NOT_EQUAL:
+        case LESS_THAN:
+        case LESS_THAN_OR_EQUAL:
+        case GREATER_THAN:
+        case GREATER_THAN_OR_EQUAL:
+        case EQ_I64:
+        case NE_I64:
+        case LT_I64:
+        case LE_I64:
+        case GT_I64:
+        case GE_I64:
+        case EQ_F64:
+        case NE_F64:
+        case LT_F64:
+        case LE_F64:
+        case GT_F64:
+        case GE_F64:
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    static Cond intCondition(uint16_t opcode)
+    {
+        switch (opcode) {
+        case EQUAL:
+        case EQ_I64:
+        case EQ_F64:
+            return E;
+        case NOT_EQUAL:
+        case NE_I64:
+        case NE_F64:
+            return NE;
+        case LESS_THAN:
+        case LT_I64:
+        case LT_F64:
+            return L;
+        case LESS_THAN_OR_EQUAL:
+        case LE_I64:
+        case LE_F64:
+            return LE;
+        case GREATER_THAN:
+        case GT_I64:
+        case GT_F64:
+            return G;
+        default:
+            return GE;
+        }
+    }
+
+    // Arithmetic and comparisons. Generic opcodes are resolved from the operand types,
+    // which are static inside a trace.
+    void binary(uint16_t opcode)
+    {
+        if (stack.size() < 2) {
+            throw std::runtime_error("operand stack underflow");
+        }
+        Entry rhs = stack[stack.size() - 1];
+        Entry lhs = stack[stack.size() - 2];
+        if (lhs.kind != rhs.kind || lhs.kind == Entry::Bool) {
+            throw std::runtime_error("mixed or boolean operands");
+        }
+        Cond cond = intCondition(opcode);
+        bool comparison = isComparison(opcode);
+        pop();
+        pop();
+
+        if (lhs.kind == Entry::Int) {
+            if (comparison) {
+                as.cmp(lhs.reg, rhs.reg);
+                pushFlags(cond);
+                return;
+            }
+            Reg result = takeInt(); // lhs.reg, just released
+            switch (opcode) {
+            case ADD:
+            case ADD_I64:
+                as.add(result, rhs.reg);
+                break;
+            case SUBTRACT:
+            case SUB_I64:
+                as.sub(result, rhs.reg);
+                break;
+            case MULTIPLY:
+            case MUL_I64:
+                as.imul(result, rhs.reg);
+                break;
+            default:
+                throw std::runtime_error("unsupported integer operation");
+            }
+            push(Entry::Int, result);
+            return;
+        }
+
+        if (comparison) {
+            // ucomisd reports "unordered" for NaN through ZF=PF=CF=1; A and AE are false
+            // then, so < and <= compare the swapped operands
+            if (cond == E || cond == NE) {
+                as.ucomisd(lhs.xmm, rhs.xmm);
+                as.setcc(cond == E ? E : NE, RAX);
+                as.setcc(cond == E ? NP : P, RCX);
+                if (cond == E) {
+                    as.andByte(RAX, RCX);
+                } else {
+                    as.orByte(RAX, RCX);
+                }
+                as.movzxByte(RAX, RAX);
+                Reg reg = takeInt();
+                as.mov(reg, RAX);
+                push(Entry::Bool, reg);
+            } else if (cond == L || cond == LE) {
+                as.ucomisd(rhs.xmm, lhs.xmm);
+                pushFlags(cond == L ? A : AE);
+            } else {
+                as.ucomisd(lhs.xmm, rhs.xmm);
+                pushFlags(cond == G ? A : AE);
+            }
+            return;
+        }
+        Xmm result = takeFloat(); // lhs.xmm, just released
+        switch (opcode) {
+        case ADD:
+        case ADD_F64:
+            as.addsd(result, rhs.xmm);
+            break;
+        case SUBTRACT:
+        case SUB_F64:
+            as.subsd(result, rhs.xmm);
+            break;
+        case MULTIPLY:
+        case MUL_F64:
+            as.mulsd(result, rhs.xmm);
+            break;
+        default:
+            throw std::runtime_error("unsupported float operation");
+        }
+        pushFloat(result);
+    }
+
+    // Leaves the trace unless the branch goes the way it went while recording. Control
+    // reaches `taken` when `takenWhen` holds on the flags.
+    void guardBranch(Cond takenWhen, size_t pc, size_t taken, size_t fallthrough, size_t next)
+    {
+        if (!stack.empty()) {
+            throw std::runtime_error("values on the operand stack at a side exit");
+        }
+        if (taken == fallthrough) {
+            return;
+        }
+        if (next == fallthrough) {
+            as.jcc(takenWhen, exitTo(taken));
+        } else if (next == taken) {
+            as.jcc(invert(takenWhen), exitTo(fallthrough));
+        } else {
+            throw std::runtime_error("trace does not follow the branch at " + std::to_string(pc));
+        }
+    }
+
+    void compileInstruction(const DecodedInstruction &instruction, size_t pc, size_t next,
+                            Label loop)
+    {
+        switch (instruction.opcode) {
+        case NOP:
+        case DECLARE_VARIABLE:
+            break;
+        case LOAD_CONST:
+        case LOAD_STR:
+        case BOOLEAN:
+            loadConstant(instruction.a);
+            break;
+        case LOAD_VARIABLE:
+        case LOAD_LOCAL: {
+            size_t index = slotIndex(instruction);
+            load(slotMem(instruction.opcode == LOAD_LOCAL, instruction.a), types[index]);
+            break;
+        }
+        case STORE_VARIABLE:
+        case STORE_LOCAL:
+            store(slotMem(instruction.opcode == STORE_LOCAL, instruction.a),
+                  slotIndex(instruction));
+            break;
+        case POP:
+            pop();
+            break;
+        case NOT: {
+            if (stack.empty() || stack.back().kind != Entry::Bool) {
+                throw std::runtime_error("NOT on a non-boolean");
+            }
+            as.xorImm(stack.back().reg, 1);
+            break;
+        }
+        case NEG_I64: {
+            if (stack.empty() || stack.back().kind != Entry::Int) {
+                throw std::runtime_error("NEG_I64 on a non-integer");
+            }
+            as.neg(stack.back().reg);
+            break;
+        }
+        case INC_VAR_CONST:
+        case INC_LOCAL_CONST: {
+            size_t index = slotIndex(instruction);
+            Mem slot = slotMem(instruction.opcode == INC_LOCAL_CONST, instruction.a);
+            const TaggedValue &constant = constants[instruction.b];
+            if (types[index] != constant.tag || !(constant.isInt() || constant.isFloat())) {
+                throw std::runtime_error("increment with mixed types");
+            }
+            if (constant.isInt()) {
+                as.mov(RAX, payload(slot));
+                as.add(RAX, payload(constantMem(instruction.b)));
+                as.mov(payload(slot), RAX);
+            } else {
+                as.movsd(XMM7, payload(slot));
+                as.addsd(XMM7, payload(constantMem(instruction.b)));
+                as.movsd(payload(slot), XMM7);
+            }
+            break;
+        }
+        case JUMP_IF_VAR_LT_CONST:
+        case JUMP_IF_LOCAL_LT_CONST: {
+            size_t index = slotIndex(instruction);
+            Mem slot = slotMem(instruction.opcode == JUMP_IF_LOCAL_LT_CONST, instruction.a);
+            const TaggedValue &constant = constants[instruction.b];
+            if (types[index] != constant.tag || !(constant.isInt() || constant.isFloat())) {
+                throw std::runtime_error("comparison with mixed types");
+            }
+            Cond less;
+            if (constant.isInt()) {
+                as.mov(RAX, payload(slot));
+                as.cmp(RAX, payload(constantMem(instruction.b)));
+                less = L;
+            } else {
+                as.movsd(XMM7, payload(constantMem(instruction.b)));
+                as.ucomisd(XMM7, payload(slot));
+                less = A;
+            }
+            guardBranch(invert(less), pc, instruction.c, pc + instruction.aux, next);
+            break;
+        }
+        case JUMP:
+            if (instruction.a == static_cast<int32_t>(trace.header)) {
+                closeLoop(loop);
+            }
+            break; // forward jumps are implicit in the recorded order
+        case JUMP_IF_FALSE: {
+            Entry condition = pop();
+            Cond whenTrue = condition.kind == Entry::Flags ? condition.cond : NE;
+            if (condition.kind == Entry::Bool) {
+                as.test(condition.reg, condition.reg);
+            } else if (condition.kind != Entry::Flags) {
+                throw std::runtime_error("JUMP_IF_FALSE on a non-boolean");
+            }
+            guardBranch(invert(whenTrue), pc, instruction.a, pc + 1, next);
+            break;
+        }
+        default:
+            binary(genericOpcode(instruction));
+            break;
+        }
+    }
+
+    // Loops natively while every slot the next iteration reads first still has its entry
+    // type; otherwise hands the header back to the interpreter.
+    void closeLoop(Label loop)
+    {
+        if (!stack.empty()) {
+            throw std::runtime_error("values on the operand stack at the loop header");
+        }
+        for (size_t i = 0; i < trace.slots.size(); ++i) {
+            if (!trace.slots[i].writtenFirst && types[i] != trace.slots[i].tag) {
+                as.jmp(exitTo(trace.header));
+                return;
+            }
+        }
+        as.jmp(loop);
+    }
+};
+
+} // namespace
+#endif
+
+std::unique_ptr<CompiledTrace> CompiledTrace::compile(const RecordedTrace &trace,
+                                                      const std::vector<DecodedInstruction> &code,
+                                                      const std::vector<TaggedValue> &constants)
+{
+#if LUMINAR_X64_JIT
+    TraceCompiler compiler(trace, code, constants);
+    compiler.compile();
+
+    auto compiled = std::make_unique<CompiledTrace>();
+    compiled->machineCode.load(compiler.as.code());
+    compiled->entry = reinterpret_cast<int64_t (*)(TaggedValue *, TaggedValue *,
+                                                   const TaggedValue *)>(
+        const_cast<uint8_t *>(compiled->machineCode.data()));
+    compiled->header = trace.header;
+    compiled->length = trace.pcs.size();
+    compiled->codeSize = compiler.as.size();
+    return compiled;
+#else
+    (void) trace;
+    (void) code;
+    (void) constants;
+    throw std::runtime_error("no native code generator for this host");
+#endif
+}
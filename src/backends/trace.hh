@@ -0,0 +1,78 @@
+#ifndef TRACE_HH
+#define TRACE_HH
+
+#include "bytecode.hh"
+#include "tagged.hh"
+#include "x64.hh"
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+// A variable or local slot a trace touches, with the tag it had when the trace first
+// touched it. Slots the trace writes before reading only need to hold a scalar on entry.
+struct TraceSlot
+{
+    bool local;
+    int32_t index;
+    TaggedValue::Tag tag;
+    bool writtenFirst;
+};
+
+// One iteration of a hot loop as the StackBackend executed it: the pc of every record from
+// the loop header up to and including the backward JUMP that closes it. Branch directions
+// are implicit in which pc follows each conditional jump.
+struct RecordedTrace
+{
+    size_t header;
+    std::vector<size_t> pcs;
+    std::vector<TraceSlot> slots;
+
+    // Whether the recorder may execute and record `opcode`; anything else ends the trace
+    static bool canRecord(uint16_t opcode);
+    // The slot `instruction` reads or writes, if it touches one
+    static bool slotOf(const DecodedInstruction &instruction, bool &local, int32_t &index,
+                       bool &writes);
+};
+
+// Native code for a RecordedTrace. It runs against the interpreter's own TaggedValue
+// variables and locals: on entry it checks the slot tags the trace was specialized for,
+// keeps every value the trace computes typed in machine registers, and leaves through a
+// side exit wherever a branch goes the other way than it did while recording. Every exit
+// writes back nothing but the pc the interpreter resumes at, since stores go straight to
+// the slots.
+class CompiledTrace
+{
+public:
+    // Throws std::runtime_error for traces it cannot specialize (mixed operand types,
+    // values left on the operand stack at a side exit, ...).
+    static std::unique_ptr<CompiledTrace> compile(const RecordedTrace &trace,
+                                                  const std::vector<DecodedInstruction> &code,
+                                                  const std::vector<TaggedValue> &constants);
+
+    // Runs the loop until a guard fails; returns the pc to resume interpreting at
+    size_t run(TaggedValue *variables, TaggedValue *locals, const TaggedValue *constants)
+    {
+        ++entries;
+        size_t exit = static_cast<size_t>(entry(variables, locals, constants));
+        if (exit == header) {
+            ++guardFailures;
+        }
+        return exit;
+    }
+
+    size_t header = 0;
+    size_t length = 0;      // recorded instructions
+    size_t codeSize = 0;    // bytes of machine code
+    uint64_t entries = 0;   // calls from the interpreter
+    uint64_t guardFailures = 0; // entries that failed the slot guards straight away
+
+private:
+#if LUMINAR_X64_JIT
+    x64::ExecutableMemory machineCode;
+#endif
+    int64_t (*entry)(TaggedValue *variables, TaggedValue *locals, const TaggedValue *constants)
+        = nullptr;
+};
+
+#endif // TRACE_HH
@@ -0,0 +1,780 @@
+#include "verifier.hh"
+#include <algorithm>
+#include <deque>
+#include <iomanip>
+#include <stdexcept>
+#include <type_traits>
+
+std::string typeSetName(TypeSet types)
+{
+    static const std::pair<TypeSet, const char *> names[] = {
+        {TYPE_NIL, "nil"},       {TYPE_BOOL, "bool"},     {TYPE_INT, "int"},
+        {TYPE_FLOAT, "float"},   {TYPE_STRING, "str"},    {TYPE_OBJECT, "object"},
+        {TYPE_UNDECLARED, "undeclared"},
+    };
+
+    std::string name;
+    if ((types & TYPE_ANY) == TYPE_ANY) {
+        name = "any";
+        types &= ~TYPE_ANY;
+    }
+    for (const auto &[type, typeName] : names) {
+        if (types & type) {
+            name += (name.empty() ? "" : "|") + std::string(typeName);
+        }
+    }
+    return name.empty() ? "none" : name;
+}
+
+namespace {
+
+constexpr int32_t TOP_LEVEL = -1; // owner of the records outside every function body
+
+TypeSet constantType(const ValuePtr &constant)
+{
+    return std::visit(
+        [](const auto &v) -> TypeSet {
+            using T = std::decay_t<decltype(v)>;
+            if constexpr (std::is_same_v<T, std::monostate>) {
+                return TYPE_NIL;
+            } else if constexpr (std::is_same_v<T, bool>) {
+                return TYPE_BOOL;
+            } else if constexpr (std::is_integral_v<T>) {
+                return TYPE_INT;
+            } else if constexpr (std::is_floating_point_v<T>) {
+                return TYPE_FLOAT;
+            } else if constexpr (std::is_same_v<T, std::string>) {
+                return TYPE_STRING;
+            } else {
+                return TYPE_OBJECT;
+            }
+        },
+        constant->data);
+}
+
+// Values a straight-line record pops and pushes; false for control flow and calls, whose
+// effect depends on where they go
+bool stackEffect(uint16_t opcode, int &pops, int &pushes)
+{
+    pops = 0;
+    pushes = 0;
+    switch (opcode) {
+    case NEGATE:
+    case NOT:
+    case NEG_I64:
+    case NEG_F64:
+    case TO_INT64:
+    case TO_FLOAT64:
+        pops = pushes = 1;
+        return true;
+    case ADD:
+    case SUBTRACT:
+    case MULTIPLY:
+    case DIVIDE:
+    case MODULUS:
+    case EQUAL:
+    case NOT_EQUAL:
+    case LESS_THAN:
+    case LESS_THAN_OR_EQUAL:
+    case GREATER_THAN:
+    case GREATER_THAN_OR_EQUAL:
+    case AND:
+    case OR:
+    case ADD_I64:
+    case SUB_I64:
+    case MUL_I64:
+    case DIV_I64:
+    case MOD_I64:
+    case ADD_F64:
+    case SUB_F64:
+    case MUL_F64:
+    case DIV_F64:
+    case MOD_F64:
+    case EQ_I64:
+    case NE_I64:
+    case LT_I64:
+    case LE_I64:
+    case GT_I64:
+    case GE_I64:
+    case EQ_F64:
+    case NE_F64:
+    case LT_F64:
+    case LE_F64:
+    case GT_F64:
+    case GE_F64:
+    case EQ_STR:
+    case NE_STR:
+    case CONCATENATE_STR:
+    case INTERPOLATE_STRING:
+        pops = 2;
+        pushes = 1;
+        return true;
+    case NOP:
+    case DECLARE_VARIABLE:
+        return true;
+    case LOAD_CONST:
+    case LOAD_STR:
+    case BOOLEAN:
+    case PUSH_ARGS:
+    case LOAD_VARIABLE:
+    case LOAD_LOCAL:
+        pushes = 1;
+        return true;
+    case STORE_VARIABLE:
+    case STORE_LOCAL:
+    case PRINT:
+    case POP:
+        pops = 1;
+        return true;
+    default:
+        return false;
+    }
+}
+
+// Same as the register translation: the caller leaves the arguments on the stack and the
+// prologue pops them into the parameters, so the parameter count is how far the first
+// block dips below its entry depth.
+int32_t parameterCount(const DecodedProgram &program, const FunctionInfo &function)
+{
+    int depth = 0;
+    int lowest = 0;
+    for (int32_t pc = function.entry; pc < function.end; ++pc) {
+        int pops, pushes;
+        if (!stackEffect(program.code[pc].opcode, pops, pushes)) {
+            break;
+        }
+        depth -= pops;
+        lowest = std::min(lowest, depth);
+        depth += pushes;
+    }
+    return -lowest;
+}
+
+// Calls f for every single tag in `types`
+template<typename F>
+void forEachTag(TypeSet types, F f)
+{
+    for (int tag = TYPE_NIL; tag <= TYPE_OBJECT; tag <<= 1) {
+        if (types & tag) {
+            f(static_cast<TypeSet>(tag));
+        }
+    }
+}
+
+// What the StackBackend's handler for `opcode` pushes for operands of exactly these tags.
+// Operations it cannot perform report the error and push nil.
+TypeSet operationResult(uint16_t opcode, TypeSet lhs, TypeSet rhs)
+{
+    const bool ints = lhs == TYPE_INT && rhs == TYPE_INT;
+    const bool numbers = (lhs == TYPE_INT || lhs == TYPE_FLOAT)
+                         && (rhs == TYPE_INT || rhs == TYPE_FLOAT);
+    const bool strings = lhs == TYPE_STRING && rhs == TYPE_STRING;
+
+    switch (opcode) {
+    case NEGATE:
+        return rhs == TYPE_INT || rhs == TYPE_FLOAT ? rhs : TypeSet{TYPE_NIL};
+    case NOT:
+        return rhs == TYPE_BOOL ? TYPE_BOOL : TYPE_NIL;
+    case ADD:
+    case SUBTRACT:
+    case MULTIPLY:
+        if (numbers) {
+            return ints ? TYPE_INT : TYPE_FLOAT;
+        }
+        return opcode == ADD && strings ? TYPE_STRING : TYPE_NIL;
+    case DIVIDE:
+        if (numbers) {
+            return (ints ? TYPE_INT : TYPE_FLOAT) | TYPE_NIL; // by zero
+        }
+        return TYPE_NIL;
+    case MODULUS:
+        if (numbers) {
+            return ints ? TYPE_INT | TYPE_NIL : TYPE_FLOAT;
+        }
+        return TYPE_NIL;
+    case EQUAL:
+    case NOT_EQUAL:
+        if (lhs == TYPE_BOOL && rhs == TYPE_BOOL) {
+            return TYPE_BOOL;
+        }
+        [[fallthrough]];
+    case LESS_THAN:
+    case LESS_THAN_OR_EQUAL:
+    case GREATER_THAN:
+    case GREATER_THAN_OR_EQUAL:
+        return numbers || strings ? TYPE_BOOL : TYPE_NIL;
+    case AND:
+    case OR:
+        return lhs == TYPE_BOOL && rhs == TYPE_BOOL ? TYPE_BOOL : TYPE_NIL;
+    case EQ_STR:
+        return strings ? TypeSet{TYPE_BOOL} : operationResult(EQUAL, lhs, rhs);
+    case NE_STR:
+        return strings ? TypeSet{TYPE_BOOL} : operationResult(NOT_EQUAL, lhs, rhs);
+    case CONCATENATE_STR:
+        return strings ? TypeSet{TYPE_STRING} : operationResult(ADD, lhs, rhs);
+    case INTERPOLATE_STRING:
+        return lhs == TYPE_STRING ? TYPE_STRING | TYPE_NIL : TYPE_NIL; // the template needs a {}
+    default:
+        throw std::logic_error("no generic result for " + decodedOpcodeName(opcode));
+    }
+}
+
+// Type of the value `opcode` pushes; rhs is the top of the stack, lhs the value below it
+TypeSet resultType(uint16_t opcode, TypeSet lhs, TypeSet rhs)
+{
+    switch (opcode) {
+    // The typed forms trust the parser and never look at the tags
+    case ADD_I64:
+    case SUB_I64:
+    case MUL_I64:
+        return TYPE_INT;
+    case DIV_I64:
+    case MOD_I64:
+        return TYPE_INT | TYPE_NIL; // by zero
+    case DIV_F64:
+        return TYPE_FLOAT | TYPE_NIL;
+    case ADD_F64:
+    case SUB_F64:
+    case MUL_F64:
+    case MOD_F64:
+        return TYPE_FLOAT;
+    case EQ_I64:
+    case NE_I64:
+    case LT_I64:
+    case LE_I64:
+    case GT_I64:
+    case GE_I64:
+    case EQ_F64:
+    case NE_F64:
+    case LT_F64:
+    case LE_F64:
+    case GT_F64:
+    case GE_F64:
+        return TYPE_BOOL;
+    case NEG_I64:
+    case NEG_F64:
+        return rhs; // negates the payload in place, the tag stays
+    case TO_INT64: // anything but a number or nil is reported and becomes nil
+        return (rhs & (TYPE_INT | TYPE_FLOAT) ? TYPE_INT : 0)
+               | (rhs & ~(TYPE_INT | TYPE_FLOAT) ? TYPE_NIL : 0);
+    case TO_FLOAT64:
+        return (rhs & (TYPE_INT | TYPE_FLOAT) ? TYPE_FLOAT : 0)
+               | (rhs & ~(TYPE_INT | TYPE_FLOAT) ? TYPE_NIL : 0);
+    case NEGATE:
+    case NOT: {
+        TypeSet result = 0;
+        forEachTag(rhs, [&](TypeSet tag) { result |= operationResult(opcode, 0, tag); });
+        return result;
+    }
+    default: {
+        TypeSet result = 0;
+        forEachTag(lhs, [&](TypeSet left) {
+            forEachTag(rhs, [&](TypeSet right) { result |= operationResult(opcode, left, right); });
+        });
+        return result;
+    }
+    }
+}
+
+// DECLARE_VARIABLE and STORE_VARIABLE of `slot` grow the variables to include it
+void declareUpTo(std::vector<TypeSet> &globals, int32_t slot)
+{
+    for (int32_t i = 0; i <= slot; ++i) {
+        if (globals[i] & TYPE_UNDECLARED) {
+            globals[i] = (globals[i] & ~TYPE_UNDECLARED) | TYPE_NIL;
+        }
+    }
+}
+
+// Types at one record. The stack is relative to the frame's base.
+struct State
+{
+    std::vector<TypeSet> stack;
+    std::vector<TypeSet> locals;
+    std::vector<TypeSet> globals;
+};
+
+bool joinInto(std::vector<TypeSet> &into, const std::vector<TypeSet> &from)
+{
+    bool changed = false;
+    for (size_t i = 0; i < into.size(); ++i) {
+        TypeSet joined = into[i] | from[i];
+        changed |= joined != into[i];
+        into[i] = joined;
+    }
+    return changed;
+}
+
+class Verifier
+{
+public:
+    explicit Verifier(const DecodedProgram &program)
+        : program(program)
+        , code(program.code)
+    {}
+
+    Verification run()
+    {
+        Verification &out = verification;
+        const size_t functionCount = program.functions.size();
+        out.records.assign(code.size(), RecordFacts{});
+        out.functionDepths.assign(functionCount, 0);
+        out.resultTypes.assign(functionCount, 0);
+        for (const auto &function : program.functions) {
+            out.paramCounts.push_back(parameterCount(program, function));
+        }
+
+        // Records belong to the innermost function body around them. Bodies follow their
+        // DEFINE_FUNCTION, so inner ones come later in the table.
+        owners.assign(code.size(), TOP_LEVEL);
+        for (size_t id = 0; id < functionCount; ++id) {
+            const FunctionInfo &function = program.functions[id];
+            std::fill(owners.begin() + function.entry, owners.begin() + function.end,
+                      static_cast<int32_t>(id));
+        }
+        for (const auto &record : code) {
+            if (record.opcode == DECLARE_VARIABLE || record.opcode == LOAD_VARIABLE
+                || record.opcode == STORE_VARIABLE) {
+                out.variableCount = std::max(out.variableCount, record.a + 1);
+            }
+        }
+        writes.assign(functionCount, std::vector<TypeSet>(out.variableCount, 0));
+        callSites.resize(functionCount);
+        isCallSite.assign(code.size(), false);
+
+        states.resize(code.size());
+        queued.assign(code.size(), false);
+        try {
+            merge(0, TOP_LEVEL, State{{}, {}, std::vector<TypeSet>(out.variableCount, TYPE_UNDECLARED)});
+            while (!worklist.empty()) {
+                size_t pc = worklist.front();
+                worklist.pop_front();
+                queued[pc] = false;
+                step(pc);
+            }
+        } catch (const std::runtime_error &e) {
+            out.problem = e.what();
+            return out;
+        }
+
+        for (size_t pc = 0; pc < code.size(); ++pc) {
+            RecordFacts &facts = out.records[pc];
+            if (facts.depth < 0) {
+                continue;
+            }
+            const auto &stack = states[pc].stack;
+            facts.top = stack.empty() ? 0 : stack.back();
+            facts.second = stack.size() < 2 ? 0 : stack[stack.size() - 2];
+        }
+        out.verified = true;
+        return out;
+    }
+
+private:
+    const DecodedProgram &program;
+    const std::vector<DecodedInstruction> &code;
+    Verification verification;
+    std::vector<int32_t> owners; // by pc: function id, or TOP_LEVEL
+    std::vector<State> states;   // by pc, where records[pc].depth >= 0
+    std::vector<std::vector<TypeSet>> writes; // by function id: what it may store to each variable
+    std::vector<std::vector<size_t>> callSites; // by function id: calls reached so far
+    std::vector<bool> isCallSite;
+    std::deque<size_t> worklist;
+    std::vector<bool> queued;
+
+    [[noreturn]] void fail(size_t pc, const std::string &what) const
+    {
+        throw std::runtime_error("pc " + std::to_string(pc) + " (line "
+                                 + std::to_string(program.lineAt(pc)) + "): " + what);
+    }
+
+    // Jumping to the end of the program is running off it
+    void checkTarget(size_t pc, int32_t target) const
+    {
+        if (target < 0 || static_cast<size_t>(target) > code.size()) {
+            fail(pc, "jumps to " + std::to_string(target) + ", outside the program");
+        }
+    }
+
+    std::string nameOf(int32_t owner) const
+    {
+        return owner == TOP_LEVEL ? "the top level"
+                                  : program.names[program.functions[owner].nameIndex];
+    }
+
+    int32_t &maxDepth(int32_t owner)
+    {
+        return owner == TOP_LEVEL ? verification.maxDepth : verification.functionDepths[owner];
+    }
+
+    void enqueue(size_t pc)
+    {
+        if (!queued[pc]) {
+            queued[pc] = true;
+            worklist.push_back(pc);
+        }
+    }
+
+    // Control reaches `pc` from a record of `owner` with `state`
+    void merge(size_t pc, int32_t owner, State state)
+    {
+        int32_t depth = static_cast<int32_t>(state.stack.size());
+        maxDepth(owner) = std::max(maxDepth(owner), depth);
+        if (pc >= code.size()) {
+            if (owner != TOP_LEVEL) {
+                throw std::runtime_error("control runs off the end of the program in "
+                                         + nameOf(owner));
+            }
+            return; // the backend warns about the missing HALT and stops
+        }
+        if (owners[pc] != owner) {
+            fail(pc, "control reaches it from " + nameOf(owner) + " but it belongs to "
+                         + nameOf(owners[pc]));
+        }
+
+        RecordFacts &facts = verification.records[pc];
+        if (facts.depth < 0) {
+            facts.depth = depth;
+            states[pc] = std::move(state);
+            enqueue(pc);
+            return;
+        }
+        if (facts.depth != depth) {
+            fail(pc, "reached with " + std::to_string(depth) + " values on the stack and with "
+                         + std::to_string(facts.depth) + " on another path");
+        }
+        State &known = states[pc];
+        bool changed = joinInto(known.stack, state.stack);
+        changed |= joinInto(known.locals, state.locals);
+        changed |= joinInto(known.globals, state.globals);
+        if (changed) {
+            enqueue(pc);
+        }
+    }
+
+    // The types of a function's result or stores grew: calls of it need another look
+    void revisitCalls(int32_t function)
+    {
+        for (size_t pc : callSites[function]) {
+            enqueue(pc);
+        }
+    }
+
+    void step(size_t pc)
+    {
+        const DecodedInstruction &record = code[pc];
+        const int32_t owner = owners[pc];
+        State state = states[pc];
+        auto &stack = state.stack;
+        auto need = [&](size_t count) {
+            if (stack.size() < count) {
+                fail(pc, decodedOpcodeName(record.opcode) + " pops " + std::to_string(count)
+                             + " values, the stack holds " + std::to_string(stack.size()));
+            }
+        };
+
+        int pops, pushes;
+        if (stackEffect(record.opcode, pops, pushes)) {
+            need(pops);
+            if ((record.opcode == DECLARE_VARIABLE || record.opcode == LOAD_VARIABLE
+                 || record.opcode == STORE_VARIABLE)
+                && record.a < 0) {
+                fail(pc, "variable " + std::to_string(record.a) + " does not exist");
+            }
+            TypeSet rhs = pops > 0 ? stack.back() : 0;
+            TypeSet lhs = pops > 1 ? stack[stack.size() - 2] : 0;
+            TypeSet result = 0;
+
+            switch (record.opcode) {
+            case NOP:
+            case PRINT:
+            case POP:
+                break;
+            case LOAD_CONST:
+            case LOAD_STR:
+            case BOOLEAN:
+            case PUSH_ARGS:
+                if (record.a < 0 || static_cast<size_t>(record.a) >= program.constants.size()) {
+                    fail(pc, "constant " + std::to_string(record.a) + " does not exist");
+                }
+                result = constantType(program.constants[record.a]);
+                break;
+            case DECLARE_VARIABLE:
+                declareUpTo(state.globals, record.a);
+                break;
+            case LOAD_VARIABLE:
+                result = state.globals[record.a];
+                if (result & TYPE_UNDECLARED) {
+                    fail(pc, "variable " + std::to_string(record.a) + " may not be declared yet");
+                }
+                break;
+            case STORE_VARIABLE:
+                declareUpTo(state.globals, record.a);
+                state.globals[record.a] = rhs;
+                if (owner != TOP_LEVEL && (writes[owner][record.a] | rhs) != writes[owner][record.a]) {
+                    writes[owner][record.a] |= rhs;
+                    revisitCalls(owner);
+                }
+                break;
+            case LOAD_LOCAL:
+            case STORE_LOCAL:
+                if (record.a < 0 || static_cast<size_t>(record.a) >= state.locals.size()) {
+                    fail(pc, "local " + std::to_string(record.a) + " outside the frame of "
+                                 + nameOf(owner));
+                }
+                if (record.opcode == LOAD_LOCAL) {
+                    result = state.locals[record.a];
+                } else {
+                    state.locals[record.a] = rhs;
+                }
+                break;
+            default:
+                result = resultType(record.opcode, lhs, rhs);
+                break;
+            }
+
+            stack.resize(stack.size() - pops);
+            if (pushes) {
+                stack.push_back(result);
+            }
+            merge(pc + 1, owner, std::move(state));
+            return;
+        }
+
+        switch (record.opcode) {
+        case DEFINE_FUNCTION:
+            merge(pc + 1, owner, std::move(state)); // the JUMP over the body follows
+            return;
+        case JUMP:
+            checkTarget(pc, record.a);
+            merge(record.a, owner, std::move(state));
+            return;
+        case JUMP_IF_FALSE:
+            need(1);
+            checkTarget(pc, record.a);
+            stack.pop_back();
+            merge(pc + 1, owner, state);
+            merge(record.a, owner, std::move(state));
+            return;
+        case INVOKE_FUNCTION:
+        case TAIL_CALL:
+            call(pc, owner, std::move(state));
+            return;
+        case RETURN:
+        case RETURN_VALUE: {
+            if (owner == TOP_LEVEL) {
+                fail(pc, "returns outside of a function");
+            }
+            size_t values = record.opcode == RETURN_VALUE ? 1 : 0;
+            if (stack.size() != values) {
+                fail(pc, "returns with " + std::to_string(stack.size()) + " values on the stack");
+            }
+            TypeSet &result = verification.resultTypes[owner];
+            TypeSet returned = values ? stack.back() : TypeSet{TYPE_NIL};
+            if ((result | returned) != result) {
+                result |= returned;
+                revisitCalls(owner);
+            }
+            return;
+        }
+        case HALT:
+            return;
+        default:
+            fail(pc, "cannot verify " + decodedOpcodeName(record.opcode));
+        }
+    }
+
+    void call(size_t pc, int32_t owner, State state)
+    {
+        const DecodedInstruction &record = code[pc];
+        if (record.a < 0) {
+            bool named = record.b >= 0 && static_cast<size_t>(record.b) < program.names.size();
+            fail(pc, "calls " + (named ? program.names[record.b] : "a function")
+                         + ", which is not declared");
+        }
+        if (static_cast<size_t>(record.a) >= program.functions.size()) {
+            fail(pc, "calls function " + std::to_string(record.a) + ", which does not exist");
+        }
+        const int32_t callee = record.a;
+        const FunctionInfo &function = program.functions[callee];
+        if (function.localCount < 0) {
+            fail(pc, "calls " + nameOf(callee) + ", whose frame has a negative size");
+        }
+        const size_t params = static_cast<size_t>(verification.paramCounts[callee]);
+        auto &stack = state.stack;
+        if (stack.size() < params) {
+            fail(pc, "calls " + nameOf(callee) + " with " + std::to_string(stack.size())
+                         + " of its " + std::to_string(params) + " arguments");
+        }
+        // The callee may run in this frame; nothing may be left under the arguments
+        if (record.opcode == TAIL_CALL && stack.size() != params) {
+            fail(pc, "tail call leaves " + std::to_string(stack.size() - params)
+                         + " values behind");
+        }
+        if (!isCallSite[pc]) {
+            isCallSite[pc] = true;
+            callSites[callee].push_back(pc);
+        }
+
+        merge(function.entry, callee,
+              State{std::vector<TypeSet>(stack.end() - params, stack.end()),
+                    std::vector<TypeSet>(function.localCount, TYPE_NIL), state.globals});
+
+        // Whatever the callee stores, its caller may store
+        if (owner != TOP_LEVEL && joinInto(writes[owner], writes[callee])) {
+            revisitCalls(owner);
+        }
+
+        TypeSet result = verification.resultTypes[callee];
+        if (!result) {
+            return; // no return of the callee was reached yet
+        }
+        stack.resize(stack.size() - params);
+        stack.push_back(result);
+        for (size_t slot = 0; slot < state.globals.size(); ++slot) {
+            state.globals[slot] |= writes[callee][slot];
+        }
+        merge(pc + 1, owner, std::move(state));
+    }
+};
+
+// Typed form of a generic operation whose operands are exactly `lhs` and `rhs` (the top),
+// or the opcode itself. Only rewrites that do the same thing for these tags qualify.
+uint16_t typedForm(uint16_t opcode, TypeSet lhs, TypeSet rhs)
+{
+    // NEGATE only has the top operand.
+    const bool unary = opcode == NEGATE;
+    const bool ints = rhs == TYPE_INT && (unary || lhs == TYPE_INT);
+    const bool floats = rhs == TYPE_FLOAT && (unary || lhs == TYPE_FLOAT);
+    const bool strings = lhs == TYPE_STRING && rhs == TYPE_STRING;
+
+    // Forms for int, float and string operands; the generic opcode where there is none.
+    uint16_t i64 = opcode;
+    uint16_t f64 = opcode;
+    uint16_t str = opcode;
+    switch (opcode) {
+    case NEGATE:
+        i64 = NEG_I64;
+        f64 = NEG_F64;
+        break;
+    case ADD:
+        i64 = ADD_I64;
+        f64 = ADD_F64;
+        str = CONCATENATE_STR;
+        break;
+    case SUBTRACT:
+        i64 = SUB_I64;
+        f64 = SUB_F64;
+        break;
+    case MULTIPLY:
+        i64 = MUL_I64;
+        f64 = MUL_F64;
+        break;
+    case DIVIDE:
+        i64 = DIV_I64;
+        f64 = DIV_F64;
+        break;
+    case MODULUS:
+        i64 = MOD_I64;
+        f64 = MOD_F64;
+        break;
+    case EQUAL:
+        i64 = EQ_I64;
+        f64 = EQ_F64;
+        str = EQ_STR;
+        break;
+    case NOT_EQUAL:
+        i64 = NE_I64;
+        f64 = NE_F64;
+        str = NE_STR;
+        break;
+    case LESS_THAN:
+        i64 = LT_I64;
+        f64 = LT_F64;
+        break;
+    case LESS_THAN_OR_EQUAL:
+        i64 = LE_I64;
+        f64 = LE_F64;
+        break;
+    case GREATER_THAN:
+        i64 = GT_I64;
+        f64 = GT_F64;
+        break;
+    case GREATER_THAN_OR_EQUAL:
+        i64 = GE_I64;
+        f64 = GE_F64;
+        break;
+    default:
+        return opcode;
+    }
+    return ints ? i64 : floats ? f64 : strings ? str : opcode;
+}
+
+} // namespace
+
+Verification verifyProgram(const DecodedProgram &program)
+{
+    return Verifier(program).run();
+}
+
+size_t specializeOperations(DecodedProgram &program, const Verification &verification)
+{
+    if (!verification.verified) {
+        return 0;
+    }
+    size_t rewritten = 0;
+    for (size_t pc = 0; pc < program.code.size(); ++pc) {
+        const RecordFacts &facts = verification.records[pc];
+        DecodedInstruction &record = program.code[pc];
+        if (facts.depth < 0) {
+            continue;
+        }
+        uint16_t typed = typedForm(record.opcode, facts.second, facts.top);
+        if (typed != record.opcode) {
+            record.opcode = typed;
+            rewritten++;
+        }
+    }
+    return rewritten;
+}
+
+void printVerification(std::ostream &out, const DecodedProgram &program,
+                       const Verification &verification)
+{
+    if (!verification.verified) {
+        out << "; not verified: " << verification.problem << "\n";
+        return;
+    }
+
+    out << "; top level: max depth " << verification.maxDepth << ", variables "
+        << verification.variableCount << "\n";
+    for (size_t id = 0; id < program.functions.size(); ++id) {
+        const FunctionInfo &function = program.functions[id];
+        out << "; function " << program.names[function.nameIndex] << ": parameters "
+            << verification.paramCounts[id];
+        if (verification.records[function.entry].depth < 0) {
+            out << ", never called\n";
+            continue;
+        }
+        out << ", max depth " << verification.functionDepths[id] << ", returns "
+            << typeSetName(verification.resultTypes[id]) << "\n";
+    }
+
+    for (size_t pc = 0; pc < program.code.size(); ++pc) {
+        const DecodedInstruction &record = program.code[pc];
+        const RecordFacts &facts = verification.records[pc];
+        out << std::setw(5) << pc << "  " << std::left << std::setw(22)
+            << decodedOpcodeName(record.opcode) << std::right << std::setw(5) << record.a;
+        if (facts.depth < 0) {
+            out << "  ; unreachable\n";
+            continue;
+        }
+        out << "  ; depth " << facts.depth;
+        if (facts.depth > 1) {
+            out << ": " << typeSetName(facts.second) << ", " << typeSetName(facts.top);
+        } else if (facts.depth == 1) {
+            out << ": " << typeSetName(facts.top);
+        }
+        out << "\n";
+    }
+}
@@ -0,0 +1,71 @@
+#ifndef VERIFIER_HH
+#define VERIFIER_HH
+
+#include "bytecode.hh"
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// The tags an operand may carry, as a set: one bit per TaggedValue tag, with strings apart
+// from the other heap objects. TYPE_UNDECLARED only describes variables, whose slots may not
+// exist yet.
+using TypeSet = uint8_t;
+enum OperandType : TypeSet {
+    TYPE_NIL = 1 << 0,
+    TYPE_BOOL = 1 << 1,
+    TYPE_INT = 1 << 2,
+    TYPE_FLOAT = 1 << 3,
+    TYPE_STRING = 1 << 4,
+    TYPE_OBJECT = 1 << 5,
+    TYPE_ANY = TYPE_NIL | TYPE_BOOL | TYPE_INT | TYPE_FLOAT | TYPE_STRING | TYPE_OBJECT,
+    TYPE_UNDECLARED = 1 << 6,
+};
+
+// "int", "int|nil", ...
+std::string typeSetName(TypeSet types);
+
+// What the verifier knows about a record before it runs
+struct RecordFacts
+{
+    int32_t depth = -1;  // operand stack depth above the frame's base, -1 if unreachable
+    TypeSet top = 0;     // type of the top of the stack, if depth > 0
+    TypeSet second = 0;  // and of the value below it, if depth > 1
+};
+
+// Result of verifyProgram(). A verified program needs none of the StackBackend's run-time
+// checks of its operand stack and variables:
+//   - every path reaching a record arrives with the same stack depth, no record pops more
+//     than its frame pushed, functions return exactly their value and tail calls leave
+//     nothing behind;
+//   - every top-level variable is declared on every path that reads it;
+//   - control stays inside the function it entered, and calls go to defined functions.
+struct Verification
+{
+    bool verified = false;
+    std::string problem; // why not, "pc 12 (line 3): ..."
+    std::vector<RecordFacts> records;
+    int32_t maxDepth = 0;                // of the top level
+    std::vector<int32_t> functionDepths; // by function id, arguments included
+    std::vector<int32_t> paramCounts;    // by function id
+    std::vector<TypeSet> resultTypes;    // by function id, none for functions never called
+    int32_t variableCount = 0;           // one past the largest top-level variable slot
+};
+
+// Proves the properties above by abstract interpretation of `program`, as decoded and
+// before fuseSuperinstructions(): a fixpoint over every record reachable from pc 0, with
+// the types of the stack, the frame's locals and the top-level variables at each of them.
+// Calls pass their argument and variable types to the callee, and continue with the
+// callee's result type and the variables it may store to.
+Verification verifyProgram(const DecodedProgram &program);
+
+// Rewrites generic operations whose operand types the verification proved into their typed
+// forms (ADD on two ints into ADD_I64, ...), which the StackBackend runs without looking at
+// tags. Returns how many it rewrote.
+size_t specializeOperations(DecodedProgram &program, const Verification &verification);
+
+// The verification of every reachable record: its depth and operand types
+void printVerification(std::ostream &out, const DecodedProgram &program,
+                       const Verification &verification);
+
+#endif // VERIFIER_HH
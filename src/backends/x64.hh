@@ -0,0 +1,433 @@
+#ifndef X64_HH
+#define X64_HH
+
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#if defined(__x86_64__) && (defined(__unix__) || defined(__APPLE__))
+#include <sys/mman.h>
+#include <unistd.h>
+#define LUMINAR_X64_JIT 1
+#else
+#define LUMINAR_X64_JIT 0
+#endif
+
+// Minimal x86-64 machine code emitter for the JIT backends. It only knows the handful of
+// instruction forms they use: 64-bit integer moves and arithmetic on registers and
+// [base + disp] operands, scalar SSE2 doubles, setcc, and rel32 jumps/calls to labels.
+namespace x64 {
+
+enum Reg : uint8_t { RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI, R8, R9, R10, R11, R12, R13, R14, R15 };
+enum Xmm : uint8_t { XMM0, XMM1, XMM2, XMM3, XMM4, XMM5, XMM6, XMM7 };
+enum Cond : uint8_t { O, NO, B, AE, E, NE, BE, A, S, NS, P, NP, L, GE, LE, G };
+
+inline Cond invert(Cond cond)
+{
+    return static_cast<Cond>(cond ^ 1);
+}
+
+// [base + disp]
+struct Mem
+{
+    Reg base;
+    int32_t disp;
+};
+
+struct Label
+{
+    int32_t id;
+};
+
+class Emitter
+{
+public:
+    const std::vector<uint8_t> &code() const { return bytes; }
+    size_t size() const { return bytes.size(); }
+
+    Label newLabel()
+    {
+        labels.push_back(-1);
+        return Label{static_cast<int32_t>(labels.size() - 1)};
+    }
+
+    void bind(Label label) { labels[label.id] = static_cast<int32_t>(bytes.size()); }
+    bool isBound(Label label) const { return labels[label.id] >= 0; }
+    int32_t offsetOf(Label label) const { return labels[label.id]; }
+
+    // Patches every jump and call to its label
+    void finish()
+    {
+        for (const auto &fixup : fixups) {
+            int32_t target = labels[fixup.label];
+            if (target < 0) {
+                throw std::runtime_error("x64: jump to an unbound label");
+            }
+            int32_t rel = target - static_cast<int32_t>(fixup.position + 4);
+            std::memcpy(&bytes[fixup.position], &rel, 4);
+        }
+        fixups.clear();
+    }
+
+    // Moves
+    void mov(Reg dst, Reg src) { op64(0x89, src, dst); }
+    void mov(Reg dst, Mem src) { op64(0x8B, dst, src); }
+    void mov(Mem dst, Reg src) { op64(0x89, src, dst); }
+    void movImm(Reg dst, uint64_t imm)
+    {
+        rex(true, 0, dst);
+        byte(0xB8 + (dst & 7));
+        quad(imm);
+    }
+    void movByte(Mem dst, uint8_t imm)
+    {
+        rex(false, 0, dst.base);
+        byte(0xC6);
+        modrm(0, dst);
+        byte(imm);
+    }
+    void movzxByte(Reg dst, Mem src)
+    {
+        rex(false, dst, src.base);
+        byte(0x0F);
+        byte(0xB6);
+        modrm(dst, src);
+    }
+    void movzxByte(Reg dst, Reg src) // dst32 = src8; src must be AL..BL
+    {
+        rex(false, dst, src);
+        byte(0x0F);
+        byte(0xB6);
+        modrmDirect(dst, src);
+    }
+    void lea(Reg dst, Mem src) { op64(0x8D, dst, src); }
+
+    // Integer arithmetic
+    void add(Reg dst, Mem src) { op64(0x03, dst, src); }
+    void sub(Reg dst, Mem src) { op64(0x2B, dst, src); }
+    void imul(Reg dst, Mem src)
+    {
+        rex(true, dst, src.base);
+        byte(0x0F);
+        byte(0xAF);
+        modrm(dst, src);
+    }
+    void add(Reg dst, Reg src) { op64(0x01, src, dst); }
+    void sub(Reg dst, Reg src) { op64(0x29, src, dst); }
+    void imul(Reg dst, Reg src)
+    {
+        rex(true, dst, src);
+        byte(0x0F);
+        byte(0xAF);
+        modrmDirect(dst, src);
+    }
+    // RDX:RAX / divisor -> RAX, remainder RDX. Traps when the divisor is 0, and when it is -1
+    // with INT64_MIN in RAX: callers branch around both first.
+    void cqo()
+    {
+        rex(true, 0, 0);
+        byte(0x99);
+    }
+    void idiv(Reg divisor)
+    {
+        rex(true, 0, divisor);
+        byte(0xF7);
+        modrmDirect(7, divisor);
+    }
+    void cmp(Reg lhs, Mem rhs) { op64(0x3B, lhs, rhs); }
+    void cmp(Reg lhs, Reg rhs) { op64(0x39, rhs, lhs); }
+    void test(Reg lhs, Reg rhs) { op64(0x85, rhs, lhs); }
+    void neg(Reg reg)
+    {
+        rex(true, 0, reg);
+        byte(0xF7);
+        modrmDirect(3, reg);
+    }
+    void addImm(Reg reg, int32_t imm) { arithImm(0, reg, imm); }
+    void subImm(Reg reg, int32_t imm) { arithImm(5, reg, imm); }
+    void xorImm(Reg reg, int32_t imm) { arithImm(6, reg, imm); }
+    void cmpImm(Reg reg, int32_t imm) { arithImm(7, reg, imm); }
+    void cmpByte(Mem lhs, uint8_t imm)
+    {
+        rex(false, 0, lhs.base);
+        byte(0x80);
+        modrm(7, lhs);
+        byte(imm);
+    }
+    void cmpDword(Mem lhs, int32_t imm)
+    {
+        rex(false, 0, lhs.base);
+        byte(0x81);
+        modrm(7, lhs);
+        dword(imm);
+    }
+    void incDword(Mem target)
+    {
+        rex(false, 0, target.base);
+        byte(0xFF);
+        modrm(0, target);
+    }
+    void decDword(Mem target)
+    {
+        rex(false, 0, target.base);
+        byte(0xFF);
+        modrm(1, target);
+    }
+
+    // Byte registers; only AL, CL, DL and BL, which need no REX prefix
+    void setcc(Cond cond, Reg dst)
+    {
+        byte(0x0F);
+        byte(0x90 + cond);
+        modrmDirect(0, dst);
+    }
+    void andByte(Reg dst, Reg src)
+    {
+        byte(0x20);
+        modrmDirect(src, dst);
+    }
+    void orByte(Reg dst, Reg src)
+    {
+        byte(0x08);
+        modrmDirect(src, dst);
+    }
+    void testByte(Reg lhs, Reg rhs)
+    {
+        byte(0x84);
+        modrmDirect(rhs, lhs);
+    }
+
+    // Scalar doubles
+    void movsd(Xmm dst, Mem src) { sse(0xF2, 0x10, dst, src); }
+    void movsd(Mem dst, Xmm src) { sse(0xF2, 0x11, src, dst); }
+    void addsd(Xmm dst, Mem src) { sse(0xF2, 0x58, dst, src); }
+    void mulsd(Xmm dst, Mem src) { sse(0xF2, 0x59, dst, src); }
+    void subsd(Xmm dst, Mem src) { sse(0xF2, 0x5C, dst, src); }
+    void divsd(Xmm dst, Mem src) { sse(0xF2, 0x5E, dst, src); }
+    void ucomisd(Xmm lhs, Mem rhs) { sse(0x66, 0x2E, lhs, rhs); }
+    void movsd(Xmm dst, Xmm src) { sse(0xF2, 0x10, dst, src); }
+    void addsd(Xmm dst, Xmm src) { sse(0xF2, 0x58, dst, src); }
+    void mulsd(Xmm dst, Xmm src) { sse(0xF2, 0x59, dst, src); }
+    void subsd(Xmm dst, Xmm src) { sse(0xF2, 0x5C, dst, src); }
+    void divsd(Xmm dst, Xmm src) { sse(0xF2, 0x5E, dst, src); }
+    void ucomisd(Xmm lhs, Xmm rhs) { sse(0x66, 0x2E, lhs, rhs); }
+    void cvtsi2sd(Xmm dst, Reg src)
+    {
+        byte(0xF2);
+        rex(true, dst, src);
+        byte(0x0F);
+        byte(0x2A);
+        modrmDirect(dst, src);
+    }
+    void cvttsd2si(Reg dst, Xmm src)
+    {
+        byte(0xF2);
+        rex(true, dst, src);
+        byte(0x0F);
+        byte(0x2C);
+        modrmDirect(dst, src);
+    }
+
+    // Control flow
+    void jmp(Label target)
+    {
+        byte(0xE9);
+        reference(target);
+    }
+    void jcc(Cond cond, Label target)
+    {
+        byte(0x0F);
+        byte(0x80 + cond);
+        reference(target);
+    }
+    void call(Label target)
+    {
+        byte(0xE8);
+        reference(target);
+    }
+    void call(Reg target)
+    {
+        rex(false, 0, target);
+        byte(0xFF);
+        modrmDirect(2, target);
+    }
+    // Absolute call through RAX, which it clobbers
+    void callAbsolute(const void *function)
+    {
+        movImm(RAX, reinterpret_cast<uint64_t>(function));
+        call(RAX);
+    }
+    void push(Reg reg)
+    {
+        rex(false, 0, reg);
+        byte(0x50 + (reg & 7));
+    }
+    void pop(Reg reg)
+    {
+        rex(false, 0, reg);
+        byte(0x58 + (reg & 7));
+    }
+    void ret() { byte(0xC3); }
+
+private:
+    struct Fixup
+    {
+        size_t position; // of the rel32 field
+        int32_t label;
+    };
+
+    std::vector<uint8_t> bytes;
+    std::vector<int32_t> labels; // label id -> code offset, -1 while unbound
+    std::vector<Fixup> fixups;
+
+    void byte(uint8_t value) { bytes.push_back(value); }
+    void dword(int32_t value)
+    {
+        uint8_t raw[4];
+        std::memcpy(raw, &value, 4);
+        bytes.insert(bytes.end(), raw, raw + 4);
+    }
+    void quad(uint64_t value)
+    {
+        uint8_t raw[8];
+        std::memcpy(raw, &value, 8);
+        bytes.insert(bytes.end(), raw, raw + 8);
+    }
+
+    void reference(Label target)
+    {
+        fixups.push_back(Fixup{bytes.size(), target.id});
+        dword(0);
+    }
+
+    // REX prefix, omitted when it would be a plain 0x40
+    void rex(bool wide, uint8_t reg, uint8_t base)
+    {
+        uint8_t prefix = 0x40 | (wide ? 8 : 0) | ((reg >> 3) & 1) << 2 | ((base >> 3) & 1);
+        if (prefix != 0x40) {
+            byte(prefix);
+        }
+    }
+
+    void modrmDirect(uint8_t reg, uint8_t rm) { byte(0xC0 | (reg & 7) << 3 | (rm & 7)); }
+
+    void modrm(uint8_t reg, Mem mem)
+    {
+        uint8_t base = mem.base & 7;
+        uint8_t mod = 2;
+        if (mem.disp == 0 && base != RBP) {
+            mod = 0;
+        } else if (mem.disp >= -128 && mem.disp <= 127) {
+            mod = 1;
+        }
+        byte(mod << 6 | (reg & 7) << 3 | base);
+        if (base == RSP) {
+            byte(0x24); // SIB: no index, base only (RSP and R12)
+        }
+        if (mod == 1) {
+            byte(static_cast<uint8_t>(mem.disp));
+        } else if (mod == 2) {
+            dword(mem.disp);
+        }
+    }
+
+    void op64(uint8_t opcode, uint8_t reg, Mem mem)
+    {
+        rex(true, reg, mem.base);
+        byte(opcode);
+        modrm(reg, mem);
+    }
+
+    void op64(uint8_t opcode, uint8_t reg, Reg rm)
+    {
+        rex(true, reg, rm);
+        byte(opcode);
+        modrmDirect(reg, rm);
+    }
+
+    void arithImm(uint8_t extension, Reg reg, int32_t imm)
+    {
+        rex(true, 0, reg);
+        if (imm >= -128 && imm <= 127) {
+            byte(0x83);
+            modrmDirect(extension, reg);
+            byte(static_cast<uint8_t>(imm));
+        } else {
+            byte(0x81);
+            modrmDirect(extension, reg);
+            dword(imm);
+        }
+    }
+
+    void sse(uint8_t prefix, uint8_t opcode, uint8_t reg, Mem mem)
+    {
+        byte(prefix);
+        rex(false, reg, mem.base);
+        byte(0x0F);
+        byte(opcode);
+        modrm(reg, mem);
+    }
+
+    void sse(uint8_t prefix, uint8_t opcode, uint8_t reg, Xmm rm)
+    {
+        byte(prefix);
+        rex(false, reg, rm);
+        byte(0x0F);
+        byte(opcode);
+        modrmDirect(reg, rm);
+    }
+};
+
+#if LUMINAR_X64_JIT
+// Page-aligned read+execute copy of emitted code.
+class ExecutableMemory
+{
+public:
+    ExecutableMemory() = default;
+    ExecutableMemory(const ExecutableMemory &) = delete;
+    ExecutableMemory &operator=(const ExecutableMemory &) = delete;
+    ~ExecutableMemory() { release(); }
+
+    void load(const std::vector<uint8_t> &code)
+    {
+        release();
+        size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+        length = (code.size() + page - 1) / page * page;
+        void *memory = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+                            -1, 0);
+        if (memory == MAP_FAILED) {
+            length = 0;
+            throw std::runtime_error("x64: cannot map memory for generated code");
+        }
+        std::memcpy(memory, code.data(), code.size());
+        if (mprotect(memory, length, PROT_READ | PROT_EXEC) != 0) {
+            munmap(memory, length);
+            length = 0;
+            throw std::runtime_error("x64: cannot make generated code executable");
+        }
+        base = static_cast<uint8_t *>(memory);
+    }
+
+    const uint8_t *data() const { return base; }
+    size_t size() const { return length; }
+
+private:
+    uint8_t *base = nullptr;
+    size_t length = 0;
+
+    void release()
+    {
+        if (base) {
+            munmap(base, length);
+            base = nullptr;
+            length = 0;
+        }
+    }
+};
+#endif
+
+} // namespace x64
+
+#endif // X64_HH
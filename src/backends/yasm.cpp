@@ -1,385 +1,1176 @@
-//#include "yasm.hh"
-
-//void YASMBackend::dumpRegisters()
-//{
-//    //    std::cout << "Stack:\n";
-//    //    std::stack<Value> tempStack = stack;
-//    //    while (!tempStack.empty()) {
-//    //        auto value = tempStack.top();
-//    //        tempStack.pop();
-//    //        std::visit([](const auto &val) { std::cout << val; }, value);
-//    //        std::cout << "\n";
-//    //    }
-
-//    //    std::cout << "Constants:\n";
-//    //    for (size_t i = 0; i < constants.size(); ++i) {
-//    //        std::cout << "C-" << i << ": ";
-//    //        std::visit([](const auto &value) { std::cout << value; }, constants[i]);
-//    //        std::cout << "\n";
-//    //    }
-
-//    //    std::cout << "Variables:\n";
-//    //    for (size_t i = 0; i < variables.size(); ++i) {
-//    //        std::cout << "V-" << i << ": ";
-//    //        std::visit([](const auto &value) { std::cout << value; }, variables[i]);
-//    //        std::cout << "\n";
-//    //    }
-
-//    //    std::cout << "Functions:\n";
-//    //    for (const auto &[name, _] : functions) {
-//    //        std::cout << "Function: " << name << "\n";
-//    //    }
-//}
-
-//void YASMBackend::run(const std::vector<Instruction> &program)
-//{
-//    outputFile.open("output.asm");
-
-//    if (!outputFile.is_open()) {
-//        std::cerr << "Failed to open output file." << std::endl;
-//        return;
-//    }
-
-//    // Emit initial assembly setup
-//    emit("section .data");
-//    emit("format db '%d', 0");
-
-//    // Emit data section for strings
-//    for (const auto &[label, str] : stringTable) {
-//        emit(label + " db '" + str + "', 0");
-//    }
-
-//    emit("section .text");
-//    emit("global _start");
-//    emit("_start:");
-//    this->program = program; // Store the program in the instance
-//    try {
-//        pc = 0; // Reset program counter
-//        while (pc < program.size()) {
-//            const Instruction &instruction = program[pc];
-//            execute(instruction);
-//            pc++;
-//        }
-//    } catch (const std::exception &ex) {
-//        std::cerr << "Exception occurred during code generation: " << ex.what() << std::endl;
-//    }
-//    outputFile.close();
-//}
-
-//void YASMBackend::execute(const Instruction &instruction)
-//{
-//    //    for (const auto &instruction : program) {
-//    switch (instruction.opcode) {
-//    case NEGATE:
-//    case NOT:
-//        emitUnaryOperation(instruction);
-//        break;
-//    case ADD:
-//    case SUBTRACT:
-//    case MULTIPLY:
-//    case DIVIDE:
-//    case MODULUS:
-//        emitBinaryOperation(instruction);
-//        break;
-//    case EQUAL:
-//    case NOT_EQUAL:
-//    case LESS_THAN:
-//    case LESS_THAN_OR_EQUAL:
-//    case GREATER_THAN:
-//    case GREATER_THAN_OR_EQUAL:
-//        emitComparisonOperation(instruction);
-//        break;
-//    case AND:
-//    case OR:
-//        emitLogicalOperation(instruction);
-//        break;
-//    case LOAD_CONST:
-//    case LOAD_STR:
-//        emitLoadConst(instruction);
-//        break;
-//    case PRINT:
-//        emitPrint();
-//        break;
-//    case HALT:
-//        emitHalt();
-//        break;
-//    case DECLARE_VARIABLE:
-//        emitDeclareVariable(instruction);
-//        break;
-//    case LOAD_VARIABLE:
-//        emitLoadVariable(instruction);
-//        break;
-//    case STORE_VARIABLE:
-//        emitStoreVariable(instruction);
-//        break;
-//    case DEFINE_FUNCTION:
-//        emitDeclareFunction(instruction);
-//        break;
-//    case INVOKE_FUNCTION:
-//        emitCallFunction(instruction);
-//        break;
-//    case JUMP:
-//        emitJump(instruction);
-//        break;
-//    case JUMP_IF_FALSE:
-//        emitJumpZero(instruction);
-//        break;
-//    case CONCURRENT:
-//        emitHandleConcurrent(instruction);
-//        break;
-//    case PARALLEL:
-//        emitHandleParallel(instruction);
-//        break;
-//    default:
-//        std::cerr << "Unknown opcode." << std::endl;
-//    }
-//    //}
-//}
-
-//std::string YASMBackend::getUniqueLabel()
-//{
-//    return "L" + std::to_string(labelCounter++);
-//}
-
-//void YASMBackend::emit(const std::string &line)
-//{
-//    outputFile << line << std::endl;
-//    std::cout << line << std::endl;
-//}
-
-//void YASMBackend::emitUnaryOperation(const Instruction &instruction)
-//{
-//    if (instruction.opcode == NEGATE) {
-//        emit("pop rax");
-//        emit("neg rax");
-//        emit("push rax");
-//    } else if (instruction.opcode == NOT) {
-//        emit("pop rax");
-//        emit("not rax");
-//        emit("push rax");
-//    }
-//}
-
-//void YASMBackend::emitBinaryOperation(const Instruction &instruction)
-//{
-//    emit("pop rbx");
-//    emit("pop rax");
-//    switch (instruction.opcode) {
-//    case ADD:
-//        emit("add rax, rbx");
-//        break;
-//    case SUBTRACT:
-//        emit("sub rax, rbx");
-//        break;
-//    case MULTIPLY:
-//        emit("imul rax, rbx");
-//        break;
-//    case DIVIDE:
-//        emit("xor rdx, rdx");
-//        emit("idiv rbx");
-//        break;
-//    case MODULUS:
-//        emit("xor rdx, rdx");
-//        emit("idiv rbx");
-//        emit("mov rax, rdx");
-//        break;
-//    default:
-//        std::cerr << "Invalid binary operation opcode" << std::endl;
-//    }
-//    emit("push rax");
-//}
-
-//void YASMBackend::emitComparisonOperation(const Instruction &instruction)
-//{
-//    emit("pop rbx");
-//    emit("pop rax");
-//    emit("cmp rax, rbx");
-//    switch (instruction.opcode) {
-//    case EQUAL:
-//        emit("sete al");
-//        break;
-//    case NOT_EQUAL:
-//        emit("setne al");
-//        break;
-//    case LESS_THAN:
-//        emit("setl al");
-//        break;
-//    case LESS_THAN_OR_EQUAL:
-//        emit("setle al");
-//        break;
-//    case GREATER_THAN:
-//        emit("setg al");
-//        break;
-//    case GREATER_THAN_OR_EQUAL:
-//        emit("setge al");
-//        break;
-//    default:
-//        std::cerr << "Invalid comparison operation opcode" << std::endl;
-//    }
-//    emit("movzx rax, al");
-//    emit("push rax");
-//}
-
-//void YASMBackend::emitLogicalOperation(const Instruction &instruction)
-//{
-//    emit("pop rbx");
-//    emit("pop rax");
-//    switch (instruction.opcode) {
-//    case AND:
-//        emit("and rax, rbx");
-//        break;
-//    case OR:
-//        emit("or rax, rbx");
-//        break;
-//    default:
-//        std::cerr << "Invalid logical operation opcode" << std::endl;
-//    }
-//    emit("push rax");
-//}
-
-//void YASMBackend::emitLoadConst(const Instruction &instruction)
-//{
-//    if (std::holds_alternative<int32_t>(instruction.value)) {
-//        emit("mov rax, " + std::to_string(std::get<int32_t>(instruction.value)));
-//        emit("push rax");
-//        emit("\n");
-//    } else if (std::holds_alternative<double>(instruction.value)) {
-//        //        std::string dataLabel = "dbl" + std::to_string(dataLabelCounter++);
-//        //        emit(dataLabel + " dq " + std::to_string(std::get<double>(instruction.value)));
-//        //        emit("mov rax, [rip + " + dataLabel + "]");
-//        //        emit("push rax");
-
-//        // Define double constants in the .data section and load them
-//        std::string dataLabel = "dbl" + std::to_string(dataLabelCounter++);
-//        emit("section .data");
-//        emit(dataLabel + " dq " + std::to_string(std::get<double>(instruction.value)));
-//        emit("section .text");
-
-//        // Load the double constant
-//        emit("lea rax, [rel " + dataLabel + "]"); // Load address into rax
-//        emit("movsd xmm0, [rax]");                // Move double into xmm0 register
-//        emit("sub rsp, 8");                       // Allocate space on the stack
-//        emit("movsd [rsp], xmm0");                // Store double on the stack
-//        emit("\n");
-//    } else if (std::holds_alternative<bool>(instruction.value)) {
-//        bool value = std::get<bool>(instruction.value);
-//        emit("mov rax, " + std::to_string(value ? 1 : 0));
-//        emit("push rax");
-//        emit("\n");
-//    } else if (std::holds_alternative<std::string>(instruction.value)) {
-//        // Define string constants in the .data section and load them
-//        std::string str = std::get<std::string>(instruction.value);
-//        std::string label = "str" + std::to_string(dataLabelCounter++);
-//        emit("section .data");
-//        emit(label + " db '" + str + "'"); // Define string in data section
-//        emit(label + "len" + " db '" + " $-" + label);
-//        emit("section .text");
-
-//        // Load the address of the string
-//        emit("lea rax, [rel " + label + "]"); // Load address into rax
-//        emit("push rax");
-//        emit("\n");
-//    } else {
-//        //        std::string str = std::get<std::string>(instruction.value);
-//        //        std::string label = "str" + std::to_string(dataLabelCounter++);
-//        //        stringTable[label] = str;
-//        //        emit("mov rax, " + label);
-//        //        emit("push rax");
-//        // std::cerr << "Unsupported constant type" << std::endl;
-//        // Define string constants in the .data section and load them
-//        std::string str = std::get<std::string>(instruction.value);
-//        std::string label = "str" + std::to_string(dataLabelCounter++);
-//        emit("section .data");
-//        emit(label + " db '" + str + "'"); // Define string in data section
-//        emit(label + "len" + " db '" + " $-" + label);
-//        emit("section .text");
-
-//        // Load the address of the string
-//        emit("lea rax, [rel " + label + "]"); // Load address into rax
-//        emit("push rax");
-//        emit("\n");
-//    }
-//}
-
-//void YASMBackend::emitPrint()
-//{
-//    emit("section .text");
-//    emit("extern  printf");
-//    emit("pop rdi");
-//    emit("call printf"); // Assume there's a print function in assembly
-//}
-
-//void YASMBackend::emitHalt()
-//{
-//    emit("mov rax, 60");  // syscall number for exit
-//    emit("xor rdi, rdi"); // exit code 0
-//    emit("syscall");
-//}
-
-//void YASMBackend::emitDeclareVariable(const Instruction &instruction)
-//{
-//    unsigned int variableIndex = std::get<int32_t>(instruction.value);
-//    emit("sub rsp, 8"); // Allocate space on the stack for the variable
-//}
-
-//void YASMBackend::emitLoadVariable(const Instruction &instruction)
-//{
-//    unsigned int variableIndex = std::get<int32_t>(instruction.value);
-//    emit("mov rax, [rbp-" + std::to_string((variableIndex + 1) * 8) + "]");
-//    emit("push rax");
-//}
-
-//void YASMBackend::emitStoreVariable(const Instruction &instruction)
-//{
-//    unsigned int variableIndex = std::get<int32_t>(instruction.value);
-//    emit("pop rax");
-//    emit("mov [rbp-" + std::to_string((variableIndex + 1) * 8) + "], rax");
-//}
-
-//void YASMBackend::emitDeclareFunction(const Instruction &instruction)
-//{
-//    std::string functionName = std::get<std::string>(instruction.value);
-//    emit(functionName + ":");
-//}
-
-//void YASMBackend::emitCallFunction(const Instruction &instruction)
-//{
-//    std::string functionName = std::get<std::string>(instruction.value);
-//    emit("call " + functionName);
-//}
-
-//void YASMBackend::emitJump(const Instruction &instruction)
-//{
-//    int32_t offset = std::get<int32_t>(instruction.value);
-//    std::string label = getUniqueLabel();
-//    emit("jmp " + label);
-//    // In a real implementation, we need to handle labels and their positions
-//}
-
-//void YASMBackend::emitJumpZero(const Instruction &instruction)
-//{
-//    int32_t offset = std::get<int32_t>(instruction.value);
-//    std::string label = getUniqueLabel();
-//    emit("pop rax");
-//    emit("test rax, rax");
-//    emit("jz " + label);
-//    // In a real implementation, we need to handle labels and their positions
-//}
-
-//void YASMBackend::emitHandleConcurrent(const Instruction &instruction)
-//{
-//    std::string label = getUniqueLabel();
-//    emit("mov rdi, "
-//         + std::get<std::string>(instruction.value)); // Assumes value is a function name or address
-//    emit("call concurrent_function"); // Placeholder for the actual concurrent function handling
-//    emit(label + ":");
-//}
-
-//void YASMBackend::emitHandleParallel(const Instruction &instruction)
-//{
-//    std::string label = getUniqueLabel();
-//    emit("mov rdi, "
-//         + std::get<std::string>(instruction.value)); // Assumes value is a function name or address
-//    emit("call parallel_function"); // Placeholder for the actual parallel function handling
-//    emit(label + ":");
-//}
+#include "yasm.hh"
+#include "codegen.hh"
+#include "regtypes.hh"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <type_traits>
+#include <variant>
+
+namespace {
+
+// Callee-saved, so values in them survive calls into the runtime and other functions
+const char *const ALLOCATABLE[] = {"%rbx", "%r12", "%r13", "%r14", "%r15"};
+constexpr size_t ALLOCATABLE_COUNT = sizeof(ALLOCATABLE) / sizeof(ALLOCATABLE[0]);
+
+// Runtime selectors, see luminar_runtime.h
+enum : int { LM_EQ, LM_NE, LM_LT, LM_LE, LM_GT, LM_GE };
+enum : int { LM_ADD, LM_SUB, LM_MUL, LM_DIV, LM_MOD };
+
+int64_t tagOf(StaticType type)
+{
+    switch (type) {
+    case StaticType::Bool:
+        return 1;
+    case StaticType::Int:
+        return 2;
+    case StaticType::Float:
+        return 3;
+    default:
+        return 0;
+    }
+}
+
+bool fitsImmediate(int64_t value)
+{
+    return value >= INT32_MIN && value <= INT32_MAX;
+}
+
+std::string asmString(const std::string &text)
+{
+    std::ostringstream out;
+    out << '"';
+    for (unsigned char c : text) {
+        if (c == '"' || c == '\\') {
+            out << '\\' << c;
+        } else if (c >= 0x20 && c < 0x7f) {
+            out << c;
+        } else {
+            out << '\\' << std::oct << std::setw(3) << std::setfill('0') << int(c) << std::dec;
+        }
+    }
+    out << '"';
+    return out.str();
+}
+
+// Where an operand lives. A register or memory operand holds the 8 bytes of a scalar; an
+// Any value is 16 bytes in memory, tag at `text` and payload at `payload`. Constants that
+// fit an instruction are immediates (nil: tag and value 0).
+struct Place
+{
+    enum Kind { Register, Memory, Immediate };
+    Kind kind;
+    StaticType type;
+    std::string text;
+    std::string payload;
+    int64_t value = 0;
+};
+
+std::string frameOperand(int64_t offset, const char *base)
+{
+    return std::to_string(offset) + "(" + base + ")";
+}
+
+// A comparison's outcome: in the flags (true when `j<cc>` would jump) or as a byte in al
+struct Condition
+{
+    bool flags;
+    std::string cc;
+};
+
+std::string inverse(const std::string &cc)
+{
+    static const std::pair<const char *, const char *> pairs[] = {
+        {"e", "ne"}, {"l", "ge"}, {"le", "g"}, {"a", "be"}, {"ae", "b"},
+    };
+    for (const auto &[x, y] : pairs) {
+        if (cc == x) {
+            return y;
+        }
+        if (cc == y) {
+            return x;
+        }
+    }
+    throw std::runtime_error("No inverse for condition " + cc);
+}
+
+class AsmGenerator
+{
+public:
+    explicit AsmGenerator(const RegisterProgram &code)
+        : code(code)
+        , types(RegisterTypes::infer(code))
+    {}
+
+    std::string generate(AssemblyReport *report);
+
+private:
+    static constexpr int32_t MAIN = RegisterTypes::MAIN;
+
+    const RegisterProgram &code;
+    RegisterTypes types;
+    std::vector<Place> constants;
+    std::ostringstream text;
+    std::ostringstream rodata;
+    size_t lines = 0;
+
+    // The function being generated
+    int32_t current = MAIN;
+    std::vector<Place> homes;
+    std::vector<std::string> saved;
+    std::string exitLabel;
+
+    const RegisterFunction &functionAt(int32_t id) const
+    {
+        return id == MAIN ? code.main : code.functions[id];
+    }
+    std::string functionLabel(int32_t id) const
+    {
+        return id == MAIN ? "lm_main" : "lm_fn" + std::to_string(id);
+    }
+    std::string jumpLabel(int32_t pc) const
+    {
+        return ".L" + (current == MAIN ? std::string("m") : std::to_string(current)) + "_"
+               + std::to_string(pc);
+    }
+
+    void emit(const std::string &line)
+    {
+        text << '\t' << line << '\n';
+        ++lines;
+    }
+    void emitLabel(const std::string &label) { text << label << ":\n"; }
+
+    void lowerConstants();
+    Place globalPlace(int32_t reg) const;
+    Place place(int32_t operand) const
+    {
+        return isConstantOperand(operand) ? constants[~operand] : homes[operand];
+    }
+    size_t allocate(const RegisterFunction &function, std::vector<bool> &allocated);
+
+    // Loads and stores. None of them touches a register other than the ones it is given.
+    void loadBits(const Place &p, const std::string &reg);
+    std::string source(const Place &p, const std::string &scratch);
+    void loadValue(const Place &p, const std::string &tagReg, const std::string &payloadReg);
+    void loadFloatBits(const Place &p, const std::string &xmm);
+    void toDouble(const Place &p, const std::string &xmm);
+    void storeBits(const Place &dst, const std::string &reg, StaticType type);
+    void storeXmm(const Place &dst, const std::string &xmm);
+    void storeValue(const Place &dst, const std::string &tagReg, const std::string &payloadReg);
+    void storeNil(const Place &dst);
+    void move(const Place &dst, const Place &src);
+
+    // Calls a runtime function. Each argument is a selector (an int), the bits of a place
+    // or a whole lm_value (two registers).
+    struct Argument
+    {
+        enum Kind { Selector, Bits, Value } kind;
+        Place place;
+        int selector = 0;
+    };
+    void callRuntime(const std::string &name, const std::vector<Argument> &arguments);
+    static Argument value(const Place &p) { return Argument{Argument::Value, p}; }
+    static Argument bits(const Place &p) { return Argument{Argument::Bits, p}; }
+    static Argument selector(int s) { return Argument{Argument::Selector, Place{}, s}; }
+
+    void intBinary(const char *op, bool commutative, const Place &dst, const Place &a,
+                   const Place &b);
+    Condition compare(uint16_t opcode, const Place &a, const Place &b);
+    void operation(const RegisterInstruction &instruction);
+    void instruction(const RegisterInstruction &instruction);
+    void leaveFrame();
+    void function(int32_t id, AssemblyReport *report);
+};
+
+void AsmGenerator::lowerConstants()
+{
+    for (size_t i = 0; i < code.constants.size(); ++i) {
+        Place p{Place::Immediate, types.constants[i], "", ""};
+        std::visit(
+            [&](const auto &v) {
+                using T = std::decay_t<decltype(v)>;
+                if constexpr (std::is_same_v<T, bool>) {
+                    p.value = v ? 1 : 0;
+                } else if constexpr (std::is_integral_v<T>) {
+                    p.value = static_cast<int64_t>(v);
+                } else if constexpr (std::is_floating_point_v<T>) {
+                    double d = static_cast<double>(v);
+                    uint64_t bits;
+                    std::memcpy(&bits, &d, sizeof bits);
+                    std::string label = ".LF" + std::to_string(i);
+                    rodata << "\t.balign 8\n" << label << ":\n\t.quad " << bits << "\n";
+                    p = Place{Place::Memory, StaticType::Float, label + "(%rip)", ""};
+                } else if constexpr (std::is_same_v<T, std::string>) {
+                    std::string label = ".LS" + std::to_string(i);
+                    rodata << label << ":\n\t.ascii " << asmString(v) << "\n";
+                    p = Place{Place::Memory, StaticType::Any, "K+" + std::to_string(16 * i) + "(%rip)",
+                              "K+" + std::to_string(16 * i + 8) + "(%rip)"};
+                }
+            },
+            code.constants[i]->data);
+        constants.push_back(p);
+    }
+}
+
+Place AsmGenerator::globalPlace(int32_t reg) const
+{
+    std::string name = "g" + std::to_string(reg);
+    return Place{Place::Memory, types.main.registers[reg], name + "(%rip)", name + "+8(%rip)"};
+}
+
+void AsmGenerator::loadBits(const Place &p, const std::string &reg)
+{
+    switch (p.kind) {
+    case Place::Immediate:
+        emit(std::string(fitsImmediate(p.value) ? "movq $" : "movabsq $")
+             + std::to_string(p.value) + ", " + reg);
+        break;
+    case Place::Register:
+        if (p.text != reg) {
+            emit("movq " + p.text + ", " + reg);
+        }
+        break;
+    case Place::Memory:
+        emit("movq " + (p.type == StaticType::Any ? p.payload : p.text) + ", " + reg);
+        break;
+    }
+}
+
+// An operand for the source side of an ALU instruction: the place itself when the encoding
+// allows it, else `scratch` loaded with it
+std::string AsmGenerator::source(const Place &p, const std::string &scratch)
+{
+    switch (p.kind) {
+    case Place::Immediate:
+        if (fitsImmediate(p.value)) {
+            return "$" + std::to_string(p.value);
+        }
+        loadBits(p, scratch);
+        return scratch;
+    case Place::Register:
+        return p.text;
+    default:
+        return p.type == StaticType::Any ? p.payload : p.text;
+    }
+}
+
+void AsmGenerator::loadValue(const Place &p, const std::string &tagReg,
+                             const std::string &payloadReg)
+{
+    if (p.type == StaticType::Any && p.kind == Place::Memory) {
+        emit("movq " + p.text + ", " + tagReg);
+        emit("movq " + p.payload + ", " + payloadReg);
+        return;
+    }
+    emit("movq $" + std::to_string(tagOf(p.type)) + ", " + tagReg);
+    loadBits(p, payloadReg);
+}
+
+void AsmGenerator::loadFloatBits(const Place &p, const std::string &xmm)
+{
+    switch (p.kind) {
+    case Place::Memory:
+        emit("movsd " + (p.type == StaticType::Any ? p.payload : p.text) + ", " + xmm);
+        break;
+    case Place::Register:
+        emit("movq " + p.text + ", " + xmm);
+        break;
+    case Place::Immediate:
+        loadBits(p, "%rax");
+        emit("movq %rax, " + xmm);
+        break;
+    }
+}
+
+// Numeric conversion of an int or float place
+void AsmGenerator::toDouble(const Place &p, const std::string &xmm)
+{
+    if (p.type != StaticType::Int) {
+        loadFloatBits(p, xmm);
+        return;
+    }
+    std::string src = p.kind == Place::Immediate ? (loadBits(p, "%rax"), std::string("%rax"))
+                                                 : p.text;
+    emit("pxor " + xmm + ", " + xmm);
+    emit("cvtsi2sdq " + src + ", " + xmm);
+}
+
+void AsmGenerator::storeBits(const Place &dst, const std::string &reg, StaticType type)
+{
+    if (dst.type == StaticType::Any) {
+        emit("movq $" + std::to_string(tagOf(type)) + ", " + dst.text);
+        emit("movq " + reg + ", " + dst.payload);
+    } else if (dst.text != reg) {
+        emit("movq " + reg + ", " + dst.text);
+    }
+}
+
+void AsmGenerator::storeXmm(const Place &dst, const std::string &xmm)
+{
+    if (dst.type == StaticType::Any) {
+        emit("movq $" + std::to_string(tagOf(StaticType::Float)) + ", " + dst.text);
+        emit("movsd " + xmm + ", " + dst.payload);
+    } else {
+        emit("movsd " + xmm + ", " + dst.text);
+    }
+}
+
+void AsmGenerator::storeValue(const Place &dst, const std::string &tagReg,
+                              const std::string &payloadReg)
+{
+    if (dst.type != StaticType::Any) {
+        throw std::runtime_error("Assembly cannot store a value of unknown type in a typed "
+                                 "register");
+    }
+    emit("movq " + tagReg + ", " + dst.text);
+    emit("movq " + payloadReg + ", " + dst.payload);
+}
+
+void AsmGenerator::storeNil(const Place &dst)
+{
+    emit("movq $0, " + dst.text);
+    emit("movq $0, " + dst.payload);
+}
+
+void AsmGenerator::move(const Place &dst, const Place &src)
+{
+    if (src.type == StaticType::Any) {
+        loadValue(src, "%rax", "%rdx");
+        storeValue(dst, "%rax", "%rdx");
+    } else if (dst.kind == Place::Register) {
+        loadBits(src, dst.text);
+    } else {
+        loadBits(src, "%rax");
+        storeBits(dst, "%rax", src.type);
+    }
+}
+
+void AsmGenerator::callRuntime(const std::string &name, const std::vector<Argument> &arguments)
+{
+    static const char *const registers[] = {"%rdi", "%rsi", "%rdx", "%rcx", "%r8", "%r9"};
+    size_t next = 0;
+    for (const auto &argument : arguments) {
+        switch (argument.kind) {
+        case Argument::Selector:
+            emit("movq $" + std::to_string(argument.selector) + ", " + registers[next++]);
+            break;
+        case Argument::Bits:
+            loadBits(argument.place, registers[next++]);
+            break;
+        case Argument::Value:
+            loadValue(argument.place, registers[next], registers[next + 1]);
+            next += 2;
+            break;
+        }
+    }
+    emit("call " + name + "@PLT");
+}
+
+// dst = a <op> b on 64-bit integers, in place when dst is a machine register
+void AsmGenerator::intBinary(const char *op, bool commutative, const Place &dst, const Place &a,
+                             const Place &b)
+{
+    std::string o = op;
+    if (dst.kind == Place::Register) {
+        const std::string &r = dst.text;
+        if (a.kind == Place::Register && a.text == r) {
+            emit(o + " " + source(b, "%rcx") + ", " + r);
+            return;
+        }
+        if (b.kind == Place::Register && b.text == r) {
+            if (commutative) {
+                emit(o + " " + source(a, "%rcx") + ", " + r);
+                return;
+            }
+        } else {
+            loadBits(a, r);
+            emit(o + " " + source(b, "%rcx") + ", " + r);
+            return;
+        }
+    }
+    loadBits(a, "%rax");
+    emit(o + " " + source(b, "%rcx") + ", %rax");
+    storeBits(dst, "%rax", StaticType::Int);
+}
+
+Condition AsmGenerator::compare(uint16_t opcode, const Place &a, const Place &b)
+{
+    int selectorOf = LM_EQ;
+    switch (opcode) {
+    case EQUAL:
+    case EQ_I64:
+    case EQ_F64:
+    case EQ_STR:
+        selectorOf = LM_EQ;
+        break;
+    case NOT_EQUAL:
+    case NE_I64:
+    case NE_F64:
+    case NE_STR:
+        selectorOf = LM_NE;
+        break;
+    case LESS_THAN:
+    case LT_I64:
+    case LT_F64:
+        selectorOf = LM_LT;
+        break;
+    case LESS_THAN_OR_EQUAL:
+    case LE_I64:
+    case LE_F64:
+        selectorOf = LM_LE;
+        break;
+    case GREATER_THAN:
+    case GT_I64:
+    case GT_F64:
+        selectorOf = LM_GT;
+        break;
+    default:
+        selectorOf = LM_GE;
+        break;
+    }
+
+    bool typedInt = opcode == EQ_I64 || opcode == NE_I64 || opcode == LT_I64 || opcode == LE_I64
+                    || opcode == GT_I64 || opcode == GE_I64;
+    bool typedFloat = opcode == EQ_F64 || opcode == NE_F64 || opcode == LT_F64
+                      || opcode == LE_F64 || opcode == GT_F64 || opcode == GE_F64;
+    bool generic = !typedInt && !typedFloat && opcode != EQ_STR && opcode != NE_STR;
+    bool ints = a.type == StaticType::Int && b.type == StaticType::Int;
+    bool numbers = (a.type == StaticType::Int || a.type == StaticType::Float)
+                   && (b.type == StaticType::Int || b.type == StaticType::Float);
+    bool bools = a.type == StaticType::Bool && b.type == StaticType::Bool
+                 && (selectorOf == LM_EQ || selectorOf == LM_NE);
+
+    if (typedInt || (generic && (ints || bools))) {
+        static const char *const conditions[] = {"e", "ne", "l", "le", "g", "ge"};
+        std::string lhs;
+        if (a.kind == Place::Register) {
+            lhs = a.text;
+        } else if (a.kind == Place::Memory && b.kind != Place::Memory) {
+            lhs = a.type == StaticType::Any ? a.payload : a.text;
+        } else {
+            loadBits(a, "%rax");
+            lhs = "%rax";
+        }
+        emit("cmpq " + source(b, "%rcx") + ", " + lhs);
+        return Condition{true, conditions[selectorOf]};
+    }
+    if (typedFloat || (generic && numbers)) {
+        if (typedFloat) {
+            loadFloatBits(a, "%xmm0");
+            loadFloatBits(b, "%xmm1");
+        } else {
+            toDouble(a, "%xmm0");
+            toDouble(b, "%xmm1");
+        }
+        // Unordered (NaN) operands set ZF, PF and CF: every ordered test must come out false
+        switch (selectorOf) {
+        case LM_GT:
+        case LM_GE:
+            emit("ucomisd %xmm1, %xmm0");
+            return Condition{true, selectorOf == LM_GT ? "a" : "ae"};
+        case LM_LT:
+        case LM_LE:
+            emit("ucomisd %xmm0, %xmm1");
+            return Condition{true, selectorOf == LM_LT ? "a" : "ae"};
+        case LM_EQ:
+            emit("ucomisd %xmm1, %xmm0");
+            emit("sete %al");
+            emit("setnp %cl");
+            emit("andb %cl, %al");
+            return Condition{false, ""};
+        default:
+            emit("ucomisd %xmm1, %xmm0");
+            emit("setne %al");
+            emit("setp %cl");
+            emit("orb %cl, %al");
+            return Condition{false, ""};
+        }
+    }
+    callRuntime("lm_compare", {selector(selectorOf), value(a), value(b)});
+    return Condition{false, ""};
+}
+
+// Every instruction that computes a value into dst, lowered by the case resultType() picks
+void AsmGenerator::operation(const RegisterInstruction &instruction)
+{
+    uint16_t opcode = instruction.opcode;
+    bool unary = isUnaryOperation(opcode);
+    Place a = place(instruction.a);
+    Place b = unary ? Place{Place::Immediate, StaticType::Any, "", ""} : place(instruction.b);
+    Place dst = homes[instruction.dst];
+    StaticType type = resultType(opcode, a.type, b.type, !unary && types.nonZero(instruction.b));
+
+    auto runtime1 = [&](const char *name) {
+        callRuntime(name, {value(a)});
+        storeValue(dst, "%rax", "%rdx");
+    };
+    auto runtime2 = [&](const char *name) {
+        callRuntime(name, {value(a), value(b)});
+        storeValue(dst, "%rax", "%rdx");
+    };
+    auto arith = [&](int op) {
+        callRuntime("lm_arith", {selector(op), value(a), value(b)});
+        storeValue(dst, "%rax", "%rdx");
+    };
+    // Only for a constant divisor other than zero. idivq traps on INT64_MIN / -1, so -1
+    // negates (wrapping) and leaves a remainder of 0 like lm_quot_i64/lm_rem_i64.
+    auto divide = [&](bool remainder) {
+        if (b.value == -1) {
+            if (remainder) {
+                emit("xorl %eax, %eax");
+            } else {
+                loadBits(a, "%rax");
+                emit("negq %rax");
+            }
+            storeBits(dst, "%rax", StaticType::Int);
+            return;
+        }
+        loadBits(a, "%rax");
+        loadBits(b, "%rcx");
+        emit("cqto");
+        emit("idivq %rcx");
+        storeBits(dst, remainder ? "%rdx" : "%rax", StaticType::Int);
+    };
+    auto floatOp = [&](const char *op, bool numeric) {
+        if (numeric) {
+            toDouble(a, "%xmm0");
+            toDouble(b, "%xmm1");
+        } else {
+            loadFloatBits(a, "%xmm0");
+            loadFloatBits(b, "%xmm1");
+        }
+        if (std::strcmp(op, "fmod") == 0) {
+            emit("call fmod@PLT");
+        } else {
+            emit(std::string(op) + " %xmm1, %xmm0");
+        }
+        storeXmm(dst, "%xmm0");
+    };
+
+    switch (opcode) {
+    case MOVE:
+        move(dst, a);
+        return;
+    case NEGATE:
+    case NEG_I64:
+    case NEG_F64:
+        if (type == StaticType::Int) {
+            if (dst.kind == Place::Register) {
+                loadBits(a, dst.text);
+                emit("negq " + dst.text);
+            } else {
+                loadBits(a, "%rax");
+                emit("negq %rax");
+                storeBits(dst, "%rax", StaticType::Int);
+            }
+        } else if (type == StaticType::Float) {
+            loadBits(a, "%rax");
+            emit("btcq $63, %rax");
+            storeBits(dst, "%rax", StaticType::Float);
+        } else {
+            runtime1("lm_negate");
+        }
+        return;
+    case NOT:
+        if (type == StaticType::Bool) {
+            loadBits(a, "%rax");
+            emit("xorq $1, %rax");
+            storeBits(dst, "%rax", StaticType::Bool);
+        } else {
+            runtime1("lm_not");
+        }
+        return;
+    case TO_INT64:
+        if (type != StaticType::Int) {
+            runtime1("lm_to_int");
+        } else if (a.type == StaticType::Int) {
+            move(dst, a);
+        } else {
+            emit("cvttsd2siq " + a.text + ", %rax");
+            storeBits(dst, "%rax", StaticType::Int);
+        }
+        return;
+    case TO_FLOAT64:
+        if (type != StaticType::Float) {
+            runtime1("lm_to_float");
+        } else if (a.type == StaticType::Float) {
+            move(dst, a);
+        } else {
+            toDouble(a, "%xmm0");
+            storeXmm(dst, "%xmm0");
+        }
+        return;
+
+    case ADD_I64:
+        intBinary("addq", true, dst, a, b);
+        return;
+    case SUB_I64:
+        intBinary("subq", false, dst, a, b);
+        return;
+    case MUL_I64:
+        intBinary("imulq", true, dst, a, b);
+        return;
+    case DIV_I64:
+    case MOD_I64:
+        if (type == StaticType::Int) {
+            divide(opcode == MOD_I64);
+        } else {
+            callRuntime(opcode == DIV_I64 ? "lm_div_i64" : "lm_mod_i64", {bits(a), bits(b)});
+            storeValue(dst, "%rax", "%rdx");
+        }
+        return;
+    case ADD_F64:
+        floatOp("addsd", false);
+        return;
+    case SUB_F64:
+        floatOp("subsd", false);
+        return;
+    case MUL_F64:
+        floatOp("mulsd", false);
+        return;
+    case DIV_F64:
+        if (type == StaticType::Float) {
+            floatOp("divsd", false);
+        } else {
+            loadFloatBits(a, "%xmm0");
+            loadFloatBits(b, "%xmm1");
+            emit("call lm_div_f64@PLT");
+            storeValue(dst, "%rax", "%rdx");
+        }
+        return;
+    case MOD_F64:
+        floatOp("fmod", false);
+        return;
+
+    case ADD:
+    case SUBTRACT:
+    case MULTIPLY: {
+        static const char *const intOps[] = {"addq", "subq", "imulq"};
+        static const char *const floatOps[] = {"addsd", "subsd", "mulsd"};
+        int k = opcode == ADD ? 0 : opcode == SUBTRACT ? 1 : 2;
+        if (type == StaticType::Int) {
+            intBinary(intOps[k], k != 1, dst, a, b);
+        } else if (type == StaticType::Float) {
+            floatOp(floatOps[k], true);
+        } else {
+            arith(k == 0 ? LM_ADD : k == 1 ? LM_SUB : LM_MUL);
+        }
+        return;
+    }
+    case DIVIDE:
+        if (type == StaticType::Int) {
+            divide(false);
+        } else if (type == StaticType::Float) {
+            floatOp("divsd", true);
+        } else {
+            arith(LM_DIV);
+        }
+        return;
+    case MODULUS:
+        if (type == StaticType::Int) {
+            divide(true);
+        } else if (type == StaticType::Float) {
+            floatOp("fmod", true);
+        } else {
+            arith(LM_MOD);
+        }
+        return;
+
+    case AND:
+    case OR:
+        if (type == StaticType::Bool) {
+            intBinary(opcode == AND ? "andq" : "orq", true, dst, a, b);
+        } else {
+            runtime2(opcode == AND ? "lm_and" : "lm_or");
+        }
+        return;
+    case CONCATENATE_STR:
+        runtime2("lm_concat");
+        return;
+    case INTERPOLATE_STRING:
+        runtime2("lm_interpolate");
+        return;
+    default:
+        break;
+    }
+
+    // Comparisons
+    Condition condition = compare(opcode, a, b);
+    if (condition.flags) {
+        emit("set" + condition.cc + " %al");
+    }
+    emit("movzbl %al, %eax");
+    storeBits(dst, "%rax", StaticType::Bool);
+}
+
+// Undoes the prologue of the current function, up to its return address
+void AsmGenerator::leaveFrame()
+{
+    if (current != MAIN) {
+        emit("decl lm_depth(%rip)");
+    }
+    emit("leaq " + frameOperand(-8 * static_cast<int64_t>(saved.size()), "%rbp") + ", %rsp");
+    for (auto it = saved.rbegin(); it != saved.rend(); ++it) {
+        emit("popq " + *it);
+    }
+    emit("popq %rbp");
+}
+
+void AsmGenerator::instruction(const RegisterInstruction &instruction)
+{
+    const RegisterFunction &function = functionAt(current);
+    switch (instruction.opcode) {
+    case NOP:
+        break;
+    case GET_GLOBAL:
+        move(homes[instruction.dst], globalPlace(instruction.a));
+        break;
+    case SET_GLOBAL:
+        move(current == MAIN ? homes[instruction.dst] : globalPlace(instruction.dst),
+             place(instruction.a));
+        break;
+    case PRINT: {
+        Place p = place(instruction.a);
+        switch (p.type) {
+        case StaticType::Int:
+            callRuntime("lm_print_int", {bits(p)});
+            break;
+        case StaticType::Bool:
+            callRuntime("lm_print_bool", {bits(p)});
+            break;
+        case StaticType::Float:
+            loadFloatBits(p, "%xmm0");
+            emit("call lm_print_float@PLT");
+            break;
+        default:
+            callRuntime("lm_print", {value(p)});
+            break;
+        }
+        break;
+    }
+    case JUMP:
+        emit("jmp " + jumpLabel(instruction.dst));
+        break;
+    case JUMP_IF_FALSE: {
+        Place p = place(instruction.a);
+        if (p.type != StaticType::Bool) {
+            callRuntime("lm_jump_unless", {value(p)});
+            emit("testb %al, %al");
+            emit("jne " + jumpLabel(instruction.dst));
+        } else if (p.kind == Place::Immediate) {
+            if (p.value == 0) {
+                emit("jmp " + jumpLabel(instruction.dst));
+            }
+        } else if (p.kind == Place::Register) {
+            emit("testq " + p.text + ", " + p.text);
+            emit("je " + jumpLabel(instruction.dst));
+        } else {
+            emit("cmpq $0, " + p.text);
+            emit("je " + jumpLabel(instruction.dst));
+        }
+        break;
+    }
+    case BRANCH_UNLESS: {
+        Condition condition = compare(instruction.aux, place(instruction.a), place(instruction.b));
+        if (condition.flags) {
+            emit("j" + inverse(condition.cc) + " " + jumpLabel(instruction.dst));
+        } else {
+            emit("testb %al, %al");
+            emit("je " + jumpLabel(instruction.dst));
+        }
+        break;
+    }
+    case INVOKE_FUNCTION: {
+        Place dst = homes[instruction.dst];
+        if (instruction.a < 0) {
+            emit("leaq .LU" + std::to_string(instruction.b) + "(%rip), %rdi");
+            emit("call lm_unknown_function@PLT");
+            storeNil(dst);
+            break;
+        }
+        const RegisterTypes::Function &callee = types.functions[instruction.a];
+        for (uint16_t i = 0; i < instruction.aux; ++i) {
+            Place argument = place(function.arguments[instruction.b + i]);
+            std::string slot = frameOperand(16 * i, "%rsp");
+            if (callee.registers[i] == StaticType::Any) {
+                loadValue(argument, "%rax", "%rdx");
+                emit("movq %rax, " + slot);
+                emit("movq %rdx, " + frameOperand(16 * i + 8, "%rsp"));
+            } else {
+                loadBits(argument, "%rax");
+                emit("movq %rax, " + slot);
+            }
+        }
+        if (current != MAIN && isTailCall(function, &instruction - function.code.data())
+            && callee.result == types.functions[current].result
+            && instruction.aux <= function.paramCount) {
+            // The arguments replace our own, of which there are at least as many, and the
+            // callee returns straight to our caller
+            for (uint16_t i = 0; i < instruction.aux; ++i) {
+                for (int64_t half : {0, 8}) {
+                    emit("movq " + frameOperand(16 * i + half, "%rsp") + ", %rax");
+                    emit("movq %rax, " + frameOperand(16 + 16 * i + half, "%rbp"));
+                }
+            }
+            leaveFrame();
+            emit("jmp " + functionLabel(instruction.a));
+            break;
+        }
+        emit("call " + functionLabel(instruction.a));
+        switch (callee.result) {
+        case StaticType::Any:
+            storeValue(dst, "%rax", "%rdx");
+            break;
+        case StaticType::Float:
+            storeXmm(dst, "%xmm0");
+            break;
+        default:
+            storeBits(dst, "%rax", callee.result);
+            break;
+        }
+        break;
+    }
+    case RETURN:
+    case RETURN_VALUE: {
+        if (current == MAIN) {
+            emit("call lm_return_outside_function@PLT");
+            break;
+        }
+        StaticType result = types.functions[current].result;
+        Place p = instruction.opcode == RETURN ? Place{Place::Immediate, StaticType::Any, "", ""}
+                                               : place(instruction.a);
+        if (result == StaticType::Any) {
+            loadValue(p, "%rax", "%rdx");
+        } else if (result == StaticType::Float) {
+            loadFloatBits(p, "%xmm0");
+        } else {
+            loadBits(p, "%rax");
+        }
+        emit("jmp " + exitLabel);
+        break;
+    }
+    case HALT:
+        emit("call lm_halt@PLT");
+        break;
+    default:
+        operation(instruction);
+        break;
+    }
+}
+
+// Picks the int and bool registers that go into machine registers: the ones used most,
+// each use weighted by 8 to the power of its loop nesting depth
+size_t AsmGenerator::allocate(const RegisterFunction &function, std::vector<bool> &allocated)
+{
+    size_t count = function.code.size();
+    std::vector<int> depth(count, 0);
+    for (size_t pc = 0; pc < count; ++pc) {
+        const RegisterInstruction &instruction = function.code[pc];
+        bool jumps = instruction.opcode == JUMP || instruction.opcode == JUMP_IF_FALSE
+                     || instruction.opcode == BRANCH_UNLESS;
+        if (jumps && instruction.dst >= 0 && static_cast<size_t>(instruction.dst) <= pc) {
+            for (size_t loop = instruction.dst; loop <= pc; ++loop) {
+                ++depth[loop];
+            }
+        }
+    }
+
+    const RegisterTypes::Function &typesOf = types.of(current);
+    std::vector<uint64_t> weight(function.frameSize, 0);
+    for (size_t pc = 0; pc < count; ++pc) {
+        const RegisterInstruction &instruction = function.code[pc];
+        uint64_t w = uint64_t(1) << (3 * std::min(depth[pc], 6));
+        forEachRegisterRead(function, instruction, [&](int32_t reg) { weight[reg] += w; });
+        if (writesRegister(instruction.opcode)) {
+            weight[instruction.dst] += w;
+        }
+    }
+
+    std::vector<int32_t> candidates;
+    for (int32_t reg = 0; reg < function.frameSize; ++reg) {
+        StaticType type = typesOf.registers[reg];
+        bool global = current == MAIN && types.globals[reg];
+        if ((type == StaticType::Int || type == StaticType::Bool) && !global && weight[reg] > 0) {
+            candidates.push_back(reg);
+        }
+    }
+    std::stable_sort(candidates.begin(), candidates.end(),
+                     [&](int32_t x, int32_t y) { return weight[x] > weight[y]; });
+    if (candidates.size() > ALLOCATABLE_COUNT) {
+        candidates.resize(ALLOCATABLE_COUNT);
+    }
+
+    allocated.assign(function.frameSize, false);
+    homes.assign(function.frameSize, Place{});
+    saved.clear();
+    for (int32_t reg : candidates) {
+        allocated[reg] = true;
+        homes[reg] = Place{Place::Register, typesOf.registers[reg], ALLOCATABLE[saved.size()], ""};
+        saved.push_back(ALLOCATABLE[saved.size()]);
+    }
+    return candidates.size();
+}
+
+void AsmGenerator::function(int32_t id, AssemblyReport *report)
+{
+    current = id;
+    const RegisterFunction &function = functionAt(id);
+    const RegisterTypes::Function &typesOf = types.of(id);
+    std::vector<bool> allocated;
+    size_t inRegisters = allocate(function, allocated);
+
+    // Frame: saved registers below rbp, then the slots, then the outgoing arguments
+    int64_t offset = 8 * static_cast<int64_t>(saved.size());
+    std::vector<int32_t> nilSlots;
+    for (int32_t reg = 0; reg < function.frameSize; ++reg) {
+        StaticType type = typesOf.registers[reg];
+        if (allocated[reg]) {
+            continue;
+        }
+        if (id == MAIN && types.globals[reg]) {
+            homes[reg] = globalPlace(reg);
+        } else if (reg < function.paramCount) {
+            homes[reg] = Place{Place::Memory, type, frameOperand(16 + 16 * reg, "%rbp"),
+                               frameOperand(24 + 16 * reg, "%rbp")};
+        } else {
+            offset += type == StaticType::Any ? 16 : 8;
+            homes[reg] = Place{Place::Memory, type, frameOperand(-offset, "%rbp"),
+                               frameOperand(-offset + 8, "%rbp")};
+            if (type == StaticType::Any) {
+                nilSlots.push_back(reg);
+            }
+        }
+    }
+    int64_t outgoing = 0;
+    for (const auto &instruction : function.code) {
+        if (instruction.opcode == INVOKE_FUNCTION && instruction.a >= 0) {
+            outgoing = std::max<int64_t>(outgoing, 16 * instruction.aux);
+        }
+    }
+    int64_t frameSize = offset - 8 * static_cast<int64_t>(saved.size()) + outgoing;
+    while ((8 * static_cast<int64_t>(saved.size()) + frameSize) % 16 != 0) {
+        frameSize += 8;
+    }
+
+    if (report) {
+        report->registers += function.frameSize;
+        report->machineRegisters += inRegisters;
+    }
+
+    std::string name = functionLabel(id);
+    text << "\n# " << (function.nameIndex < 0 ? "<main>" : code.names[function.nameIndex])
+         << "\n\t.type " << name << ", @function\n";
+    emitLabel(name);
+    emit("pushq %rbp");
+    emit("movq %rsp, %rbp");
+    for (const auto &reg : saved) {
+        emit("pushq " + reg);
+    }
+    if (frameSize > 0) {
+        emit("subq $" + std::to_string(frameSize) + ", %rsp");
+    }
+    for (int32_t reg = 0; reg < function.paramCount && reg < function.frameSize; ++reg) {
+        if (allocated[reg]) {
+            emit("movq " + frameOperand(16 + 16 * reg, "%rbp") + ", " + homes[reg].text);
+        }
+    }
+    for (int32_t reg : nilSlots) {
+        storeNil(homes[reg]);
+    }
+    std::string overflow = ".Lov" + std::to_string(id);
+    if (id == MAIN) {
+        for (size_t i = 0; i < code.constants.size(); ++i) {
+            if (constants[i].kind == Place::Memory && constants[i].type == StaticType::Any) {
+                const auto &string = std::get<std::string>(code.constants[i]->data);
+                emit("leaq .LS" + std::to_string(i) + "(%rip), %rdi");
+                emit("movq $" + std::to_string(string.size()) + ", %rsi");
+                emit("call lm_string_literal@PLT");
+                storeValue(constants[i], "%rax", "%rdx");
+            }
+        }
+    } else {
+        emit("movl lm_depth(%rip), %eax");
+        emit("cmpl $100000, %eax");
+        emit("jge " + overflow);
+        emit("incl %eax");
+        emit("movl %eax, lm_depth(%rip)");
+    }
+
+    std::vector<bool> labels(function.code.size() + 1, false);
+    for (const auto &instruction : function.code) {
+        if (instruction.opcode == JUMP || instruction.opcode == JUMP_IF_FALSE
+            || instruction.opcode == BRANCH_UNLESS) {
+            labels[instruction.dst] = true;
+        }
+    }
+    exitLabel = id == MAIN ? ".Lexitm" : ".Lexit" + std::to_string(id);
+    for (size_t pc = 0; pc < function.code.size(); ++pc) {
+        if (labels[pc]) {
+            emitLabel(jumpLabel(static_cast<int32_t>(pc)));
+        }
+        instruction(function.code[pc]);
+    }
+
+    emitLabel(exitLabel);
+    leaveFrame();
+    emit("ret");
+    if (id != MAIN) {
+        emitLabel(overflow);
+        emit("leaq .LN" + std::to_string(id) + "(%rip), %rdi");
+        emit("call lm_call_overflow@PLT");
+        rodata << ".LN" << id << ":\n\t.asciz " << asmString(code.names[function.nameIndex])
+               << "\n";
+    }
+    text << "\t.size " << name << ", .-" << name << "\n";
+}
+
+std::string AsmGenerator::generate(AssemblyReport *report)
+{
+    lowerConstants();
+    std::vector<bool> unknownNames(code.names.size(), false);
+    auto scanUnknown = [&](const RegisterFunction &function) {
+        for (const auto &instruction : function.code) {
+            if (instruction.opcode == INVOKE_FUNCTION && instruction.a < 0) {
+                unknownNames[instruction.b] = true;
+            }
+        }
+    };
+    scanUnknown(code.main);
+    for (const auto &function : code.functions) {
+        scanUnknown(function);
+    }
+    for (size_t i = 0; i < unknownNames.size(); ++i) {
+        if (unknownNames[i]) {
+            rodata << ".LU" << i << ":\n\t.asciz " << asmString(code.names[i]) << "\n";
+        }
+    }
+
+    for (size_t id = 0; id < code.functions.size(); ++id) {
+        function(static_cast<int32_t>(id), report);
+    }
+    function(MAIN, report);
+    if (report) {
+        report->instructions = lines;
+    }
+
+    std::ostringstream out;
+    out << "# Generated by luminar build.\n\t.text\n" << text.str();
+    out << "\n\t.globl main\n\t.type main, @function\nmain:\n"
+        << "\tsubq $8, %rsp\n\tleaq lm_main(%rip), %rdi\n\tcall lm_start@PLT\n"
+        << "\taddq $8, %rsp\n\tret\n\t.size main, .-main\n";
+    out << "\n\t.section .rodata\n" << rodata.str();
+    out << "\n\t.bss\n\t.balign 16\n";
+    if (!code.constants.empty()) {
+        out << "K:\n\t.zero " << 16 * code.constants.size() << "\n";
+    }
+    for (int32_t reg = 0; reg < code.main.frameSize; ++reg) {
+        if (types.globals[reg]) {
+            out << "g" << reg << ":\n\t.zero 16\n";
+        }
+    }
+    out << "\n\t.section .note.GNU-stack,\"\",@progbits\n";
+    return out.str();
+}
+
+std::string shellQuote(const std::string &text)
+{
+    std::string quoted = "'";
+    for (char c : text) {
+        quoted += c == '\'' ? std::string("'\\''") : std::string(1, c);
+    }
+    return quoted + "'";
+}
+
+} // namespace
+
+YASMBackend::YASMBackend(std::vector<Instruction> &program, const ConstantPool &constantPool,
+                         std::string outputFile)
+    : constantPool(constantPool)
+    , program(program)
+    , outputFile(std::move(outputFile))
+{}
+
+void YASMBackend::execute(const Instruction &instruction)
+{
+    run({instruction, Instruction(HALT, instruction.lineNumber)});
+}
+
+void YASMBackend::run(const std::vector<Instruction> &program)
+{
+    built = false;
+    this->program = program;
+    DecodedProgram decoded;
+    try {
+        decoded = DecodedProgram::decode(this->program, constantPool.values());
+    } catch (const std::exception &ex) {
+        std::cerr << "Error: Cannot compile to assembly: " << ex.what() << std::endl;
+        return;
+    }
+    run(decoded);
+}
+
+void YASMBackend::run(const DecodedProgram &program)
+{
+    auto start_time = std::chrono::high_resolution_clock::now();
+    built = false;
+    std::string source;
+    try {
+        code = RegisterProgram::translate(program);
+        report = AssemblyReport();
+        source = generate(code, &report);
+    } catch (const std::exception &ex) {
+        std::cerr << "Error: Cannot compile to assembly: " << ex.what() << std::endl;
+        return;
+    }
+
+    std::string sFile = outputFile + ".s";
+    std::ofstream file(sFile);
+    if (!file.is_open()) {
+        std::cerr << "Error: Unable to write " << sFile << std::endl;
+        return;
+    }
+    file << source;
+    file.close();
+
+    built = assemble(sFile, outputFile);
+    auto end_time = std::chrono::high_resolution_clock::now();
+    auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(end_time - start_time);
+    if (built) {
+        std::cout << "Built " << outputFile << " from " << sFile << " in " << duration.count()
+                  << " ms." << std::endl;
+    }
+}
+
+void YASMBackend::dumpRegisters()
+{
+    std::cout << "Assembly: " << code.functions.size() << " functions, " << report.instructions
+              << " instructions, " << report.machineRegisters << " of " << report.registers
+              << " registers in machine registers\n";
+}
+
+std::string YASMBackend::generate(const RegisterProgram &code, AssemblyReport *report)
+{
+    return AsmGenerator(code).generate(report);
+}
+
+bool YASMBackend::assemble(const std::string &sFile, const std::string &outputFile)
+{
+    const char *assembler = std::getenv("AS");
+    std::string object = outputFile + ".o";
+    std::string command = std::string(assembler && *assembler ? assembler : "as") + " -o "
+                          + shellQuote(object) + " " + shellQuote(sFile);
+    std::cout << command << std::endl;
+    int status = std::system(command.c_str());
+    if (status != 0) {
+        std::cerr << "Error: Assembler failed (exit status " << status << ")" << std::endl;
+        return false;
+    }
+    return CodegenBackend::compile(object, outputFile);
+}
@@ -1,46 +1,57 @@
+#ifndef YASM_HH
+#define YASM_HH
+
+#include "../constants.hh"
 #include "backend.hh"
-#include <fstream>
-#include <iostream>
-#include <map>
-#include <stack>
+#include "bytecode.hh"
+#include "regcode.hh"
 #include <string>
-#include <variant>
 #include <vector>
 
+// How generate() placed a program's registers
+struct AssemblyReport
+{
+    size_t registers = 0;          // over all functions, main included
+    size_t machineRegisters = 0;   // kept in callee-saved general purpose registers
+    size_t instructions = 0;       // lines of assembly emitted
+};
+
+// Ahead-of-time backend that lowers a whole script to x86-64 assembly in GNU as (AT&T)
+// syntax, assembles it with the system `as` and links it with the C runtime in src/runtime.
+// It shares the static types of the C backend (RegisterTypes): int and bool registers are
+// 64-bit integers, float registers doubles and everything else the runtime's 16-byte
+// lm_value. A priority allocator keeps the int and bool registers used most, weighted by
+// loop depth, in rbx and r12-r15; the rest live in the frame. Functions follow their own
+// convention: arguments in 16-byte slots at the bottom of the caller's frame, results in
+// rax, xmm0 or rax:rdx, like the System V ABI the runtime calls use.
 class YASMBackend : public Backend
 {
 public:
-    explicit YASMBackend(std::vector<Instruction> &program)
-        : program(program)
-    {}
+    YASMBackend(std::vector<Instruction> &program, const ConstantPool &constantPool,
+                std::string outputFile);
+
+    // Only whole programs can be compiled; execute() builds the one instruction as one.
     void execute(const Instruction &instruction) override;
     void dumpRegisters() override;
+    // Writes outputFile + ".s" and assembles and links it into the executable outputFile
     void run(const std::vector<Instruction> &program) override;
+    void run(const DecodedProgram &program) override;
+
+    bool succeeded() const { return built; }
+
+    // Throws std::runtime_error for code it cannot lower (heap constants other than strings).
+    static std::string generate(const RegisterProgram &code, AssemblyReport *report = nullptr);
+    // Assembles with $AS (default `as`), compiles the runtime with $CC (default `cc`) and
+    // links both with $CC, which runs the system linker with the C library's start files.
+    static bool assemble(const std::string &sFile, const std::string &outputFile);
 
 private:
-    std::string getUniqueLabel();
-    void emit(const std::string &line);
-    void emitUnaryOperation(const Instruction &instruction);
-    void emitBinaryOperation(const Instruction &instruction);
-    void emitComparisonOperation(const Instruction &instruction);
-    void emitLogicalOperation(const Instruction &instruction);
-    void emitLoadConst(const Instruction &instruction);
-    void emitPrint();
-    void emitHalt();
-    void emitDeclareVariable(const Instruction &instruction);
-    void emitLoadVariable(const Instruction &instruction);
-    void emitStoreVariable(const Instruction &instruction);
-    void emitDeclareFunction(const Instruction &instruction);
-    void emitCallFunction(const Instruction &instruction);
-    void emitJump(const Instruction &instruction);
-    void emitJumpZero(const Instruction &instruction);
-    void emitHandleConcurrent(const Instruction &instruction);
-    void emitHandleParallel(const Instruction &instruction);
-
-    std::ofstream outputFile;
-    std::vector<Instruction> &program;
-    unsigned int pc = 0; // program counter
-    size_t labelCounter = 0;
-    size_t dataLabelCounter = 0;
-    std::map<std::string, std::string> stringTable; // For storing string literals
+    ConstantPool constantPool;
+    std::vector<Instruction> program;
+    std::string outputFile;
+    RegisterProgram code;
+    AssemblyReport report;
+    bool built = false;
 };
+
+#endif // YASM_HH
@@ -0,0 +1,75 @@
+//constants.hh
+#pragma once
+#include "types.hh"
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+// Program-wide table of literal operands. The parsers intern every literal they emit and
+// LOAD_CONST/LOAD_STR/BOOLEAN carry the returned index instead of the value, so identical
+// literals share one entry and the backends can convert each entry once at load time.
+class ConstantPool
+{
+public:
+    int32_t add(Value value)
+    {
+        int32_t slot = static_cast<int32_t>(values_.size());
+        if (!isShareable(value)) {
+            values_.push_back(std::make_shared<Value>(std::move(value)));
+            return slot;
+        }
+
+        std::string key = keyFor(value);
+        auto it = index_.find(key);
+        if (it != index_.end()) {
+            return it->second;
+        }
+        values_.push_back(std::make_shared<Value>(std::move(value)));
+        index_.emplace(std::move(key), slot);
+        return slot;
+    }
+
+    const ValuePtr &at(size_t slot) const { return values_.at(slot); }
+    const std::vector<ValuePtr> &values() const { return values_; }
+    size_t size() const { return values_.size(); }
+
+private:
+    std::vector<ValuePtr> values_;
+    std::unordered_map<std::string, int32_t> index_;
+
+    static bool isShareable(const Value &value)
+    {
+        return std::visit(
+            [](const auto &v) {
+                using T = std::decay_t<decltype(v)>;
+                return std::is_arithmetic_v<T> || std::is_same_v<T, std::string>
+                       || std::is_same_v<T, std::monostate>;
+            },
+            value.data);
+    }
+
+    // The key is the type tag, the variant alternative and the raw payload, so 1 (int) and
+    // 1.0 (float) stay distinct.
+    static std::string keyFor(const Value &value)
+    {
+        std::string key;
+        key += static_cast<char>(value.type ? static_cast<int>(value.type->tag) : -1);
+        key += static_cast<char>(value.data.index());
+        std::visit(
+            [&key](const auto &v) {
+                using T = std::decay_t<decltype(v)>;
+                if constexpr (std::is_same_v<T, std::string>) {
+                    key += v;
+                } else if constexpr (std::is_arithmetic_v<T>) {
+                    char bytes[sizeof(T)];
+                    std::memcpy(bytes, &v, sizeof(T));
+                    key.append(bytes, sizeof(T));
+                }
+            },
+            value.data);
+        return key;
+    }
+};
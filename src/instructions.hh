@@ -137,6 +137,8 @@ struct Instruction
             return "NOP";
         case Opcode::HALT:
             return "HALT";
+        case Opcode::POP:
+            return "POP";
         case Opcode::PRINT:
             return "PRINT";
 
@@ -209,6 +211,62 @@ struct Instruction
             return "LOAD_CONST";
         case Opcode::INTERPOLATE_STRING:
             return "INTERPOLATE STRING";
+        case Opcode::ADD_I64:
+            return "ADD_I64";
+        case Opcode::SUB_I64:
+            return "SUB_I64";
+        case Opcode::MUL_I64:
+            return "MUL_I64";
+        case Opcode::DIV_I64:
+            return "DIV_I64";
+        case Opcode::MOD_I64:
+            return "MOD_I64";
+        case Opcode::NEG_I64:
+            return "NEG_I64";
+        case Opcode::ADD_F64:
+            return "ADD_F64";
+        case Opcode::SUB_F64:
+            return "SUB_F64";
+        case Opcode::MUL_F64:
+            return "MUL_F64";
+        case Opcode::DIV_F64:
+            return "DIV_F64";
+        case Opcode::MOD_F64:
+            return "MOD_F64";
+        case Opcode::NEG_F64:
+            return "NEG_F64";
+        case Opcode::EQ_I64:
+            return "EQ_I64";
+        case Opcode::NE_I64:
+            return "NE_I64";
+        case Opcode::LT_I64:
+            return "LT_I64";
+        case Opcode::LE_I64:
+            return "LE_I64";
+        case Opcode::GT_I64:
+            return "GT_I64";
+        case Opcode::GE_I64:
+            return "GE_I64";
+        case Opcode::EQ_F64:
+            return "EQ_F64";
+        case Opcode::NE_F64:
+            return "NE_F64";
+        case Opcode::LT_F64:
+            return "LT_F64";
+        case Opcode::LE_F64:
+            return "LE_F64";
+        case Opcode::GT_F64:
+            return "GT_F64";
+        case Opcode::GE_F64:
+            return "GE_F64";
+        case Opcode::EQ_STR:
+            return "EQ_STR";
+        case Opcode::NE_STR:
+            return "NE_STR";
+        case Opcode::TO_INT64:
+            return "TO_INT64";
+        case Opcode::TO_FLOAT64:
+            return "TO_FLOAT64";
             // Unrecognized opcode
         default:
             return "UNKNOWN";
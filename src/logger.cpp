@@ -0,0 +1,174 @@
+#include "logger.hh"
+#include <ctime>
+#include <iomanip>
+#include <iostream>
+
+Logger::Logger(std::string path, LogLevel level)
+    : path(std::move(path))
+    , level(level)
+    , slots(new Slot[Capacity])
+{
+    for (size_t i = 0; i < Capacity; ++i) {
+        slots[i].sequence.store(i, std::memory_order_relaxed);
+    }
+}
+
+Logger::~Logger()
+{
+    if (worker.joinable()) {
+        stopping.store(true);
+        {
+            std::lock_guard<std::mutex> lock(wakeMutex);
+            wake.notify_one();
+        }
+        worker.join();
+    }
+}
+
+Logger &Logger::memory()
+{
+    static Logger logger("memory.log");
+    return logger;
+}
+
+bool Logger::parseLevel(const std::string &name, LogLevel &level)
+{
+    for (LogLevel candidate :
+         {LogLevel::Debug, LogLevel::Info, LogLevel::Warning, LogLevel::Error, LogLevel::Off}) {
+        if (name == levelName(candidate)) {
+            level = candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+const char *Logger::levelName(LogLevel level)
+{
+    switch (level) {
+    case LogLevel::Debug:
+        return "debug";
+    case LogLevel::Info:
+        return "info";
+    case LogLevel::Warning:
+        return "warning";
+    case LogLevel::Error:
+        return "error";
+    case LogLevel::Off:
+        break;
+    }
+    return "off";
+}
+
+std::tm Logger::localTime(std::time_t time)
+{
+    std::tm local{};
+#ifdef _WIN32
+    localtime_s(&local, &time);
+#else
+    localtime_r(&time, &local);
+#endif
+    return local;
+}
+
+void Logger::write(LogLevel messageLevel, std::string message)
+{
+    std::call_once(started, [this] {
+        file.open(path, std::ios::app);
+        if (!file.is_open()) {
+            std::cerr << "Error: Failed to open " << path << std::endl;
+        }
+        worker = std::thread(&Logger::drain, this);
+    });
+
+    // Claim the next slot; when the background thread has not emptied it yet, the buffer is
+    // full and we wait for it
+    size_t position = enqueuePosition.load(std::memory_order_relaxed);
+    Slot *slot;
+    for (;;) {
+        slot = &slots[position & (Capacity - 1)];
+        size_t sequence = slot->sequence.load(std::memory_order_acquire);
+        auto difference = static_cast<std::ptrdiff_t>(sequence - position);
+        if (difference == 0) {
+            if (enqueuePosition.compare_exchange_weak(position,
+                                                      position + 1,
+                                                      std::memory_order_relaxed)) {
+                break;
+            }
+        } else if (difference < 0) {
+            std::this_thread::yield();
+            position = enqueuePosition.load(std::memory_order_relaxed);
+        } else {
+            position = enqueuePosition.load(std::memory_order_relaxed);
+        }
+    }
+    slot->level = messageLevel;
+    slot->time = std::chrono::system_clock::now();
+    slot->text = std::move(message);
+    slot->sequence.store(position + 1, std::memory_order_release);
+
+    // Pairs with the fence in drain(): either we see it asleep or it sees our message
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (sleeping.load()) {
+        std::lock_guard<std::mutex> lock(wakeMutex);
+        wake.notify_one();
+    }
+}
+
+void Logger::flush()
+{
+    size_t target = enqueuePosition.load();
+    while (writtenCount.load(std::memory_order_acquire) < target && worker.joinable()) {
+        if (sleeping.load()) {
+            std::lock_guard<std::mutex> lock(wakeMutex);
+            wake.notify_one();
+        }
+        std::this_thread::yield();
+    }
+}
+
+bool Logger::tryRead(Slot *&slot)
+{
+    slot = &slots[dequeuePosition & (Capacity - 1)];
+    return slot->sequence.load(std::memory_order_acquire) == dequeuePosition + 1;
+}
+
+void Logger::drain()
+{
+    for (;;) {
+        size_t batch = 0;
+        Slot *slot;
+        while (tryRead(slot)) {
+            std::string text = std::move(slot->text);
+            LogLevel messageLevel = slot->level;
+            std::time_t time = std::chrono::system_clock::to_time_t(slot->time);
+            slot->sequence.store(dequeuePosition + Capacity, std::memory_order_release);
+            dequeuePosition++;
+
+            if (file.is_open()) {
+                std::tm local = localTime(time);
+                file << "[" << std::put_time(&local, "%Y-%m-%d %X") << "] ["
+                     << levelName(messageLevel) << "] " << text << '\n';
+            }
+            batch++;
+        }
+        if (batch > 0) {
+            file.flush();
+            writtenCount.fetch_add(batch, std::memory_order_release);
+            continue;
+        }
+        if (stopping.load()) {
+            return;
+        }
+
+        // Nothing queued: sleep until a writer wakes us. Checking the buffer again after
+        // announcing it closes the race with a writer that looked just before.
+        std::unique_lock<std::mutex> lock(wakeMutex);
+        sleeping.store(true);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (!tryRead(slot) && !stopping.load()) {
+            wake.wait_for(lock, std::chrono::milliseconds(100));
+        }
+        sleeping.store(false);
+    }
+}
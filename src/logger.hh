@@ -0,0 +1,110 @@
+#pragma once
+// logger.hh
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+enum class LogLevel : uint8_t { Debug, Info, Warning, Error, Off };
+
+// Least severe level compiled in at all, 0 (debug) to 4 (off). CMake sets it from the
+// LUMINAR_LOG_LEVEL cache variable.
+#ifndef LUMINAR_LOG_LEVEL
+#define LUMINAR_LOG_LEVEL 0
+#endif
+
+// Whether messages at `level` are compiled in. The levels are compared as LogLevels: as ints,
+// the test is always true at level 0 and -Wtype-limits reports every LUMINAR_LOG.
+constexpr bool isLogLevelCompiled(LogLevel level)
+{
+    return level >= static_cast<LogLevel>(LUMINAR_LOG_LEVEL);
+}
+
+// Logs `message` at `level`. The message expression is only evaluated when the level is both
+// compiled in and enabled at run time, so a disabled call costs one relaxed load, and a call
+// below LUMINAR_LOG_LEVEL costs nothing.
+#define LUMINAR_LOG(logger, level, message) \
+    do { \
+        if constexpr (isLogLevelCompiled(level)) { \
+            if ((logger).isEnabled(level)) { \
+                (logger).write(level, message); \
+            } \
+        } \
+    } while (0)
+
+// Asynchronous log file. Writers put their message and its time in a bounded lock-free ring
+// buffer (a sequence number per slot, so any thread may write) and return; a background
+// thread, started by the first message, formats, writes and flushes them in batches. A full
+// buffer makes writers wait for the thread rather than drop messages.
+class Logger
+{
+public:
+    explicit Logger(std::string path, LogLevel level = LogLevel::Info);
+    ~Logger(); // writes out everything still queued
+
+    Logger(const Logger &) = delete;
+    Logger &operator=(const Logger &) = delete;
+
+    // memory.log, shared by every MemoryManager
+    static Logger &memory();
+
+    // "debug", "info", "warning", "error" or "off"
+    static bool parseLevel(const std::string &name, LogLevel &level);
+    static const char *levelName(LogLevel level);
+
+    // std::localtime() without its shared buffer, so the worker thread and the threads
+    // formatting their own timestamps do not overwrite each other's
+    static std::tm localTime(std::time_t time);
+
+    void setLevel(LogLevel newLevel) { level.store(newLevel, std::memory_order_relaxed); }
+    LogLevel getLevel() const { return level.load(std::memory_order_relaxed); }
+    bool isEnabled(LogLevel messageLevel) const
+    {
+        return messageLevel >= level.load(std::memory_order_relaxed);
+    }
+
+    void write(LogLevel messageLevel, std::string message);
+
+    // Waits until everything written so far is in the file
+    void flush();
+
+private:
+    struct Slot
+    {
+        std::atomic<size_t> sequence;
+        LogLevel level;
+        std::chrono::system_clock::time_point time;
+        std::string text;
+    };
+
+    static constexpr size_t Capacity = 4096; // a power of two
+
+    std::string path;
+    std::atomic<LogLevel> level;
+    std::unique_ptr<Slot[]> slots;
+    alignas(64) std::atomic<size_t> enqueuePosition{0};
+    alignas(64) size_t dequeuePosition = 0;  // the background thread's
+    std::atomic<size_t> writtenCount{0};     // messages the background thread has written
+    std::atomic<bool> stopping{false};
+
+    // The background thread only sleeps on the condition variable when the buffer is empty;
+    // writers take the mutex just to wake it.
+    std::atomic<bool> sleeping{false};
+    std::mutex wakeMutex;
+    std::condition_variable wake;
+
+    std::once_flag started;
+    std::thread worker;
+    std::ofstream file;
+
+    bool tryRead(Slot *&slot);
+    void drain();
+};
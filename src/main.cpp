@@ -1,4 +1,5 @@
 #include "repl.hh"
+#include <filesystem>
 #include <iostream>
 
 int main(int argc, char *argv[])
@@ -22,10 +23,36 @@ int main(int argc, char *argv[])
                     std::cout << "Building for macOS..." << std::endl;
                     REPL::start("");
                 } else if (target == "linux") {
-                    // Call function to build for Linux
-                    // buildLinux();
-                    REPL::start("");
+                    std::string filename;
+                    std::string output;
+                    std::string backend = "c";
+                    for (int i = 3; i < argc; ++i) {
+                        std::string arg = argv[i];
+                        if (arg == "-o" && i + 1 < argc) {
+                            output = argv[++i];
+                        } else if (arg.rfind("--backend=", 0) == 0) {
+                            backend = arg.substr(10);
+                        } else if (arg == "--backend" && i + 1 < argc) {
+                            backend = argv[++i];
+                        } else if (arg == "--no-optimize") {
+                            REPL::setOptimizing(false);
+                        } else if (arg == "--inline-budget" && i + 1 < argc) {
+                            REPL::setInlineBudget(std::stoul(argv[++i]));
+                        } else {
+                            filename = arg;
+                        }
+                    }
+                    if (filename.empty()) {
+                        std::cerr << "Error: Missing script file." << std::endl;
+                        return 1;
+                    }
+                    if (output.empty()) {
+                        output = std::filesystem::path(filename).stem().string();
+                    }
                     std::cout << "Building for Linux..." << std::endl;
+                    if (!REPL::build(filename, output, backend)) {
+                        return 1;
+                    }
                 } else {
                     std::cerr << "Error: Invalid target operating system." << std::endl;
                     return 1;
@@ -35,21 +62,109 @@ int main(int argc, char *argv[])
                 return 1;
             }
         } else if (mode == "run") {
+            std::string filename;
+            for (int i = 2; i < argc; ++i) {
+                std::string arg = argv[i];
+                if (arg.rfind("--backend=", 0) == 0) {
+                    if (!REPL::setBackend(arg.substr(10))) {
+                        return 1;
+                    }
+                } else if (arg == "--backend" && i + 1 < argc) {
+                    if (!REPL::setBackend(argv[++i])) {
+                        return 1;
+                    }
+                } else if (arg == "--no-cache") {
+                    REPL::setBytecodeCache(false);
+                } else if (arg == "--no-optimize") {
+                    REPL::setOptimizing(false);
+                } else if (arg == "--no-verify") {
+                    REPL::setVerifying(false);
+                } else if (arg == "--log-level" && i + 1 < argc) {
+                    if (!REPL::setLogLevel(argv[++i])) {
+                        return 1;
+                    }
+                } else if (arg == "--inline-budget" && i + 1 < argc) {
+                    REPL::setInlineBudget(std::stoul(argv[++i]));
+                } else {
+                    filename = arg;
+                }
+            }
+            // Start the REPL in development mode with hot reloading, interpreting the file if given
+            REPL::startDevMode(filename);
+        } else if (mode == "census") {
             if (argc > 2) {
-                std::string filename = argv[2];
-                // Start the REPL in development mode with hot reloading and interpret the specified file
-                REPL::startDevMode(filename);
+                REPL::census(std::vector<std::string>(argv + 2, argv + argc));
+            } else {
+                std::cerr << "Error: Missing script files." << std::endl;
+                return 1;
+            }
+        } else if (mode == "ir") {
+            std::vector<std::string> filenames;
+            for (int i = 2; i < argc; ++i) {
+                std::string arg = argv[i];
+                if (arg == "--no-optimize") {
+                    REPL::setOptimizing(false);
+                } else {
+                    filenames.push_back(arg);
+                }
+            }
+            if (!filenames.empty()) {
+                REPL::printIR(filenames);
             } else {
-                // Start the REPL in development mode with hot reloading without a specific file
-                REPL::startDevMode("");
+                std::cerr << "Error: Missing script files." << std::endl;
+                return 1;
+            }
+        } else if (mode == "verify") {
+            std::vector<std::string> filenames;
+            for (int i = 2; i < argc; ++i) {
+                std::string arg = argv[i];
+                if (arg == "--no-optimize") {
+                    REPL::setOptimizing(false);
+                } else {
+                    filenames.push_back(arg);
+                }
+            }
+            if (!filenames.empty()) {
+                REPL::printVerification(filenames);
+            } else {
+                std::cerr << "Error: Missing script files." << std::endl;
+                return 1;
+            }
+        } else if (mode == "conform") {
+            if (argc > 2) {
+                if (!REPL::conformance(std::vector<std::string>(argv + 2, argv + argc))) {
+                    return 1;
+                }
+            } else {
+                std::cerr << "Error: Missing script files." << std::endl;
+                return 1;
             }
         } else if (mode == "help" || "-h") {
             std::cout
                 << "Usage: " << argv[0] << " [mode] [options]\n"
                 << "Modes:\n"
                 << "  build <target>   Build for the specified target (windows, mac, linux)\n"
+                << "    linux <file> [-o output]   Compile the script to C and from there to a\n"
+                << "                               native executable with the system C compiler\n"
+                << "      --backend <name>   Lower through 'c' (default) or straight to x86-64 'asm'\n"
                 << "  run [file]       Start the REPL in development mode with hot reloading\n"
                 << "                   Optionally specify a file to interpret\n"
+                << "    --backend <name>   Execute with the 'stack' (default), 'register' or 'jit' VM\n"
+                << "    --no-cache         Neither load nor write the compiled script (file.lmc)\n"
+                << "    --no-optimize      Run the parser's bytecode as is (also for build)\n"
+                << "    --no-verify        Run the stack VM's checks even on code that verifies\n"
+                << "    --log-level <level>  Write memory.log messages from 'debug', 'info'\n"
+                << "                       (default), 'warning' or 'error' up, or 'off'\n"
+                << "    --inline-budget <n>  Inline functions of up to n instructions (default "
+                << DEFAULT_INLINE_BUDGET << ", 0: none; also for build)\n"
+                << "  census <files>   Count the opcode sequences the scripts compile to\n"
+                << "  ir <files>       Print the SSA form the scripts (optimized, unless\n"
+                << "                   --no-optimize) take on the way to the backends\n"
+                << "  verify <files>   Print the stack depth and operand types the bytecode\n"
+                << "                   verifier proves at every instruction of the scripts\n"
+                << "  conform <files>  Check that every VM, the .lmc cache and the 'asm' and 'c'\n"
+                << "                   builds print what the stack VM does, and what file.out\n"
+                << "                   next to file.lm lists\n"
                 << "  help, -h         Display this help message\n"
                 << std::endl;
         } else {
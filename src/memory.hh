@@ -1,16 +1,17 @@
 #pragma once
 // memory.hh
 
+#include "logger.hh"
 #include <algorithm>
 #include <atomic> // For atomic reference counting
 #include <chrono>
 #include <cstddef>
+#include <cstdint>
 #include <cstring>
 #include <fstream>
 #include <iomanip>
 #include <iostream>
 #include <memory>
-#include <mutex>
 #include <sstream>
 #include <stdexcept>
 #include <string>
@@ -59,24 +60,171 @@ public:
         free(ptr);
 #endif
     }
+
+    void printOccupancy(std::ostream &) const {}
 };
 
-template<typename Allocator = DefaultAllocator>
-class MemoryManager
+// Allocator that serves small blocks from slabs, one free list per size class. Every block
+// is preceded by a 16-byte header naming its class, so deallocate() pushes it back on its
+// free list in O(1) and the next allocation of that class reuses it. Blocks larger than the
+// largest class, or aligned beyond 16 bytes, come from the DefaultAllocator.
+class SlabAllocator
 {
+public:
+    // Payload sizes. std::string and list nodes fit in 32, a Value in 112 and the backends'
+    // HeapObject (a Value with its reference count and region) in 128.
+    static constexpr size_t ClassSizes[] = {16, 32, 48, 64, 96, 112, 128,
+                                            192, 256, 512, 1024, 2048};
+    static constexpr size_t ClassCount = sizeof(ClassSizes) / sizeof(ClassSizes[0]);
+    static constexpr size_t SlabSize = 64 * 1024;
+
+    struct ClassOccupancy
+    {
+        size_t blockSize;
+        size_t slabs;
+        size_t inUse;    // blocks handed out and not freed
+        size_t capacity; // blocks the class's slabs hold
+    };
+
+    SlabAllocator() = default;
+    // Slabs belong to the allocator that carved them: a copy starts out empty
+    SlabAllocator(const SlabAllocator &)
+        : SlabAllocator()
+    {}
+    SlabAllocator &operator=(const SlabAllocator &) = delete;
+
+    ~SlabAllocator()
+    {
+        for (void *slab : slabs) {
+            system.deallocate(slab);
+        }
+    }
+
+    void *allocate(size_t size, size_t alignment)
+    {
+        if (alignment <= alignof(BlockHeader)) {
+            for (uint32_t sizeClass = 0; sizeClass < ClassCount; ++sizeClass) {
+                if (size <= ClassSizes[sizeClass]) {
+                    return allocateSmall(sizeClass);
+                }
+            }
+        }
+        size_t offset = std::max(alignment, sizeof(BlockHeader));
+        char *base = static_cast<char *>(
+            system.allocate(offset + size, std::max(alignment, alignof(BlockHeader))));
+        BlockHeader *header = reinterpret_cast<BlockHeader *>(base + offset) - 1;
+        header->base = base;
+        header->sizeClass = LargeClass;
+        largeInUse++;
+        return base + offset;
+    }
+
+    void deallocate(void *ptr) noexcept
+    {
+        if (!ptr) {
+            return;
+        }
+        BlockHeader *header = static_cast<BlockHeader *>(ptr) - 1;
+        if (header->sizeClass == LargeClass) {
+            largeInUse--;
+            system.deallocate(header->base);
+            return;
+        }
+        SizeClass &sizeClass = classes[header->sizeClass];
+        FreeBlock *block = static_cast<FreeBlock *>(ptr);
+        block->next = sizeClass.freeList;
+        sizeClass.freeList = block;
+        sizeClass.inUse--;
+    }
+
+    std::vector<ClassOccupancy> occupancy() const
+    {
+        std::vector<ClassOccupancy> result;
+        for (size_t i = 0; i < ClassCount; ++i) {
+            const SizeClass &sizeClass = classes[i];
+            result.push_back({ClassSizes[i],
+                              sizeClass.slabs,
+                              sizeClass.inUse,
+                              sizeClass.slabs * (SlabSize / stride(i))});
+        }
+        return result;
+    }
+
+    size_t getLargeBlocksInUse() const { return largeInUse; }
+
+    void printOccupancy(std::ostream &out) const
+    {
+        for (const ClassOccupancy &entry : occupancy()) {
+            if (entry.slabs > 0) {
+                out << "  Slab Class " << entry.blockSize << " bytes: " << entry.inUse << " of "
+                    << entry.capacity << " blocks in use (" << entry.slabs << " slabs)\n";
+            }
+        }
+        out << "  Large Blocks In Use: " << largeInUse << "\n";
+    }
+
 private:
-    //std::ofstream logFile;
-    mutable std::ofstream logFile;
-    mutable std::mutex logMutex;
+    struct alignas(16) BlockHeader
+    {
+        void *base;         // what the DefaultAllocator returned, for large blocks
+        uint32_t sizeClass; // index into ClassSizes, or LargeClass
+    };
+    static constexpr uint32_t LargeClass = UINT32_MAX;
 
-    void log(const std::string &message)
+    // A freed block holds the link to the next free block of its class
+    struct FreeBlock
     {
-        std::lock_guard<std::mutex> lock(logMutex);
-        if (logFile.is_open()) {
-            logFile << "[" << getTimestamp() << "] " << message << std::endl;
-            logFile.flush();
+        FreeBlock *next;
+    };
+
+    struct SizeClass
+    {
+        FreeBlock *freeList = nullptr;
+        char *fresh = nullptr; // not yet handed out part of the newest slab
+        char *freshEnd = nullptr;
+        size_t slabs = 0;
+        size_t inUse = 0;
+    };
+
+    DefaultAllocator system;
+    SizeClass classes[ClassCount];
+    std::vector<void *> slabs;
+    size_t largeInUse = 0;
+
+    static size_t stride(size_t sizeClass) { return sizeof(BlockHeader) + ClassSizes[sizeClass]; }
+
+    void *allocateSmall(uint32_t index)
+    {
+        SizeClass &sizeClass = classes[index];
+        sizeClass.inUse++;
+        if (sizeClass.freeList) {
+            FreeBlock *block = sizeClass.freeList;
+            sizeClass.freeList = block->next;
+            return block;
         }
+        if (static_cast<size_t>(sizeClass.freshEnd - sizeClass.fresh) < stride(index)) {
+            char *slab = static_cast<char *>(system.allocate(SlabSize, alignof(BlockHeader)));
+            slabs.push_back(slab);
+            sizeClass.slabs++;
+            sizeClass.fresh = slab;
+            sizeClass.freshEnd = slab + SlabSize;
+        }
+        BlockHeader *header = reinterpret_cast<BlockHeader *>(sizeClass.fresh);
+        header->base = nullptr;
+        header->sizeClass = index;
+        sizeClass.fresh += stride(index);
+        return header + 1;
     }
+};
+
+template<typename Allocator = DefaultAllocator>
+class MemoryManager
+{
+private:
+    // memory.log. Messages about single objects are at LogLevel::Debug, so by default they
+    // are neither built nor written.
+    Logger &logger;
+
     struct AllocationInfo
     {
         size_t size;
@@ -90,7 +238,13 @@ private:
         {}
     };
 
-    std::unordered_map<void *, std::unique_ptr<AllocationInfo>> allocations;
+    // Nothing is recorded per allocation outside audit mode: whoever frees a block passes its
+    // size back to deallocate() (regions know it from the type they destroy, and only count
+    // what is live). In audit mode
+    // every auditSampling-th allocation gets an entry here, for the audit log and the leak
+    // report.
+    std::unordered_map<void *, AllocationInfo> audited;
+    size_t auditSampling = 1;
     bool auditMode;
     Allocator allocator;
 
@@ -110,7 +264,8 @@ private:
         auto now = std::chrono::system_clock::now();
         auto in_time_t = std::chrono::system_clock::to_time_t(now);
         std::stringstream ss;
-        ss << std::put_time(std::localtime(&in_time_t), "%Y-%m-%d %X");
+        std::tm local = Logger::localTime(in_time_t);
+        ss << std::put_time(&local, "%Y-%m-%d %X");
         return ss.str();
     }
 
@@ -118,19 +273,20 @@ private:
     {
         void *ptr = allocator.allocate(size, alignment);
         // std::cout << "Allocated " << size << " bytes at " << ptr << std::endl;
-        log("Allocated " + std::to_string(size) + " bytes at "
-            + std::to_string(reinterpret_cast<uintptr_t>(ptr)));
-
-        auto info = std::make_unique<AllocationInfo>(size, auditMode ? TRACE_INFO() : "");
-
-        if (auditMode) {
-            log("[AUDIT] Allocation: " + std::to_string(size) + " bytes at "
-                + std::to_string(reinterpret_cast<uintptr_t>(ptr))
-                + " (alignment: " + std::to_string(alignment) + ") " + " (" + getTimestamp() + ")");
+        LUMINAR_LOG(logger,
+                    LogLevel::Debug,
+                    "Allocated " + std::to_string(size) + " bytes at "
+                        + std::to_string(reinterpret_cast<uintptr_t>(ptr)));
+
+        if (auditMode && allocationCount % auditSampling == 0) {
+            audited.emplace(ptr, AllocationInfo(size, TRACE_INFO()));
+            LUMINAR_LOG(logger,
+                        LogLevel::Debug,
+                        "[AUDIT] Allocation: " + std::to_string(size) + " bytes at "
+                            + std::to_string(reinterpret_cast<uintptr_t>(ptr)) + " (alignment: "
+                            + std::to_string(alignment) + ") " + " (" + getTimestamp() + ")");
         }
 
-        allocations[ptr] = std::move(info);
-
         // Update statistics
         totalAllocated += size;
         peakMemoryUsage = std::max(peakMemoryUsage, totalAllocated);
@@ -140,29 +296,33 @@ private:
         return ptr;
     }
 
-    void deallocate(void *ptr)
-    {
-        std::cout << "Deallocating memory at " << ptr << std::endl;
-        // log("Deallocating memory at " + std::to_string(ptr));
-        auto it = allocations.find(ptr);
-        if (it != allocations.end()) {
-            if (auditMode) {
-                auto duration = std::chrono::steady_clock::now() - it->second->timestamp;
-                log("[AUDIT] Deallocation: " + std::to_string(it->second->size) + " bytes at "
-                    + std::to_string(reinterpret_cast<uintptr_t>(ptr)) + " (" + getTimestamp()
-                    + "), lived for "
-                    + std::to_string(
-                        std::chrono::duration_cast<std::chrono::milliseconds>(duration).count())
-                    + "ms");
+    // `size` is what allocate() was asked for
+    void deallocate(void *ptr, size_t size)
+    {
+        LUMINAR_LOG(logger,
+                    LogLevel::Debug,
+                    "Deallocating memory at "
+                        + std::to_string(reinterpret_cast<uintptr_t>(ptr)));
+        if (!audited.empty()) {
+            auto it = audited.find(ptr);
+            if (it != audited.end()) {
+                auto duration = std::chrono::steady_clock::now() - it->second.timestamp;
+                auto lifetime = std::chrono::duration_cast<std::chrono::milliseconds>(duration);
+                LUMINAR_LOG(logger,
+                            LogLevel::Debug,
+                            "[AUDIT] Deallocation: " + std::to_string(it->second.size)
+                                + " bytes at " + std::to_string(reinterpret_cast<uintptr_t>(ptr))
+                                + " (" + getTimestamp() + "), lived for "
+                                + std::to_string(lifetime.count()) + "ms");
+                audited.erase(it);
             }
+        }
 
-            // Update statistics
-            totalAllocated -= it->second->size;
-            deallocationCount++;
+        // Update statistics
+        totalAllocated -= size;
+        deallocationCount++;
 
-            allocator.deallocate(ptr);
-            allocations.erase(it);
-        }
+        allocator.deallocate(ptr);
     }
 
     // Non-const log function
@@ -188,6 +348,7 @@ private:
             } else {
                 logFile << "  Average Allocation Size: N/A (no allocations)\n";
             }
+            allocator.printOccupancy(logFile);
 
             logFile << "=======================================\n";
         }
@@ -200,7 +361,8 @@ public:
     size_t getActiveLinearsCount() const { return activeLinearsCount.load(); }
 
     MemoryManager(bool enableAuditMode = false, const Allocator &alloc = Allocator())
-        : auditMode(enableAuditMode)
+        : logger(Logger::memory())
+        , auditMode(enableAuditMode)
         , allocator(alloc)
         , totalAllocated(0)
         , peakMemoryUsage(0)
@@ -208,41 +370,49 @@ public:
         , deallocationCount(0)
         , largestAllocation(0)
     {
-        logFile.open("memory.log", std::ios::app);
-        if (!logFile.is_open()) {
-            throw std::runtime_error("Failed to open memory.log file");
-        }
-        log("MemoryManager initialized");
+        LUMINAR_LOG(logger, LogLevel::Info, "MemoryManager initialized");
     }
 
+    // In audit mode, record only every `every`-th allocation (1, the default: all of them)
+    void setAuditSampling(size_t every) { auditSampling = std::max<size_t>(every, 1); }
+
     void setAuditMode(bool enable)
     {
         auditMode = enable;
-        log("Audit mode " + std::string(enable ? "enabled" : "disabled"));
+        LUMINAR_LOG(logger,
+                    LogLevel::Info,
+                    "Audit mode " + std::string(enable ? "enabled" : "disabled"));
     }
 
     static void logMemoryUsage(const std::string &msg)
     {
-        std::ofstream logFile("memory.log", std::ios::app);
-        logFile << "[MemoryManager] " << msg << std::endl;
+        LUMINAR_LOG(Logger::memory(), LogLevel::Info, "[MemoryManager] " + msg);
     }
 
     void reportLeaks()
     {
-        if (allocations.empty()) {
-            log("No memory leaks detected.");
+        size_t live = allocationCount - deallocationCount;
+        if (live == 0) {
+            LUMINAR_LOG(logger, LogLevel::Info, "No memory leaks detected.");
             return;
         }
 
-        log("Memory leaks detected:\n");
-        for (const auto &[ptr, info] : allocations) {
-            auto duration = std::chrono::steady_clock::now() - info->timestamp;
-            log("- Leak: " + std::to_string(info->size) + " bytes at "
-                + std::to_string(reinterpret_cast<uintptr_t>(ptr)) + ", allocated "
-                + std::to_string(std::chrono::duration_cast<std::chrono::seconds>(duration).count())
-                + " seconds ago");
-            if (auditMode && !info->stackTrace.empty()) {
-                log("  Stack trace:\n" + info->stackTrace);
+        // The counts cover every allocation; the audited ones can also be listed
+        LUMINAR_LOG(logger,
+                    LogLevel::Warning,
+                    "Memory leaks detected: " + std::to_string(live) + " allocations, "
+                        + std::to_string(totalAllocated) + " bytes\n");
+        for (const auto &[ptr, info] : audited) {
+            auto duration = std::chrono::steady_clock::now() - info.timestamp;
+            LUMINAR_LOG(logger,
+                        LogLevel::Warning,
+                        "- Leak: " + std::to_string(info.size) + " bytes at "
+                            + std::to_string(reinterpret_cast<uintptr_t>(ptr)) + ", allocated "
+                            + std::to_string(
+                                std::chrono::duration_cast<std::chrono::seconds>(duration).count())
+                            + " seconds ago");
+            if (!info.stackTrace.empty()) {
+                LUMINAR_LOG(logger, LogLevel::Warning, "  Stack trace:\n" + info.stackTrace);
             }
         }
     }
@@ -257,6 +427,8 @@ public:
 
     size_t getLargestAllocation() const { return largestAllocation; }
 
+    const Allocator &getAllocator() const { return allocator; }
+
     double getAverageAllocationSize() const
     {
         return allocationCount > 0 ? static_cast<double>(totalAllocated) / allocationCount : 0.0;
@@ -283,11 +455,12 @@ public:
         } else {
             ss << "  Average Allocation Size: N/A (no allocations)\n";
         }
+        allocator.printOccupancy(ss);
 
         ss << "=======================================\n";
 
         std::string result = ss.str();
-        log(result);
+        LUMINAR_LOG(logger, LogLevel::Info, result);
         std::cout << result;
         // Log the statistics to a file
         logToFile();
@@ -296,52 +469,175 @@ public:
     ~MemoryManager()
     {
         reportLeaks();
-        log("MemoryManager destroyed");
-        logFile.close();
+        LUMINAR_LOG(logger, LogLevel::Info, "MemoryManager destroyed");
         // printStatistics();
     }
 
+    // How a Region gets its memory. Tracked regions allocate every object on its own through
+    // the manager and keep no list of them: each object's owner frees it with destroy(),
+    // which the allocator serves in O(1) from the block's header, and it shows up in leak
+    // reports until then. Arena regions bump-allocate from chunks that are freed all at once
+    // when the region is reset or destroyed; destroying a single object only gives its memory
+    // back if it was the last one allocated.
+    enum class RegionMode { Tracked, Arena };
+
     class Region
     {
     private:
+        // Header at the start of every arena chunk
+        struct Chunk
+        {
+            Chunk *previous;
+            size_t size; // header included
+        };
+
+        static constexpr size_t DefaultChunkSize = 4 * 1024;
+        static constexpr size_t MaxChunkSize = 64 * 1024;
+
         MemoryManager &manager;
-        std::vector<void *> regionAllocations;
+        RegionMode mode;
+        size_t liveObjects = 0; // tracked mode: created and not yet destroyed
+        size_t liveBytes = 0;
+
+        // Arena mode: the newest chunk and its unused part
+        Chunk *chunks = nullptr;
+        char *cursor = nullptr;
+        char *limit = nullptr;
+        void *lastAllocation = nullptr;
+        size_t chunkSize; // of the next chunk, doubling up to MaxChunkSize
+
+        void *bump(size_t size, size_t alignment)
+        {
+            uintptr_t address = (reinterpret_cast<uintptr_t>(cursor) + alignment - 1)
+                                & ~(alignment - 1);
+            if (address + size > reinterpret_cast<uintptr_t>(limit)) {
+                return grow(size, alignment);
+            }
+            cursor = reinterpret_cast<char *>(address + size);
+            lastAllocation = reinterpret_cast<void *>(address);
+            return lastAllocation;
+        }
+
+        void *grow(size_t size, size_t alignment)
+        {
+            size_t needed = sizeof(Chunk) + size + alignment;
+            if (needed > chunkSize && chunks) {
+                // Too big for a chunk: give it one of its own, behind the current chunk so
+                // the rest of that one stays in use
+                Chunk *chunk = static_cast<Chunk *>(manager.allocate(needed));
+                chunk->previous = chunks->previous;
+                chunk->size = needed;
+                chunks->previous = chunk;
+                lastAllocation = nullptr;
+                uintptr_t address = (reinterpret_cast<uintptr_t>(chunk + 1) + alignment - 1)
+                                    & ~(alignment - 1);
+                return reinterpret_cast<void *>(address);
+            }
+            size_t bytes = std::max(chunkSize, needed);
+            Chunk *chunk = static_cast<Chunk *>(manager.allocate(bytes));
+            chunk->previous = chunks;
+            chunk->size = bytes;
+            chunks = chunk;
+            cursor = reinterpret_cast<char *>(chunk + 1);
+            limit = reinterpret_cast<char *>(chunk) + bytes;
+            if (chunkSize < MaxChunkSize) {
+                chunkSize = std::min(chunkSize * 2, MaxChunkSize);
+            }
+            return bump(size, alignment);
+        }
+
+        void releaseChunks(Chunk *chunk)
+        {
+            while (chunk) {
+                Chunk *previous = chunk->previous;
+                manager.deallocate(chunk, chunk->size);
+                chunk = previous;
+            }
+        }
 
     public:
-        explicit Region(MemoryManager &mgr)
+        explicit Region(MemoryManager &mgr,
+                        RegionMode regionMode = RegionMode::Tracked,
+                        size_t firstChunkSize = DefaultChunkSize)
             : manager(mgr)
+            , mode(regionMode)
+            , chunkSize(firstChunkSize)
         {
             manager.activeRegionsCount++;
-            manager.log("Region created. Active Regions: "
-                        + std::to_string(manager.getActiveRegionsCount()));
+            LUMINAR_LOG(manager.logger,
+                        LogLevel::Debug,
+                        "Region created. Active Regions: "
+                            + std::to_string(manager.getActiveRegionsCount()));
         }
 
+        Region(const Region &) = delete;
+        Region &operator=(const Region &) = delete;
+
         ~Region()
         {
-            for (void *ptr : regionAllocations) {
-                manager.deallocate(ptr);
+            if (liveObjects > 0) {
+                LUMINAR_LOG(manager.logger,
+                            LogLevel::Warning,
+                            "Region destroyed with " + std::to_string(liveObjects)
+                                + " live objects (" + std::to_string(liveBytes) + " bytes)");
             }
+            releaseChunks(chunks);
             manager.activeRegionsCount--;
-            manager.log("Region destroyed. Active Regions: "
-                        + std::to_string(manager.getActiveRegionsCount()));
+            LUMINAR_LOG(manager.logger,
+                        LogLevel::Debug,
+                        "Region destroyed. Active Regions: "
+                            + std::to_string(manager.getActiveRegionsCount()));
         }
 
+        RegionMode getMode() const { return mode; }
+        MemoryManager &getManager() const { return manager; }
+
         template<typename T, typename... Args>
         T *create(Args &&...args)
         {
-            void *memory = manager.allocate(sizeof(T), alignof(T));
-            T *obj = new (memory) T(std::forward<Args>(args)...);
-            regionAllocations.push_back(memory);
-            return obj;
+            if (mode == RegionMode::Arena) {
+                void *memory = bump(sizeof(T), alignof(T));
+                if (manager.auditMode) {
+                    LUMINAR_LOG(manager.logger,
+                                LogLevel::Debug,
+                                "[AUDIT] Arena allocation: " + std::to_string(sizeof(T))
+                                    + " bytes at "
+                                    + std::to_string(reinterpret_cast<uintptr_t>(memory)));
+                }
+                return new (memory) T(std::forward<Args>(args)...);
+            }
+            liveObjects++;
+            liveBytes += sizeof(T);
+            return new (manager.allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+        }
+
+        // Runs the destructor of an object create<T>() returned and frees its memory
+        template<typename T>
+        void destroy(T *object)
+        {
+            object->~T();
+            if (mode == RegionMode::Arena) {
+                if (object == lastAllocation) {
+                    cursor = reinterpret_cast<char *>(object);
+                    lastAllocation = nullptr;
+                }
+                return;
+            }
+            liveObjects--;
+            liveBytes -= sizeof(T);
+            manager.deallocate(object, sizeof(T));
         }
 
-        void deallocate(void *ptr)
+        // Arena regions only: frees every object at once, without running destructors, and
+        // leaves the region ready for reuse with its newest chunk
+        void reset()
         {
-            auto it = std::find(regionAllocations.begin(), regionAllocations.end(), ptr);
-            if (it != regionAllocations.end()) {
-                manager.deallocate(ptr);
-                regionAllocations.erase(it);
+            if (chunks) {
+                releaseChunks(chunks->previous);
+                chunks->previous = nullptr;
+                cursor = reinterpret_cast<char *>(chunks + 1);
             }
+            lastAllocation = nullptr;
         }
     };
 
@@ -362,8 +658,10 @@ public:
             , manager(mgr)
         {
             manager.activeLinearsCount++;
-            manager.log("Linear object created. Active Linears: "
-                        + std::to_string(manager.getActiveLinearsCount()));
+            LUMINAR_LOG(manager.logger,
+                        LogLevel::Debug,
+                        "Linear object created. Active Linears: "
+                            + std::to_string(manager.getActiveLinearsCount()));
         }
 
         Linear(const Linear &) = delete;
@@ -402,7 +700,7 @@ public:
 
         T *borrow() const
         {
-            manager.log("Borrowing Linear resource.");
+            LUMINAR_LOG(manager.logger, LogLevel::Debug, "Borrowing Linear resource.");
             return ptr;
         }
 
@@ -411,123 +709,140 @@ public:
         void release()
         {
             if (ptr && ownsResource) {
-                ptr->~T(); // Call destructor
-                region->deallocate(ptr);
+                region->destroy(ptr);
                 ptr = nullptr;
                 ownsResource = false;
                 manager.activeLinearsCount--;
-                manager.log("Linear object destroyed. Active Linears: "
-                            + std::to_string(manager.getActiveLinearsCount()));
+                LUMINAR_LOG(manager.logger,
+                            LogLevel::Debug,
+                            "Linear object destroyed. Active Linears: "
+                                + std::to_string(manager.getActiveLinearsCount()));
             }
         }
     };
 
+    // Header and payload of a Ref'd value, allocated as one object in its region: the
+    // reference count and the region the memory goes back to, followed by the value
+    template<typename T>
+    struct Counted
+    {
+        uint32_t count;
+        Region *region;
+        T value;
+
+        template<typename... Args>
+        explicit Counted(Region &r, Args &&...args)
+            : count(1)
+            , region(&r)
+            , value(std::forward<Args>(args)...)
+        {}
+    };
+
+    // Reference counted pointer to a Counted<T> in a region. It is only a pointer: the count
+    // lives in the object's header, and the region (and through it the manager) is found from
+    // there when the last reference goes. The count is a plain integer and nothing below it
+    // (the region, the allocator's free lists, the manager's statistics) is synchronized, so
+    // a Ref and every copy of it must stay on the thread of its region, or only be touched
+    // under one lock that every thread using them holds (StackBackend's PARALLEL and
+    // CONCURRENT tasks run each instruction under its mutex). Values that cross threads
+    // otherwise go as ValuePtr (std::shared_ptr) copies.
     template<typename T>
     class Ref
     {
+    public:
+        using Object = Counted<T>;
+
     private:
-        T *ref;
-        Region *region;
-        std::atomic<int> *refCount; // Atomic reference counter
-        MemoryManager manager;
+        Object *object;
 
-        void incrementRefCount()
+        void retain() const
         {
-            if (refCount) {
-                refCount->fetch_add(1, std::memory_order_relaxed);
-                manager.activeReferencesCount++;
-                manager.log("Reference count incremented. Active References: "
-                            + std::to_string(manager.getActiveReferencesCount()));
+            if (object) {
+                share(object);
             }
         }
 
-        void decrementRefCount()
+        void release()
         {
-            if (refCount && refCount->fetch_sub(1, std::memory_order_acq_rel) == 1) {
-                // std::cout << "Destroying Ref object at " << static_cast<void *>(ref) << std::endl;
-                manager.log("Destroying Ref object");
-                // manager.log("Destroying Ref object at " + std::to_string(*ref->data));
-                delete refCount;
-                if (ref) {
-                    ref->~T(); // Call destructor
-                    region->deallocate(ref);
-                }
-                ref = nullptr;
-                region = nullptr;
-                refCount = nullptr;
+            if (!object) {
+                return;
+            }
+            if (--object->count == 0) {
+                Region *region = object->region;
+                MemoryManager &manager = region->getManager();
+                region->destroy(object);
                 manager.activeReferencesCount--;
-                manager.log("Reference object destroyed. Active References: "
-                            + std::to_string(manager.getActiveReferencesCount()));
+                LUMINAR_LOG(manager.logger,
+                            LogLevel::Debug,
+                            "Reference object destroyed. Active References: "
+                                + std::to_string(manager.getActiveReferencesCount()));
             }
+            object = nullptr;
         }
 
     public:
-        T *operator->() const { return ref; }
-        T &operator*() const { return *ref; }
-        T *get() const { return ref; }
-        Region &getRegion() const { return *region; }
+        T *operator->() const { return &object->value; }
+        T &operator*() const { return object->value; }
+        T *get() const { return object ? &object->value : nullptr; }
+        Region &getRegion() const { return *object->region; }
+        explicit operator bool() const { return object != nullptr; }
 
         Ref()
-            : ref(nullptr)
-            , region(nullptr)
-            , refCount(nullptr)
+            : object(nullptr)
         {}
 
-        Ref(Region &r, T *p)
-            : ref(p)
-            , region(&r)
-            , refCount(new std::atomic<int>(1))
+        // Takes over a reference to `owned`: the one a new Counted starts with, or one that
+        // detach() gave up
+        explicit Ref(Object *owned)
+            : object(owned)
+        {}
+
+        // For holders of a bare Object pointer that still count through Ref (TaggedValue):
+        // detach() gives this reference up to the caller, share() adds one to an object, and
+        // Ref(object) above takes one back so that dropping it frees the object when it was
+        // the last
+        Object *detach()
         {
-            manager.activeReferencesCount++;
-            manager.log("Reference created. Active References: "
-                        + std::to_string(manager.getActiveReferencesCount()));
+            Object *owned = object;
+            object = nullptr;
+            return owned;
         }
 
+        static void share(Object *object) { object->count++; }
+
         Ref(const Ref &other)
-            : ref(other.ref)
-            , region(other.region)
-            , refCount(other.refCount)
+            : object(other.object)
         {
-            incrementRefCount();
+            retain();
         }
 
         Ref &operator=(const Ref &other)
         {
             if (this != &other) {
-                decrementRefCount();
-                ref = other.ref;
-                region = other.region;
-                refCount = other.refCount;
-                incrementRefCount();
+                other.retain();
+                release();
+                object = other.object;
             }
             return *this;
         }
 
         Ref(Ref &&other) noexcept
-            : ref(other.ref)
-            , region(other.region)
-            , refCount(other.refCount)
+            : object(other.object)
         {
-            other.ref = nullptr;
-            other.region = nullptr;
-            other.refCount = nullptr;
+            other.object = nullptr;
         }
 
         Ref &operator=(Ref &&other) noexcept
         {
             if (this != &other) {
-                decrementRefCount();
-                ref = other.ref;
-                region = other.region;
-                refCount = other.refCount;
-                other.ref = nullptr;
-                other.region = nullptr;
-                other.refCount = nullptr;
+                release();
+                object = other.object;
+                other.object = nullptr;
             }
             return *this;
         }
 
-        ~Ref() { decrementRefCount(); }
+        ~Ref() { release(); }
     };
 
     class Unsafe
@@ -604,16 +919,32 @@ public:
     template<typename T, typename... Args>
     Ref<T> makeRef(Region &region, Args &&...args)
     {
-        // Handle regular case
+        using Object = typename Ref<T>::Object;
         if constexpr (sizeof...(Args) == 1) {
             using FirstArg = std::decay_t<std::tuple_element_t<0, std::tuple<Args...>>>;
             if constexpr (std::is_same_v<FirstArg, std::shared_ptr<T>>) {
                 auto &sharedPtr = std::get<0>(std::forward_as_tuple(args...));
-                T *obj = region.template create<T>(*sharedPtr);
-                return Ref<T>(region, obj);
+                return adoptRef(region.template create<Object>(region, *sharedPtr));
+            } else {
+                return adoptRef(
+                    region.template create<Object>(region, std::forward<Args>(args)...));
             }
+        } else {
+            // Handle regular case
+            return adoptRef(region.template create<Object>(region, std::forward<Args>(args)...));
         }
-        return Ref<T>(region, region.template create<T>(std::forward<Args>(args)...));
+    }
+
+private:
+    template<typename T>
+    Ref<T> adoptRef(Counted<T> *object)
+    {
+        activeReferencesCount++;
+        LUMINAR_LOG(logger,
+                    LogLevel::Debug,
+                    "Reference created. Active References: "
+                        + std::to_string(getActiveReferencesCount()));
+        return Ref<T>(object);
     }
 };
 
@@ -42,6 +42,7 @@ enum Opcode {
     NOP,   // No operation
     HALT,  // Halt execution
     PRINT, // Print
+    POP,   // Discard the top of the stack
 
     // Function definition and invocation
     DEFINE_FUNCTION,
@@ -89,6 +90,39 @@ enum Opcode {
     CONCATENATE_STR,    // Concatenate strings
     INTERPOLATE_STRING, //Interpolate strings
 
+    // Type-specialized operations, emitted when both operand types are known statically.
+    // The generic forms above remain for `any`-typed operands.
+    ADD_I64,
+    SUB_I64,
+    MUL_I64,
+    DIV_I64,
+    MOD_I64,
+    NEG_I64,
+    ADD_F64,
+    SUB_F64,
+    MUL_F64,
+    DIV_F64,
+    MOD_F64,
+    NEG_F64,
+    EQ_I64,
+    NE_I64,
+    LT_I64,
+    LE_I64,
+    GT_I64,
+    GE_I64,
+    EQ_F64,
+    NE_F64,
+    LT_F64,
+    LE_F64,
+    GT_F64,
+    GE_F64,
+    EQ_STR,
+    NE_STR,
+    // Convert the top of the stack to an integer or a float (no-op if it already is one).
+    // nil stays nil; anything else that is not a number is reported and becomes nil.
+    TO_INT64,
+    TO_FLOAT64,
+
     //Memory Management
     ALLOC,
     DEALLOC,
@@ -98,5 +132,7 @@ enum Opcode {
     COMPARE,
     MOVE,
     ALLOCATE_ZEROED,
-    SET_UNSAFE_MODE
+    SET_UNSAFE_MODE,
+
+    OPCODE_COUNT // Number of opcodes, keep last
 };
@@ -2,6 +2,7 @@
 #ifndef ALGORITHM_HH
 #define ALGORITHM_HH
 
+#include "../constants.hh"
 #include "../instructions.hh"
 
 //using Value = std::variant<int32_t, double, bool, std::string>;
@@ -15,6 +16,9 @@ public:
     virtual Bytecode parse() = 0;
     virtual std::string toString() const = 0;
     virtual std::vector<Instruction> getBytecode() const = 0;
+    virtual const ConstantPool &getConstants() const = 0;
+    // Whether parse() reported a syntax error; its bytecode is then not the program's
+    virtual bool failed() const = 0;
 };
 
 #endif // ALGORITHM_HH
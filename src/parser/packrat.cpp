@@ -19,6 +19,7 @@ Bytecode PackratParser::parse()
         auto start_time = std::chrono::high_resolution_clock::now();
         scanner.current = 0;
         program();
+        dropForwardCallConversions();
         if (pos >= tokens.size()) {
             error("Unexpected input at position " + std::to_string(pos + 1));
         }
@@ -64,9 +65,13 @@ void PackratParser::statement()
         // return_statement();
         if (!check(TokenType::SEMICOLON)) {
             expression();
+            consume(TokenType::SEMICOLON, "Expected ';' after return statement.");
+            emitConversion(popType(), currentReturnType);
+            emit(Opcode::RETURN_VALUE, peek().line);
+        } else {
+            consume(TokenType::SEMICOLON, "Expected ';' after return statement.");
+            emit(Opcode::RETURN, peek().line);
         }
-        consume(TokenType::SEMICOLON, "Expected ';' after return statement.");
-        emit(Opcode::RETURN, peek().line);
     } else if (match(TokenType::CLASS)) {
         class_declaration();
     } else {
@@ -77,6 +82,7 @@ void PackratParser::statement()
 void PackratParser::if_statement()
 {
     expression(); // condition
+    popType();
     size_t jumpIfFalsePos = bytecode.size();
     emit(Opcode::JUMP_IF_FALSE,
          peek().line,
@@ -99,6 +105,7 @@ void PackratParser::if_statement()
 
     while (match(TokenType::ELIF)) {
         expression(); // condition
+        popType();
         size_t elifJumpIfFalsePos = bytecode.size();
         emit(Opcode::JUMP_IF_FALSE,
              peek().line,
@@ -125,12 +132,14 @@ void PackratParser::if_statement()
 
     size_t endIfStatement = bytecode.size();
 
-    // Update all JUMP instructions to the end of the if statement
+    // Update all JUMP instructions to the end of the if statement (JUMP is relative)
     bytecode[jumpPos].value = std::make_shared<Value>(
-        Value{std::make_shared<Type>(TypeTag::Int), endIfStatement});
+        Value{std::make_shared<Type>(TypeTag::Int),
+              static_cast<int32_t>(endIfStatement - jumpPos - 1)});
     for (size_t elifJump : elifJumps) {
         bytecode[elifJump].value = std::make_shared<Value>(
-            Value{std::make_shared<Type>(TypeTag::Int), endIfStatement});
+            Value{std::make_shared<Type>(TypeTag::Int),
+                  static_cast<int32_t>(endIfStatement - elifJump - 1)});
     }
 }
 
@@ -138,6 +147,7 @@ void PackratParser::while_statement()
 {
     size_t loopStart = bytecode.size();
     expression(); // condition
+    popType();
     size_t jumpIfFalsePos = bytecode.size();
     emit(Opcode::JUMP_IF_FALSE,
          peek().line,
@@ -163,6 +173,7 @@ void PackratParser::for_statement()
 
     // Initialization
     if (!match(TokenType::SEMICOLON)) {
+        match(TokenType::VAR); // `for (var i = 0; ...)` and `for (i = 0; ...)` both declare i
         var_declaration();
     } else {
         emit(Opcode::NOP, peek().line);
@@ -174,26 +185,37 @@ void PackratParser::for_statement()
     size_t exitJump = 0;
     if (!match(TokenType::SEMICOLON)) {
         expression();
+        popType();
         consume(TokenType::SEMICOLON, "Expected ';' after loop condition.");
         exitJump = bytecode.size();
         emit(Opcode::JUMP_IF_FALSE, peek().line, Value{std::make_shared<Type>(TypeTag::Int), 0}); // Placeholder jump
     }
 
-    // Increment
-    size_t bodyJump = bytecode.size();
-    emit(Opcode::JUMP, peek().line, Value{std::make_shared<Type>(TypeTag::Int), 0}); // Placeholder jump
+    // Increment. It is parsed here but runs after the body, so its code is moved there and
+    // the loop comes out in the shape of a while loop, with a single jump back. Expressions
+    // and assignments never contain jumps, so the moved code needs no patching.
     size_t incrementStart = bytecode.size();
     if (!match(TokenType::RIGHT_PAREN)) {
-        expression();
-        emit(Opcode::JUMP, peek().line, Value{std::make_shared<Type>(TypeTag::Int), loopStart});
-        consume(TokenType::RIGHT_PAREN, "Expected ')' after for clauses.");
+        if (peek().type == TokenType::IDENTIFIER
+            && (peekNext().type == TokenType::EQUAL || peekNext().type == TokenType::PLUS_EQUAL
+                || peekNext().type == TokenType::MINUS_EQUAL)) {
+            assignment(TokenType::RIGHT_PAREN);
+        } else {
+            expression();
+            popType();
+            emit(Opcode::POP, peek().line);
+            consume(TokenType::RIGHT_PAREN, "Expected ')' after for clauses.");
+        }
     }
+    Bytecode increment(bytecode.begin() + incrementStart, bytecode.end());
+    bytecode.erase(bytecode.begin() + incrementStart, bytecode.end());
 
     // Body
-    size_t bodyStart = bytecode.size();
-    bytecode[bodyJump].value = std::make_shared<Value>(Value{std::make_shared<Type>(TypeTag::Int), bodyStart});
+    consume(TokenType::LEFT_BRACE, "Expected '{' after for clauses.");
     block();
-    emit(Opcode::JUMP, peek().line, Value{std::make_shared<Type>(TypeTag::Int), incrementStart});
+    bytecode.insert(bytecode.end(), increment.begin(), increment.end());
+    int32_t conditionJump = static_cast<int32_t>(loopStart) - static_cast<int32_t>(bytecode.size()) - 1;
+    emit(Opcode::JUMP, peek().line, Value{std::make_shared<Type>(TypeTag::Int), conditionJump});
 
     // Update jumps
     size_t loopEnd = bytecode.size();
@@ -206,6 +228,7 @@ void PackratParser::print_statement()
 {
     consume(TokenType::LEFT_PAREN, "Expected '(' before print expression.");
     expression();
+    popType();
     consume(TokenType::RIGHT_PAREN, "Expected ')' after print expression.");
     consume(TokenType::SEMICOLON, "Expected ';' after the print function.");
     emit(Opcode::PRINT, peek().line);
@@ -227,7 +250,7 @@ void PackratParser::var_declaration()
     Token name = peek();
     consume(TokenType::IDENTIFIER, "Expected variable name.");
 
-    TypePtr type = std::make_shared<Type>(TypeTag::Int);
+    TypePtr type = nullptr;
     if (match(TokenType::COLON)) {
         //        std::cout << "Variable initialization found for " << name.lexeme << std::endl;
         Token typeToken = peek();
@@ -236,15 +259,20 @@ void PackratParser::var_declaration()
         type = std::make_shared<Type>(stringToType(typeToken.lexeme));
     }
 
-    //    std::cout << "declaration of variables initiated" << std::endl;
-    declareVariable(name, type);
-
     if (match(TokenType::EQUAL)) {
+        // The initializer is parsed first so an unannotated variable takes its type
         expression();
+        TypeTag valueType = popType();
+        if (!type) {
+            type = std::make_shared<Type>(valueType);
+        }
+        declareVariable(name, type);
+        emitConversion(valueType, type->tag);
         emit(Opcode::STORE_VARIABLE,
              peek().line,
              Value{std::make_shared<Type>(TypeTag::Int), getVariableMemoryLocation(name)});
     } else {
+        declareVariable(name, type ? type : std::make_shared<Type>(TypeTag::Int));
         emit(Opcode::NOP, peek().line);
     }
 
@@ -259,9 +287,10 @@ void PackratParser::var_call(const Token &name)
 {
     int32_t location = getVariableMemoryLocation(name);
     emit(Opcode::LOAD_VARIABLE, peek().line, Value{std::make_shared<Type>(TypeTag::Int), location});
+    pushType(tagOf(variable.getVariableType(name.lexeme)));
 }
 
-void PackratParser::assignment()
+void PackratParser::assignment(TokenType terminator)
 {
     auto start = std::chrono::high_resolution_clock::now();
     Token name = peek();
@@ -278,22 +307,28 @@ void PackratParser::assignment()
     }
 
     std::cout << "Variable " << name.lexeme << " assigned" << std::endl;
-    expression();
-    consume(TokenType::SEMICOLON, "Expected ';' after assignment.");
-
     int32_t location = getVariableMemoryLocation(name);
+    TypeTag variableType = tagOf(variable.getVariableType(name.lexeme));
 
-    if (assignmentType == TokenType::PLUS_EQUAL) {
+    // For += and -= the variable is the left operand, so it is loaded first
+    if (assignmentType != TokenType::EQUAL) {
         emit(Opcode::LOAD_VARIABLE,
              peek().line,
              Value{std::make_shared<Type>(TypeTag::Int), location});
-        emit(Opcode::ADD, peek().line);
+        pushType(variableType);
+    }
+    size_t rightStart = bytecode.size();
+    expression();
+    consume(terminator,
+            terminator == TokenType::SEMICOLON ? "Expected ';' after assignment."
+                                               : "Expected ')' after for clauses.");
+
+    if (assignmentType == TokenType::PLUS_EQUAL) {
+        emitTyped(Opcode::ADD, rightStart);
     } else if (assignmentType == TokenType::MINUS_EQUAL) {
-        emit(Opcode::LOAD_VARIABLE,
-             peek().line,
-             Value{std::make_shared<Type>(TypeTag::Int), location});
-        emit(Opcode::SUBTRACT, peek().line);
+        emitTyped(Opcode::SUBTRACT, rightStart);
     }
+    emitConversion(popType(), variableType);
 
     emit(Opcode::STORE_VARIABLE, peek().line, Value{std::make_shared<Type>(TypeTag::Int), location});
 
@@ -313,7 +348,7 @@ void PackratParser::function_declaration()
         do {
             Token paramName = peek();
             consume(TokenType::IDENTIFIER, "Expected parameter name.");
-            TypePtr paramType = nullptr;
+            TypePtr paramType = std::make_shared<Type>(TypeTag::Any);
             if (match(TokenType::COLON)) {
                 Token typeToken = peek();
                 advance();
@@ -334,23 +369,44 @@ void PackratParser::function_declaration()
 
     consume(TokenType::LEFT_BRACE, "Expected '{' before function body.");
 
+    // Registered before the body so recursive calls know their result type
+    functionReturnTypes[name.lexeme] = tagOf(returnType);
+    TypeTag enclosingReturnType = currentReturnType;
+    currentReturnType = tagOf(returnType);
+
     enterScope();
 
-    // Emit function definition
+    // Emit function definition, followed by a jump over the body so that straight-line
+    // execution does not fall into it
     emit(Opcode::DEFINE_FUNCTION,
          peek().line,
          Value{std::make_shared<Type>(TypeTag::Int), name.lexeme});
+    size_t skipBodyPos = bytecode.size();
+    emit(Opcode::JUMP, peek().line, Value{std::make_shared<Type>(TypeTag::Int), 0}); // Placeholder jump
 
     // Add parameters to the current scope
+    std::vector<int32_t> parameterLocations;
     for (const auto &param : parameters) {
-        declareVariable(Token{TokenType::IDENTIFIER, param.first}, param.second);
+        Token paramToken{TokenType::IDENTIFIER, param.first, name.filename, name.filepath,
+                         name.column, name.line};
+        declareVariable(paramToken, param.second);
+        parameterLocations.push_back(getVariableMemoryLocation(paramToken));
+    }
+
+    // Arguments arrive on the stack in call order, so the last one is on top. Callers may
+    // not know the parameter types, so numeric arguments are converted here.
+    for (size_t i = parameters.size(); i-- > 0;) {
+        emitConversion(TypeTag::Any, parameters[i].second->tag);
+        emit(Opcode::STORE_VARIABLE,
+             peek().line,
+             Value{std::make_shared<Type>(TypeTag::Int), parameterLocations[i]});
     }
 
     while (!check(TokenType::RIGHT_BRACE) && !isAtEnd()) {
         statement();
     }
     // Emit return if not present
-    if (bytecode.back().opcode != Opcode::RETURN) {
+    if (bytecode.back().opcode != Opcode::RETURN && bytecode.back().opcode != Opcode::RETURN_VALUE) {
         if (returnType && returnType->tag != TypeTag::Nil) {
             error("Function must return a value of type " + returnType->toString());
         }
@@ -358,6 +414,11 @@ void PackratParser::function_declaration()
     }
     consume(TokenType::RIGHT_BRACE, "Expected '}' after function block.");
 
+    bytecode[skipBodyPos].value = std::make_shared<Value>(
+        Value{std::make_shared<Type>(TypeTag::Int),
+              static_cast<int32_t>(bytecode.size() - skipBodyPos - 1)});
+
+    currentReturnType = enclosingReturnType;
     exitScope();
 }
 
@@ -374,10 +435,39 @@ void PackratParser::function_call(const Token &name)
     }
     consume(TokenType::RIGHT_PAREN, "Expected ')' after arguments.");
 
+    for (int i = 0; i < argCount; ++i) {
+        popType();
+    }
+
+    // The arguments are already on the stack; the callee's prologue stores them
     emit(Opcode::INVOKE_FUNCTION,
          peek().line,
          Value{std::make_shared<Type>(TypeTag::String), name.lexeme});
-    emit(Opcode::PUSH_ARGS, peek().line, Value{std::make_shared<Type>(TypeTag::Int), argCount});
+    auto returnType = functionReturnTypes.find(name.lexeme);
+    pushType(returnType != functionReturnTypes.end() ? returnType->second : TypeTag::Any);
+}
+
+// A call to a function declared further down gets its result converted to the type the
+// call site expects, since the parser does not know the return type yet. Once it does,
+// conversions to the very type the callee declares are no-ops: the callee converts what it
+// returns itself. They become NOPs, so `return f(...)` is again a call directly followed by
+// its return and can be a tail call.
+void PackratParser::dropForwardCallConversions()
+{
+    for (size_t pc = 0; pc + 1 < bytecode.size(); ++pc) {
+        if (bytecode[pc].opcode != Opcode::INVOKE_FUNCTION || !bytecode[pc].value
+            || !std::holds_alternative<std::string>(bytecode[pc].value->data)) {
+            continue;
+        }
+        auto returnType = functionReturnTypes.find(std::get<std::string>(bytecode[pc].value->data));
+        if (returnType == functionReturnTypes.end()) {
+            continue;
+        }
+        Instruction &next = bytecode[pc + 1];
+        if (next.opcode != NOP && next.opcode == conversionOpcode(TypeTag::Any, returnType->second)) {
+            next = Instruction(Opcode::NOP, next.lineNumber);
+        }
+    }
 }
 
 void PackratParser::class_declaration()
@@ -402,7 +492,8 @@ void PackratParser::expression_statement()
 {
     expression();
     consume(TokenType::SEMICOLON, "Expected ';' after expression.");
-    // emit(Opcode::POP, peek().line);
+    popType();
+    emit(Opcode::POP, peek().line);
 }
 
 void PackratParser::expression()
@@ -415,8 +506,9 @@ void PackratParser::logical_or_expression()
     logical_and_expression();
 
     while (match(TokenType::OR)) {
+        size_t rightStart = bytecode.size();
         logical_and_expression();
-        emit(Opcode::OR, peek().line);
+        emitTyped(Opcode::OR, rightStart);
     }
 }
 
@@ -425,8 +517,9 @@ void PackratParser::logical_and_expression()
     equality_expression();
 
     while (match(TokenType::AND)) {
+        size_t rightStart = bytecode.size();
         equality_expression();
-        emit(Opcode::AND, peek().line);
+        emitTyped(Opcode::AND, rightStart);
     }
 }
 
@@ -436,12 +529,13 @@ void PackratParser::equality_expression()
 
     while (match(TokenType::EQUAL_EQUAL) || match(TokenType::BANG_EQUAL)) {
         TokenType operatorType = previous().type;
+        size_t rightStart = bytecode.size();
         comparison_expression();
 
         if (operatorType == TokenType::EQUAL_EQUAL) {
-            emit(Opcode::EQUAL, peek().line);
+            emitTyped(Opcode::EQUAL, rightStart);
         } else {
-            emit(Opcode::NOT_EQUAL, peek().line);
+            emitTyped(Opcode::NOT_EQUAL, rightStart);
         }
     }
 }
@@ -453,20 +547,21 @@ void PackratParser::comparison_expression()
     while (match(TokenType::GREATER) || match(TokenType::GREATER_EQUAL) || match(TokenType::LESS)
            || match(TokenType::LESS_EQUAL)) {
         TokenType operatorType = previous().type;
+        size_t rightStart = bytecode.size();
         additive_expression();
 
         switch (operatorType) {
         case TokenType::GREATER:
-            emit(Opcode::GREATER_THAN, peek().line);
+            emitTyped(Opcode::GREATER_THAN, rightStart);
             break;
         case TokenType::GREATER_EQUAL:
-            emit(Opcode::GREATER_THAN_OR_EQUAL, peek().line);
+            emitTyped(Opcode::GREATER_THAN_OR_EQUAL, rightStart);
             break;
         case TokenType::LESS:
-            emit(Opcode::LESS_THAN, peek().line);
+            emitTyped(Opcode::LESS_THAN, rightStart);
             break;
         case TokenType::LESS_EQUAL:
-            emit(Opcode::LESS_THAN_OR_EQUAL, peek().line);
+            emitTyped(Opcode::LESS_THAN_OR_EQUAL, rightStart);
             break;
         default:
             break; // Unreachable
@@ -480,12 +575,13 @@ void PackratParser::additive_expression()
 
     while (match(TokenType::PLUS) || match(TokenType::MINUS)) {
         TokenType operatorType = previous().type;
+        size_t rightStart = bytecode.size();
         multiplicative_expression();
 
         if (operatorType == TokenType::PLUS) {
-            emit(Opcode::ADD, peek().line);
+            emitTyped(Opcode::ADD, rightStart);
         } else {
-            emit(Opcode::SUBTRACT, peek().line);
+            emitTyped(Opcode::SUBTRACT, rightStart);
         }
     }
 }
@@ -496,12 +592,13 @@ void PackratParser::multiplicative_expression()
 
     while (match(TokenType::STAR) || match(TokenType::SLASH)) {
         TokenType operatorType = previous().type;
+        size_t rightStart = bytecode.size();
         unary_expression();
 
         if (operatorType == TokenType::STAR) {
-            emit(Opcode::MULTIPLY, peek().line);
+            emitTyped(Opcode::MULTIPLY, rightStart);
         } else {
-            emit(Opcode::DIVIDE, peek().line);
+            emitTyped(Opcode::DIVIDE, rightStart);
         }
     }
 }
@@ -512,10 +609,14 @@ void PackratParser::unary_expression()
         TokenType operatorType = previous().type;
         unary_expression();
 
+        TypeTag operandType = popType();
         if (operatorType == TokenType::BANG) {
             emit(Opcode::NOT, peek().line);
+            pushType(TypeTag::Bool);
         } else {
-            emit(Opcode::NEGATE, peek().line);
+            TypeTag operands = commonOperandType(operandType, operandType);
+            emit(specializedOpcode(Opcode::NEGATE, operands), peek().line);
+            pushType(resultType(Opcode::NEGATE, operands));
         }
     } else {
         primary_expression();
@@ -529,12 +630,15 @@ void PackratParser::primary_expression()
     Value value = setValue(typePtr, token.lexeme);
     if (match(TokenType::FALSE)) {
         emit(Opcode::BOOLEAN, peek().line, Value{std::make_shared<Type>(TypeTag::Bool), false});
+        pushType(TypeTag::Bool);
     } else if (match(TokenType::TRUE)) {
         emit(Opcode::BOOLEAN, peek().line, Value{std::make_shared<Type>(TypeTag::Bool), true});
+        pushType(TypeTag::Bool);
     } else if (match(TokenType::NIL_TYPE)) {
         emit(Opcode::NOP, peek().line);
     } else if (match(TokenType::NUMBER)) {
         emit(Opcode::LOAD_CONST, peek().line, std::move(value));
+        pushType(typePtr->tag);
     } else if (match(TokenType::STRING)) {
         parse_string();
     } else if (match(TokenType::IDENTIFIER)) {
@@ -589,6 +693,7 @@ void PackratParser::interpolate_string(const std::string &str)
 
             // Parse and evaluate the expression
             expression();
+            popType();
 
             // Restore parser state
             pos = savedPos;
@@ -600,6 +705,7 @@ void PackratParser::interpolate_string(const std::string &str)
 
         searchStart = match.suffix().first;
     }
+    pushType(TypeTag::String);
 }
 
 std::vector<Token> PackratParser::tokenizeExpression(const std::string &expr)
@@ -647,6 +753,9 @@ void PackratParser::method_call(const Token &object)
             } while (match(TokenType::COMMA));
         }
         consume(TokenType::RIGHT_PAREN, "Expected ')' after arguments.");
+        for (int i = 0; i < argCount; ++i) {
+            popType();
+        }
 
         emit(Opcode::METHOD_CALL,
              peek().line,
@@ -658,6 +767,7 @@ void PackratParser::method_call(const Token &object)
              peek().line,
              Value{std::make_shared<Type>(TypeTag::String), object.lexeme + "." + method.lexeme});
     }
+    pushType(TypeTag::Any);
 }
 
 Instruction PackratParser::emit(Opcode opcode, uint32_t lineNumber)
@@ -670,6 +780,11 @@ Instruction PackratParser::emit(Opcode opcode, uint32_t lineNumber)
 
 Instruction PackratParser::emit(Opcode opcode, uint32_t lineNumber, Value &&value)
 {
+    // Literals go to the constant pool; the instruction only carries their index
+    if (opcode == Opcode::LOAD_CONST || opcode == Opcode::LOAD_STR || opcode == Opcode::BOOLEAN) {
+        int32_t slot = constants.add(std::move(value));
+        value = Value{std::make_shared<Type>(TypeTag::Int), slot};
+    }
     ValuePtr valuePtr = std::make_shared<Value>(std::move(value));
     Instruction instruction(opcode, lineNumber, valuePtr);
     instruction.debug();
@@ -677,6 +792,57 @@ Instruction PackratParser::emit(Opcode opcode, uint32_t lineNumber, Value &&valu
     return instruction;
 }
 
+void PackratParser::emitTyped(Opcode opcode, size_t rightStart)
+{
+    TypeTag right = popType();
+    TypeTag left = popType();
+    TypeTag operands = commonOperandType(left, right);
+    Opcode typed = specializedOpcode(opcode, operands);
+
+    if (typed != opcode) {
+        // An integer operand next to a float one is converted where it was produced; the
+        // left operand ends where the right one starts.
+        Opcode leftConversion = conversionOpcode(left, operands);
+        if (leftConversion != Opcode::NOP) {
+            Instruction conversion(leftConversion, peek().line);
+            conversion.debug();
+            bytecode.insert(bytecode.begin() + rightStart, conversion);
+        }
+        emitConversion(right, operands);
+    }
+
+    emit(typed, peek().line);
+    pushType(resultType(opcode, operands));
+}
+
+void PackratParser::emitConversion(TypeTag from, TypeTag to)
+{
+    Opcode conversion = conversionOpcode(from, to);
+    if (conversion != Opcode::NOP) {
+        emit(conversion, peek().line);
+    }
+}
+
+void PackratParser::pushType(TypeTag tag)
+{
+    typeStack.push_back(tag);
+}
+
+TypeTag PackratParser::popType()
+{
+    if (typeStack.empty()) {
+        return TypeTag::Any; // e.g. after a parse error or `nil`
+    }
+    TypeTag tag = typeStack.back();
+    typeStack.pop_back();
+    return tag;
+}
+
+TypeTag PackratParser::tagOf(const TypePtr &type)
+{
+    return type ? type->tag : TypeTag::Any;
+}
+
 void PackratParser::declareVariable(const Token &name,
                                     const TypePtr &type,
                                     std::optional<ValuePtr> defaultValue)
@@ -993,3 +1159,8 @@ std::vector<Instruction> PackratParser::getBytecode() const
 {
     return bytecode;
 }
+
+const ConstantPool &PackratParser::getConstants() const
+{
+    return constants;
+}
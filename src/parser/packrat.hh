@@ -1,10 +1,12 @@
 #pragma once
 
+#include "../constants.hh"
 #include "../instructions.hh"
 #include "../scanner.hh"
 #include "../types.hh"
 #include "../variable.hh"
 #include "algorithm.hh"
+#include "specialize.hh"
 #include <any>
 #include <array>
 #include <cstdint>
@@ -29,18 +31,32 @@ public:
     Bytecode parse() override;
     std::string toString() const override;
     std::vector<Instruction> getBytecode() const override;
+    const ConstantPool &getConstants() const override;
+    bool failed() const override { return hadError; }
 
 private:
     std::vector<Token> tokens;
     size_t pos;
     bool hadError = false;
     Bytecode bytecode;
+    ConstantPool constants;
     Scanner &scanner;
     Variables variable;
     std::shared_ptr<TypeSystem> typeSystem;
 
+    // Static types of the values the expression being parsed has left on the stack
+    std::vector<TypeTag> typeStack;
+    std::unordered_map<std::string, TypeTag> functionReturnTypes;
+    TypeTag currentReturnType = TypeTag::Any;
+
     Instruction emit(Opcode opcode, uint32_t lineNumber);
     Instruction emit(Opcode opcode, uint32_t lineNumber, Value &&value);
+    void emitTyped(Opcode opcode, size_t rightStart);
+    void emitConversion(TypeTag from, TypeTag to);
+    void dropForwardCallConversions();
+    void pushType(TypeTag tag);
+    TypeTag popType();
+    static TypeTag tagOf(const TypePtr &type);
 
     void declareVariable(const Token &name,
                          const TypePtr &type,
@@ -65,7 +81,8 @@ private:
     void handle_identifier();
     void var_declaration();
     void var_call(const Token &name);
-    void assignment();
+    // The increment clause of a for loop ends its assignment with ')' instead of ';'
+    void assignment(TokenType terminator = TokenType::SEMICOLON);
     void function_declaration();
     void function_call(const Token &name);
     void class_declaration();
@@ -277,6 +277,7 @@ bool PrattParser::isExpression(TokenType type)
 void PrattParser::error(const std::string &message)
 {
     hadError = true;
+    reportedError = true;
     Debugger::error(message, peek(), InterpretationStage::PARSING, scanner.getSource());
 }
 
@@ -411,6 +412,11 @@ Instruction PrattParser::emit(Opcode opcode, uint32_t lineNumber)
 
 Instruction PrattParser::emit(Opcode opcode, uint32_t lineNumber, Value &&value)
 {
+    // Literals go to the constant pool; the instruction only carries their index
+    if (opcode == Opcode::LOAD_CONST || opcode == Opcode::LOAD_STR || opcode == Opcode::BOOLEAN) {
+        int32_t slot = constants.add(std::move(value));
+        value = Value{std::make_shared<Type>(TypeTag::Int32), slot};
+    }
     ValuePtr valuePtr = std::make_shared<Value>(std::move(value));
     Instruction instruction(opcode, lineNumber, valuePtr);
     instruction.debug();
@@ -418,6 +424,51 @@ Instruction PrattParser::emit(Opcode opcode, uint32_t lineNumber, Value &&value)
     return instruction;
 }
 
+void PrattParser::emitTyped(Opcode opcode, size_t rightStart, uint32_t lineNumber)
+{
+    TypeTag right = popType();
+    TypeTag left = popType();
+    TypeTag operands = commonOperandType(left, right);
+    Opcode typed = specializedOpcode(opcode, operands);
+
+    if (typed != opcode) {
+        // The left operand ends where the right one starts
+        Opcode leftConversion = conversionOpcode(left, operands);
+        if (leftConversion != Opcode::NOP) {
+            Instruction conversion(leftConversion, lineNumber);
+            conversion.debug();
+            bytecode.insert(bytecode.begin() + rightStart, conversion);
+        }
+        emitConversion(right, operands, lineNumber);
+    }
+
+    emit(typed, lineNumber);
+    pushType(resultType(opcode, operands));
+}
+
+void PrattParser::emitConversion(TypeTag from, TypeTag to, uint32_t lineNumber)
+{
+    Opcode conversion = conversionOpcode(from, to);
+    if (conversion != Opcode::NOP) {
+        emit(conversion, lineNumber);
+    }
+}
+
+void PrattParser::pushType(TypeTag tag)
+{
+    typeStack.push_back(tag);
+}
+
+TypeTag PrattParser::popType()
+{
+    if (typeStack.empty()) {
+        return TypeTag::Any;
+    }
+    TypeTag tag = typeStack.back();
+    typeStack.pop_back();
+    return tag;
+}
+
 void PrattParser::parsePrimary()
 {
     TokenType tokenType = peek().type;
@@ -471,6 +522,7 @@ void PrattParser::parseDeclaration()
 
 void PrattParser::parseStatement()
 {
+    typeStack.clear(); // nothing is pending between statements
     if (check(TokenType::PRINT)) {
         parsePrintStatement();
     } else if (check(TokenType::LEFT_BRACE)) {
@@ -510,10 +562,14 @@ void PrattParser::parseUnary()
     Token op = previous();
     advance(); // Consume the unary operator
     parsePrecedence(PREC_UNARY);
+    TypeTag operandType = popType();
     if (op.type == TokenType::MINUS) {
-        emit(Opcode::NEGATE, op.line);
+        TypeTag operands = commonOperandType(operandType, operandType);
+        emit(specializedOpcode(Opcode::NEGATE, operands), op.line);
+        pushType(resultType(Opcode::NEGATE, operands));
     } else if (op.type == TokenType::BANG) {
         emit(Opcode::NOT, op.line);
+        pushType(TypeTag::Bool);
     }
 }
 
@@ -527,28 +583,30 @@ void PrattParser::parseBoolean()
     } else {
         error("Unexpected boolean value");
     }
+    pushType(TypeTag::Bool);
 }
 
 void PrattParser::parseBinary()
 {
     Token op = previous();
     Precedence precedence = getTokenPrecedence(op.type);
+    size_t rightStart = bytecode.size();
     parsePrecedence(static_cast<Precedence>(precedence + 1));
     switch (op.type) {
     case TokenType::PLUS:
-        emit(Opcode::ADD, op.line);
+        emitTyped(Opcode::ADD, rightStart, op.line);
         break;
     case TokenType::MINUS:
-        emit(Opcode::SUBTRACT, op.line);
+        emitTyped(Opcode::SUBTRACT, rightStart, op.line);
         break;
     case TokenType::STAR:
-        emit(Opcode::MULTIPLY, op.line);
+        emitTyped(Opcode::MULTIPLY, rightStart, op.line);
         break;
     case TokenType::SLASH:
-        emit(Opcode::DIVIDE, op.line);
+        emitTyped(Opcode::DIVIDE, rightStart, op.line);
         break;
     case TokenType::MODULUS:
-        emit(Opcode::MODULUS, op.line);
+        emitTyped(Opcode::MODULUS, rightStart, op.line);
         break;
     default:
         error("Unexpected binary operator");
@@ -563,6 +621,7 @@ void PrattParser::parseLiteral()
     case TokenType::NUMBER: {
         Value value = setValue(typePtr, token.lexeme);
         emit(Opcode::LOAD_CONST, token.line, std::move(value));
+        pushType(typePtr->tag);
     } break;
     case TokenType::STRING:
         parseString();
@@ -582,8 +641,10 @@ void PrattParser::parseString()
     if (!isInterpolated) {
         // Regular string, just emit a LOAD_CONST
         emit(Opcode::LOAD_STR, previous().line, setValue(typePtr, str));
+        pushType(TypeTag::String);
         return;
     }
+    size_t typeDepth = typeStack.size();
     std::string current;
     bool inExpression = false;
     int bracketCount = 0;
@@ -633,6 +694,8 @@ void PrattParser::parseString()
     emit(Opcode::INTERPOLATE_STRING,
          previous().line,
          Value{std::make_shared<Type>(TypeTag::Int), partCount});
+    typeStack.resize(typeDepth); // the interpolated parts are consumed
+    pushType(TypeTag::String);
 }
 
 void PrattParser::parseIdentifier()
@@ -658,8 +721,10 @@ void PrattParser::parseDecVariable()
     // consume(TokenType::VAR, "Expected 'var' before variable name");
     Token name = peek();
     TypeTag type = TypeTag::Any;
+    bool annotated = false;
     consume(TokenType::IDENTIFIER, "Expected variable name after 'var' token");
     if (check(TokenType::COLON)) {
+        annotated = true;
         consume(TokenType::COLON, "Expected ':' after variable name");
         Token typeToken = peek();
         type = stringToType(typeToken.lexeme);
@@ -669,6 +734,10 @@ void PrattParser::parseDecVariable()
     }
     consume(TokenType::EQUAL, "Expected '=' after type");
     parseExpression();
+    TypeTag valueType = popType();
+    if (!annotated) {
+        type = valueType; // an unannotated variable takes the type of its initializer
+    }
     // Check if the next token is a semicolon
     if (match(TokenType::SEMICOLON)) {
         // If it is, consume the semicolon without emitting any opcodes
@@ -678,6 +747,7 @@ void PrattParser::parseDecVariable()
     // Value value{std::make_shared<Type>(inferType())
     declareVariable(name, std::make_shared<Type>(type));
     int32_t memoryLocation = getVariableMemoryLocation(name);
+    emitConversion(valueType, type, name.line);
     emit(Opcode::STORE_VARIABLE,
          name.line,
          Value{std::make_shared<Type>(TypeTag::Int), memoryLocation});
@@ -697,6 +767,8 @@ void PrattParser::parseLoadVariable()
     emit(Opcode::LOAD_VARIABLE,
          name.line,
          Value{std::make_shared<Type>(TypeTag::Int), memoryLocation});
+    TypePtr type = variable.getVariableType(name.lexeme);
+    pushType(type ? type->tag : TypeTag::Any);
 }
 
 void PrattParser::parseBlock()
@@ -738,6 +810,8 @@ void PrattParser::parseAssignment()
 
     // Get the memory location of the variable (assumes variable is now declared)
     int32_t memoryLocation = variable.getVariableMemoryLocation(varName);
+    TypePtr type = variable.getVariableType(varName);
+    emitConversion(popType(), type ? type->tag : TypeTag::Any, token.line);
     emit(Opcode::STORE_VARIABLE,
          token.line,
          Value{std::make_shared<Type>(TypeTag::Int), memoryLocation});
@@ -746,15 +820,17 @@ void PrattParser::parseAssignment()
 void PrattParser::parseAnd()
 {
     Token op = previous();
+    size_t rightStart = bytecode.size();
     parsePrecedence(static_cast<Precedence>(PREC_AND + 1));
-    emit(Opcode::AND, op.line);
+    emitTyped(Opcode::AND, rightStart, op.line);
 }
 
 void PrattParser::parseOr()
 {
     Token op = previous();
+    size_t rightStart = bytecode.size();
     parsePrecedence(static_cast<Precedence>(PREC_OR + 1));
-    emit(Opcode::OR, op.line);
+    emitTyped(Opcode::OR, rightStart, op.line);
 }
 
 void PrattParser::parseLogical()
@@ -771,26 +847,27 @@ void PrattParser::parseComparison()
     Token op = previous(); //change and or and comparison to previous
     Precedence precedence = getTokenPrecedence(op.type);
 
+    size_t rightStart = bytecode.size();
     parsePrecedence(static_cast<Precedence>(precedence + 1));
 
     switch (op.type) {
     case TokenType::EQUAL_EQUAL:
-        emit(Opcode::EQUAL, op.line);
+        emitTyped(Opcode::EQUAL, rightStart, op.line);
         break;
     case TokenType::BANG_EQUAL:
-        emit(Opcode::NOT_EQUAL, op.line);
+        emitTyped(Opcode::NOT_EQUAL, rightStart, op.line);
         break;
     case TokenType::LESS:
-        emit(Opcode::LESS_THAN, op.line);
+        emitTyped(Opcode::LESS_THAN, rightStart, op.line);
         break;
     case TokenType::LESS_EQUAL:
-        emit(Opcode::LESS_THAN_OR_EQUAL, op.line);
+        emitTyped(Opcode::LESS_THAN_OR_EQUAL, rightStart, op.line);
         break;
     case TokenType::GREATER:
-        emit(Opcode::GREATER_THAN, op.line);
+        emitTyped(Opcode::GREATER_THAN, rightStart, op.line);
         break;
     case TokenType::GREATER_EQUAL:
-        emit(Opcode::GREATER_THAN_OR_EQUAL, op.line);
+        emitTyped(Opcode::GREATER_THAN_OR_EQUAL, rightStart, op.line);
         break;
     default:
         error("Unexpected comparison operator");
@@ -1184,3 +1261,8 @@ std::vector<Instruction> PrattParser::getBytecode() const
     // Get the generated bytecode
     return bytecode;
 }
+
+const ConstantPool &PrattParser::getConstants() const
+{
+    return constants;
+}
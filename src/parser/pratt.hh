@@ -1,9 +1,11 @@
 //parser.hh
+#include "../constants.hh"
 #include "../instructions.hh"
 #include "../precedence.hh"
 #include "../scanner.hh"
 #include "../types.hh"
 #include "../variable.hh"
+#include "specialize.hh"
 #include <any>
 #include <cstdint>
 #include <functional>
@@ -34,13 +36,17 @@ public:
     Bytecode parse();
     std::string toString() const;                 //debug the parser
     std::vector<Instruction> getBytecode() const; //get the bytecode generated from the parser
+    const ConstantPool &getConstants() const;     //literal operands referenced by LOAD_CONST
+    bool failed() const { return reportedError; }         //whether parse() reported an error
 
 private:
     std::vector<size_t> endJumps;
     std::vector<Token> tokens;
-    bool hadError = false;
+    bool hadError = false;      // since the last synchronize()
+    bool reportedError = false; // during the whole parse
     size_t current = 0;                // get the current index position
     std::vector<Instruction> bytecode; // Declare bytecode as a local variable
+    ConstantPool constants;            // Deduplicated literals, indexed by LOAD_CONST
     bool isNewExpression = true;
     // Scanner instance
     Scanner &scanner;
@@ -56,6 +62,9 @@ private:
     Token currentToken;
     Token previousToken;
 
+    // Static types of the values the current expression has left on the stack
+    std::vector<TypeTag> typeStack;
+
     // Pratt parsing functions (adapt from first parser or rewrite)
     void parsePrintStatement();      // print(), or debug() statements
     void parseIfStatement();         // if, elif , else statement
@@ -92,6 +101,10 @@ private:
 
     Instruction emit(Opcode opcode, uint32_t lineNumber);
     Instruction emit(Opcode opcode, uint32_t lineNumber, Value &&value);
+    void emitTyped(Opcode opcode, size_t rightStart, uint32_t lineNumber);
+    void emitConversion(TypeTag from, TypeTag to, uint32_t lineNumber);
+    void pushType(TypeTag tag);
+    TypeTag popType();
 
     // Parse expression functions
     void parsePrimary();
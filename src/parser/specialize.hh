@@ -0,0 +1,140 @@
+#pragma once
+#ifndef SPECIALIZE_HH
+#define SPECIALIZE_HH
+
+#include "../opcodes.hh"
+#include "../types.hh"
+
+// Static typing helpers shared by the parsers. While emitting an expression the parsers
+// track the type of every value it leaves on the stack and use these to pick the typed
+// opcode for an operation. The backends represent every integer type as int64 and every
+// float type as double, so Int64, Float64, String and Bool are the only categories that
+// matter here; everything else is Any.
+
+inline bool isIntegerType(TypeTag tag)
+{
+    switch (tag) {
+    case TypeTag::Int:
+    case TypeTag::Int8:
+    case TypeTag::Int16:
+    case TypeTag::Int32:
+    case TypeTag::Int64:
+    case TypeTag::UInt:
+    case TypeTag::UInt8:
+    case TypeTag::UInt16:
+    case TypeTag::UInt32:
+    case TypeTag::UInt64:
+        return true;
+    default:
+        return false;
+    }
+}
+
+inline bool isFloatType(TypeTag tag)
+{
+    return tag == TypeTag::Float32 || tag == TypeTag::Float64;
+}
+
+// Category both operands of a binary operation are brought to, Any if there is none.
+inline TypeTag commonOperandType(TypeTag left, TypeTag right)
+{
+    if (isIntegerType(left) && isIntegerType(right)) {
+        return TypeTag::Int64;
+    }
+    if ((isIntegerType(left) || isFloatType(left)) && (isIntegerType(right) || isFloatType(right))) {
+        return TypeTag::Float64;
+    }
+    if (left == TypeTag::String && right == TypeTag::String) {
+        return TypeTag::String;
+    }
+    if (left == TypeTag::Bool && right == TypeTag::Bool) {
+        return TypeTag::Bool;
+    }
+    return TypeTag::Any;
+}
+
+// Typed form of a generic arithmetic, comparison or negation opcode for operands of the
+// given category; the generic opcode itself when there is none.
+inline Opcode specializedOpcode(Opcode opcode, TypeTag operands)
+{
+    if (operands == TypeTag::Int64) {
+        switch (opcode) {
+        case ADD: return ADD_I64;
+        case SUBTRACT: return SUB_I64;
+        case MULTIPLY: return MUL_I64;
+        case DIVIDE: return DIV_I64;
+        case MODULUS: return MOD_I64;
+        case NEGATE: return NEG_I64;
+        case EQUAL: return EQ_I64;
+        case NOT_EQUAL: return NE_I64;
+        case LESS_THAN: return LT_I64;
+        case LESS_THAN_OR_EQUAL: return LE_I64;
+        case GREATER_THAN: return GT_I64;
+        case GREATER_THAN_OR_EQUAL: return GE_I64;
+        default: return opcode;
+        }
+    }
+    if (operands == TypeTag::Float64) {
+        switch (opcode) {
+        case ADD: return ADD_F64;
+        case SUBTRACT: return SUB_F64;
+        case MULTIPLY: return MUL_F64;
+        case DIVIDE: return DIV_F64;
+        case MODULUS: return MOD_F64;
+        case NEGATE: return NEG_F64;
+        case EQUAL: return EQ_F64;
+        case NOT_EQUAL: return NE_F64;
+        case LESS_THAN: return LT_F64;
+        case LESS_THAN_OR_EQUAL: return LE_F64;
+        case GREATER_THAN: return GT_F64;
+        case GREATER_THAN_OR_EQUAL: return GE_F64;
+        default: return opcode;
+        }
+    }
+    if (operands == TypeTag::String) {
+        switch (opcode) {
+        case ADD: return CONCATENATE_STR;
+        case EQUAL: return EQ_STR;
+        case NOT_EQUAL: return NE_STR;
+        default: return opcode;
+        }
+    }
+    return opcode;
+}
+
+// Static type of the value a generic opcode produces from operands of the given category.
+inline TypeTag resultType(Opcode opcode, TypeTag operands)
+{
+    switch (opcode) {
+    case EQUAL:
+    case NOT_EQUAL:
+    case LESS_THAN:
+    case LESS_THAN_OR_EQUAL:
+    case GREATER_THAN:
+    case GREATER_THAN_OR_EQUAL:
+    case AND:
+    case OR:
+    case NOT:
+        return TypeTag::Bool;
+    default:
+        return specializedOpcode(opcode, operands) != opcode ? operands : TypeTag::Any;
+    }
+}
+
+// Conversion that makes a value of type `from` usable where `to` is expected, NOP if the
+// representation already matches. Values of unknown type are converted defensively.
+inline Opcode conversionOpcode(TypeTag from, TypeTag to)
+{
+    if (from != TypeTag::Any && !isIntegerType(from) && !isFloatType(from)) {
+        return NOP; // not a number at all; nothing sensible to convert
+    }
+    if (isFloatType(to) && !isFloatType(from)) {
+        return TO_FLOAT64;
+    }
+    if (isIntegerType(to) && !isIntegerType(from)) {
+        return TO_INT64;
+    }
+    return NOP;
+}
+
+#endif // SPECIALIZE_HH
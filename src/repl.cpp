@@ -1,14 +1,26 @@
 #include "repl.hh"
+#include "backends/fusion.hh"
+#include "backends/ssa.hh"
+#include "backends/verifier.hh"
+#include "logger.hh"
 #include "parser/packrat.hh"
+#include <algorithm>
 #include <chrono>
 #include <filesystem>
 #include <fstream>
 #include <iostream>
+#include <sstream>
 #include <string>
 #include <variant>
 
+std::string REPL::backendName = "stack";
+bool REPL::bytecodeCache = true;
+bool REPL::optimizing = true;
+bool REPL::verifying = true;
+size_t REPL::inlineBudget = DEFAULT_INLINE_BUDGET;
+
 REPL::REPL(std::unique_ptr<Algorithm> parser)
-    : backend(std::make_unique<StackBackend>(bytecode))
+    : backend(std::make_unique<StackBackend>(bytecode, constants))
     , vm(nullptr)
     , parser(std::move(parser))
 {}
@@ -22,7 +34,9 @@ void REPL::start(const std::string &filename = "test.lm")
         std::string filePath = std::filesystem::absolute(filename).string();
         if (!fileContent.empty()) {
             std::cout << "Interpreting file: " << filename << std::endl;
-            run(fileContent, filename, filePath);
+            if (!runCompiled(fileContent, filePath)) {
+                run(fileContent, filename, filePath);
+            }
         } else {
             std::cerr << "Error: Unable to read file or file is empty." << std::endl;
         }
@@ -57,8 +71,13 @@ void REPL::run(std::string input, const std::string &filename = "", const std::s
     parser->parse();
     // debug(scanner, *parser);
     std::vector<Instruction> bytecode = parser->getBytecode();
-    auto backend = std::make_unique<StackBackend>(bytecode); // passing by value
-    VM vm(*parser, std::move(backend));
+    ConstantPool constants = parser->getConstants();
+    optimize(bytecode, constants);
+    // A script with syntax errors is parsed again next time, so they are reported again
+    if (!filepath.empty() && !parser->failed()) {
+        writeCompiled(input, filepath, bytecode, constants);
+    }
+    VM vm(*parser, makeBackend(bytecode, constants, backendName), bytecode);
 
     try {
         vm.run();
@@ -81,7 +100,9 @@ void REPL::startDevMode(const std::string &filename = "")
         std::string filePath = std::filesystem::absolute(filename).string();
         if (!fileContent.empty()) {
             std::cout << "Interpreting file: " << filename << std::endl;
-            run(fileContent, filename, filePath);
+            if (!runCompiled(fileContent, filePath)) {
+                run(fileContent, filename, filePath);
+            }
         } else {
             std::cerr << "Error: Unable to read file or file is empty." << std::endl;
         }
@@ -104,6 +125,416 @@ void REPL::startDevMode(const std::string &filename = "")
     }
 }
 
+void REPL::optimize(std::vector<Instruction> &bytecode, ConstantPool &constants)
+{
+    if (!optimizing) {
+        return;
+    }
+    try {
+        optimizeBytecode(bytecode, constants, inlineBudget).print(std::cout);
+    } catch (const std::exception &e) {
+        std::cerr << "Error: Cannot optimize: " << e.what() << std::endl;
+    }
+}
+
+// The cache holds programs optimized with the default settings only
+bool REPL::caching()
+{
+    return bytecodeCache && optimizing && inlineBudget == DEFAULT_INLINE_BUDGET;
+}
+
+// Runs the .lmc next to the script when it was compiled from this very source
+bool REPL::runCompiled(const std::string &source, const std::string &filepath)
+{
+    if (!caching()) {
+        return false;
+    }
+    std::string path = BytecodeFile::pathFor(filepath);
+    std::optional<DecodedProgram> program = BytecodeFile::load(path,
+                                                               BytecodeFile::hashSource(source));
+    if (!program) {
+        return false;
+    }
+    std::cout << "Loaded compiled bytecode from " << path << std::endl;
+    std::vector<Instruction> bytecode;
+    ConstantPool constants;
+    std::unique_ptr<Backend> backend = makeBackend(bytecode, constants, backendName);
+    try {
+        backend->run(*program);
+        backend->dumpRegisters();
+    } catch (const std::exception &e) {
+        std::cerr << " Repl Error: " << e.what() << std::endl;
+    }
+    return true;
+}
+
+void REPL::writeCompiled(const std::string &source, const std::string &filepath,
+                         const std::vector<Instruction> &bytecode, const ConstantPool &constants)
+{
+    if (!caching()) {
+        return;
+    }
+    try {
+        BytecodeFile::write(BytecodeFile::pathFor(filepath),
+                            DecodedProgram::decode(bytecode, constants.values()),
+                            BytecodeFile::hashSource(source));
+    } catch (const std::exception &) {
+        // Programs that do not decode are reported when they run
+    }
+}
+
+bool REPL::setBackend(const std::string &name)
+{
+    if (name != "stack" && name != "register" && name != "jit") {
+        std::cerr << "Error: Unknown backend '" << name << "'. Use 'stack', 'register' or 'jit'."
+                  << std::endl;
+        return false;
+    }
+    backendName = name;
+    return true;
+}
+
+bool REPL::setLogLevel(const std::string &name)
+{
+    LogLevel level;
+    if (!Logger::parseLevel(name, level)) {
+        std::cerr << "Error: Unknown log level '" << name
+                  << "'. Use 'debug', 'info', 'warning', 'error' or 'off'." << std::endl;
+        return false;
+    }
+    Logger::memory().setLevel(level);
+    return true;
+}
+
+std::unique_ptr<Backend> REPL::makeBackend(std::vector<Instruction> &bytecode,
+                                           const ConstantPool &constants,
+                                           const std::string &name)
+{
+    if (name == "register") {
+        return std::make_unique<RegisterBackend>(bytecode, constants);
+    }
+    if (name == "jit") {
+        return std::make_unique<JitBackend>(bytecode, constants);
+    }
+    auto backend = std::make_unique<StackBackend>(bytecode, constants);
+    backend->setVerifying(verifying);
+    return backend;
+}
+
+void REPL::census(const std::vector<std::string> &filenames)
+{
+    OpcodeCensus census;
+    for (const auto &filename : filenames) {
+        std::string fileContent = readFile(filename);
+        if (fileContent.empty()) {
+            std::cerr << "Error: Unable to read file or file is empty: " << filename << std::endl;
+            continue;
+        }
+        Scanner scanner(fileContent, filename, std::filesystem::absolute(filename).string());
+        PackratParser parser(scanner, std::make_shared<TypeSystem>());
+        parser.parse();
+        census.add(DecodedProgram::decode(parser.getBytecode(), parser.getConstants().values()));
+    }
+    census.report(std::cout);
+}
+
+void REPL::printIR(const std::vector<std::string> &filenames)
+{
+    for (const auto &filename : filenames) {
+        std::string fileContent = readFile(filename);
+        if (fileContent.empty()) {
+            std::cerr << "Error: Unable to read file or file is empty: " << filename << std::endl;
+            continue;
+        }
+        Scanner scanner(fileContent, filename, std::filesystem::absolute(filename).string());
+        PackratParser parser(scanner, std::make_shared<TypeSystem>());
+        parser.parse();
+        std::vector<Instruction> program = parser.getBytecode();
+        ConstantPool constants = parser.getConstants();
+        optimize(program, constants);
+        std::cout << "; " << filename << std::endl;
+        try {
+            SSAProgram ssa = SSAProgram::build(program, constants);
+            ssa.print(std::cout);
+            std::vector<std::string> problems = ssa.verify();
+            for (const auto &problem : problems) {
+                std::cout << "; error: " << problem << std::endl;
+            }
+            if (problems.empty()) {
+                std::cout << "; verified" << std::endl;
+            }
+        } catch (const std::runtime_error &e) {
+            std::cerr << "Error: No SSA form for " << filename << ": " << e.what() << std::endl;
+        }
+    }
+}
+
+void REPL::printVerification(const std::vector<std::string> &filenames)
+{
+    for (const auto &filename : filenames) {
+        std::string fileContent = readFile(filename);
+        if (fileContent.empty()) {
+            std::cerr << "Error: Unable to read file or file is empty: " << filename << std::endl;
+            continue;
+        }
+        Scanner scanner(fileContent, filename, std::filesystem::absolute(filename).string());
+        PackratParser parser(scanner, std::make_shared<TypeSystem>());
+        parser.parse();
+        std::vector<Instruction> program = parser.getBytecode();
+        ConstantPool constants = parser.getConstants();
+        optimize(program, constants);
+        std::cout << "; " << filename << std::endl;
+        try {
+            DecodedProgram decoded = DecodedProgram::decode(program, constants.values());
+            ::printVerification(std::cout, decoded, verifyProgram(decoded));
+        } catch (const std::exception &e) {
+            std::cerr << "Error: Cannot decode " << filename << ": " << e.what() << std::endl;
+        }
+    }
+}
+
+bool REPL::build(const std::string &filename, const std::string &output, const std::string &target)
+{
+    if (target != "c" && target != "asm") {
+        std::cerr << "Error: Unknown build backend '" << target << "'. Use 'c' or 'asm'."
+                  << std::endl;
+        return false;
+    }
+    std::string fileContent = readFile(filename);
+    if (fileContent.empty()) {
+        std::cerr << "Error: Unable to read file or file is empty: " << filename << std::endl;
+        return false;
+    }
+    Scanner scanner(fileContent, filename, std::filesystem::absolute(filename).string());
+    PackratParser parser(scanner, std::make_shared<TypeSystem>());
+    parser.parse();
+    std::vector<Instruction> bytecode = parser.getBytecode();
+    ConstantPool constants = parser.getConstants();
+    optimize(bytecode, constants);
+    bool succeeded = false;
+    if (target == "asm") {
+        YASMBackend assembly(bytecode, constants, output);
+        assembly.run(bytecode);
+        if ((succeeded = assembly.succeeded())) {
+            assembly.dumpRegisters();
+        }
+    } else {
+        CodegenBackend codegen(bytecode, constants, output);
+        codegen.run(bytecode);
+        if ((succeeded = codegen.succeeded())) {
+            codegen.dumpRegisters();
+        }
+    }
+    return succeeded;
+}
+
+namespace {
+
+// Everything a run printed but the report the VMs add after the program (timings, the
+// StackBackend teardown and the memory manager's statistics), which the executables do not
+// print; the part of the output every run must agree on
+std::vector<std::string> programOutput(const std::string &output)
+{
+    static const char *const report[] = {"VM Execution completed in ", "VM ran for a total of ",
+                                         "Starting StackBackend destruction",
+                                         "StackBackend destruction complete", "Clearing stack"};
+    std::vector<std::string> lines;
+    std::istringstream in(output);
+    std::string line;
+    bool statistics = false; // between the rules of ======= around the memory statistics
+    while (std::getline(in, line)) {
+        if (!line.empty() && line.find_first_not_of('=') == std::string::npos) {
+            statistics = !statistics;
+            continue;
+        }
+        bool reported = std::any_of(std::begin(report), std::end(report),
+                                    [&](const char *prefix) { return line.rfind(prefix, 0) == 0; });
+        if (!statistics && !reported) {
+            lines.push_back(line);
+        }
+    }
+    return lines;
+}
+
+// Everything `run` prints to std::cout and std::cerr; an exception it throws ends the
+// output with an "Error: " line, like the VMs report errors.
+template<typename Run>
+std::string captureOutput(Run &&run)
+{
+    std::ostringstream captured;
+    std::streambuf *out = std::cout.rdbuf(captured.rdbuf());
+    std::streambuf *err = std::cerr.rdbuf(captured.rdbuf());
+    try {
+        run();
+    } catch (const std::exception &e) {
+        std::string printed = captured.str();
+        captured << (printed.empty() || printed.back() == '\n' ? "" : "\n") << "Error: "
+                 << e.what() << "\n";
+    }
+    std::cout.rdbuf(out);
+    std::cerr.rdbuf(err);
+    return captured.str();
+}
+
+std::string runExecutable(const std::string &executable)
+{
+    std::string output;
+    if (FILE *pipe = popen(("'" + executable + "' 2>&1").c_str(), "r")) {
+        char buffer[4096];
+        size_t n;
+        while ((n = fread(buffer, 1, sizeof buffer, pipe)) > 0) {
+            output.append(buffer, n);
+        }
+        pclose(pipe);
+    }
+    return output;
+}
+
+} // namespace
+
+bool REPL::conformance(const std::vector<std::string> &filenames)
+{
+    size_t failures = 0;
+    for (const auto &filename : filenames) {
+        const std::filesystem::path temporary = std::filesystem::temp_directory_path()
+                                                / ("luminar_conform_"
+                                                   + std::filesystem::path(filename).stem().string());
+
+        // What each way of running the script printed, the reference first
+        std::vector<std::pair<std::string, std::vector<std::string>>> runs;
+        std::string expectedPath = std::filesystem::path(filename).replace_extension(".out").string();
+        if (std::filesystem::exists(expectedPath)) {
+            runs.emplace_back(expectedPath, programOutput(readFile(expectedPath)));
+        }
+
+        std::string fileContent;
+        std::unique_ptr<PackratParser> parser;
+        std::vector<Instruction> optimized;
+        ConstantPool constants;
+        std::string parsed = captureOutput([&] {
+            fileContent = readFile(filename);
+            Scanner scanner(fileContent, filename, std::filesystem::absolute(filename).string());
+            parser = std::make_unique<PackratParser>(scanner, std::make_shared<TypeSystem>());
+            parser->parse();
+            optimized = parser->getBytecode();
+            constants = parser->getConstants();
+            optimize(optimized, constants);
+        });
+        // A script may have syntax errors when file.out says what the rest of it prints
+        bool syntaxErrors = parser && parser->failed();
+        if (!parser || ("\n" + parsed).find("\nError: ") != std::string::npos
+            || (syntaxErrors && runs.empty())) {
+            std::cout << "FAIL " << filename << ": it does not compile" << std::endl;
+            ++failures;
+            continue;
+        }
+        // and then REPL::run must not cache it, so that the next run reports them again
+        if (syntaxErrors) {
+            std::string scriptPath = temporary.string() + ".lm";
+            captureOutput([&] { run(fileContent, filename, scriptPath); });
+            std::string cached = BytecodeFile::pathFor(scriptPath);
+            if (std::filesystem::remove(cached)) {
+                std::cout << "FAIL " << filename << ": its syntax errors were cached in " << cached
+                          << std::endl;
+                ++failures;
+                continue;
+            }
+        }
+
+        // The stack VM on the parser's own bytecode, then every backend on the optimized one
+        runs.emplace_back("stack VM", programOutput(captureOutput([&] {
+                              std::vector<Instruction> bytecode = parser->getBytecode();
+                              VM vm(*parser,
+                                    std::make_unique<StackBackend>(bytecode,
+                                                                   parser->getConstants()));
+                              vm.run();
+                          })));
+        for (const char *name : {"stack", "register", "jit"}) {
+            runs.emplace_back(std::string("optimized ") + name + " VM",
+                              programOutput(captureOutput([&] {
+                                  std::vector<Instruction> bytecode = optimized;
+                                  VM vm(*parser, makeBackend(bytecode, constants, name), bytecode);
+                                  vm.run();
+                              })));
+        }
+
+        // Through a .lmc file and back
+        std::string cachePath = temporary.string() + ".lmc";
+        runs.emplace_back("cached stack VM", programOutput(captureOutput([&] {
+                              uint64_t hash = BytecodeFile::hashSource(fileContent);
+                              if (!BytecodeFile::write(cachePath,
+                                                       DecodedProgram::decode(optimized,
+                                                                              constants.values()),
+                                                       hash)) {
+                                  throw std::runtime_error("cannot write " + cachePath);
+                              }
+                              std::optional<DecodedProgram> program = BytecodeFile::load(cachePath,
+                                                                                         hash);
+                              if (!program) {
+                                  throw std::runtime_error("cannot load " + cachePath);
+                              }
+                              std::vector<Instruction> bytecode;
+                              ConstantPool none;
+                              makeBackend(bytecode, none, "stack")->run(*program);
+                          })));
+        std::filesystem::remove(cachePath);
+
+        // The executables `build linux` makes, through assembly and through C
+        for (const char *target : {"asm", "c"}) {
+            std::string executable = temporary.string() + "_" + target;
+            bool built = false;
+            captureOutput([&] {
+                std::vector<Instruction> bytecode = optimized;
+                if (std::string(target) == "asm") {
+                    YASMBackend assembly(bytecode, constants, executable);
+                    assembly.run(bytecode);
+                    built = assembly.succeeded();
+                } else {
+                    CodegenBackend codegen(bytecode, constants, executable);
+                    codegen.run(bytecode);
+                    built = codegen.succeeded();
+                }
+            });
+            std::vector<std::string> lines{"<" + std::string(target) + " build failed>"};
+            if (built) {
+                lines = programOutput(runExecutable(executable));
+            }
+            runs.emplace_back(std::string(target) + " executable", lines);
+            for (const char *suffix : {"", ".s", ".o", ".c"}) {
+                std::filesystem::remove(executable + suffix);
+            }
+        }
+
+        const auto &[referenceName, expected] = runs.front();
+        bool conforms = true;
+        for (size_t i = 1; i < runs.size(); ++i) {
+            const auto &[name, got] = runs[i];
+            size_t line = 0;
+            while (line < expected.size() && line < got.size() && expected[line] == got[line]) {
+                ++line;
+            }
+            if (line == expected.size() && line == got.size()) {
+                continue;
+            }
+            conforms = false;
+            std::cout << "FAIL " << filename << " at line " << line + 1 << ":\n"
+                      << "  " << referenceName << ": "
+                      << (line < expected.size() ? expected[line] : "<end>") << "\n"
+                      << "  " << name << ": " << (line < got.size() ? got[line] : "<end>")
+                      << std::endl;
+        }
+        if (conforms) {
+            std::cout << "PASS " << filename << " (" << expected.size() << " lines, "
+                      << runs.size() - 1 << " runs)" << std::endl;
+        } else {
+            ++failures;
+        }
+    }
+    std::cout << filenames.size() - failures << " of " << filenames.size()
+              << " programs conform." << std::endl;
+    return failures == 0;
+}
+
 std::string REPL::readInput()
 {
     std::cout << "$ ";
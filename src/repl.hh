@@ -13,6 +13,36 @@ public:
     static void start(const std::string &filename);
     static void run(std::string input, const std::string &filename, const std::string &filepath);
     static void startDevMode(const std::string &filename);
+    static void census(const std::vector<std::string> &filenames);
+    // Prints the SSA form of each script, optimized unless setOptimizing(false), and what
+    // SSAProgram::verify() finds wrong with it
+    static void printIR(const std::vector<std::string> &filenames);
+    // Prints what verifyProgram() proves about each script's decoded bytecode, optimized
+    // unless setOptimizing(false)
+    static void printVerification(const std::vector<std::string> &filenames);
+    // Compiles `filename` to the native executable `output`, through C with the "c" target
+    // (the default) or straight to x86-64 assembly with "asm"
+    static bool build(const std::string &filename, const std::string &output,
+                      const std::string &target = "c");
+    // Runs every script on the stack VM, on each VM after optimizeBytecode(), through a .lmc
+    // file and as the executables the asm and C build backends make, and checks that they
+    // all print the same; and what file.out lists next to file.lm, if there is one. A script
+    // with a file.out may have syntax errors, which run() must then not cache. Returns
+    // whether all of them agree.
+    static bool conformance(const std::vector<std::string> &filenames);
+    // Backend `run` executes programs with: "stack" (the default), "register" or "jit"
+    static bool setBackend(const std::string &name);
+    // Least severe level written to memory.log: "debug", "info" (the default), "warning",
+    // "error" or "off"
+    static bool setLogLevel(const std::string &name);
+    // Whether `run <file>` reuses and refreshes the compiled form next to the script (.lmc)
+    static void setBytecodeCache(bool enable) { bytecodeCache = enable; }
+    // Whether `run` and `build` pass the parser's bytecode through optimizeBytecode()
+    static void setOptimizing(bool enable) { optimizing = enable; }
+    // Whether the stack VM verifies programs at load and runs verified ones without checks
+    static void setVerifying(bool enable) { verifying = enable; }
+    // Largest function body the optimizer inlines, in instructions; 0 turns inlining off
+    static void setInlineBudget(size_t budget) { inlineBudget = budget; }
     static void setParser(std::unique_ptr<Algorithm> newParser);
 
 private:
@@ -20,7 +50,24 @@ private:
     std::unique_ptr<VM> vm;
     std::unique_ptr<Algorithm> parser;
     std::vector<Instruction> bytecode;
+    ConstantPool constants;
     static std::string readInput();
     static std::string readFile(const std::string& filename);
     static void debug(const Scanner &scanner, const Algorithm &parser);
+
+    static std::string backendName;
+    static bool bytecodeCache;
+    static bool optimizing;
+    static bool verifying;
+    static size_t inlineBudget;
+    static bool caching();
+    static void optimize(std::vector<Instruction> &bytecode, ConstantPool &constants);
+    static bool runCompiled(const std::string &source, const std::string &filepath);
+    static void writeCompiled(const std::string &source, const std::string &filepath,
+                              const std::vector<Instruction> &bytecode,
+                              const ConstantPool &constants);
+    // The VM called `name` ("stack", "register" or "jit") over `bytecode`
+    static std::unique_ptr<Backend> makeBackend(std::vector<Instruction> &bytecode,
+                                                const ConstantPool &constants,
+                                                const std::string &name);
 };
@@ -0,0 +1,414 @@
+#include "luminar_runtime.h"
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+int32_t lm_depth = 0;
+
+static void lm_error(const char *message)
+{
+    fflush(stdout); /* keep the order the interpreter prints in */
+    fprintf(stderr, "Error: %s\n", message);
+}
+
+static lm_string *lm_allocate_string(size_t length)
+{
+    lm_string *s = malloc(sizeof(lm_string) + length + 1);
+    if (s == NULL) {
+        fputs("Error: Out of memory\n", stderr);
+        exit(1);
+    }
+    s->length = length;
+    s->data[length] = '\0';
+    return s;
+}
+
+static lm_value lm_string_value(const lm_string *s)
+{
+    lm_value v = {LM_STRING, {.s = s}};
+    return v;
+}
+
+lm_value lm_string_literal(const char *data, size_t length)
+{
+    lm_string *s = lm_allocate_string(length);
+    memcpy(s->data, data, length);
+    return lm_string_value(s);
+}
+
+static lm_value lm_join(const char *a, size_t aLength, const char *b, size_t bLength,
+                        const char *c, size_t cLength)
+{
+    lm_string *s = lm_allocate_string(aLength + bLength + cLength);
+    memcpy(s->data, a, aLength);
+    memcpy(s->data + aLength, b, bLength);
+    memcpy(s->data + aLength + bLength, c, cLength);
+    return lm_string_value(s);
+}
+
+static bool lm_is_number(lm_value v)
+{
+    return v.tag == LM_INT || v.tag == LM_FLOAT;
+}
+
+static double lm_as_double(lm_value v)
+{
+    return v.tag == LM_INT ? (double) v.as.i : v.as.f;
+}
+
+lm_value lm_arith(int op, lm_value lhs, lm_value rhs)
+{
+    if (lhs.tag == LM_INT && rhs.tag == LM_INT) {
+        int64_t v1 = lhs.as.i;
+        int64_t v2 = rhs.as.i;
+        switch (op) {
+        case LM_ADD:
+            return lm_int(lm_add_i64(v1, v2));
+        case LM_SUB:
+            return lm_int(lm_sub_i64(v1, v2));
+        case LM_MUL:
+            return lm_int(lm_mul_i64(v1, v2));
+        case LM_DIV:
+            return lm_div_i64(v1, v2);
+        default:
+            return lm_mod_i64(v1, v2);
+        }
+    }
+    if (lm_is_number(lhs) && lm_is_number(rhs)) {
+        double v1 = lm_as_double(lhs);
+        double v2 = lm_as_double(rhs);
+        switch (op) {
+        case LM_ADD:
+            return lm_float(v1 + v2);
+        case LM_SUB:
+            return lm_float(v1 - v2);
+        case LM_MUL:
+            return lm_float(v1 * v2);
+        case LM_DIV:
+            if (v2 == 0.0) {
+                lm_error("Division by zero");
+                return lm_nil();
+            }
+            return lm_float(v1 / v2);
+        default:
+            return lm_float(fmod(v1, v2));
+        }
+    }
+    if (op == LM_ADD && lhs.tag == LM_STRING && rhs.tag == LM_STRING) {
+        return lm_join(lhs.as.s->data, lhs.as.s->length, rhs.as.s->data, rhs.as.s->length, "",
+                       0);
+    }
+    lm_error("Unsupported types for binary operation");
+    return lm_nil();
+}
+
+lm_value lm_div_i64(int64_t lhs, int64_t rhs)
+{
+    if (rhs == 0) {
+        lm_error("Division by zero");
+        return lm_nil();
+    }
+    return lm_int(lm_quot_i64(lhs, rhs));
+}
+
+lm_value lm_mod_i64(int64_t lhs, int64_t rhs)
+{
+    if (rhs == 0) {
+        lm_error("Modulo by zero");
+        return lm_nil();
+    }
+    return lm_int(lm_rem_i64(lhs, rhs));
+}
+
+lm_value lm_div_f64(double lhs, double rhs)
+{
+    if (rhs == 0.0) {
+        lm_error("Division by zero");
+        return lm_nil();
+    }
+    return lm_float(lhs / rhs);
+}
+
+static bool lm_ordered(int op, int order)
+{
+    switch (op) {
+    case LM_EQ:
+        return order == 0;
+    case LM_NE:
+        return order != 0;
+    case LM_LT:
+        return order < 0;
+    case LM_LE:
+        return order <= 0;
+    case LM_GT:
+        return order > 0;
+    default:
+        return order >= 0;
+    }
+}
+
+static bool lm_compare_double(int op, double v1, double v2)
+{
+    /* Not via lm_ordered: every ordered comparison with a NaN is false */
+    switch (op) {
+    case LM_EQ:
+        return v1 == v2;
+    case LM_NE:
+        return v1 != v2;
+    case LM_LT:
+        return v1 < v2;
+    case LM_LE:
+        return v1 <= v2;
+    case LM_GT:
+        return v1 > v2;
+    default:
+        return v1 >= v2;
+    }
+}
+
+bool lm_compare(int op, lm_value lhs, lm_value rhs)
+{
+    if (lhs.tag == LM_INT && rhs.tag == LM_INT) {
+        return lm_ordered(op, (lhs.as.i > rhs.as.i) - (lhs.as.i < rhs.as.i));
+    }
+    if (lm_is_number(lhs) && lm_is_number(rhs)) {
+        return lm_compare_double(op, lm_as_double(lhs), lm_as_double(rhs));
+    }
+    if (lhs.tag == LM_STRING && rhs.tag == LM_STRING) {
+        size_t l1 = lhs.as.s->length;
+        size_t l2 = rhs.as.s->length;
+        int order = memcmp(lhs.as.s->data, rhs.as.s->data, l1 < l2 ? l1 : l2);
+        if (order == 0) {
+            order = (l1 > l2) - (l1 < l2);
+        }
+        return lm_ordered(op, order);
+    }
+    if (lhs.tag == LM_BOOL && rhs.tag == LM_BOOL && (op == LM_EQ || op == LM_NE)) {
+        return (lhs.as.b == rhs.as.b) == (op == LM_EQ);
+    }
+    lm_error("Unsupported type for comparison operation");
+    return false;
+}
+
+lm_value lm_and(lm_value lhs, lm_value rhs)
+{
+    if (lhs.tag != LM_BOOL || rhs.tag != LM_BOOL) {
+        lm_error("Unsupported types for logical operation");
+        return lm_nil();
+    }
+    return lm_bool(lhs.as.b && rhs.as.b);
+}
+
+lm_value lm_or(lm_value lhs, lm_value rhs)
+{
+    if (lhs.tag != LM_BOOL || rhs.tag != LM_BOOL) {
+        lm_error("Unsupported types for logical operation");
+        return lm_nil();
+    }
+    return lm_bool(lhs.as.b || rhs.as.b);
+}
+
+lm_value lm_concat(lm_value lhs, lm_value rhs)
+{
+    /* A `str` can still hold anything via `any`, so this falls back to ADD */
+    return lm_arith(LM_ADD, lhs, rhs);
+}
+
+/* TaggedValue::toString(): what interpolation inserts, which is not what PRINT shows */
+static const char *lm_to_string(lm_value value, char *buffer, size_t size, size_t *length)
+{
+    switch (value.tag) {
+    case LM_BOOL:
+        *length = value.as.b ? 4 : 5;
+        return value.as.b ? "true" : "false";
+    case LM_INT:
+        *length = (size_t) snprintf(buffer, size, "%" PRId64, value.as.i);
+        return buffer;
+    case LM_FLOAT:
+        *length = (size_t) snprintf(buffer, size, "%f", value.as.f);
+        if (*length >= size) {
+            char *large = malloc(*length + 1); /* %f of a huge double; rare enough to leak */
+            snprintf(large, *length + 1, "%f", value.as.f);
+            return large;
+        }
+        return buffer;
+    case LM_STRING:
+        *length = value.as.s->length;
+        return value.as.s->data;
+    default:
+        *length = 4;
+        return "null";
+    }
+}
+
+lm_value lm_interpolate(lm_value templateValue, lm_value value)
+{
+    if (templateValue.tag != LM_STRING) {
+        lm_error("Template is not a string");
+        return lm_nil();
+    }
+    const lm_string *t = templateValue.as.s;
+    const char *hole = NULL;
+    for (size_t i = 0; i + 1 < t->length; ++i) {
+        if (t->data[i] == '{' && t->data[i + 1] == '}') {
+            hole = t->data + i;
+            break;
+        }
+    }
+    if (hole == NULL) {
+        lm_error("No {} found in template string");
+        return lm_nil();
+    }
+    char buffer[64];
+    size_t length;
+    const char *text = lm_to_string(value, buffer, sizeof buffer, &length);
+    size_t before = (size_t) (hole - t->data);
+    return lm_join(t->data, before, text, length, hole + 2, t->length - before - 2);
+}
+
+lm_value lm_negate(lm_value value)
+{
+    if (value.tag == LM_INT) {
+        return lm_int(lm_sub_i64(0, value.as.i));
+    }
+    if (value.tag == LM_FLOAT) {
+        return lm_float(-value.as.f);
+    }
+    lm_error("Unsupported type for NEGATE operation");
+    return lm_nil();
+}
+
+lm_value lm_not(lm_value value)
+{
+    if (value.tag == LM_BOOL) {
+        return lm_bool(!value.as.b);
+    }
+    lm_error("Unsupported type for NOT operation");
+    return lm_nil();
+}
+
+lm_value lm_to_int(lm_value value)
+{
+    if (value.tag == LM_FLOAT) {
+        return lm_int((int64_t) value.as.f);
+    }
+    if (value.tag == LM_INT || value.tag == LM_NIL) {
+        return value;
+    }
+    lm_error("Cannot convert a non-number to int");
+    return lm_nil();
+}
+
+lm_value lm_to_float(lm_value value)
+{
+    if (value.tag == LM_INT) {
+        return lm_float((double) value.as.i);
+    }
+    if (value.tag == LM_FLOAT || value.tag == LM_NIL) {
+        return value;
+    }
+    lm_error("Cannot convert a non-number to float");
+    return lm_nil();
+}
+
+bool lm_jump_unless(lm_value condition)
+{
+    if (condition.tag != LM_BOOL) {
+        lm_error("JUMP_IF_FALSE requires a boolean condition");
+        return false;
+    }
+    return !condition.as.b;
+}
+
+void lm_print(lm_value value)
+{
+    switch (value.tag) {
+    case LM_BOOL:
+        lm_print_bool(value.as.b);
+        break;
+    case LM_INT:
+        lm_print_int(value.as.i);
+        break;
+    case LM_FLOAT:
+        lm_print_float(value.as.f);
+        break;
+    case LM_STRING:
+        fputs("The result: ", stdout);
+        fwrite(value.as.s->data, 1, value.as.s->length, stdout);
+        putchar('\n');
+        break;
+    default:
+        puts("The result: Nil");
+        break;
+    }
+}
+
+void lm_print_int(int64_t value)
+{
+    printf("The result: %" PRId64 "\n", value);
+}
+
+void lm_print_float(double value)
+{
+    /* std::ostream's default floating-point format */
+    printf("The result: %g\n", value);
+}
+
+void lm_print_bool(bool value)
+{
+    printf("The result: %s\n", value ? "true" : "false");
+}
+
+void lm_halt(void)
+{
+    puts("Program halted normally.");
+    fflush(stdout);
+    exit(0);
+}
+
+void lm_unknown_function(const char *name)
+{
+    fflush(stdout);
+    fprintf(stderr, "Error: Function %s not declared\n", name);
+}
+
+void lm_return_outside_function(void)
+{
+    lm_error("RETURN outside of a function");
+}
+
+void lm_call_overflow(const char *name)
+{
+    fflush(stdout);
+    fprintf(stderr, "Exception occurred during VM execution: Call stack overflow in %s\n", name);
+    exit(1);
+}
+
+static void (*lm_program)(void);
+
+static void *lm_thread(void *unused)
+{
+    (void) unused;
+    lm_program();
+    return NULL;
+}
+
+int lm_start(void (*program)(void))
+{
+    pthread_attr_t attributes;
+    pthread_t thread;
+    lm_program = program;
+    pthread_attr_init(&attributes);
+    /* Address space only; pages are touched as deep recursion reaches them */
+    pthread_attr_setstacksize(&attributes, (size_t) 1 << 30);
+    if (pthread_create(&thread, &attributes, lm_thread, NULL) != 0) {
+        program(); /* fall back to the main thread's stack */
+    } else {
+        pthread_join(thread, NULL);
+    }
+    pthread_attr_destroy(&attributes);
+    fflush(stdout);
+    return 0;
+}
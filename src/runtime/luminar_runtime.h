@@ -0,0 +1,140 @@
+#ifndef LUMINAR_RUNTIME_H
+#define LUMINAR_RUNTIME_H
+
+/*
+ * Runtime library for programs `luminar build` lowers to C. Registers whose type the code
+ * generator could pin down stay native int64_t/double/bool locals; everything else is an
+ * lm_value, the C twin of the interpreter's TaggedValue, and goes through the functions
+ * below, which follow the semantics (and the error messages) of ValueOperations.
+ */
+
+#include <math.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+enum { LM_NIL, LM_BOOL, LM_INT, LM_FLOAT, LM_STRING };
+
+/* Strings are immutable and live until the program exits. */
+typedef struct lm_string
+{
+    size_t length;
+    char data[];
+} lm_string;
+
+typedef struct lm_value
+{
+    uint8_t tag;
+    union {
+        bool b;
+        int64_t i;
+        double f;
+        const lm_string *s;
+    } as;
+} lm_value;
+
+/* Comparison and arithmetic selectors for lm_compare() and lm_arith() */
+enum { LM_EQ, LM_NE, LM_LT, LM_LE, LM_GT, LM_GE };
+enum { LM_ADD, LM_SUB, LM_MUL, LM_DIV, LM_MOD };
+
+#define LM_MAX_CALL_DEPTH 100000
+
+extern int32_t lm_depth;
+
+static inline lm_value lm_nil(void)
+{
+    lm_value v = {LM_NIL, {.i = 0}};
+    return v;
+}
+
+static inline lm_value lm_bool(bool b)
+{
+    lm_value v = {LM_BOOL, {.i = 0}};
+    v.as.b = b;
+    return v;
+}
+
+static inline lm_value lm_int(int64_t i)
+{
+    lm_value v = {LM_INT, {.i = i}};
+    return v;
+}
+
+static inline lm_value lm_float(double f)
+{
+    lm_value v = {LM_FLOAT, {.f = f}};
+    return v;
+}
+
+/* Integer arithmetic wraps like the interpreter's int64_t does on every target it runs on */
+static inline int64_t lm_add_i64(int64_t a, int64_t b)
+{
+    return (int64_t) ((uint64_t) a + (uint64_t) b);
+}
+
+static inline int64_t lm_sub_i64(int64_t a, int64_t b)
+{
+    return (int64_t) ((uint64_t) a - (uint64_t) b);
+}
+
+static inline int64_t lm_mul_i64(int64_t a, int64_t b)
+{
+    return (int64_t) ((uint64_t) a * (uint64_t) b);
+}
+
+/* Quotient and remainder for a divisor known not to be zero. INT64_MIN / -1 wraps to
+   INT64_MIN (remainder 0) instead of trapping, as in the interpreter. */
+static inline int64_t lm_quot_i64(int64_t a, int64_t b)
+{
+    return b == -1 ? lm_sub_i64(0, a) : a / b;
+}
+
+static inline int64_t lm_rem_i64(int64_t a, int64_t b)
+{
+    return b == -1 ? 0 : a % b;
+}
+
+lm_value lm_string_literal(const char *data, size_t length);
+
+lm_value lm_arith(int op, lm_value lhs, lm_value rhs);
+lm_value lm_div_i64(int64_t lhs, int64_t rhs);
+lm_value lm_mod_i64(int64_t lhs, int64_t rhs);
+lm_value lm_div_f64(double lhs, double rhs);
+bool lm_compare(int op, lm_value lhs, lm_value rhs);
+lm_value lm_and(lm_value lhs, lm_value rhs);
+lm_value lm_or(lm_value lhs, lm_value rhs);
+lm_value lm_concat(lm_value lhs, lm_value rhs);
+lm_value lm_interpolate(lm_value templateValue, lm_value value);
+
+lm_value lm_negate(lm_value value);
+lm_value lm_not(lm_value value);
+lm_value lm_to_int(lm_value value);
+lm_value lm_to_float(lm_value value);
+
+/* JUMP_IF_FALSE on a value of unknown type: whether to take the jump */
+bool lm_jump_unless(lm_value condition);
+
+void lm_print(lm_value value);
+void lm_print_int(int64_t value);
+void lm_print_float(double value);
+void lm_print_bool(bool value);
+
+void lm_halt(void);
+void lm_unknown_function(const char *name);
+void lm_return_outside_function(void);
+void lm_call_overflow(const char *name);
+
+#define LM_ENTER(name) \
+    do { \
+        if (lm_depth >= LM_MAX_CALL_DEPTH) { \
+            lm_call_overflow(name); \
+        } \
+        ++lm_depth; \
+    } while (0)
+
+#define LM_LEAVE() (--lm_depth)
+
+/* Runs `program` on a thread with a stack deep enough for LM_MAX_CALL_DEPTH calls */
+int lm_start(void (*program)(void));
+
+#endif /* LUMINAR_RUNTIME_H */
@@ -15,6 +15,13 @@ public:
         program = parser.getBytecode();
     }
 
+    // Runs `program` instead of the parser's own bytecode, e.g. after optimizeBytecode()
+    VM(Algorithm &parser, std::unique_ptr<Backend> backend, std::vector<Instruction> program)
+        : parser(parser)
+        , program(std::move(program))
+        , backend(std::move(backend))
+    {}
+
     void run() {
         backend->run(program);
     }